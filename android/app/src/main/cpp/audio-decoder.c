@@ -61,6 +61,7 @@ void android_chiaki_audio_decoder_get_sink(AndroidChiakiAudioDecoder *decoder, C
 	sink->user = decoder;
 	sink->header_cb = android_chiaki_audio_decoder_header;
 	sink->frame_cb = android_chiaki_audio_decoder_frame;
+	sink->frame_indexed_cb = NULL;
 }
 
 void android_chiaki_audio_haptics_decoder_get_sink(ChiakiSession *session,AndroidChiakiAudioDecoder *decoder, ChiakiAudioSink *sink)
@@ -68,6 +69,7 @@ void android_chiaki_audio_haptics_decoder_get_sink(ChiakiSession *session,Androi
     sink->user = session;
     sink->header_cb = android_chiaki_audio_haptics_decoder_header;
     sink->frame_cb = android_chiaki_audio_haptics_decoder_frame;
+    sink->frame_indexed_cb = NULL;
 }
 
 static void *android_chiaki_audio_decoder_output_thread_func(void *user)
@@ -2,17 +2,17 @@
 
 #include "audio-output.h"
 
-#include "circular-buf.hpp"
-
 #include <chiaki/log.h>
 #include <chiaki/thread.h>
+#include <chiaki/audioring.h>
 
 #include <oboe/Oboe.h>
 
-#define BUFFER_CHUNK_SIZE 1024
-#define BUFFER_CHUNKS_COUNT 32
+#include <atomic>
+#include <string.h>
 
-using AudioBuffer = CircularBuffer<BUFFER_CHUNKS_COUNT, BUFFER_CHUNK_SIZE>;
+#define AUDIO_RING_SIZE_EXP 13
+#define AUDIO_RING_TARGET_MS 20 // on top of a burst of the stream
 
 class AudioOutput;
 
@@ -33,9 +33,10 @@ struct AudioOutput
 	ChiakiLog *log;
 	oboe::ManagedStream stream;
 	AudioOutputCallback stream_callback;
-	AudioBuffer buf;
+	ChiakiAudioRing ring;
+	std::atomic<bool> ring_ready; // only set once, the decoder may already deliver frames before
 
-	AudioOutput() : stream_callback(this) {}
+	AudioOutput() : stream_callback(this), ring_ready(false) {}
 };
 
 extern "C" void *android_chiaki_audio_output_new(ChiakiLog *log)
@@ -51,6 +52,8 @@ extern "C" void android_chiaki_audio_output_free(void *audio_output)
 		return;
 	auto ao = reinterpret_cast<AudioOutput *>(audio_output);
 	ao->stream = nullptr;
+	if(ao->ring_ready)
+		chiaki_audio_ring_fini(&ao->ring);
 	delete ao;
 }
 
@@ -58,6 +61,22 @@ extern "C" void android_chiaki_audio_output_settings(uint32_t channels, uint32_t
 {
 	auto ao = reinterpret_cast<AudioOutput *>(audio_output);
 
+	if(!ao->ring_ready)
+	{
+		ChiakiErrorCode err = chiaki_audio_ring_init(&ao->ring, channels, AUDIO_RING_SIZE_EXP, rate * AUDIO_RING_TARGET_MS / 1000);
+		if(err != CHIAKI_ERR_SUCCESS)
+		{
+			CHIAKI_LOGE(ao->log, "Audio Output failed to init ring: %s", chiaki_error_string(err));
+			return;
+		}
+		ao->ring_ready = true;
+	}
+	else if(ao->ring.channels != channels)
+	{
+		CHIAKI_LOGE(ao->log, "Audio Output can not change from %u to %u channels", (unsigned int)ao->ring.channels, (unsigned int)channels);
+		return;
+	}
+
 	oboe::AudioStreamBuilder builder;
 	builder.setPerformanceMode(oboe::PerformanceMode::LowLatency)
 		->setSharingMode(oboe::SharingMode::Exclusive)
@@ -72,6 +91,10 @@ extern "C" void android_chiaki_audio_output_settings(uint32_t channels, uint32_t
 	else
 		CHIAKI_LOGE(ao->log, "Audio Output failed to open Oboe stream: %s", oboe::convertToText(result));
 
+	// the ring has to cover a whole burst read by the callback
+	if(ao->stream)
+		chiaki_audio_ring_set_target(&ao->ring, (size_t)ao->stream->getFramesPerBurst() + rate * AUDIO_RING_TARGET_MS / 1000);
+
 	result = ao->stream->start();
 	if(result == oboe::Result::OK)
 		CHIAKI_LOGI(ao->log, "Audio Output started Oboe stream");
@@ -82,10 +105,13 @@ extern "C" void android_chiaki_audio_output_settings(uint32_t channels, uint32_t
 extern "C" void android_chiaki_audio_output_frame(int16_t *buf, size_t samples_count, void *audio_output)
 {
 	auto ao = reinterpret_cast<AudioOutput *>(audio_output);
+	if(!ao->ring_ready)
+		return;
 
-	size_t buf_size = samples_count * sizeof(int16_t);
-	size_t pushed = ao->buf.Push(reinterpret_cast<uint8_t *>(buf), buf_size);
-	if(pushed < buf_size)
+	// samples_count covers all channels here
+	size_t frames_count = samples_count / ao->ring.channels;
+	size_t pushed = chiaki_audio_ring_push(&ao->ring, buf, frames_count);
+	if(pushed < frames_count)
 		CHIAKI_LOGW(ao->log, "Audio Output Buffer Overflow!");
 }
 
@@ -97,19 +123,15 @@ oboe::DataCallbackResult AudioOutputCallback::onAudioReady(oboe::AudioStream *st
 		return oboe::DataCallbackResult::Stop;
 	}
 
-	int32_t bytes_per_frame = stream->getBytesPerFrame();
-	size_t buf_size_requested = static_cast<size_t>(bytes_per_frame * num_frames);
-	auto buf = reinterpret_cast<uint8_t *>(audio_data);
-
-	size_t buf_size_delivered = audio_output->buf.Pop(buf, buf_size_requested);
-	//CHIAKI_LOGW(audio_output->log, "Delivered %llu", (unsigned long long)buf_size_delivered);
-
-	if(buf_size_delivered < buf_size_requested)
+	if(!audio_output->ring_ready || audio_output->ring.channels != static_cast<size_t>(stream->getChannelCount()))
 	{
-		CHIAKI_LOGV(audio_output->log, "Audio Output Buffer Underflow!");
-		memset(buf + buf_size_delivered, 0, buf_size_requested - buf_size_delivered);
+		memset(audio_data, 0, static_cast<size_t>(stream->getBytesPerFrame() * num_frames));
+		return oboe::DataCallbackResult::Continue;
 	}
 
+	// fills with silence on underflow and holds the fill level against clock drift
+	chiaki_audio_ring_pull(&audio_output->ring, reinterpret_cast<int16_t *>(audio_data), static_cast<size_t>(num_frames));
+
 	return oboe::DataCallbackResult::Continue;
 }
 
@@ -11,6 +11,7 @@
 #include <chiaki/regist.h>
 
 #include <string.h>
+#include <unistd.h>
 #include <linux/in.h>
 #include <linux/in6.h>
 #include <arpa/inet.h>
@@ -245,6 +246,8 @@ JNIEXPORT void JNICALL JNI_FCN(sessionCreate)(JNIEnv *env, jobject obj, jobject
 	ChiakiConnectInfo connect_info = { 0 };
 	connect_info.ps5 = ps5;
     connect_info.enable_dualsense=ps5;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	connect_info.fec_threads = cpus > 1 ? (unsigned int)(cpus - 1 < CHIAKI_FEC_THREADS_MAX ? cpus - 1 : CHIAKI_FEC_THREADS_MAX) : 0;
 
 	const char *str_borrow = E->GetStringUTFChars(env, host_string, NULL);
 	connect_info.host = host_str = strdup(str_borrow);
@@ -0,0 +1,31 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_AUDIORINGDEVICE_H
+#define CHIAKI_AUDIORINGDEVICE_H
+
+#include <QIODevice>
+
+#include <chiaki/audioring.h>
+
+/**
+ * Read-only device for QAudioOutput in pull mode, reading from a ChiakiAudioRing.
+ * Reads always succeed, with silence where the ring has nothing to play.
+ */
+class AudioRingDevice: public QIODevice
+{
+	Q_OBJECT
+
+	private:
+		ChiakiAudioRing *ring;
+
+	protected:
+		qint64 readData(char *data, qint64 max_size) override;
+		qint64 writeData(const char *data, qint64 size) override;
+
+	public:
+		AudioRingDevice(ChiakiAudioRing *ring, QObject *parent = nullptr);
+
+		bool isSequential() const override	{ return true; }
+};
+
+#endif // CHIAKI_AUDIORINGDEVICE_H
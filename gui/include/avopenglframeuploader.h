@@ -3,8 +3,12 @@
 #ifndef CHIAKI_AVOPENGLFRAMEUPLOADER_H
 #define CHIAKI_AVOPENGLFRAMEUPLOADER_H
 
+#include "avopenglwidget.h"
+
 #include <QObject>
 #include <QOpenGLWidget>
+#include <QOpenGLFunctions>
+#include <QMutex>
 
 #include <chiaki/ffmpegdecoder.h>
 
@@ -21,12 +25,51 @@ class AVOpenGLFrameUploader: public QObject
 		AVOpenGLWidget *widget;
 		QOpenGLContext *context;
 		QSurface *surface;
+		ChiakiLog *log;
+
+		bool gl_initialized;
+		bool allow_persistent;
+		bool immutable_storage;
+		void (QOPENGLF_APIENTRYP buffer_storage)(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
+		AVOpenGLPixelBuffer buffers[AV_OPENGL_PIXEL_BUFFERS_COUNT];
+		size_t buffer_next;
+
+		QMutex stats_mutex;
+		AVOpenGLUploadStats stats;
+
+		void InitGL();
+		AVOpenGLPixelBuffer *AcquireBuffer(size_t size);
+		bool Upload(AVFrame *av_frame, AVOpenGLFrame *frame);
+		bool RunSelfTest(unsigned int frames_count);
 
 	private slots:
 		void UpdateFrameFromDecoder();
 
 	public:
 		AVOpenGLFrameUploader(StreamSession *session, AVOpenGLWidget *widget, QOpenGLContext *context, QSurface *surface);
+
+		/**
+		 * Uploader without a session, frames are only passed in through the self test
+		 */
+		AVOpenGLFrameUploader(ChiakiLog *log, QOpenGLContext *context, QSurface *surface);
+		~AVOpenGLFrameUploader() override;
+
+		AVOpenGLUploadStats GetStats();
+
+		/**
+		 * Upload synthetic frames on an offscreen context with both persistently and per frame mapped
+		 * pixel buffers and read them back. Needs no stream, so it can be run headless on Mesa's llvmpipe:
+		 * LIBGL_ALWAYS_SOFTWARE=1 chiaki uploadtest
+		 *
+		 * @return true if every frame came back from the textures as it was uploaded
+		 */
+		static bool SelfTest(ChiakiLog *log, unsigned int frames_count);
+
+	public slots:
+		/**
+		 * Release all pixel buffers and fences, must be called on the uploader's thread before the context is destroyed
+		 */
+		void ReleaseGL();
 };
 
 #endif // CHIAKI_AVOPENGLFRAMEUPLOADER_H
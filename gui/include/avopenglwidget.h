@@ -16,6 +16,7 @@ extern "C"
 }
 
 #define MAX_PANES 3
+#define AV_OPENGL_PIXEL_BUFFERS_COUNT 3
 
 class StreamSession;
 class AVOpenGLFrameUploader;
@@ -39,15 +40,37 @@ struct ConversionConfig
 	struct PlaneConfig plane_configs[MAX_PANES];
 };
 
+/**
+ * Staging buffer holding all planes of one frame on their way to the textures
+ */
+struct AVOpenGLPixelBuffer
+{
+	GLuint pbo;
+	size_t size;
+	uint8_t *mapped; // persistently mapped, or nullptr if the buffer has to be mapped for every upload
+	GLsync fence; // signaled once the last upload sourcing from this buffer is done reading it
+};
+
 struct AVOpenGLFrame
 {
-	GLuint pbo[MAX_PANES];
 	GLuint tex[MAX_PANES];
 	unsigned int width;
 	unsigned int height;
 	ConversionConfig *conversion_config;
+	GLsync upload_fence; // created by the uploader, the renderer waits for it before sampling tex
+	GLsync draw_fence; // created by the renderer, the uploader waits for it before overwriting tex
 
-	bool Update(AVFrame *frame, ChiakiLog *log);
+	size_t StagingSize(AVFrame *frame);
+	void AllocateTextures(bool immutable_storage);
+	bool Update(AVFrame *frame, AVOpenGLPixelBuffer *buffer, bool immutable_storage, ChiakiLog *log);
+};
+
+struct AVOpenGLUploadStats
+{
+	uint64_t frames;
+	double upload_ms; // average cpu time to get one frame submitted to the gpu
+	double upload_ms_last;
+	bool persistent; // whether persistently mapped pixel buffers are in use
 };
 
 class AVOpenGLWidget: public QOpenGLWidget
@@ -75,12 +98,14 @@ class AVOpenGLWidget: public QOpenGLWidget
 
 	public:
 		static QSurfaceFormat CreateSurfaceFormat();
+		static ConversionConfig *GetConversionConfig(enum AVPixelFormat pixel_format);
 
 		explicit AVOpenGLWidget(StreamSession *session, QWidget *parent = nullptr, TransformMode transform_mode = TransformMode::Fit);
 		~AVOpenGLWidget() override;
 
 		void SwapFrames();
 		AVOpenGLFrame *GetBackgroundFrame()	{ return &frames[1 - frame_fg]; }
+		AVOpenGLUploadStats GetUploadStats();
 
 		void SetTransformMode(TransformMode mode) { transform_mode = mode; }
 		TransformMode GetTransformMode() const { return transform_mode; }
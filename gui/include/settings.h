@@ -66,6 +66,9 @@ class Settings : public QObject
 		bool GetDualSenseEnabled() const		{ return settings.value("settings/dualsense_enabled", false).toBool(); }
 		void SetDualSenseEnabled(bool enabled)	{ settings.setValue("settings/dualsense_enabled", enabled); }
 
+		bool GetVideoSlicesEnabled() const		{ return settings.value("settings/video_slices", false).toBool(); }
+		void SetVideoSlicesEnabled(bool enabled)	{ settings.setValue("settings/video_slices", enabled); }
+
 		ChiakiVideoResolutionPreset GetResolution() const;
 		void SetResolution(ChiakiVideoResolutionPreset resolution);
 
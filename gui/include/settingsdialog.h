@@ -30,6 +30,7 @@ class SettingsDialog : public QDialog
 		QComboBox *audio_device_combo_box;
 		QCheckBox *pi_decoder_check_box;
 		QComboBox *hw_decoder_combo_box;
+		QCheckBox *video_slices_check_box;
 
 		QListWidget *registered_hosts_list_widget;
 		QPushButton *delete_registered_host_button;
@@ -48,6 +49,7 @@ class SettingsDialog : public QDialog
 		void AudioBufferSizeEdited();
 		void AudioOutputSelected();
 		void HardwareDecodeEngineSelected();
+		void VideoSlicesChanged();
 		void UpdateHardwareDecodeEngineComboBox();
 
 		void UpdateRegisteredHosts();
@@ -5,6 +5,8 @@
 
 #include <chiaki/session.h>
 #include <chiaki/opusdecoder.h>
+#include <chiaki/audioring.h>
+#include <chiaki/hapticsresampler.h>
 #include <chiaki/ffmpegdecoder.h>
 
 #if CHIAKI_LIB_ENABLE_PI_DECODER
@@ -32,6 +34,15 @@ class QIODevice;
 class QKeyEvent;
 class Settings;
 
+struct StreamSessionAudioStats
+{
+	double device_latency_ms; // queued in the audio device
+	double ring_latency_ms; // queued in the audio ring, averaged
+	double ring_target_ms;
+	uint64_t underflows;
+	int32_t drift_ppm;
+};
+
 class ChiakiException: public Exception
 {
 	public:
@@ -57,6 +68,7 @@ struct StreamSessionConnectInfo
 	TransformMode transform_mode;
 	bool enable_keyboard;
 	bool enable_dualsense;
+	bool video_slices;
 
 	StreamSessionConnectInfo(
 			Settings *settings,
@@ -102,8 +114,18 @@ class StreamSession : public QObject
 		unsigned int audio_buffer_size;
 		QAudioOutput *audio_output;
 		QIODevice *audio_io;
+		ChiakiAudioRing audio_ring; // network thread pushes, audio_io pulls
+		bool audio_ring_initialized;
+		unsigned int audio_rate;
+		size_t audio_target_min_frames;
+		uint64_t audio_underflows_prev;
+		unsigned int audio_clean_ms; // time since the last underflow
+		unsigned int audio_tune_window_ms; // how long it has to stay clean before the target is lowered
+		QTimer *audio_stats_timer;
 		SDL_AudioDeviceID haptics_output;
-		uint8_t *haptics_resampler_buf;
+		ChiakiHapticsResampler haptics_resampler;
+		ChiakiAudioRing haptics_ring; // network thread pushes, the sdl audio callback pulls
+		bool haptics_ring_initialized;
 
 		QMap<Qt::Key, int> key_map;
 
@@ -119,6 +141,7 @@ class StreamSession : public QObject
 		void Event(ChiakiEvent *event);
 		void DisconnectHaptics();
 		void ConnectHaptics();
+		void UpdateAudioStats();
 
 	public:
 		explicit StreamSession(const StreamSessionConnectInfo &connect_info, QObject *parent = nullptr);
@@ -146,6 +169,7 @@ class StreamSession : public QObject
 		void FfmpegFrameAvailable();
 		void SessionQuit(ChiakiQuitReason reason, const QString &reason_str);
 		void LoginPINRequested(bool incorrect);
+		void AudioStatsUpdated(const StreamSessionAudioStats &stats);
 
 	private slots:
 		void UpdateGamepads();
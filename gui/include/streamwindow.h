@@ -8,6 +8,7 @@
 #include "streamsession.h"
 
 class QLabel;
+class QTimer;
 class AVOpenGLWidget;
 
 class StreamWindow: public QMainWindow
@@ -25,9 +26,15 @@ class StreamWindow: public QMainWindow
 		QAction *fullscreen_action;
 		QAction *stretch_action;
 		QAction *zoom_action;
+		QAction *stats_action;
 		AVOpenGLWidget *av_widget;
+		QLabel *stats_label;
+		QString audio_stats_text;
+		QString video_stats_text;
+		QTimer *video_stats_timer;
 
 		void Init();
+		void UpdateStatsLabel();
 		void UpdateVideoTransform();
 		void UpdateTransformModeActions();
 
@@ -48,6 +55,9 @@ class StreamWindow: public QMainWindow
 		void ToggleFullscreen();
 		void ToggleStretch();
 		void ToggleZoom();
+		void ToggleStats();
+		void AudioStatsUpdated(const StreamSessionAudioStats &stats);
+		void UpdateVideoStats();
 		void Quit();
 };
 
@@ -0,0 +1,22 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <audioringdevice.h>
+
+AudioRingDevice::AudioRingDevice(ChiakiAudioRing *ring, QObject *parent)
+	: QIODevice(parent),
+	ring(ring)
+{
+}
+
+qint64 AudioRingDevice::readData(char *data, qint64 max_size)
+{
+	size_t frame_size = ring->channels * sizeof(int16_t);
+	size_t frames_count = static_cast<size_t>(max_size) / frame_size;
+	chiaki_audio_ring_pull(ring, reinterpret_cast<int16_t *>(data), frames_count);
+	return static_cast<qint64>(frames_count * frame_size);
+}
+
+qint64 AudioRingDevice::writeData(const char *data, qint64 size)
+{
+	return -1;
+}
@@ -5,37 +5,369 @@
 #include <streamsession.h>
 
 #include <QOpenGLContext>
-#include <QOpenGLFunctions>
+#include <QOpenGLExtraFunctions>
+#include <QOffscreenSurface>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QVector>
+
+#include <cstring>
+
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+#define BUFFER_WAIT_TIMEOUT_NS 100000000
+#define UPLOAD_STATS_WEIGHT (1.0 / 16.0)
 
 AVOpenGLFrameUploader::AVOpenGLFrameUploader(StreamSession *session, AVOpenGLWidget *widget, QOpenGLContext *context, QSurface *surface)
 	: QObject(nullptr),
 	session(session),
 	widget(widget),
 	context(context),
-	surface(surface)
+	surface(surface),
+	log(session->GetChiakiLog()),
+	gl_initialized(false),
+	allow_persistent(true),
+	immutable_storage(false),
+	buffer_storage(nullptr),
+	buffer_next(0),
+	stats()
 {
+	memset(buffers, 0, sizeof(buffers));
 	connect(session, &StreamSession::FfmpegFrameAvailable, this, &AVOpenGLFrameUploader::UpdateFrameFromDecoder);
 }
 
+AVOpenGLFrameUploader::AVOpenGLFrameUploader(ChiakiLog *log, QOpenGLContext *context, QSurface *surface)
+	: QObject(nullptr),
+	session(nullptr),
+	widget(nullptr),
+	context(context),
+	surface(surface),
+	log(log),
+	gl_initialized(false),
+	allow_persistent(true),
+	immutable_storage(false),
+	buffer_storage(nullptr),
+	buffer_next(0),
+	stats()
+{
+	memset(buffers, 0, sizeof(buffers));
+}
+
+AVOpenGLFrameUploader::~AVOpenGLFrameUploader()
+{
+	if(!gl_initialized)
+		return;
+	// a context can only be made current on the thread it belongs to
+	if(context->thread() == QThread::currentThread())
+		ReleaseGL();
+	else
+		CHIAKI_LOGW(log, "Frame uploader destroyed without releasing its pixel buffers");
+}
+
+AVOpenGLUploadStats AVOpenGLFrameUploader::GetStats()
+{
+	QMutexLocker lock(&stats_mutex);
+	return stats;
+}
+
+void AVOpenGLFrameUploader::InitGL()
+{
+	auto f = context->extraFunctions();
+
+	QPair<int, int> version = context->format().version();
+	immutable_storage = version >= qMakePair(4, 2) || context->hasExtension(QByteArrayLiteral("GL_ARB_texture_storage"));
+	if(allow_persistent && (version >= qMakePair(4, 4) || context->hasExtension(QByteArrayLiteral("GL_ARB_buffer_storage"))))
+		buffer_storage = reinterpret_cast<decltype(buffer_storage)>(context->getProcAddress("glBufferStorage"));
+
+	for(auto &buffer : buffers)
+		f->glGenBuffers(1, &buffer.pbo);
+
+	// rows are copied with the decoder's line size, which is not necessarily a multiple of 4
+	f->glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	CHIAKI_LOGI(log, "Frame uploader using %s pixel buffers and %s textures",
+			buffer_storage ? "persistently mapped" : "per frame mapped",
+			immutable_storage ? "immutable" : "mutable");
+
+	QMutexLocker lock(&stats_mutex);
+	stats.persistent = buffer_storage != nullptr;
+	gl_initialized = true;
+}
+
+void AVOpenGLFrameUploader::ReleaseGL()
+{
+	if(!gl_initialized)
+		return;
+
+	if(QOpenGLContext::currentContext() != context)
+		context->makeCurrent(surface);
+	auto f = context->extraFunctions();
+
+	for(auto &buffer : buffers)
+	{
+		if(buffer.fence)
+			f->glDeleteSync(buffer.fence);
+		if(buffer.mapped)
+		{
+			f->glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.pbo);
+			f->glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		}
+		f->glDeleteBuffers(1, &buffer.pbo);
+	}
+	f->glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	memset(buffers, 0, sizeof(buffers));
+	buffer_next = 0;
+
+	context->doneCurrent();
+	gl_initialized = false;
+}
+
+AVOpenGLPixelBuffer *AVOpenGLFrameUploader::AcquireBuffer(size_t size)
+{
+	auto f = context->extraFunctions();
+
+	AVOpenGLPixelBuffer *buffer = &buffers[buffer_next];
+	buffer_next = (buffer_next + 1) % AV_OPENGL_PIXEL_BUFFERS_COUNT;
+
+	if(buffer->fence)
+	{
+		// with three buffers, this only blocks if the gpu is more than two uploads behind
+		GLenum r;
+		while((r = f->glClientWaitSync(buffer->fence, GL_SYNC_FLUSH_COMMANDS_BIT, BUFFER_WAIT_TIMEOUT_NS)) == GL_TIMEOUT_EXPIRED)
+			CHIAKI_LOGW(log, "Frame uploader is still waiting for the GPU to release a pixel buffer");
+		if(r == GL_WAIT_FAILED)
+			CHIAKI_LOGE(log, "Frame uploader failed to wait for a pixel buffer");
+		f->glDeleteSync(buffer->fence);
+		buffer->fence = nullptr;
+	}
+
+	if(buffer->size >= size)
+		return buffer;
+
+	// storage of persistent buffers is immutable, so growing means starting over with a new buffer
+	f->glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer->pbo);
+	if(buffer->mapped)
+		f->glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	f->glDeleteBuffers(1, &buffer->pbo);
+	f->glGenBuffers(1, &buffer->pbo);
+	f->glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer->pbo);
+	buffer->mapped = nullptr;
+	buffer->size = 0;
+
+	if(buffer_storage)
+	{
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		buffer_storage(GL_PIXEL_UNPACK_BUFFER, size, nullptr, flags);
+		buffer->mapped = reinterpret_cast<uint8_t *>(f->glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags));
+		if(!buffer->mapped)
+		{
+			CHIAKI_LOGW(log, "Frame uploader failed to persistently map a pixel buffer, falling back to mapping per frame");
+			buffer_storage = nullptr;
+			f->glDeleteBuffers(1, &buffer->pbo);
+			f->glGenBuffers(1, &buffer->pbo);
+			f->glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer->pbo);
+			QMutexLocker lock(&stats_mutex);
+			stats.persistent = false;
+		}
+	}
+	if(!buffer->mapped)
+		f->glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+
+	f->glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	buffer->size = size;
+	return buffer;
+}
+
+bool AVOpenGLFrameUploader::Upload(AVFrame *av_frame, AVOpenGLFrame *frame)
+{
+	if(QOpenGLContext::currentContext() != context)
+		context->makeCurrent(surface);
+
+	if(!gl_initialized)
+		InitGL();
+
+	QElapsedTimer upload_timer;
+	upload_timer.start();
+
+	AVOpenGLPixelBuffer *buffer = AcquireBuffer(frame->StagingSize(av_frame));
+	if(!frame->Update(av_frame, buffer, immutable_storage, log))
+		return false;
+
+	double upload_ms = upload_timer.nsecsElapsed() / 1000000.0;
+	QMutexLocker lock(&stats_mutex);
+	stats.upload_ms = stats.frames ? stats.upload_ms + (upload_ms - stats.upload_ms) * UPLOAD_STATS_WEIGHT : upload_ms;
+	stats.upload_ms_last = upload_ms;
+	stats.frames++;
+	return true;
+}
+
 void AVOpenGLFrameUploader::UpdateFrameFromDecoder()
 {
 	ChiakiFfmpegDecoder *decoder = session->GetFfmpegDecoder();
 	if(!decoder)
 	{
-		CHIAKI_LOGE(session->GetChiakiLog(), "Session has no ffmpeg decoder");
+		CHIAKI_LOGE(log, "Session has no ffmpeg decoder");
 		return;
 	}
 
-	if(QOpenGLContext::currentContext() != context)
-		context->makeCurrent(surface);
-
 	AVFrame *next_frame = chiaki_ffmpeg_decoder_pull_frame(decoder);
 	if(!next_frame)
 		return;
 
-	bool success = widget->GetBackgroundFrame()->Update(next_frame, decoder->log);
+	bool success = Upload(next_frame, widget->GetBackgroundFrame());
 	av_frame_free(&next_frame);
 
 	if(success)
 		widget->SwapFrames();
 }
+
+static void FillTestFrame(AVFrame *frame, ConversionConfig *conversion_config, unsigned int seq)
+{
+	for(int i=0; i<conversion_config->planes; i++)
+	{
+		const PlaneConfig &plane = conversion_config->plane_configs[i];
+		int height = frame->height / plane.height_divider;
+		int row_size = (frame->width / plane.width_divider) * plane.data_per_pixel;
+		for(int y=0; y<height; y++)
+		{
+			for(int x=0; x<row_size; x++)
+				frame->data[i][frame->linesize[i] * y + x] = (uint8_t)(x + 3 * y + 7 * i + seq);
+		}
+	}
+}
+
+/**
+ * Read back every plane texture of frame and compare it to av_frame
+ */
+static bool VerifyTestFrame(QOpenGLExtraFunctions *f, AVOpenGLFrame *frame, AVFrame *av_frame, ChiakiLog *log)
+{
+	ConversionConfig *conversion_config = frame->conversion_config;
+	GLuint fbo;
+	f->glGenFramebuffers(1, &fbo);
+	f->glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	f->glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+	bool success = true;
+	for(int i=0; i<conversion_config->planes && success; i++)
+	{
+		const PlaneConfig &plane = conversion_config->plane_configs[i];
+		int width = frame->width / plane.width_divider;
+		int height = frame->height / plane.height_divider;
+		int row_size = width * plane.data_per_pixel;
+		f->glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, frame->tex[i], 0);
+		if(f->glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		{
+			CHIAKI_LOGE(log, "Upload test can not read back plane %d", i);
+			success = false;
+			break;
+		}
+		QVector<uint8_t> pixels(row_size * height);
+		f->glReadPixels(0, 0, width, height, plane.format, GL_UNSIGNED_BYTE, pixels.data());
+		for(int y=0; y<height; y++)
+		{
+			if(memcmp(pixels.data() + row_size * y, av_frame->data[i] + av_frame->linesize[i] * y, row_size) != 0)
+			{
+				CHIAKI_LOGE(log, "Upload test read back wrong pixels in plane %d, row %d", i, y);
+				success = false;
+				break;
+			}
+		}
+	}
+
+	f->glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	f->glDeleteFramebuffers(1, &fbo);
+	return success;
+}
+
+bool AVOpenGLFrameUploader::RunSelfTest(unsigned int frames_count)
+{
+	if(QOpenGLContext::currentContext() != context)
+		context->makeCurrent(surface);
+	auto f = context->extraFunctions();
+
+	AVOpenGLFrame frame = {};
+	frame.conversion_config = AVOpenGLWidget::GetConversionConfig(AV_PIX_FMT_YUV420P);
+	f->glGenTextures(frame.conversion_config->planes, frame.tex);
+
+	// the second size makes every pixel buffer and texture grow
+	static const int sizes[][2] = { { 1280, 720 }, { 1920, 1080 } };
+	bool success = true;
+	for(const auto &size : sizes)
+	{
+		AVFrame *av_frame = av_frame_alloc();
+		if(!av_frame)
+		{
+			success = false;
+			break;
+		}
+		av_frame->format = AV_PIX_FMT_YUV420P;
+		av_frame->width = size[0];
+		av_frame->height = size[1];
+		if(av_frame_get_buffer(av_frame, 0) < 0)
+		{
+			CHIAKI_LOGE(log, "Upload test failed to allocate a frame");
+			av_frame_free(&av_frame);
+			success = false;
+			break;
+		}
+		for(unsigned int i=0; i<frames_count && success; i++)
+		{
+			FillTestFrame(av_frame, frame.conversion_config, i);
+			success = Upload(av_frame, &frame);
+		}
+		if(success)
+			success = VerifyTestFrame(f, &frame, av_frame, log);
+		av_frame_free(&av_frame);
+		if(!success)
+			break;
+	}
+
+	if(frame.upload_fence)
+		f->glDeleteSync(frame.upload_fence);
+	f->glDeleteTextures(frame.conversion_config->planes, frame.tex);
+
+	AVOpenGLUploadStats upload_stats = GetStats();
+	CHIAKI_LOGI(log, "Upload test with %s pixel buffers %s after %llu frames, %.3f ms average upload",
+			upload_stats.persistent ? "persistently mapped" : "per frame mapped",
+			success ? "passed" : "failed",
+			(unsigned long long)upload_stats.frames,
+			upload_stats.upload_ms);
+	return success;
+}
+
+bool AVOpenGLFrameUploader::SelfTest(ChiakiLog *log, unsigned int frames_count)
+{
+	QSurfaceFormat format = AVOpenGLWidget::CreateSurfaceFormat();
+	QOffscreenSurface surface;
+	surface.setFormat(format);
+	surface.create();
+	QOpenGLContext context;
+	context.setFormat(format);
+	if(!context.create() || !context.makeCurrent(&surface))
+	{
+		CHIAKI_LOGE(log, "Upload test failed to create an OpenGL context");
+		return false;
+	}
+
+	auto f = context.functions();
+	const char *gl_renderer = (const char *)f->glGetString(GL_RENDERER);
+	const char *gl_version = (const char *)f->glGetString(GL_VERSION);
+	CHIAKI_LOGI(log, "Upload test running on \"%s\" with OpenGL version \"%s\"",
+			gl_renderer ? gl_renderer : "(null)", gl_version ? gl_version : "(null)");
+
+	bool success = true;
+	for(bool persistent : { true, false })
+	{
+		AVOpenGLFrameUploader uploader(log, &context, &surface);
+		uploader.allow_persistent = persistent;
+		if(!uploader.RunSelfTest(frames_count))
+			success = false;
+		uploader.ReleaseGL();
+	}
+	return success;
+}
@@ -12,6 +12,7 @@
 #include <QTimer>
 
 #define MOUSE_TIMEOUT_MS 1000
+#define STAGING_PLANE_ALIGNMENT 64
 
 //#define DEBUG_OPENGL
 
@@ -122,26 +123,27 @@ QSurfaceFormat AVOpenGLWidget::CreateSurfaceFormat()
 	return format;
 }
 
-AVOpenGLWidget::AVOpenGLWidget(StreamSession *session, QWidget *parent, TransformMode transform_mode)
-	: QOpenGLWidget(parent),
-	session(session), transform_mode(transform_mode)
+ConversionConfig *AVOpenGLWidget::GetConversionConfig(enum AVPixelFormat pixel_format)
 {
-	enum AVPixelFormat pixel_format = chiaki_ffmpeg_decoder_get_pixel_format(session->GetFfmpegDecoder());
-	conversion_config = nullptr;
 	for(auto &cc : conversion_configs)
 	{
 		if(pixel_format == cc.pixel_format)
-		{
-			conversion_config = &cc;
-			break;
-		}
+			return &cc;
 	}
+	return nullptr;
+}
 
+AVOpenGLWidget::AVOpenGLWidget(StreamSession *session, QWidget *parent, TransformMode transform_mode)
+	: QOpenGLWidget(parent),
+	session(session), transform_mode(transform_mode)
+{
+	conversion_config = GetConversionConfig(chiaki_ffmpeg_decoder_get_pixel_format(session->GetFfmpegDecoder()));
 	if(!conversion_config)
 		throw Exception("No matching video conversion config can be found");
 
 	setFormat(CreateSurfaceFormat());
 
+	frame_uploader_surface = nullptr;
 	frame_uploader_context = nullptr;
 	frame_uploader = nullptr;
 	frame_uploader_thread = nullptr;
@@ -157,6 +159,7 @@ AVOpenGLWidget::~AVOpenGLWidget()
 {
 	if(frame_uploader_thread)
 	{
+		// the uploader releases its pixel buffers when the thread finishes, so this must come before deleting the context
 		frame_uploader_thread->quit();
 		frame_uploader_thread->wait();
 		delete frame_uploader_thread;
@@ -190,7 +193,82 @@ void AVOpenGLWidget::SwapFrames()
 	QMetaObject::invokeMethod(this, "update");
 }
 
-bool AVOpenGLFrame::Update(AVFrame *frame, ChiakiLog *log)
+AVOpenGLUploadStats AVOpenGLWidget::GetUploadStats()
+{
+	if(!frame_uploader)
+		return AVOpenGLUploadStats();
+	return frame_uploader->GetStats();
+}
+
+static void SetTextureParameters(QOpenGLExtraFunctions *f)
+{
+	f->glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	f->glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	f->glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	f->glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+/**
+ * Computes where each plane of frame goes in a staging buffer.
+ * Planes keep the decoder's line size where possible, so they can be copied in one go.
+ *
+ * @param offsets byte offset of each plane
+ * @param strides bytes per row of each plane
+ * @return total size of the staging buffer
+ */
+static size_t StagingLayout(ConversionConfig *conversion_config, AVFrame *frame, size_t *offsets, size_t *strides)
+{
+	size_t size = 0;
+	for(int i=0; i<conversion_config->planes; i++)
+	{
+		const PlaneConfig &plane = conversion_config->plane_configs[i];
+		size_t height = frame->height / plane.height_divider;
+		size_t row_size = (frame->width / plane.width_divider) * plane.data_per_pixel;
+		int linesize = frame->linesize[i];
+		if(linesize > 0 && (size_t)linesize >= row_size && linesize % plane.data_per_pixel == 0)
+			strides[i] = linesize;
+		else
+			strides[i] = row_size;
+		offsets[i] = size;
+		size += (strides[i] * height + STAGING_PLANE_ALIGNMENT - 1) & ~(size_t)(STAGING_PLANE_ALIGNMENT - 1);
+	}
+	return size;
+}
+
+size_t AVOpenGLFrame::StagingSize(AVFrame *frame)
+{
+	size_t offsets[MAX_PANES];
+	size_t strides[MAX_PANES];
+	return StagingLayout(conversion_config, frame, offsets, strides);
+}
+
+void AVOpenGLFrame::AllocateTextures(bool immutable_storage)
+{
+	auto f = QOpenGLContext::currentContext()->extraFunctions();
+
+	for(int i=0; i<conversion_config->planes; i++)
+	{
+		const PlaneConfig &plane = conversion_config->plane_configs[i];
+		GLsizei plane_width = width / plane.width_divider;
+		GLsizei plane_height = height / plane.height_divider;
+		if(immutable_storage)
+		{
+			// immutable storage can not be resized, so the texture has to be replaced
+			f->glDeleteTextures(1, &tex[i]);
+			f->glGenTextures(1, &tex[i]);
+			f->glBindTexture(GL_TEXTURE_2D, tex[i]);
+			SetTextureParameters(f);
+			f->glTexStorage2D(GL_TEXTURE_2D, 1, plane.internal_format, plane_width, plane_height);
+		}
+		else
+		{
+			f->glBindTexture(GL_TEXTURE_2D, tex[i]);
+			f->glTexImage2D(GL_TEXTURE_2D, 0, plane.internal_format, plane_width, plane_height, 0, plane.format, GL_UNSIGNED_BYTE, nullptr);
+		}
+	}
+}
+
+bool AVOpenGLFrame::Update(AVFrame *frame, AVOpenGLPixelBuffer *buffer, bool immutable_storage, ChiakiLog *log)
 {
 	auto f = QOpenGLContext::currentContext()->extraFunctions();
 
@@ -200,42 +278,82 @@ bool AVOpenGLFrame::Update(AVFrame *frame, ChiakiLog *log)
 		return false;
 	}
 
-	width = frame->width;
-	height = frame->height;
-
-	for(int i=0; i<conversion_config->planes; i++)
+	size_t offsets[MAX_PANES];
+	size_t strides[MAX_PANES];
+	size_t size = StagingLayout(conversion_config, frame, offsets, strides);
+	if(buffer->size < size)
 	{
-		int width = frame->width / conversion_config->plane_configs[i].width_divider;
-		int height = frame->height / conversion_config->plane_configs[i].height_divider;
-		int size = width * height * conversion_config->plane_configs[i].data_per_pixel;
-
-		f->glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo[i]);
-		f->glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+		CHIAKI_LOGE(log, "AVOpenGLFrame got a pixel buffer that is too small");
+		return false;
+	}
 
-		auto buf = reinterpret_cast<uint8_t *>(f->glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+	f->glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer->pbo);
+	uint8_t *buf = buffer->mapped;
+	if(!buf)
+	{
+		// the buffer's fence has already been waited for, so there is no need for the driver to synchronize again
+		buf = reinterpret_cast<uint8_t *>(f->glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+				GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
 		if(!buf)
 		{
 			CHIAKI_LOGE(log, "AVOpenGLFrame failed to map PBO");
-			continue;
+			f->glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			return false;
 		}
+	}
 
-		if(frame->linesize[i] == width)
-			memcpy(buf, frame->data[i], size);
+	for(int i=0; i<conversion_config->planes; i++)
+	{
+		const PlaneConfig &plane = conversion_config->plane_configs[i];
+		size_t height = frame->height / plane.height_divider;
+		size_t row_size = (frame->width / plane.width_divider) * plane.data_per_pixel;
+		if(strides[i] == (size_t)frame->linesize[i])
+			memcpy(buf + offsets[i], frame->data[i], strides[i] * height);
 		else
 		{
-			for(int l=0; l<height; l++)
-				memcpy(buf + width * l * conversion_config->plane_configs[i].data_per_pixel, frame->data[i] + frame->linesize[i] * l, width * conversion_config->plane_configs[i].data_per_pixel);
+			for(size_t l=0; l<height; l++)
+				memcpy(buf + offsets[i] + strides[i] * l, frame->data[i] + frame->linesize[i] * l, row_size);
 		}
+	}
 
+	if(!buffer->mapped)
 		f->glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
 
-		f->glBindTexture(GL_TEXTURE_2D, tex[i]);
-		f->glTexImage2D(GL_TEXTURE_2D, 0, conversion_config->plane_configs[i].internal_format, width, height, 0, conversion_config->plane_configs[i].format, GL_UNSIGNED_BYTE, nullptr);
+	// the renderer might still be sampling from these textures
+	if(draw_fence)
+	{
+		f->glWaitSync(draw_fence, 0, GL_TIMEOUT_IGNORED);
+		f->glDeleteSync(draw_fence);
+		draw_fence = nullptr;
 	}
 
+	if(width != (unsigned int)frame->width || height != (unsigned int)frame->height)
+	{
+		width = frame->width;
+		height = frame->height;
+		AllocateTextures(immutable_storage);
+	}
+
+	for(int i=0; i<conversion_config->planes; i++)
+	{
+		const PlaneConfig &plane = conversion_config->plane_configs[i];
+		f->glBindTexture(GL_TEXTURE_2D, tex[i]);
+		f->glPixelStorei(GL_UNPACK_ROW_LENGTH, strides[i] / plane.data_per_pixel);
+		f->glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width / plane.width_divider, height / plane.height_divider,
+				plane.format, GL_UNSIGNED_BYTE, reinterpret_cast<const void *>(offsets[i]));
+	}
+	f->glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
 	f->glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 
-	f->glFinish();
+	if(buffer->fence)
+		f->glDeleteSync(buffer->fence);
+	buffer->fence = f->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	if(upload_fence)
+		f->glDeleteSync(upload_fence);
+	upload_fence = f->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	// fences must be flushed before another context can wait for them
+	f->glFlush();
 
 	return true;
 }
@@ -302,19 +420,17 @@ void AVOpenGLWidget::initializeGL()
 	{
 		frames[i].conversion_config = conversion_config;
 		f->glGenTextures(conversion_config->planes, frames[i].tex);
-		f->glGenBuffers(conversion_config->planes, frames[i].pbo);
 		uint8_t uv_default[] = {0x7f, 0x7f};
 		for(int j=0; j<conversion_config->planes; j++)
 		{
 			f->glBindTexture(GL_TEXTURE_2D, frames[i].tex[j]);
-			f->glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-			f->glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-			f->glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-			f->glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+			SetTextureParameters(f);
 			f->glTexImage2D(GL_TEXTURE_2D, 0, conversion_config->plane_configs[j].internal_format, 1, 1, 0, conversion_config->plane_configs[j].format, GL_UNSIGNED_BYTE, j > 0 ? uv_default : nullptr);
 		}
 		frames[i].width = 0;
 		frames[i].height = 0;
+		frames[i].upload_fence = nullptr;
+		frames[i].draw_fence = nullptr;
 	}
 
 	f->glUseProgram(program);
@@ -358,6 +474,8 @@ void AVOpenGLWidget::initializeGL()
 
 	frame_uploader_thread = new QThread(this);
 	frame_uploader_thread->setObjectName("Frame Uploader");
+	// finished is emitted on the uploader thread itself, the only place its context can be made current
+	connect(frame_uploader_thread, &QThread::finished, frame_uploader, &AVOpenGLFrameUploader::ReleaseGL, Qt::DirectConnection);
 	frame_uploader_context->moveToThread(frame_uploader_thread);
 	frame_uploader->moveToThread(frame_uploader_thread);
 	frame_uploader_thread->start();
@@ -426,6 +544,13 @@ void AVOpenGLWidget::paintGL()
 
 	f->glViewport((widget_width - vp_width) / 2, (widget_height - vp_height) / 2, vp_width, vp_height);
 
+	if(frame->upload_fence)
+	{
+		f->glWaitSync(frame->upload_fence, 0, GL_TIMEOUT_IGNORED);
+		f->glDeleteSync(frame->upload_fence);
+		frame->upload_fence = nullptr;
+	}
+
 	for(int i=0; i<3; i++)
 	{
 		f->glActiveTexture(GL_TEXTURE0 + i);
@@ -434,5 +559,9 @@ void AVOpenGLWidget::paintGL()
 
 	f->glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 
-	f->glFinish();
+	// lets the uploader know when it may overwrite this frame again
+	if(frame->draw_fence)
+		f->glDeleteSync(frame->draw_fence);
+	frame->draw_fence = f->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	f->glFlush();
 }
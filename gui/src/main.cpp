@@ -10,6 +10,7 @@ int main(int argc, char *argv[]) { return real_main(argc, argv); }
 #include <registdialog.h>
 #include <host.h>
 #include <avopenglwidget.h>
+#include <avopenglframeuploader.h>
 #include <controllermanager.h>
 
 #ifdef CHIAKI_ENABLE_CLI
@@ -30,6 +31,8 @@ int main(int argc, char *argv[]) { return real_main(argc, argv); }
 #include <QMap>
 #include <QSurfaceFormat>
 
+#define UPLOAD_TEST_FRAMES 120
+
 Q_DECLARE_METATYPE(ChiakiLogLevel)
 
 #ifdef CHIAKI_ENABLE_CLI
@@ -88,6 +91,7 @@ int real_main(int argc, char *argv[])
 	QStringList cmds;
 	cmds.append("stream");
 	cmds.append("list");
+	cmds.append("uploadtest");
 #ifdef CHIAKI_ENABLE_CLI
 	cmds.append(cli_commands.keys());
 #endif
@@ -197,6 +201,12 @@ int real_main(int argc, char *argv[])
 
 		return RunStream(app, connect_info);
 	}
+	if(args[0] == "uploadtest")
+	{
+		ChiakiLog log;
+		chiaki_log_init(&log, CHIAKI_LOG_ALL & ~CHIAKI_LOG_VERBOSE, chiaki_log_cb_print, nullptr);
+		return AVOpenGLFrameUploader::SelfTest(&log, UPLOAD_TEST_FRAMES) ? 0 : 1;
+	}
 #ifdef CHIAKI_ENABLE_CLI
 	else if(cli_commands.contains(args[0]))
 	{
@@ -240,6 +240,11 @@ SettingsDialog::SettingsDialog(Settings *settings, QWidget *parent) : QDialog(pa
 	decode_settings_layout->addRow(tr("Hardware decode method:"), hw_decoder_combo_box);
 	UpdateHardwareDecodeEngineComboBox();
 
+	video_slices_check_box = new QCheckBox(this);
+	video_slices_check_box->setChecked(settings->GetVideoSlicesEnabled());
+	connect(video_slices_check_box, &QCheckBox::stateChanged, this, &SettingsDialog::VideoSlicesChanged);
+	decode_settings_layout->addRow(tr("Decode slices early:\nLower latency, H.264 only."), video_slices_check_box);
+
 	// Registered Consoles
 
 	auto registered_hosts_group_box = new QGroupBox(tr("Registered Consoles"));
@@ -362,6 +367,11 @@ void SettingsDialog::HardwareDecodeEngineSelected()
 	settings->SetHardwareDecoder(hw_decoder_combo_box->currentData().toString());
 }
 
+void SettingsDialog::VideoSlicesChanged()
+{
+	settings->SetVideoSlicesEnabled(video_slices_check_box->isChecked());
+}
+
 void SettingsDialog::UpdateHardwareDecodeEngineComboBox()
 {
 	hw_decoder_combo_box->setEnabled(settings->GetDecoder() == Decoder::Ffmpeg);
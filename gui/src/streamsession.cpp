@@ -3,17 +3,31 @@
 #include <streamsession.h>
 #include <settings.h>
 #include <controllermanager.h>
+#include <audioringdevice.h>
 
 #include <chiaki/base64.h>
 
 #include <QKeyEvent>
 #include <QAudioOutput>
+#include <QThread>
 
 #include <cstring>
+#include <algorithm>
 #include <chiaki/session.h>
 
 #define SETSU_UPDATE_INTERVAL_MS 4
 
+#define AUDIO_RING_SIZE_EXP 14
+#define AUDIO_RING_TARGET_MS 20 // on top of what the audio device reads at once, before tuning
+#define AUDIO_RING_TARGET_MIN_MS 2
+#define AUDIO_STATS_INTERVAL_MS 500
+#define AUDIO_TUNE_WINDOW_MS 10000 // the ring target is lowered after this long without underflows
+#define AUDIO_TUNE_WINDOW_MAX_MS 160000
+#define AUDIO_TUNE_RAISE_MIN_MS 5
+
+#define HAPTICS_RING_SIZE_EXP 13
+#define HAPTICS_DEVICE_SAMPLES 480 // 10ms buffer
+
 #ifdef Q_OS_LINUX
 #define DUALSENSE_AUDIO_DEVICE_NEEDLE "DualSense"
 #else
@@ -46,11 +60,13 @@ StreamSessionConnectInfo::StreamSessionConnectInfo(
 	this->transform_mode = transform_mode;
 	this->enable_keyboard = false; // TODO: from settings
 	this->enable_dualsense = settings->GetDualSenseEnabled();
+	this->video_slices = settings->GetVideoSlicesEnabled();
 }
 
 static void AudioSettingsCb(uint32_t channels, uint32_t rate, void *user);
 static void AudioFrameCb(int16_t *buf, size_t samples_count, void *user);
 static void HapticsFrameCb(uint8_t *buf, size_t buf_size, void *user);
+static void HapticsAudioCb(void *user, Uint8 *stream, int len);
 static void EventCb(ChiakiEvent *event, void *user);
 #if CHIAKI_GUI_ENABLE_SETSU
 static void SessionSetsuCb(SetsuEvent *event, void *user);
@@ -66,8 +82,15 @@ StreamSession::StreamSession(const StreamSessionConnectInfo &connect_info, QObje
 #endif
 	audio_output(nullptr),
 	audio_io(nullptr),
+	audio_ring_initialized(false),
+	audio_rate(0),
+	audio_target_min_frames(0),
+	audio_underflows_prev(0),
+	audio_clean_ms(0),
+	audio_tune_window_ms(AUDIO_TUNE_WINDOW_MS),
+	audio_stats_timer(nullptr),
 	haptics_output(0),
-	haptics_resampler_buf(nullptr)
+	haptics_ring_initialized(false)
 {
 	connected = false;
 	ChiakiErrorCode err;
@@ -89,6 +112,7 @@ StreamSession::StreamSession(const StreamSessionConnectInfo &connect_info, QObje
 				chiaki_log_sniffer_get_log(&sniffer),
 				chiaki_target_is_ps5(connect_info.target) ? connect_info.video_profile.codec : CHIAKI_CODEC_H264,
 				connect_info.hw_decoder.isEmpty() ? NULL : connect_info.hw_decoder.toUtf8().constData(),
+				connect_info.video_slices,
 				FfmpegFrameCb, this);
 		if(err != CHIAKI_ERR_SUCCESS)
 		{
@@ -127,6 +151,7 @@ StreamSession::StreamSession(const StreamSessionConnectInfo &connect_info, QObje
 	chiaki_connect_info.video_profile_auto_downgrade = true;
 	chiaki_connect_info.enable_keyboard = false;
 	chiaki_connect_info.enable_dualsense = connect_info.enable_dualsense;
+	chiaki_connect_info.fec_threads = (unsigned int)qBound(0, QThread::idealThreadCount() - 1, CHIAKI_FEC_THREADS_MAX);
 
 #if CHIAKI_LIB_ENABLE_PI_DECODER
 	if(connect_info.decoder == Decoder::Pi && chiaki_connect_info.video_profile.codec != CHIAKI_CODEC_H264)
@@ -160,6 +185,7 @@ StreamSession::StreamSession(const StreamSessionConnectInfo &connect_info, QObje
 		ChiakiAudioSink haptics_sink;
 		haptics_sink.user = this;
 		haptics_sink.frame_cb = HapticsFrameCb;
+		haptics_sink.frame_indexed_cb = nullptr;
 		chiaki_session_set_haptics_sink(&session, &haptics_sink);
 	}
 
@@ -169,7 +195,10 @@ StreamSession::StreamSession(const StreamSessionConnectInfo &connect_info, QObje
 	else
 	{
 #endif
-		chiaki_session_set_video_sample_cb(&session, chiaki_ffmpeg_decoder_video_sample_cb, ffmpeg_decoder);
+		if(connect_info.video_slices)
+			chiaki_session_set_video_slice_cb(&session, chiaki_ffmpeg_decoder_video_slice_cb, ffmpeg_decoder);
+		else
+			chiaki_session_set_video_sample_iov_cb(&session, chiaki_ffmpeg_decoder_video_sample_iov_cb, ffmpeg_decoder);
 #if CHIAKI_LIB_ENABLE_PI_DECODER
 	}
 #endif
@@ -199,6 +228,10 @@ StreamSession::StreamSession(const StreamSessionConnectInfo &connect_info, QObje
 	timer->start(SETSU_UPDATE_INTERVAL_MS);
 #endif
 
+	audio_stats_timer = new QTimer(this);
+	connect(audio_stats_timer, &QTimer::timeout, this, &StreamSession::UpdateAudioStats);
+	audio_stats_timer->start(AUDIO_STATS_INTERVAL_MS);
+
 	key_map = connect_info.key_map;
 	if(connect_info.enable_dualsense)
 	{
@@ -212,6 +245,17 @@ StreamSession::~StreamSession()
 	chiaki_session_join(&session);
 	chiaki_session_fini(&session);
 	chiaki_opus_decoder_fini(&opus_decoder);
+	delete audio_output;
+	audio_output = nullptr;
+	if(audio_ring_initialized)
+	{
+		ChiakiAudioRingStats ring_stats;
+		chiaki_audio_ring_get_stats(&audio_ring, &ring_stats);
+		CHIAKI_LOGI(log.GetChiakiLog(), "Audio ring had %llu underflows, dropped %llu frames, final target %.1f ms",
+				(unsigned long long)ring_stats.underflows, (unsigned long long)ring_stats.frames_dropped,
+				ring_stats.target_frames * 1000.0 / audio_rate);
+		chiaki_audio_ring_fini(&audio_ring);
+	}
 #if CHIAKI_GUI_ENABLE_SDL_GAMECONTROLLER
 	for(auto controller : controllers)
 		delete controller;
@@ -236,10 +280,10 @@ StreamSession::~StreamSession()
 		SDL_CloseAudioDevice(haptics_output);
 		haptics_output = 0;
 	}
-	if(haptics_resampler_buf)
+	if(haptics_ring_initialized)
 	{
-		free(haptics_resampler_buf);
-		haptics_resampler_buf = nullptr;
+		chiaki_audio_ring_fini(&haptics_ring);
+		haptics_ring_initialized = false;
 	}
 }
 
@@ -399,9 +443,15 @@ void StreamSession::SendFeedbackState()
 
 void StreamSession::InitAudio(unsigned int channels, unsigned int rate)
 {
+	// the network thread is blocked while we are here, so the ring can be replaced safely
 	delete audio_output;
 	audio_output = nullptr;
 	audio_io = nullptr;
+	if(audio_ring_initialized)
+	{
+		chiaki_audio_ring_fini(&audio_ring);
+		audio_ring_initialized = false;
+	}
 
 	QAudioFormat audio_format;
 	audio_format.setSampleRate(rate);
@@ -419,19 +469,87 @@ void StreamSession::InitAudio(unsigned int channels, unsigned int rate)
 		return;
 	}
 
+	ChiakiErrorCode err = chiaki_audio_ring_init(&audio_ring, channels, AUDIO_RING_SIZE_EXP, rate * AUDIO_RING_TARGET_MS / 1000);
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGE(log.GetChiakiLog(), "Failed to init audio ring: %s", chiaki_error_string(err));
+		return;
+	}
+	audio_ring_initialized = true;
+
 	audio_output = new QAudioOutput(audio_device_info, audio_format, this);
 	audio_output->setBufferSize(audio_buffer_size);
-	audio_io = audio_output->start();
-
-	CHIAKI_LOGI(log.GetChiakiLog(), "Audio Device %s opened with %u channels @ %u Hz, buffer size %u",
+	auto ring_device = new AudioRingDevice(&audio_ring, audio_output);
+	ring_device->open(QIODevice::ReadOnly);
+	audio_output->start(ring_device);
+	audio_io = ring_device;
+
+	// the ring has to cover a whole read of the device
+	size_t period_frames = static_cast<size_t>(audio_output->periodSize()) / (channels * sizeof(int16_t));
+	size_t ring_target = period_frames + rate * AUDIO_RING_TARGET_MS / 1000;
+	chiaki_audio_ring_set_target(&audio_ring, ring_target);
+
+	audio_rate = rate;
+	audio_target_min_frames = period_frames + rate * AUDIO_RING_TARGET_MIN_MS / 1000;
+	audio_underflows_prev = 0;
+	audio_clean_ms = 0;
+	audio_tune_window_ms = AUDIO_TUNE_WINDOW_MS;
+
+	CHIAKI_LOGI(log.GetChiakiLog(), "Audio Device %s opened with %u channels @ %u Hz, buffer size %u, ring target %u frames",
 				audio_device_info.deviceName().toLocal8Bit().constData(),
-				channels, rate, audio_output->bufferSize());
+				channels, rate, audio_output->bufferSize(),
+				static_cast<unsigned int>(ring_target));
+}
+
+void StreamSession::UpdateAudioStats()
+{
+	if(!audio_output || !audio_ring_initialized || !audio_rate)
+		return;
+
+	ChiakiAudioRingStats ring_stats;
+	chiaki_audio_ring_get_stats(&audio_ring, &ring_stats);
+
+	// raise the target right away on underflows and lower it slowly once it has been fine for a while,
+	// probing less often every time a lower target turned out to be too low
+	size_t target = ring_stats.target_frames;
+	if(ring_stats.underflows != audio_underflows_prev)
+	{
+		size_t step = std::max(target / 4, static_cast<size_t>(audio_rate * AUDIO_TUNE_RAISE_MIN_MS / 1000));
+		target = std::min(target + step, static_cast<size_t>(audio_ring.mask / 2));
+		chiaki_audio_ring_set_target(&audio_ring, target);
+		audio_clean_ms = 0;
+		audio_tune_window_ms = std::min(audio_tune_window_ms * 2, static_cast<unsigned int>(AUDIO_TUNE_WINDOW_MAX_MS));
+		CHIAKI_LOGI(log.GetChiakiLog(), "Audio underflow, raising ring target to %.1f ms", target * 1000.0 / audio_rate);
+	}
+	else
+	{
+		audio_clean_ms += AUDIO_STATS_INTERVAL_MS;
+		if(audio_clean_ms >= audio_tune_window_ms && target > audio_target_min_frames)
+		{
+			size_t step = std::max(target / 10, static_cast<size_t>(audio_rate / 1000));
+			target = std::max(target - std::min(step, target), audio_target_min_frames);
+			chiaki_audio_ring_set_target(&audio_ring, target);
+			audio_clean_ms = 0;
+			CHIAKI_LOGV(log.GetChiakiLog(), "No audio underflows for %u ms, lowering ring target to %.1f ms",
+					audio_tune_window_ms, target * 1000.0 / audio_rate);
+		}
+	}
+	audio_underflows_prev = ring_stats.underflows;
+
+	size_t frame_size = audio_ring.channels * sizeof(int16_t);
+	StreamSessionAudioStats stats;
+	size_t device_queued = static_cast<size_t>(std::max(0, audio_output->bufferSize() - audio_output->bytesFree()));
+	stats.device_latency_ms = device_queued / frame_size * 1000.0 / audio_rate;
+	stats.ring_latency_ms = ring_stats.fill_frames * 1000.0 / audio_rate;
+	stats.ring_target_ms = target * 1000.0 / audio_rate;
+	stats.underflows = ring_stats.underflows;
+	stats.drift_ppm = ring_stats.ratio_ppm;
+	emit AudioStatsUpdated(stats);
 }
 
 void StreamSession::InitHaptics()
 {
 	haptics_output = 0;
-	haptics_resampler_buf = nullptr;
 #ifdef Q_OS_LINUX
 	// Haptics work most reliably with Pipewire, so try to use that if available
 	SDL_SetHint("SDL_AUDIODRIVER", "pipewire");
@@ -453,10 +571,16 @@ void StreamSession::InitHaptics()
 	}
 #endif
 
-	SDL_AudioCVT cvt;
-	SDL_BuildAudioCVT(&cvt, AUDIO_S16LSB, 4, 3000, AUDIO_S16LSB, 4, 48000);
-	cvt.len = 240;  // 10 16bit stereo samples
-	haptics_resampler_buf = (uint8_t*) calloc(cvt.len * cvt.len_mult, sizeof(uint8_t));
+	chiaki_haptics_resampler_init(&haptics_resampler);
+	// keep one haptics frame on top of what the device reads at once
+	ChiakiErrorCode err = chiaki_audio_ring_init(&haptics_ring, CHIAKI_HAPTICS_RESAMPLER_CHANNELS_OUT, HAPTICS_RING_SIZE_EXP,
+			HAPTICS_DEVICE_SAMPLES + CHIAKI_HAPTICS_RESAMPLER_RATE_OUT / 100);
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGE(log.GetChiakiLog(), "Failed to init haptics ring: %s", chiaki_error_string(err));
+		return;
+	}
+	haptics_ring_initialized = true;
 }
 
 void StreamSession::DisconnectHaptics()
@@ -475,14 +599,17 @@ void StreamSession::ConnectHaptics()
 		CHIAKI_LOGW(this->log.GetChiakiLog(), "Haptics already connected to an attached DualSense controller, ignoring additional controllers.");
 		return;
 	}
+	if(!haptics_ring_initialized)
+		return;
 
 	SDL_AudioSpec want, have;
 	SDL_zero(want);
-	want.freq = 48000;
-	want.format = AUDIO_S16LSB;
-	want.channels = 4;
-	want.samples = 480; // 10ms buffer
-	want.callback = NULL;
+	want.freq = CHIAKI_HAPTICS_RESAMPLER_RATE_OUT;
+	want.format = AUDIO_S16SYS;
+	want.channels = CHIAKI_HAPTICS_RESAMPLER_CHANNELS_OUT;
+	want.samples = HAPTICS_DEVICE_SAMPLES;
+	want.callback = HapticsAudioCb;
+	want.userdata = &haptics_ring;
 
 	const char *device_name = nullptr;
 	for(int i=0; i < SDL_GetNumAudioDevices(0); i++)
@@ -508,35 +635,23 @@ void StreamSession::PushAudioFrame(int16_t *buf, size_t samples_count)
 {
 	if(!audio_io)
 		return;
-	audio_io->write((const char *)buf, static_cast<qint64>(samples_count * 2 * 2));
+	chiaki_audio_ring_push(&audio_ring, buf, samples_count);
 }
 
 void StreamSession::PushHapticsFrame(uint8_t *buf, size_t buf_size)
 {
 	if(haptics_output == 0)
 		return;
-	SDL_AudioCVT cvt;
-	// Haptics samples are coming in at 3KHZ, but the DualSense expects 48KHZ
-	SDL_BuildAudioCVT(&cvt, AUDIO_S16LSB, 4, 3000, AUDIO_S16LSB, 4, 48000);
-	cvt.len = buf_size * 2;
-	cvt.buf = haptics_resampler_buf;
-	// Remix to 4 channels
-	for (int i=0; i < buf_size; i+=4)
-	{
-		SDL_memset(haptics_resampler_buf + i * 2, 0, 4);
-		SDL_memcpy(haptics_resampler_buf + (i * 2) + 4, buf + i, 4);
-	}
-	// Resample to 48kHZ
-	if(SDL_ConvertAudio(&cvt) != 0)
-	{
-		CHIAKI_LOGE(log.GetChiakiLog(), "Failed to resample haptics audio: %s", SDL_GetError());
-		return;
-	}
 
-	if(SDL_QueueAudio(haptics_output, cvt.buf, cvt.len_cvt) < 0)
+	// Haptics samples are coming in at 3KHZ, but the DualSense expects 48KHZ on the back channels of 4
+	int16_t out[CHIAKI_HAPTICS_RESAMPLER_CHUNK * CHIAKI_HAPTICS_RESAMPLER_FACTOR * CHIAKI_HAPTICS_RESAMPLER_CHANNELS_OUT];
+	const size_t chunk_size = CHIAKI_HAPTICS_RESAMPLER_CHUNK * 4;
+	for(size_t offset = 0; offset + 4 <= buf_size; offset += chunk_size)
 	{
-		CHIAKI_LOGE(log.GetChiakiLog(), "Failed to submit haptics audio to device: %s", SDL_GetError());
-		return;
+		size_t frames_count = chiaki_haptics_resampler_process(&haptics_resampler, buf + offset,
+				std::min(chunk_size, buf_size - offset), out);
+		if(chiaki_audio_ring_push(&haptics_ring, out, frames_count) < frames_count)
+			CHIAKI_LOGW(log.GetChiakiLog(), "Haptics ring overflow");
 	}
 }
 
@@ -728,6 +843,12 @@ static void HapticsFrameCb(uint8_t *buf, size_t buf_size, void *user)
 	StreamSessionPrivate::PushHapticsFrame(session, buf, buf_size);
 }
 
+static void HapticsAudioCb(void *user, Uint8 *stream, int len)
+{
+	auto ring = reinterpret_cast<ChiakiAudioRing *>(user);
+	chiaki_audio_ring_pull(ring, reinterpret_cast<int16_t *>(stream), static_cast<size_t>(len) / (ring->channels * sizeof(int16_t)));
+}
+
 static void EventCb(ChiakiEvent *event, void *user)
 {
 	auto session = reinterpret_cast<StreamSession *>(user);
@@ -11,6 +11,9 @@
 #include <QCoreApplication>
 #include <QAction>
 #include <QMenu>
+#include <QTimer>
+
+#define VIDEO_STATS_INTERVAL_MS 500
 
 StreamWindow::StreamWindow(const StreamSessionConnectInfo &connect_info, QWidget *parent)
 	: QMainWindow(parent),
@@ -21,6 +24,8 @@ StreamWindow::StreamWindow(const StreamSessionConnectInfo &connect_info, QWidget
 		
 	session = nullptr;
 	av_widget = nullptr;
+	stats_label = nullptr;
+	video_stats_timer = nullptr;
 
 	try
 	{
@@ -47,10 +52,12 @@ void StreamWindow::Init()
 
 	connect(session, &StreamSession::SessionQuit, this, &StreamWindow::SessionQuit);
 	connect(session, &StreamSession::LoginPINRequested, this, &StreamWindow::LoginPINRequested);
+	connect(session, &StreamSession::AudioStatsUpdated, this, &StreamWindow::AudioStatsUpdated);
 
 	const QKeySequence fullscreen_shortcut = Qt::Key_F11;
 	const QKeySequence stretch_shortcut = Qt::CTRL + Qt::Key_S;
 	const QKeySequence zoom_shortcut = Qt::CTRL + Qt::Key_Z;
+	const QKeySequence stats_shortcut = Qt::CTRL + Qt::Key_I;
 
 	fullscreen_action = new QAction(tr("Fullscreen"), this);
 	fullscreen_action->setCheckable(true);
@@ -72,6 +79,8 @@ void StreamWindow::Init()
 			menu.addSeparator();
 			menu.addAction(stretch_action);
 			menu.addAction(zoom_action);
+			menu.addSeparator();
+			menu.addAction(stats_action);
 			releaseKeyboard();
 			connect(&menu, &QMenu::aboutToHide, this, [this] {
 				grabKeyboard();
@@ -102,6 +111,21 @@ void StreamWindow::Init()
 	addAction(zoom_action);
 	connect(zoom_action, &QAction::triggered, this, &StreamWindow::ToggleZoom);
 
+	stats_action = new QAction(tr("Show Stats"), this);
+	stats_action->setCheckable(true);
+	stats_action->setShortcut(stats_shortcut);
+	addAction(stats_action);
+	connect(stats_action, &QAction::triggered, this, &StreamWindow::ToggleStats);
+
+	stats_label = new QLabel(this);
+	stats_label->setStyleSheet("background-color: rgba(0, 0, 0, 160); color: white; padding: 4px;");
+	stats_label->setAttribute(Qt::WA_TransparentForMouseEvents);
+	stats_label->move(8, 8);
+	stats_label->hide();
+
+	video_stats_timer = new QTimer(this);
+	connect(video_stats_timer, &QTimer::timeout, this, &StreamWindow::UpdateVideoStats);
+
 	auto quit_action = new QAction(tr("Quit"), this);
 	quit_action->setShortcut(Qt::CTRL + Qt::Key_Q);
 	addAction(quit_action);
@@ -246,6 +270,58 @@ void StreamWindow::ToggleFullscreen()
 	}
 }
 
+void StreamWindow::ToggleStats()
+{
+	if(!stats_label)
+		return;
+	stats_label->setVisible(stats_action->isChecked());
+	stats_label->raise();
+	if(stats_action->isChecked())
+	{
+		UpdateVideoStats();
+		video_stats_timer->start(VIDEO_STATS_INTERVAL_MS);
+	}
+	else
+		video_stats_timer->stop();
+}
+
+void StreamWindow::AudioStatsUpdated(const StreamSessionAudioStats &stats)
+{
+	if(!stats_label || !stats_label->isVisible())
+		return;
+	audio_stats_text = tr("Audio latency: %1 ms (device %2 ms + queue %3 ms, target %4 ms)\nAudio underflows: %5, clock drift: %6 ppm")
+			.arg(stats.device_latency_ms + stats.ring_latency_ms, 0, 'f', 1)
+			.arg(stats.device_latency_ms, 0, 'f', 1)
+			.arg(stats.ring_latency_ms, 0, 'f', 1)
+			.arg(stats.ring_target_ms, 0, 'f', 1)
+			.arg(stats.underflows)
+			.arg(stats.drift_ppm);
+	UpdateStatsLabel();
+}
+
+void StreamWindow::UpdateVideoStats()
+{
+	if(!av_widget || !stats_label || !stats_label->isVisible())
+		return;
+	AVOpenGLUploadStats upload_stats = av_widget->GetUploadStats();
+	video_stats_text = tr("Video upload: %1 ms (last %2 ms) with %3 pixel buffers")
+			.arg(upload_stats.upload_ms, 0, 'f', 2)
+			.arg(upload_stats.upload_ms_last, 0, 'f', 2)
+			.arg(upload_stats.persistent ? tr("persistently mapped") : tr("per frame mapped"));
+	UpdateStatsLabel();
+}
+
+void StreamWindow::UpdateStatsLabel()
+{
+	QStringList lines;
+	if(!audio_stats_text.isEmpty())
+		lines.append(audio_stats_text);
+	if(!video_stats_text.isEmpty())
+		lines.append(video_stats_text);
+	stats_label->setText(lines.join('\n'));
+	stats_label->adjustSize();
+}
+
 void StreamWindow::UpdateTransformModeActions()
 {
 	TransformMode tm = av_widget ? av_widget->GetTransformMode() : TransformMode::Fit;
@@ -0,0 +1,94 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_AUDIOJITTERBUFFER_H
+#define CHIAKI_AUDIOJITTERBUFFER_H
+
+#include "common.h"
+#include "seqnum.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIAKI_AUDIO_JITTER_BUFFER_SLOTS 32 // power of 2, frames further ahead make the buffer skip forward
+#define CHIAKI_AUDIO_JITTER_BUFFER_FRAME_SIZE_MAX 0x100
+#define CHIAKI_AUDIO_JITTER_BUFFER_TARGET_MAX 8 // frames
+#define CHIAKI_AUDIO_JITTER_BUFFER_CONCEAL_MAX 5 // longer gaps are skipped instead of concealed, as their time has passed anyway
+
+typedef enum
+{
+	CHIAKI_AUDIO_JITTER_BUFFER_OUT_NONE, // nothing to play yet
+	CHIAKI_AUDIO_JITTER_BUFFER_OUT_FRAME, // play the returned frame
+	CHIAKI_AUDIO_JITTER_BUFFER_OUT_FEC, // frame is missing, recover it from the in-band fec of the returned next frame
+	CHIAKI_AUDIO_JITTER_BUFFER_OUT_PLC // frame is missing and has to be concealed
+} ChiakiAudioJitterBufferOut;
+
+typedef struct chiaki_audio_jitter_buffer_slot_t
+{
+	bool set;
+	ChiakiSeqNum16 frame_index;
+	size_t size;
+	uint8_t buf[CHIAKI_AUDIO_JITTER_BUFFER_FRAME_SIZE_MAX];
+} ChiakiAudioJitterBufferSlot;
+
+typedef struct chiaki_audio_jitter_buffer_stats_t
+{
+	uint64_t frames_played;
+	uint64_t frames_fec;
+	uint64_t frames_plc;
+	uint64_t frames_skipped;
+} ChiakiAudioJitterBufferStats;
+
+/**
+ * Reorders encoded audio frames by their frame index and decides when a missing frame is given up on.
+ *
+ * Frames are played as soon as all previous ones have been, so there is no added latency without loss.
+ * A gap is only concealed once the target depth of newer frames has arrived or its time has passed,
+ * where the target depth follows the measured inter-arrival jitter.
+ */
+typedef struct chiaki_audio_jitter_buffer_t
+{
+	ChiakiAudioJitterBufferSlot slots[CHIAKI_AUDIO_JITTER_BUFFER_SLOTS];
+	uint64_t frame_duration_us;
+
+	bool started;
+	ChiakiSeqNum16 frame_index_next; // next to play
+	ChiakiSeqNum16 frame_index_newest;
+	uint64_t gap_start_us; // when frame_index_next was found missing with newer frames present, 0 if not
+	bool concealing; // the current gap has been given up on, so the rest of it is not waited for either
+
+	// RFC 3550-style jitter of packets, relative to their first new frame
+	int64_t frame_count_newest; // frame_index_newest, but unwrapped
+	int64_t transit_prev_us;
+	uint64_t arrival_prev_us;
+	uint64_t jitter_us;
+	unsigned int target_frames;
+
+	ChiakiAudioJitterBufferStats stats;
+} ChiakiAudioJitterBuffer;
+
+CHIAKI_EXPORT void chiaki_audio_jitter_buffer_init(ChiakiAudioJitterBuffer *jitter_buffer, uint64_t frame_duration_us);
+
+/**
+ * @return false if the frame was not taken, e.g. because it is a duplicate or too late
+ */
+CHIAKI_EXPORT bool chiaki_audio_jitter_buffer_put(ChiakiAudioJitterBuffer *jitter_buffer, ChiakiSeqNum16 frame_index,
+		const uint8_t *buf, size_t buf_size, uint64_t now_us);
+
+/**
+ * Get the next thing to play, call repeatedly until CHIAKI_AUDIO_JITTER_BUFFER_OUT_NONE is returned.
+ * @param buf set to the frame for CHIAKI_AUDIO_JITTER_BUFFER_OUT_FRAME and CHIAKI_AUDIO_JITTER_BUFFER_OUT_FEC,
+ * valid until the next call to any chiaki_audio_jitter_buffer function
+ */
+CHIAKI_EXPORT ChiakiAudioJitterBufferOut chiaki_audio_jitter_buffer_pop(ChiakiAudioJitterBuffer *jitter_buffer, uint64_t now_us,
+		const uint8_t **buf, size_t *buf_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_AUDIOJITTERBUFFER_H
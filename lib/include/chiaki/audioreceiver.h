@@ -16,6 +16,7 @@ extern "C" {
 
 typedef void (*ChiakiAudioSinkHeader)(ChiakiAudioHeader *header, void *user);
 typedef void (*ChiakiAudioSinkFrame)(uint8_t *buf, size_t buf_size, void *user);
+typedef void (*ChiakiAudioSinkFrameIndexed)(uint8_t *buf, size_t buf_size, ChiakiSeqNum16 frame_index, void *user);
 
 /**
  * Sink that receives Audio encoded as Opus
@@ -25,6 +26,12 @@ typedef struct chiaki_audio_sink_t
 	void *user;
 	ChiakiAudioSinkHeader header_cb;
 	ChiakiAudioSinkFrame frame_cb;
+
+	/**
+	 * If set, used instead of frame_cb for audio (not haptics).
+	 * Frames are passed with their index, possibly out of order or repeated, so the sink can reorder and conceal them.
+	 */
+	ChiakiAudioSinkFrameIndexed frame_indexed_cb;
 } ChiakiAudioSink;
 
 typedef struct chiaki_audio_receiver_t
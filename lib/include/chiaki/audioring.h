@@ -0,0 +1,104 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_AUDIORING_H
+#define CHIAKI_AUDIORING_H
+
+#include "common.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIAKI_AUDIO_RING_CACHE_LINE_SIZE 64
+#define CHIAKI_AUDIO_RING_CHANNELS_MAX 8
+#define CHIAKI_AUDIO_RING_RATIO_MAX_PPM 5000 // ±0.5%, inaudible as a pitch change
+
+typedef struct chiaki_audio_ring_stats_t
+{
+	uint64_t frames_pushed;
+	uint64_t frames_dropped; // pushed while the ring was full
+	uint64_t underflows;
+	size_t fill_frames;
+	size_t target_frames;
+	int32_t ratio_ppm; // how much faster than the nominal rate the consumer currently reads
+} ChiakiAudioRingStats;
+
+/**
+ * Wait-free ring of interleaved 16 bit PCM for exactly one producer (the decoder) and one consumer (the audio device callback).
+ *
+ * The consumer keeps the fill level at a fixed target by reading slightly faster or slower than the nominal rate,
+ * which absorbs the clock drift between the console and the local audio device instead of letting latency grow.
+ * After an underflow, playback only resumes once the target has been reached again.
+ */
+typedef struct chiaki_audio_ring_t
+{
+	int16_t *buf;
+	size_t channels;
+	uint32_t mask; // in frames
+
+	// frame indices are free-running and only masked on access
+	volatile uint32_t head; // written by the producer only
+	uint8_t pad_head[CHIAKI_AUDIO_RING_CACHE_LINE_SIZE - sizeof(uint32_t)];
+	volatile uint32_t tail; // written by the consumer only
+	uint8_t pad_tail[CHIAKI_AUDIO_RING_CACHE_LINE_SIZE - sizeof(uint32_t)];
+
+	volatile uint32_t target_frames;
+
+	// written by the producer only
+	uint64_t frames_pushed;
+	uint64_t frames_dropped;
+
+	// written by the consumer only
+	bool priming;
+	double fill_avg;
+	double drift; // integral part of the controller
+	double phase; // position between frame_prev and the frame at tail, negative if frame_prev is not set
+	int16_t frame_prev[CHIAKI_AUDIO_RING_CHANNELS_MAX];
+	volatile uint32_t fill_avg_frames;
+	volatile uint32_t ratio_ppm; // int32_t, stored for other threads
+	uint64_t underflows;
+} ChiakiAudioRing;
+
+/**
+ * @param size_exp the ring holds 2^size_exp frames
+ * @param target_frames fill level to hold, as seen by the consumer right before it reads
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_audio_ring_init(ChiakiAudioRing *ring, size_t channels, size_t size_exp, size_t target_frames);
+CHIAKI_EXPORT void chiaki_audio_ring_fini(ChiakiAudioRing *ring);
+
+/**
+ * Producer only. Frames that do not fit anymore are dropped.
+ *
+ * @return number of frames that were pushed
+ */
+CHIAKI_EXPORT size_t chiaki_audio_ring_push(ChiakiAudioRing *ring, const int16_t *pcm, size_t frames_count);
+
+/**
+ * Consumer only. Always fills all of pcm, with silence where there is nothing to play.
+ */
+CHIAKI_EXPORT void chiaki_audio_ring_pull(ChiakiAudioRing *ring, int16_t *pcm, size_t frames_count);
+
+/**
+ * May be called from any thread, takes effect with the next pull.
+ */
+CHIAKI_EXPORT void chiaki_audio_ring_set_target(ChiakiAudioRing *ring, size_t target_frames);
+
+/**
+ * Number of frames currently buffered, may be called from any thread.
+ */
+CHIAKI_EXPORT size_t chiaki_audio_ring_fill(ChiakiAudioRing *ring);
+
+/**
+ * May be called from any thread, the counters of the other side may be slightly behind.
+ */
+CHIAKI_EXPORT void chiaki_audio_ring_get_stats(ChiakiAudioRing *ring, ChiakiAudioRingStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_AUDIORING_H
@@ -0,0 +1,62 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_AVADMISSION_H
+#define CHIAKI_AVADMISSION_H
+
+#include "common.h"
+#include "log.h"
+#include "fec.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct chiaki_takion_av_packet_t;
+
+#define CHIAKI_AV_ADMISSION_VIDEO_FRAMES 4 // same window as CHIAKI_VIDEO_RECEIVER_FRAMES_MAX
+
+typedef struct chiaki_av_admission_video_frame_t
+{
+	int32_t frame_index; // -1 if unused
+	uint64_t units_bitmap[CHIAKI_FEC_UNITS_MAX / 64];
+} ChiakiAVAdmissionVideoFrame;
+
+/**
+ * Filter for AV packets that only looks at their cleartext header,
+ * so packets the receivers would discard anyway are dropped before being authenticated and decrypted.
+ *
+ * Only the state of authenticated packets is recorded, so forged headers cannot make it drop valid packets.
+ */
+typedef struct chiaki_av_admission_t
+{
+	ChiakiAVAdmissionVideoFrame video_frames[CHIAKI_AV_ADMISSION_VIDEO_FRAMES];
+	int32_t audio_frame_index_last[2]; // last frame that audio/haptics can deliver, -1 if none yet
+
+	uint64_t video_stale;
+	uint64_t video_duplicate;
+	uint64_t audio_stale;
+	uint64_t bytes_skipped; // payload bytes that were neither authenticated nor decrypted
+} ChiakiAVAdmission;
+
+CHIAKI_EXPORT void chiaki_av_admission_init(ChiakiAVAdmission *admission);
+
+/**
+ * @return false if the packet would be discarded by the receivers and can be dropped right away
+ */
+CHIAKI_EXPORT bool chiaki_av_admission_check(ChiakiAVAdmission *admission, struct chiaki_takion_av_packet_t *packet);
+
+/**
+ * Record an admitted packet after it has been authenticated.
+ */
+CHIAKI_EXPORT void chiaki_av_admission_commit(ChiakiAVAdmission *admission, struct chiaki_takion_av_packet_t *packet);
+
+CHIAKI_EXPORT void chiaki_av_admission_log_stats(ChiakiAVAdmission *admission, ChiakiLog *log);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_AVADMISSION_H
@@ -4,6 +4,7 @@
 #define CHIAKI_FEC_H
 
 #include "common.h"
+#include "thread.h"
 
 #include <stdint.h>
 #ifndef _WIN32
@@ -15,8 +16,143 @@ extern "C" {
 #endif
 
 #define CHIAKI_FEC_WORDSIZE 8
+#define CHIAKI_FEC_UNITS_MAX (1 << CHIAKI_FEC_WORDSIZE) // max k + m
+#define CHIAKI_FEC_DECODE_CACHE_SIZE 8
+#define CHIAKI_FEC_THREADS_MAX 4
+#define CHIAKI_FEC_STRIPE_ALIGN 64 // cache line
+#define CHIAKI_FEC_PARALLEL_MIN_WORK_DEFAULT (1 << 20) // bytes to multiply-add before using the workers
 
-CHIAKI_EXPORT ChiakiErrorCode chiaki_fec_decode(uint8_t *frame_buf, size_t unit_size, size_t stride, unsigned int k, unsigned int m, const unsigned int *erasures, size_t erasures_count);
+typedef enum chiaki_fec_backend_t
+{
+	CHIAKI_FEC_BACKEND_JERASURE, // reference implementation
+	CHIAKI_FEC_BACKEND_SCALAR,
+	CHIAKI_FEC_BACKEND_SSSE3,
+	CHIAKI_FEC_BACKEND_AVX2,
+	CHIAKI_FEC_BACKEND_NEON
+} ChiakiFECBackend;
+
+CHIAKI_EXPORT const char *chiaki_fec_backend_string(ChiakiFECBackend backend);
+CHIAKI_EXPORT bool chiaki_fec_backend_supported(ChiakiFECBackend backend);
+
+/**
+ * @return the fastest backend supported by the cpu we are running on
+ */
+CHIAKI_EXPORT ChiakiFECBackend chiaki_fec_backend_best(void);
+
+/**
+ * Decoding matrix for one (k, m, erasure pattern)
+ */
+typedef struct chiaki_fec_decode_matrix_t
+{
+	unsigned int k;
+	unsigned int m;
+	uint64_t erasures[CHIAKI_FEC_UNITS_MAX / 64]; // bitmap of erased units
+	uint64_t last_used; // 0 if the entry is unused
+	int *src_ids; // k indices of the units to decode from
+	int *rows; // one row of k coefficients for each erased source unit, in ascending order
+	size_t alloc_size; // number of ints allocated for src_ids and rows
+} ChiakiFECDecodeMatrix;
+
+typedef struct chiaki_fec_stats_t
+{
+	uint64_t decodes; // decodes on the calling thread only
+	uint64_t decode_us;
+	uint64_t decode_work; // bytes multiplied and added
+	uint64_t parallel_decodes; // decodes split across the workers
+	uint64_t parallel_decode_us;
+	uint64_t parallel_decode_work;
+} ChiakiFECStats;
+
+/**
+ * @return estimated speedup of parallel over single-threaded decoding per byte, or 0 if there is not enough data yet
+ */
+CHIAKI_EXPORT double chiaki_fec_stats_parallel_speedup(const ChiakiFECStats *stats);
+
+struct chiaki_fec_t;
+
+typedef struct chiaki_fec_worker_t
+{
+	struct chiaki_fec_t *fec;
+	unsigned int stripe; // stripe of each job that this worker recovers
+	ChiakiThread thread;
+} ChiakiFECWorker;
+
+/**
+ * Caches decoding matrices and owns the scratch memory for chiaki_fec_decode(),
+ * so repeated decodes with the same parameters only do the GF multiply-adds.
+ * Not thread-safe.
+ */
+typedef struct chiaki_fec_t
+{
+	ChiakiFECBackend backend; // initialized to chiaki_fec_backend_best(), may be changed to any supported backend
+	int *coding_matrix; // cauchy coding matrix for coding_k, coding_m
+	unsigned int coding_k;
+	unsigned int coding_m;
+	ChiakiFECDecodeMatrix decode_cache[CHIAKI_FEC_DECODE_CACHE_SIZE];
+	uint64_t decode_cache_clock;
+	uint64_t decode_cache_hits;
+	uint64_t decode_cache_misses;
+	int *inverse; // scratch for inverting a k x k matrix on cache misses
+	size_t inverse_size;
+	uint8_t *ptrs[CHIAKI_FEC_UNITS_MAX];
+	int erased[CHIAKI_FEC_UNITS_MAX];
+
+	ChiakiFECStats stats;
+
+	/*
+	 * Optional worker pool, large decodes are split into stripes of the unit width,
+	 * which are recovered in parallel by the workers and the calling thread.
+	 */
+	size_t parallel_min_work;
+	ChiakiFECWorker workers[CHIAKI_FEC_THREADS_MAX];
+	unsigned int workers_count;
+	ChiakiMutex workers_mutex;
+	ChiakiCond workers_cond;
+	ChiakiCond workers_done_cond;
+	bool workers_stop;
+	uint64_t job_seq;
+	unsigned int job_pending; // workers still recovering their stripe of the current job
+	ChiakiFECDecodeMatrix *job_dm;
+	unsigned int job_k;
+	size_t job_unit_size;
+	size_t job_stripe_size;
+} ChiakiFEC;
+
+CHIAKI_EXPORT void chiaki_fec_init(ChiakiFEC *fec);
+CHIAKI_EXPORT void chiaki_fec_fini(ChiakiFEC *fec);
+
+/**
+ * Start threads worker threads for decoding large frames in parallel.
+ * May only be called once, before any chiaki_fec_decode().
+ *
+ * @param threads additional threads, the calling thread of chiaki_fec_decode() always takes part too. At most CHIAKI_FEC_THREADS_MAX.
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_fec_start_workers(ChiakiFEC *fec, unsigned int threads);
+
+/**
+ * Restore the erased source units in frame_buf. Erased fec units are not restored.
+ *
+ * @param fec context to cache decoding matrices in or NULL to decode without caching
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_fec_decode(ChiakiFEC *fec, uint8_t *frame_buf, size_t unit_size, size_t stride, unsigned int k, unsigned int m, const unsigned int *erasures, size_t erasures_count);
+
+/**
+ * For incremental decoding, a received fec unit can be turned into a syndrome by subtracting
+ * each received source unit from it with this function as soon as both are there.
+ * What is left is a combination of only the erased source units.
+ *
+ * @param fec_unit index of the fec unit that syndrome belongs to, in [k, k + m)
+ * @param src_unit index of the source unit src, in [0, k)
+ */
+CHIAKI_EXPORT void chiaki_fec_syndrome_add(ChiakiFEC *fec, uint8_t *syndrome, const uint8_t *src, size_t unit_size, unsigned int k, unsigned int m, unsigned int fec_unit, unsigned int src_unit);
+
+/**
+ * Restore erased source units from as many syndromes, which only requires solving a count x count system.
+ *
+ * @param syndromes indices of the fec units in frame_buf that have been turned into syndromes
+ * @param erasures indices of the erased source units
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_fec_recover_from_syndromes(ChiakiFEC *fec, uint8_t *frame_buf, size_t unit_size, size_t stride, unsigned int k, unsigned int m, const unsigned int *syndromes, const unsigned int *erasures, size_t count);
 
 #ifdef __cplusplus
 }
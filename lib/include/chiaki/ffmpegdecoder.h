@@ -4,6 +4,8 @@
 #include <chiaki/config.h>
 #include <chiaki/log.h>
 #include <chiaki/thread.h>
+#include <chiaki/spscqueue.h>
+#include <chiaki/video.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -15,25 +17,90 @@ typedef struct chiaki_ffmpeg_decoder_t ChiakiFfmpegDecoder;
 
 typedef void (*ChiakiFfmpegFrameAvailable)(ChiakiFfmpegDecoder *decover, void *user);
 
+#define CHIAKI_FFMPEG_DECODER_QUEUE_SIZE_EXP 5
+#define CHIAKI_FFMPEG_DECODER_KEYFRAME_WAIT_MAX_MS 1000
+
+/**
+ * What to do when a packet does not fit into the decode queue anymore
+ */
+typedef enum
+{
+	/**
+	 * Drop the packet and everything after it until a keyframe arrives,
+	 * or CHIAKI_FFMPEG_DECODER_KEYFRAME_WAIT_MAX_MS have passed, so no frames are decoded from broken references.
+	 */
+	CHIAKI_FFMPEG_DECODER_DROP_UNTIL_KEYFRAME,
+
+	/**
+	 * Only drop the packet that did not fit.
+	 */
+	CHIAKI_FFMPEG_DECODER_DROP_PACKET
+} ChiakiFfmpegDecoderDropPolicy;
+
+typedef struct chiaki_ffmpeg_decoder_stats_t
+{
+	size_t queue_depth;
+	size_t queue_depth_max;
+	uint64_t packets_decoded;
+	uint64_t packets_dropped;
+	uint64_t frames_decoded;
+	uint64_t frames_replaced; // decoded frames that were replaced by a newer one before being pulled
+	uint64_t decode_time_avg_us; // per packet, moving average
+	uint64_t decode_time_max_us;
+} ChiakiFfmpegDecoderStats;
+
+/**
+ * Samples are passed from the video callbacks to an own decode thread through a lock-free queue,
+ * so decoding never blocks the thread receiving them.
+ */
 struct chiaki_ffmpeg_decoder_t
 {
 	ChiakiLog *log;
-	ChiakiMutex mutex;
+	ChiakiMutex mutex; // for frame_latest and stats
 	AVCodec *av_codec;
-	AVCodecContext *codec_context;
+	AVCodecContext *codec_context; // only used by the decode thread after init
 	enum AVPixelFormat hw_pix_fmt;
 	AVBufferRef *hw_device_ctx;
 	ChiakiMutex cb_mutex;
 	ChiakiFfmpegFrameAvailable frame_available_cb;
 	void *frame_available_cb_user;
+
+	ChiakiThread thread;
+	ChiakiSPSCQueue packet_queue; // elements are AVPacket *
+	ChiakiFfmpegDecoderDropPolicy drop_policy; // may be changed before any samples are passed
+	bool keyframe_wait; // dropping until the next keyframe
+	uint64_t keyframe_wait_start_ms;
+	AVFrame *frame_latest; // newest decoded frame that has not been pulled yet
+	ChiakiFfmpegDecoderStats stats;
+
+	// only used by the thread calling the video callbacks
+	AVBufferPool *packet_pool; // for samples assembled from parts
+	size_t packet_pool_buf_size;
+	bool chunks; // codec accepts slices as separate packets (AV_CODEC_FLAG2_CHUNKS)
+	uint8_t *slices_buf; // slices collected until the frame ends if !chunks
+	size_t slices_buf_size;
+	size_t slices_buf_len;
 };
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_ffmpeg_decoder_init(ChiakiFfmpegDecoder *decoder, ChiakiLog *log,
-		ChiakiCodec codec, const char *hw_decoder_name,
+		ChiakiCodec codec, const char *hw_decoder_name, bool slices,
 		ChiakiFfmpegFrameAvailable frame_available_cb, void *frame_available_cb_user);
 CHIAKI_EXPORT void chiaki_ffmpeg_decoder_fini(ChiakiFfmpegDecoder *decoder);
 CHIAKI_EXPORT bool chiaki_ffmpeg_decoder_video_sample_cb(uint8_t *buf, size_t buf_size, void *user);
+CHIAKI_EXPORT bool chiaki_ffmpeg_decoder_video_sample_iov_cb(ChiakiVideoSampleIOV *iov, size_t iov_count, void *user);
+
+/**
+ * ChiakiVideoSliceCallback, decoder must have been initialized with slices = true.
+ */
+CHIAKI_EXPORT bool chiaki_ffmpeg_decoder_video_slice_cb(ChiakiVideoSampleIOV *iov, size_t iov_count, bool frame_end, void *user);
+
+/**
+ * Take the newest decoded frame, older ones that have not been pulled in time are skipped.
+ * @return NULL if no new frame has been decoded since the last call
+ */
 CHIAKI_EXPORT AVFrame *chiaki_ffmpeg_decoder_pull_frame(ChiakiFfmpegDecoder *decoder);
+
+CHIAKI_EXPORT void chiaki_ffmpeg_decoder_get_stats(ChiakiFfmpegDecoder *decoder, ChiakiFfmpegDecoderStats *stats);
 CHIAKI_EXPORT enum AVPixelFormat chiaki_ffmpeg_decoder_get_pixel_format(ChiakiFfmpegDecoder *decoder);
 
 #ifdef __cplusplus
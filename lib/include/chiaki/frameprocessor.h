@@ -6,6 +6,8 @@
 #include "common.h"
 #include "takion.h"
 #include "packetstats.h"
+#include "fec.h"
+#include "video.h"
 
 #include <stdint.h>
 #include <stdbool.h>
@@ -38,10 +40,17 @@ typedef struct chiaki_frame_processor_t
 	unsigned int units_fec_expected;
 	unsigned int units_source_received;
 	unsigned int units_fec_received;
-	ChiakiFrameUnit *unit_slots;
-	size_t unit_slots_size;
+	ChiakiFrameUnit *unit_slots; // CHIAKI_FEC_UNITS_MAX entries, only valid where the bit in units_received_bitmap is set
+	size_t unit_slots_size; // units in the current frame
+	uint64_t units_received_bitmap[CHIAKI_FEC_UNITS_MAX / 64]; // received or recovered units of the current frame
+	uint64_t units_syndrome_bitmap[CHIAKI_FEC_UNITS_MAX / 64]; // fec units that have been turned into syndromes
+	uint64_t units_recovered_bitmap[CHIAKI_FEC_UNITS_MAX / 64]; // source units recovered incrementally that have not arrived since
 	bool flushed; // whether we have already flushed the current frame, i.e. are only interested in stats, not data.
 	ChiakiStreamStats stream_stats;
+	ChiakiFEC *fec; // not owned
+	bool fec_incremental; // recover missing source units while fec units arrive instead of on flush, true by default
+	unsigned int fec_syndromes_count; // fec units of the current frame that have been turned into syndromes
+	bool fec_recovered; // all missing source units of the current frame have already been recovered
 } ChiakiFrameProcessor;
 
 typedef enum chiaki_frame_flush_result_t {
@@ -51,9 +60,17 @@ typedef enum chiaki_frame_flush_result_t {
 	CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FAILED = 3
 } ChiakiFrameProcessorFlushResult;
 
-CHIAKI_EXPORT void chiaki_frame_processor_init(ChiakiFrameProcessor *frame_processor, ChiakiLog *log);
+/**
+ * @param fec FEC context to use, may be shared with other frame processors used from the same thread
+ */
+CHIAKI_EXPORT void chiaki_frame_processor_init(ChiakiFrameProcessor *frame_processor, ChiakiLog *log, ChiakiFEC *fec);
 CHIAKI_EXPORT void chiaki_frame_processor_fini(ChiakiFrameProcessor *frame_processor);
 
+/**
+ * Make sure frames of up to frame_buf_size bytes including fec units can be assembled without allocating.
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_frame_processor_reserve(ChiakiFrameProcessor *frame_processor, size_t frame_buf_size);
+
 CHIAKI_EXPORT void chiaki_frame_processor_report_packet_stats(ChiakiFrameProcessor *frame_processor, ChiakiPacketStats *packet_stats);
 CHIAKI_EXPORT ChiakiErrorCode chiaki_frame_processor_alloc_frame(ChiakiFrameProcessor *frame_processor, ChiakiTakionAVPacket *packet);
 CHIAKI_EXPORT ChiakiErrorCode chiaki_frame_processor_put_unit(ChiakiFrameProcessor *frame_processor, ChiakiTakionAVPacket *packet);
@@ -64,6 +81,21 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_frame_processor_put_unit(ChiakiFrameProcess
  */
 CHIAKI_EXPORT ChiakiFrameProcessorFlushResult chiaki_frame_processor_flush(ChiakiFrameProcessor *frame_processor, uint8_t **frame, size_t *frame_size);
 
+/**
+ * Like chiaki_frame_processor_flush(), but instead of compacting the frame in place, return its parts as they are in the internal buffer.
+ *
+ * @param iov array of at least CHIAKI_FEC_UNITS_MAX elements, receives pointers into the internal buffer of frame_processor, with the same lifetime as for chiaki_frame_processor_flush()
+ * @param iov_count receives the number of elements written to iov
+ * @param frame_size receives the total size of all parts
+ */
+CHIAKI_EXPORT ChiakiFrameProcessorFlushResult chiaki_frame_processor_flush_iov(ChiakiFrameProcessor *frame_processor, ChiakiVideoSampleIOV *iov, size_t *iov_count, size_t *frame_size);
+
+/**
+ * @return payload of source unit i of the current frame without its 2-byte prefix, or NULL if it has not arrived (or been recovered) yet.
+ * Valid until the frame is flushed.
+ */
+CHIAKI_EXPORT uint8_t *chiaki_frame_processor_source_unit(ChiakiFrameProcessor *frame_processor, unsigned int i, size_t *size);
+
 static inline bool chiaki_frame_processor_flush_possible(ChiakiFrameProcessor *frame_processor)
 {
 	return frame_processor->units_source_received + frame_processor->units_fec_received
@@ -14,28 +14,57 @@
 extern "C" {
 #endif
 
+#ifdef CHIAKI_LIB_ENABLE_MBEDTLS
+#include "mbedtls/aes.h"
+#include "mbedtls/gcm.h"
+#endif
+
 #define CHIAKI_GKCRYPT_BLOCK_SIZE 0x10
 #define CHIAKI_GKCRYPT_KEY_BUF_BLOCKS_DEFAULT 0x20 // 2MB
 #define CHIAKI_GKCRYPT_GMAC_SIZE 4
 #define CHIAKI_GKCRYPT_GMAC_KEY_REFRESH_KEY_POS 45000
 #define CHIAKI_GKCRYPT_GMAC_KEY_REFRESH_IV_OFFSET 44910
+#define CHIAKI_GKCRYPT_GMAC_KEY_CACHE_SIZE 4
 
 typedef struct chiaki_key_state_t
 {
    uint64_t prev;
 } ChiakiKeyState;
 
+/**
+ * Context keyed with a gmac key older than the current one, for late packets.
+ */
+typedef struct chiaki_gkcrypt_gmac_key_cache_entry_t
+{
+	uint64_t key_index;
+	uint64_t last_used; // 0 if the entry is unused
+#ifdef CHIAKI_LIB_ENABLE_MBEDTLS
+	mbedtls_gcm_context ctx;
+#else
+	struct evp_cipher_ctx_st *ctx;
+#endif
+} ChiakiGKCryptGMACKeyCacheEntry;
+
 typedef struct chiaki_gkcrypt_t {
 	uint8_t index;
 
-	uint8_t *key_buf; // circular buffer of the ctr mode key stream
+	/*
+	 * Circular buffer of the ctr mode key stream, key pos p is at key_buf[p % key_buf_size].
+	 * Lock-free with key_buf_thread as the single producer and the (serialized) callers
+	 * of chiaki_gkcrypt_decrypt()/chiaki_gkcrypt_get_key_stream() as the single consumer.
+	 */
+	uint8_t *key_buf;
 	size_t key_buf_size;
-	size_t key_buf_populated; // size of key_buf that is already populated (on startup)
-	uint64_t key_buf_key_pos_min; // minimal key pos currently in key_buf
-	size_t key_buf_start_offset; // offset in key_buf of the minimal key pos
-	uint64_t last_key_pos;        // last key pos that has been requested
-	bool key_buf_thread_stop;
-	ChiakiMutex key_buf_mutex;
+	volatile uint64_t key_buf_start; // first valid key pos, written by the producer
+	volatile uint64_t key_buf_head; // end of the valid key stream, written by the producer
+	volatile uint64_t key_buf_read_min; // the producer may overwrite everything below this, written by the consumer
+	volatile uint64_t last_key_pos; // end of the highest key stream requested, written by the consumer
+	volatile uint64_t key_buf_refill_threshold; // wake the producer when less is left ahead, adapted to the consumption rate
+	volatile uint32_t key_buf_thread_waiting;
+	volatile uint32_t key_buf_thread_stop;
+	uint64_t key_buf_misses; // requests beyond the head, i.e. the producer was too slow
+	uint64_t key_buf_late; // requests below key_buf_read_min, e.g. for very late packets
+	ChiakiMutex key_buf_mutex; // only for sleeping and waking key_buf_thread
 	ChiakiCond key_buf_cond;
 	ChiakiThread key_buf_thread;
 
@@ -44,6 +73,23 @@ typedef struct chiaki_gkcrypt_t {
 	uint8_t key_gmac_base[CHIAKI_GKCRYPT_BLOCK_SIZE];
 	uint8_t key_gmac_current[CHIAKI_GKCRYPT_BLOCK_SIZE];
 	uint64_t key_gmac_index_current;
+
+	// persistent cipher contexts, so the key schedule is not redone for every packet
+	bool ctxs_ready; // false if not set up by chiaki_gkcrypt_init()
+	ChiakiMutex ctx_mutex; // protects key_stream_ctx, gmac_ctx, gmac_key_cache and the current gmac key
+#ifdef CHIAKI_LIB_ENABLE_MBEDTLS
+	mbedtls_aes_context key_stream_ctx;
+	mbedtls_aes_context key_stream_thread_ctx; // only used by key_buf_thread
+	mbedtls_gcm_context gmac_ctx;
+#else
+	struct evp_cipher_ctx_st *key_stream_ctx;
+	struct evp_cipher_ctx_st *key_stream_thread_ctx; // only used by key_buf_thread
+	struct evp_cipher_ctx_st *gmac_ctx;
+#endif
+	uint64_t gmac_ctx_key_index; // index of the gmac key that gmac_ctx is currently keyed with
+	ChiakiGKCryptGMACKeyCacheEntry gmac_key_cache[CHIAKI_GKCRYPT_GMAC_KEY_CACHE_SIZE]; // LRU
+	uint64_t gmac_key_cache_clock;
+
 	ChiakiLog *log;
 } ChiakiGKCrypt;
 
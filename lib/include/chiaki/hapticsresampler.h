@@ -0,0 +1,48 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_HAPTICSRESAMPLER_H
+#define CHIAKI_HAPTICSRESAMPLER_H
+
+#include "common.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIAKI_HAPTICS_RESAMPLER_RATE_IN 3000
+#define CHIAKI_HAPTICS_RESAMPLER_RATE_OUT 48000
+#define CHIAKI_HAPTICS_RESAMPLER_FACTOR (CHIAKI_HAPTICS_RESAMPLER_RATE_OUT / CHIAKI_HAPTICS_RESAMPLER_RATE_IN)
+#define CHIAKI_HAPTICS_RESAMPLER_TAPS 8 // per phase, at the input rate
+#define CHIAKI_HAPTICS_RESAMPLER_CHUNK 32 // input frames processed at once
+#define CHIAKI_HAPTICS_RESAMPLER_CHANNELS_OUT 4
+
+/**
+ * Upsamples the stereo 3 kHz haptics stream to 48 kHz with a fixed polyphase FIR filter.
+ *
+ * The last input frames are carried over between calls, so the output is continuous
+ * no matter how the stream is split into frames.
+ */
+typedef struct chiaki_haptics_resampler_t
+{
+	// per channel: the last TAPS - 1 samples of the previous call, followed by the current chunk
+	int16_t hist[2][CHIAKI_HAPTICS_RESAMPLER_TAPS - 1 + CHIAKI_HAPTICS_RESAMPLER_CHUNK];
+} ChiakiHapticsResampler;
+
+CHIAKI_EXPORT void chiaki_haptics_resampler_init(ChiakiHapticsResampler *resampler);
+
+/**
+ * @param buf haptics as received from the console, interleaved stereo signed 16 bit little endian
+ * @param out buf_size / 4 * CHIAKI_HAPTICS_RESAMPLER_FACTOR frames of CHIAKI_HAPTICS_RESAMPLER_CHANNELS_OUT channels,
+ * laid out as the DualSense expects with silence on the first two channels and the haptics on the last two
+ * @return number of frames written to out
+ */
+CHIAKI_EXPORT size_t chiaki_haptics_resampler_process(ChiakiHapticsResampler *resampler, const uint8_t *buf, size_t buf_size, int16_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_HAPTICSRESAMPLER_H
@@ -7,6 +7,7 @@
 #if CHIAKI_LIB_ENABLE_OPUS
 
 #include "audioreceiver.h"
+#include "audiojitterbuffer.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -22,6 +23,7 @@ typedef struct chiaki_opus_decoder_t
 	ChiakiAudioHeader audio_header;
 	int16_t *pcm_buf;
 	size_t pcm_buf_size;
+	ChiakiAudioJitterBuffer jitter_buffer; // only used with frames from the indexed sink callback
 
 	ChiakiOpusDecoderSettingsCallback settings_cb;
 	ChiakiOpusDecoderFrameCallback frame_cb;
@@ -0,0 +1,88 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_PACKETPOOL_H
+#define CHIAKI_PACKETPOOL_H
+
+#include "common.h"
+#include "log.h"
+#include "thread.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Capacity of a single packet buffer, enough for any datagram on the stream connection.
+ */
+#define CHIAKI_PACKET_BUF_SIZE 1500
+
+typedef struct chiaki_packet_pool_t ChiakiPacketPool;
+
+/**
+ * Refcounted buffer holding a single received datagram.
+ * Returned to its pool when the last reference is released.
+ */
+typedef struct chiaki_packet_buf_t
+{
+	ChiakiPacketPool *pool;
+	struct chiaki_packet_buf_t *next_free;
+	volatile uint32_t refs; // only modified atomically
+	size_t size; // number of valid bytes in data
+	uint8_t *data; // CHIAKI_PACKET_BUF_SIZE bytes, inside the pool's slab
+} ChiakiPacketBuf;
+
+/**
+ * Fixed-size pool of packet buffers, allocated as one slab at init.
+ */
+struct chiaki_packet_pool_t
+{
+	ChiakiLog *log;
+	uint8_t *slab;
+	ChiakiPacketBuf *bufs;
+	size_t bufs_count;
+
+	ChiakiMutex mutex;
+	ChiakiPacketBuf *free_list;
+	size_t free_count;
+	size_t free_count_min; // low watermark since init
+	uint64_t exhausted_count; // number of failed acquires
+};
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_packet_pool_init(ChiakiPacketPool *pool, ChiakiLog *log, size_t bufs_count);
+
+/**
+ * All buffers must have been released before.
+ */
+CHIAKI_EXPORT void chiaki_packet_pool_fini(ChiakiPacketPool *pool);
+
+/**
+ * @return a buffer holding one reference with size 0 or NULL if the pool is exhausted
+ */
+CHIAKI_EXPORT ChiakiPacketBuf *chiaki_packet_pool_acquire(ChiakiPacketPool *pool);
+
+CHIAKI_EXPORT void chiaki_packet_buf_ref(ChiakiPacketBuf *buf);
+
+/**
+ * Release one reference, returning buf to its pool if it was the last one.
+ */
+CHIAKI_EXPORT void chiaki_packet_buf_unref(ChiakiPacketBuf *buf);
+
+/**
+ * @return whether the caller holds the only reference to buf
+ */
+CHIAKI_EXPORT bool chiaki_packet_buf_is_unique(ChiakiPacketBuf *buf);
+
+/**
+ * Log memory usage and exhaustion statistics of the pool.
+ */
+CHIAKI_EXPORT void chiaki_packet_pool_log_stats(ChiakiPacketPool *pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_PACKETPOOL_H
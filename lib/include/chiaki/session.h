@@ -12,6 +12,7 @@
 #include "takion.h"
 #include "ecdh.h"
 #include "audio.h"
+#include "video.h"
 #include "controller.h"
 #include "stoppipe.h"
 
@@ -79,6 +80,8 @@ typedef struct chiaki_connect_info_t
 	bool video_profile_auto_downgrade; // Downgrade video_profile if server does not seem to support it.
 	bool enable_keyboard;
 	bool enable_dualsense;
+	unsigned int fec_threads; // Additional threads for recovering large video frames, 0 to disable. At most CHIAKI_FEC_THREADS_MAX.
+	unsigned int video_frame_deadline_ms; // How long to wait for missing units of a video frame after its first packet, 0 to derive it from the frame rate and measured jitter.
 } ChiakiConnectInfo;
 
 
@@ -171,6 +174,23 @@ typedef void (*ChiakiEventCallback)(ChiakiEvent *event, void *user);
  */
 typedef bool (*ChiakiVideoSampleCallback)(uint8_t *buf, size_t buf_size, void *user);
 
+/**
+ * Alternative to ChiakiVideoSampleCallback that gets the sample as a list of parts to be concatenated,
+ * saving the copy needed to make it contiguous.
+ * The parts are only valid during the call and have no padding.
+ * @return same as for ChiakiVideoSampleCallback
+ */
+typedef bool (*ChiakiVideoSampleIOVCallback)(ChiakiVideoSampleIOV *iov, size_t iov_count, void *user);
+
+/**
+ * Low-latency alternative to ChiakiVideoSampleCallback that gets each frame in several pieces as soon as they have arrived in order.
+ * Every piece except the last ends right before an Annex-B start code, so it only contains whole NAL units.
+ * The last piece of a frame has frame_end set and may be empty, e.g. if the rest of the frame was lost.
+ * The parts are only valid during the call and have no padding.
+ * @return false if the piece could not be processed, which marks the whole frame as corrupt.
+ */
+typedef bool (*ChiakiVideoSliceCallback)(ChiakiVideoSampleIOV *iov, size_t iov_count, bool frame_end, void *user);
+
 
 
 typedef struct chiaki_session_t
@@ -188,6 +208,8 @@ typedef struct chiaki_session_t
 		bool video_profile_auto_downgrade;
 		bool enable_keyboard;
 		bool enable_dualsense;
+		unsigned int fec_threads;
+		unsigned int video_frame_deadline_ms;
 	} connect_info;
 
 	ChiakiTarget target;
@@ -208,6 +230,10 @@ typedef struct chiaki_session_t
 	void *event_cb_user;
 	ChiakiVideoSampleCallback video_sample_cb;
 	void *video_sample_cb_user;
+	ChiakiVideoSampleIOVCallback video_sample_iov_cb;
+	void *video_sample_iov_cb_user;
+	ChiakiVideoSliceCallback video_slice_cb;
+	void *video_slice_cb_user;
 	ChiakiAudioSink audio_sink;
 	ChiakiAudioSink haptics_sink;
 
@@ -257,6 +283,24 @@ static inline void chiaki_session_set_video_sample_cb(ChiakiSession *session, Ch
 	session->video_sample_cb_user = user;
 }
 
+/**
+ * If set, used instead of the callback from chiaki_session_set_video_sample_cb()
+ */
+static inline void chiaki_session_set_video_sample_iov_cb(ChiakiSession *session, ChiakiVideoSampleIOVCallback cb, void *user)
+{
+	session->video_sample_iov_cb = cb;
+	session->video_sample_iov_cb_user = user;
+}
+
+/**
+ * If set, used instead of the callbacks from chiaki_session_set_video_sample_cb() and chiaki_session_set_video_sample_iov_cb()
+ */
+static inline void chiaki_session_set_video_slice_cb(ChiakiSession *session, ChiakiVideoSliceCallback cb, void *user)
+{
+	session->video_slice_cb = cb;
+	session->video_slice_cb_user = user;
+}
+
 /**
  * @param sink contents are copied
  */
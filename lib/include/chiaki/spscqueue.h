@@ -0,0 +1,103 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_SPSCQUEUE_H
+#define CHIAKI_SPSCQUEUE_H
+
+#include "common.h"
+#include "thread.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIAKI_SPSC_QUEUE_CACHE_LINE_SIZE 64
+
+typedef struct chiaki_spsc_queue_stats_t
+{
+	uint64_t pushed;
+	uint64_t dropped; // pushes that failed because the queue was full or closed
+	size_t depth_max;
+} ChiakiSPSCQueueStats;
+
+/**
+ * Bounded lock-free queue of fixed-size elements for exactly one producer and one consumer thread.
+ *
+ * Pushing never blocks. The consumer may block in chiaki_spsc_queue_pop_wait(), which is
+ * the only place a mutex is taken, and only when the queue is empty.
+ */
+typedef struct chiaki_spsc_queue_t
+{
+	uint8_t *elems;
+	size_t elem_size;
+	uint32_t mask;
+
+	// indices are free-running and only masked on access
+	volatile uint32_t head; // written by the producer only
+	uint8_t pad_head[CHIAKI_SPSC_QUEUE_CACHE_LINE_SIZE - sizeof(uint32_t)];
+	volatile uint32_t tail; // written by the consumer only
+	uint8_t pad_tail[CHIAKI_SPSC_QUEUE_CACHE_LINE_SIZE - sizeof(uint32_t)];
+
+	volatile uint32_t consumer_waiting;
+	volatile uint32_t closed;
+	ChiakiMutex mutex;
+	ChiakiCond cond;
+
+	// written by the producer only
+	uint64_t pushed;
+	uint64_t dropped;
+	size_t depth_max;
+} ChiakiSPSCQueue;
+
+/**
+ * @param size_exp the queue holds 2^size_exp elements
+ * @param elem_size size of a single element in bytes
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_spsc_queue_init(ChiakiSPSCQueue *queue, size_t size_exp, size_t elem_size);
+CHIAKI_EXPORT void chiaki_spsc_queue_fini(ChiakiSPSCQueue *queue);
+
+/**
+ * Producer only. Copies elem into the queue.
+ *
+ * @return false if the queue is full or closed, in which case the caller keeps ownership of elem
+ */
+CHIAKI_EXPORT bool chiaki_spsc_queue_push(ChiakiSPSCQueue *queue, const void *elem);
+
+/**
+ * Consumer only. Never blocks.
+ *
+ * @return false if the queue is empty
+ */
+CHIAKI_EXPORT bool chiaki_spsc_queue_pop(ChiakiSPSCQueue *queue, void *elem);
+
+/**
+ * Consumer only. Wait until an element is available.
+ *
+ * @return CHIAKI_ERR_SUCCESS if an element was popped, CHIAKI_ERR_TIMEOUT or CHIAKI_ERR_CANCELED if the queue is closed and empty
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_spsc_queue_pop_wait(ChiakiSPSCQueue *queue, void *elem, uint64_t timeout_ms);
+
+/**
+ * Reject all further pushes and wake up the consumer.
+ * Elements that are still queued can be popped afterwards.
+ */
+CHIAKI_EXPORT void chiaki_spsc_queue_close(ChiakiSPSCQueue *queue);
+
+/**
+ * Number of queued elements, may be called from any thread.
+ */
+CHIAKI_EXPORT size_t chiaki_spsc_queue_depth(ChiakiSPSCQueue *queue);
+
+/**
+ * Read the statistics. Only consistent if called from the producer or after it has finished.
+ */
+CHIAKI_EXPORT void chiaki_spsc_queue_get_stats(ChiakiSPSCQueue *queue, ChiakiSPSCQueueStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_SPSCQUEUE_H
@@ -32,6 +32,13 @@ typedef struct chiaki_stop_pipe_t
 	// this fd is audited by 'select' as
 	// fd_set *readfds
 	int fd;
+#elif defined(__linux__)
+	// eventfd signaling the stop, always registered in epoll_fd
+	int event_fd;
+	int epoll_fd;
+	// socket persistently registered in epoll_fd by chiaki_stop_pipe_register()
+	chiaki_socket_t registered_fd;
+	bool registered_write;
 #else
 	int fds[2];
 #endif
@@ -43,6 +50,14 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_stop_pipe_init(ChiakiStopPipe *stop_pipe);
 CHIAKI_EXPORT void chiaki_stop_pipe_fini(ChiakiStopPipe *stop_pipe);
 CHIAKI_EXPORT void chiaki_stop_pipe_stop(ChiakiStopPipe *stop_pipe);
 CHIAKI_EXPORT ChiakiErrorCode chiaki_stop_pipe_select_single(ChiakiStopPipe *stop_pipe, chiaki_socket_t fd, bool write, uint64_t timeout_ms);
+/**
+ * Register fd to be watched persistently, so subsequent calls to chiaki_stop_pipe_select_single() with the same fd and write
+ * don't have to set it up again every time. Only one fd can be registered at a time, registering another one replaces it.
+ * fd must stay open until chiaki_stop_pipe_unregister() or chiaki_stop_pipe_fini() is called.
+ * Without epoll support, this does nothing.
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_stop_pipe_register(ChiakiStopPipe *stop_pipe, chiaki_socket_t fd, bool write);
+CHIAKI_EXPORT void chiaki_stop_pipe_unregister(ChiakiStopPipe *stop_pipe);
 /**
  * Like connect(), but can be canceled by the stop pipe. Only makes sense with a non-blocking socket.
  */
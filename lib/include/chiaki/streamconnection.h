@@ -34,6 +34,18 @@ typedef struct chiaki_stream_connection_t
 	ChiakiVideoReceiver *video_receiver;
 	ChiakiAudioReceiver *haptics_receiver;
 
+	/**
+	 * Receive buffers of the whole stream, shared with takion
+	 */
+	ChiakiPacketPool packet_pool;
+
+	/**
+	 * Decrypted AV packets on their way from the Takion processing thread to av_thread,
+	 * which runs the receivers above, including FEC and the audio/video sinks.
+	 */
+	ChiakiSPSCQueue av_queue;
+	ChiakiThread av_thread;
+
 	ChiakiFeedbackSender feedback_sender;
 	/**
 	 * whether feedback_sender is initialized
@@ -12,6 +12,9 @@
 #include "reorderqueue.h"
 #include "feedback.h"
 #include "takionsendbuffer.h"
+#include "packetpool.h"
+#include "spscqueue.h"
+#include "avadmission.h"
 
 #include <stdbool.h>
 
@@ -50,6 +53,11 @@ typedef struct chiaki_takion_av_packet_t
 
 	uint8_t *data; // not owned
 	size_t data_size;
+
+	/**
+	 * Pool buffer containing data, may be kept beyond the callback by taking a reference with chiaki_packet_buf_ref().
+	 */
+	ChiakiPacketBuf *buf;
 } ChiakiTakionAVPacket;
 
 static inline uint8_t chiaki_takion_av_packet_audio_unit_size(ChiakiTakionAVPacket *packet)				{ return packet->units_in_frame_fec >> 8; }
@@ -108,6 +116,13 @@ typedef struct chiaki_takion_connect_info_t
 	bool enable_crypt;
 	bool enable_dualsense;
 	uint8_t protocol_version;
+
+	/**
+	 * Optional pool to receive into, which must outlive the Takion.
+	 * Useful if packets are kept by the owner beyond chiaki_takion_close().
+	 * If NULL, the Takion creates its own.
+	 */
+	ChiakiPacketPool *packet_pool;
 } ChiakiTakionConnectInfo;
 
 
@@ -141,13 +156,27 @@ typedef struct chiaki_takion_t
 
 	ChiakiGKCrypt *gkcrypt_remote; // if NULL (default), remote gmacs are IGNORED (!) and everything is expected to be unencrypted
 
-	ChiakiReorderQueue data_queue;
+	/**
+	 * All received datagrams live in buffers of this pool, so it accounts for the whole receive buffer memory.
+	 * Either points to packet_pool_own or the pool given in ChiakiTakionConnectInfo.
+	 */
+	ChiakiPacketPool *packet_pool;
+	ChiakiPacketPool packet_pool_own;
+
+	/**
+	 * Received packets on their way from the receiving thread to the processing thread.
+	 * Elements are ChiakiPacketBuf *, each holding a reference.
+	 */
+	ChiakiSPSCQueue rx_queue;
+
+	ChiakiReorderQueue data_queue; // elements are ChiakiPacketBuf *
 	ChiakiTakionSendBuffer send_buffer;
 
 	ChiakiTakionCallback cb;
 	void *cb_user;
 	chiaki_socket_t sock;
-	ChiakiThread thread;
+	ChiakiThread thread; // receives packets
+	ChiakiThread proc_thread; // handles packets and calls cb
 	ChiakiStopPipe stop_pipe;
 	uint32_t tag_local;
 	uint32_t tag_remote;
@@ -164,6 +193,8 @@ typedef struct chiaki_takion_t
 
 	ChiakiKeyState key_state;
 
+	ChiakiAVAdmission av_admission; // only used by the processing thread
+
 	bool enable_dualsense;
 } ChiakiTakion;
 
@@ -172,7 +203,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_connect(ChiakiTakion *takion, Chiaki
 CHIAKI_EXPORT void chiaki_takion_close(ChiakiTakion *takion);
 
 /**
- * Must be called from within the Takion thread, i.e. inside the callback!
+ * Must be called from within the Takion processing thread, i.e. inside the callback!
  */
 static inline void chiaki_takion_set_crypt(ChiakiTakion *takion, ChiakiGKCrypt *gkcrypt_local, ChiakiGKCrypt *gkcrypt_remote)
 {
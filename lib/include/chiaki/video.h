@@ -18,6 +18,15 @@ typedef struct chiaki_video_profile_t
 	uint8_t *header;
 } ChiakiVideoProfile;
 
+/**
+ * One contiguous part of a video sample delivered in pieces
+ */
+typedef struct chiaki_video_sample_iov_t
+{
+	uint8_t *buf;
+	size_t size;
+} ChiakiVideoSampleIOV;
+
 /**
  * Padding for FFMPEG
  */
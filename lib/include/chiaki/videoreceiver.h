@@ -15,6 +15,28 @@ extern "C" {
 
 #define CHIAKI_VIDEO_PROFILES_MAX 8
 
+/**
+ * Number of frames that can be assembled at the same time, must be a power of 2.
+ */
+#define CHIAKI_VIDEO_RECEIVER_FRAMES_MAX 4
+
+typedef struct chiaki_video_receiver_frame_t
+{
+	int32_t frame_index; // < 0 if the slot has never been used
+	bool flushed; // delivered or given up, only receives late units for stats now
+	bool assembled; // all units needed to flush have arrived
+	uint64_t first_packet_ms;
+
+	// early delivery of slices, only if the session has a video_slice_cb
+	unsigned int slice_units; // source units from the start of the frame that have been scanned for start codes
+	size_t slice_scanned; // payload bytes in those units
+	unsigned int slice_zeros; // zero bytes at the end of the scanned data, at most 3
+	size_t slice_cut; // offset of the last start code found
+	size_t slice_delivered; // bytes already passed to the slice callback
+	bool slice_failed; // slice callback returned false for this frame
+	ChiakiFrameProcessor frame_processor;
+} ChiakiVideoReceiverFrame;
+
 typedef struct chiaki_video_receiver_t
 {
 	struct chiaki_session_t *session;
@@ -23,10 +45,21 @@ typedef struct chiaki_video_receiver_t
 	size_t profiles_count;
 	int profile_cur; // < 1 if no profile selected yet, else index in profiles
 
-	int32_t frame_index_cur; // frame that is currently being filled
+	int32_t frame_index_next; // next frame to be delivered, < 0 before the first packet
 	int32_t frame_index_prev; // last frame that has been at least partially decoded
-	int32_t frame_index_prev_complete; // last frame that has been completely decoded
-	ChiakiFrameProcessor frame_processor;
+	int32_t frame_index_prev_complete; // last frame that has been completely decoded or already reported as corrupt
+
+	double frame_interval_ms;
+	uint64_t frame_deadline_fixed_ms; // from ChiakiConnectInfo, 0 for automatic
+	uint64_t frame_deadline_ms; // how long an incomplete frame may hold back the following ones after its first packet
+	double frame_assembly_avg_ms; // time from the first packet of a frame until it can be flushed
+	double frame_jitter_ms; // deviation of frame arrival times from the frame interval, as in RFC 3550
+	int32_t frame_arrival_prev_index;
+	uint64_t frame_arrival_prev_ms;
+	uint64_t frames_deadline_flushed;
+
+	ChiakiFEC fec; // shared by all frames
+	ChiakiVideoReceiverFrame frames[CHIAKI_VIDEO_RECEIVER_FRAMES_MAX]; // indexed by frame_index % CHIAKI_VIDEO_RECEIVER_FRAMES_MAX
 	ChiakiPacketStats *packet_stats;
 } ChiakiVideoReceiver;
 
@@ -44,6 +77,18 @@ CHIAKI_EXPORT void chiaki_video_receiver_stream_info(ChiakiVideoReceiver *video_
 
 CHIAKI_EXPORT void chiaki_video_receiver_av_packet(ChiakiVideoReceiver *video_receiver, ChiakiTakionAVPacket *packet);
 
+/**
+ * @return monotonic time in ms at which chiaki_video_receiver_flush_due() should be called if no packets arrive until then,
+ * UINT64_MAX if no frame is waiting
+ */
+CHIAKI_EXPORT uint64_t chiaki_video_receiver_next_deadline_ms(ChiakiVideoReceiver *video_receiver);
+
+/**
+ * Deliver all frames whose deadline has passed, whether they are complete or not.
+ * Must be called from the same thread as chiaki_video_receiver_av_packet().
+ */
+CHIAKI_EXPORT void chiaki_video_receiver_flush_due(ChiakiVideoReceiver *video_receiver, uint64_t now_ms);
+
 static inline ChiakiVideoReceiver *chiaki_video_receiver_new(struct chiaki_session_t *session, ChiakiPacketStats *packet_stats)
 {
 	ChiakiVideoReceiver *video_receiver = CHIAKI_NEW(ChiakiVideoReceiver);
@@ -0,0 +1,97 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_ATOMIC_UTILS_H
+#define CHIAKI_ATOMIC_UTILS_H
+
+#include <stdint.h>
+
+/*
+ * Minimal atomic helpers on plain integers, so that public structs
+ * stay usable from C++ and compilers without C11 atomics.
+ */
+
+#ifdef _MSC_VER
+#include <windows.h>
+#include <intrin.h>
+
+static inline uint32_t chiaki_atomic_add_32(volatile uint32_t *v, uint32_t a)
+{
+	return (uint32_t)_InterlockedExchangeAdd((volatile long *)v, (long)a) + a;
+}
+
+static inline uint32_t chiaki_atomic_sub_32(volatile uint32_t *v, uint32_t a)
+{
+	return (uint32_t)_InterlockedExchangeAdd((volatile long *)v, -(long)a) - a;
+}
+
+static inline uint32_t chiaki_atomic_load_32(volatile uint32_t *v)
+{
+	uint32_t r = *v;
+	_ReadWriteBarrier();
+	return r;
+}
+
+static inline void chiaki_atomic_store_32(volatile uint32_t *v, uint32_t val)
+{
+	_ReadWriteBarrier();
+	*v = val;
+}
+
+static inline uint64_t chiaki_atomic_load_64(volatile uint64_t *v)
+{
+	return (uint64_t)InterlockedCompareExchange64((volatile LONG64 *)v, 0, 0);
+}
+
+static inline void chiaki_atomic_store_64(volatile uint64_t *v, uint64_t val)
+{
+	InterlockedExchange64((volatile LONG64 *)v, (LONG64)val);
+}
+
+static inline void chiaki_atomic_fence(void)
+{
+	MemoryBarrier();
+}
+
+#else
+
+static inline uint32_t chiaki_atomic_add_32(volatile uint32_t *v, uint32_t a)
+{
+	return __atomic_add_fetch(v, a, __ATOMIC_ACQ_REL);
+}
+
+static inline uint32_t chiaki_atomic_sub_32(volatile uint32_t *v, uint32_t a)
+{
+	return __atomic_sub_fetch(v, a, __ATOMIC_ACQ_REL);
+}
+
+static inline uint32_t chiaki_atomic_load_32(volatile uint32_t *v)
+{
+	return __atomic_load_n(v, __ATOMIC_ACQUIRE);
+}
+
+static inline void chiaki_atomic_store_32(volatile uint32_t *v, uint32_t val)
+{
+	__atomic_store_n(v, val, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t chiaki_atomic_load_64(volatile uint64_t *v)
+{
+	return __atomic_load_n(v, __ATOMIC_ACQUIRE);
+}
+
+static inline void chiaki_atomic_store_64(volatile uint64_t *v, uint64_t val)
+{
+	__atomic_store_n(v, val, __ATOMIC_RELEASE);
+}
+
+/**
+ * Full barrier, e.g. between publishing data and checking whether the other side is sleeping.
+ */
+static inline void chiaki_atomic_fence(void)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+#endif
+
+#endif // CHIAKI_ATOMIC_UTILS_H
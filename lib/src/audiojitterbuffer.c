@@ -0,0 +1,159 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/audiojitterbuffer.h>
+
+#include <string.h>
+
+CHIAKI_EXPORT void chiaki_audio_jitter_buffer_init(ChiakiAudioJitterBuffer *jitter_buffer, uint64_t frame_duration_us)
+{
+	memset(jitter_buffer, 0, sizeof(*jitter_buffer));
+	jitter_buffer->frame_duration_us = frame_duration_us ? frame_duration_us : 1;
+	jitter_buffer->target_frames = 1;
+}
+
+static ChiakiAudioJitterBufferSlot *jitter_buffer_slot(ChiakiAudioJitterBuffer *jitter_buffer, ChiakiSeqNum16 frame_index)
+{
+	return &jitter_buffer->slots[frame_index & (CHIAKI_AUDIO_JITTER_BUFFER_SLOTS - 1)];
+}
+
+static bool jitter_buffer_has(ChiakiAudioJitterBuffer *jitter_buffer, ChiakiSeqNum16 frame_index)
+{
+	ChiakiAudioJitterBufferSlot *slot = jitter_buffer_slot(jitter_buffer, frame_index);
+	return slot->set && slot->frame_index == frame_index;
+}
+
+static void jitter_buffer_advance(ChiakiAudioJitterBuffer *jitter_buffer, ChiakiSeqNum16 frame_index_next)
+{
+	jitter_buffer->frame_index_next = frame_index_next;
+	jitter_buffer->gap_start_us = 0;
+}
+
+/**
+ * Called for the first frame of a packet that is newer than all previous ones.
+ */
+static void jitter_buffer_arrival(ChiakiAudioJitterBuffer *jitter_buffer, uint64_t now_us)
+{
+	uint64_t frame_duration_us = jitter_buffer->frame_duration_us;
+	// frames of the same packet arrive together, which is not jitter
+	if(jitter_buffer->arrival_prev_us && now_us - jitter_buffer->arrival_prev_us < frame_duration_us / 2)
+		return;
+
+	int64_t transit_us = (int64_t)now_us - jitter_buffer->frame_count_newest * (int64_t)frame_duration_us;
+	if(jitter_buffer->arrival_prev_us)
+	{
+		int64_t d = transit_us - jitter_buffer->transit_prev_us;
+		uint64_t d_abs = (uint64_t)(d < 0 ? -d : d);
+		if(d_abs > jitter_buffer->jitter_us)
+			jitter_buffer->jitter_us += (d_abs - jitter_buffer->jitter_us) / 16;
+		else
+			jitter_buffer->jitter_us -= (jitter_buffer->jitter_us - d_abs) / 16;
+
+		uint64_t target = (3 * jitter_buffer->jitter_us + frame_duration_us - 1) / frame_duration_us;
+		if(target < 1)
+			target = 1;
+		if(target > CHIAKI_AUDIO_JITTER_BUFFER_TARGET_MAX)
+			target = CHIAKI_AUDIO_JITTER_BUFFER_TARGET_MAX;
+		jitter_buffer->target_frames = (unsigned int)target;
+	}
+	jitter_buffer->transit_prev_us = transit_us;
+	jitter_buffer->arrival_prev_us = now_us;
+}
+
+CHIAKI_EXPORT bool chiaki_audio_jitter_buffer_put(ChiakiAudioJitterBuffer *jitter_buffer, ChiakiSeqNum16 frame_index,
+		const uint8_t *buf, size_t buf_size, uint64_t now_us)
+{
+	if(!buf_size || buf_size > CHIAKI_AUDIO_JITTER_BUFFER_FRAME_SIZE_MAX)
+		return false;
+
+	if(!jitter_buffer->started)
+	{
+		jitter_buffer->started = true;
+		jitter_buffer->frame_index_next = frame_index;
+		jitter_buffer->frame_index_newest = frame_index;
+		jitter_buffer_arrival(jitter_buffer, now_us);
+	}
+
+	if(chiaki_seq_num_16_lt(frame_index, jitter_buffer->frame_index_next))
+		return false; // played or given up on already
+
+	ChiakiSeqNum16 ahead = frame_index - jitter_buffer->frame_index_next;
+	if(ahead >= CHIAKI_AUDIO_JITTER_BUFFER_SLOTS)
+	{
+		// everything before the window is lost for good
+		ChiakiSeqNum16 frame_index_next = frame_index - (CHIAKI_AUDIO_JITTER_BUFFER_SLOTS - 1);
+		jitter_buffer->stats.frames_skipped += (ChiakiSeqNum16)(frame_index_next - jitter_buffer->frame_index_next);
+		jitter_buffer_advance(jitter_buffer, frame_index_next);
+	}
+
+	ChiakiAudioJitterBufferSlot *slot = jitter_buffer_slot(jitter_buffer, frame_index);
+	if(slot->set && slot->frame_index == frame_index)
+		return false;
+	slot->set = true;
+	slot->frame_index = frame_index;
+	slot->size = buf_size;
+	memcpy(slot->buf, buf, buf_size);
+
+	if(chiaki_seq_num_16_gt(frame_index, jitter_buffer->frame_index_newest))
+	{
+		jitter_buffer->frame_count_newest += (ChiakiSeqNum16)(frame_index - jitter_buffer->frame_index_newest);
+		jitter_buffer->frame_index_newest = frame_index;
+		jitter_buffer_arrival(jitter_buffer, now_us);
+	}
+	return true;
+}
+
+CHIAKI_EXPORT ChiakiAudioJitterBufferOut chiaki_audio_jitter_buffer_pop(ChiakiAudioJitterBuffer *jitter_buffer, uint64_t now_us,
+		const uint8_t **buf, size_t *buf_size)
+{
+	if(!jitter_buffer->started)
+		return CHIAKI_AUDIO_JITTER_BUFFER_OUT_NONE;
+
+	ChiakiSeqNum16 frame_index = jitter_buffer->frame_index_next;
+	ChiakiAudioJitterBufferSlot *slot = jitter_buffer_slot(jitter_buffer, frame_index);
+	if(slot->set && slot->frame_index == frame_index)
+	{
+		slot->set = false;
+		*buf = slot->buf;
+		*buf_size = slot->size;
+		jitter_buffer_advance(jitter_buffer, frame_index + 1);
+		jitter_buffer->concealing = false;
+		jitter_buffer->stats.frames_played++;
+		return CHIAKI_AUDIO_JITTER_BUFFER_OUT_FRAME;
+	}
+
+	// missing, but maybe it is only late
+	if(!chiaki_seq_num_16_gt(jitter_buffer->frame_index_newest, frame_index))
+		return CHIAKI_AUDIO_JITTER_BUFFER_OUT_NONE;
+	if(!jitter_buffer->gap_start_us)
+		jitter_buffer->gap_start_us = now_us;
+	ChiakiSeqNum16 newer = jitter_buffer->frame_index_newest - frame_index;
+	if(!jitter_buffer->concealing
+		&& newer <= jitter_buffer->target_frames
+		&& now_us - jitter_buffer->gap_start_us < jitter_buffer->target_frames * jitter_buffer->frame_duration_us)
+		return CHIAKI_AUDIO_JITTER_BUFFER_OUT_NONE;
+
+	ChiakiSeqNum16 gap = 1;
+	while(gap < newer && !jitter_buffer_has(jitter_buffer, frame_index + gap))
+		gap++;
+	if(gap > CHIAKI_AUDIO_JITTER_BUFFER_CONCEAL_MAX)
+	{
+		// continue right with the next frame that is there
+		jitter_buffer->stats.frames_skipped += gap;
+		jitter_buffer_advance(jitter_buffer, frame_index + gap);
+		return chiaki_audio_jitter_buffer_pop(jitter_buffer, now_us, buf, buf_size);
+	}
+
+	jitter_buffer_advance(jitter_buffer, frame_index + 1);
+	jitter_buffer->concealing = true;
+	if(gap == 1)
+	{
+		// the next frame may carry in-band fec for this one
+		ChiakiAudioJitterBufferSlot *next = jitter_buffer_slot(jitter_buffer, frame_index + 1);
+		*buf = next->buf;
+		*buf_size = next->size;
+		jitter_buffer->stats.frames_fec++;
+		return CHIAKI_AUDIO_JITTER_BUFFER_OUT_FEC;
+	}
+	jitter_buffer->stats.frames_plc++;
+	return CHIAKI_AUDIO_JITTER_BUFFER_OUT_PLC;
+}
@@ -85,8 +85,10 @@ CHIAKI_EXPORT void chiaki_audio_receiver_av_packet(ChiakiAudioReceiver *audio_re
 	if(packet->frame_index > (1 << 15))
 		audio_receiver->frame_index_startup = false;
 
-	for(size_t i = 0; i < source_units_count + fec_units_count; i++)
+	// fec units carry the frames before the source units, pass them first to keep everything in order
+	for(size_t j = 0; j < source_units_count + fec_units_count; j++)
 	{
+		size_t i = (j + source_units_count) % (source_units_count + fec_units_count);
 		ChiakiSeqNum16 frame_index;
 		if(i < source_units_count)
 			frame_index = packet->frame_index + i;
@@ -113,6 +115,14 @@ static void chiaki_audio_receiver_frame(ChiakiAudioReceiver *audio_receiver, Chi
 {
 	chiaki_mutex_lock(&audio_receiver->mutex);
 
+	ChiakiAudioSink *audio_sink = &audio_receiver->session->audio_sink;
+	if(!is_haptics && audio_sink->frame_indexed_cb)
+	{
+		// the sink filters by itself
+		audio_sink->frame_indexed_cb(buf, buf_size, frame_index, audio_sink->user);
+		goto beach;
+	}
+
 	if(!chiaki_seq_num_16_gt(frame_index, audio_receiver->frame_index_prev))
 		goto beach;
 	audio_receiver->frame_index_prev = frame_index;
@@ -0,0 +1,168 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/audioring.h>
+
+#include "atomic_utils.h"
+
+#include <string.h>
+
+#define FILL_AVG_WEIGHT (1.0 / 32.0)
+#define RATIO_MAX (CHIAKI_AUDIO_RING_RATIO_MAX_PPM / 1000000.0)
+#define GAIN_P RATIO_MAX // full correction when the fill is twice the target
+#define GAIN_I 5e-8 // per frame read, slow enough not to oscillate with the fill average
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_audio_ring_init(ChiakiAudioRing *ring, size_t channels, size_t size_exp, size_t target_frames)
+{
+	if(!channels || channels > CHIAKI_AUDIO_RING_CHANNELS_MAX || size_exp > 24)
+		return CHIAKI_ERR_INVALID_DATA;
+
+	memset(ring, 0, sizeof(*ring));
+	ring->channels = channels;
+	ring->mask = (1u << size_exp) - 1;
+	ring->priming = true;
+	ring->phase = -1.0;
+	chiaki_audio_ring_set_target(ring, target_frames);
+
+	ring->buf = malloc(((size_t)1 << size_exp) * channels * sizeof(int16_t));
+	if(!ring->buf)
+		return CHIAKI_ERR_MEMORY;
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT void chiaki_audio_ring_fini(ChiakiAudioRing *ring)
+{
+	free(ring->buf);
+}
+
+CHIAKI_EXPORT size_t chiaki_audio_ring_push(ChiakiAudioRing *ring, const int16_t *pcm, size_t frames_count)
+{
+	uint32_t head = ring->head;
+	uint32_t tail = chiaki_atomic_load_32(&ring->tail);
+	size_t free_frames = (size_t)ring->mask + 1 - (size_t)(head - tail);
+	size_t pushed = frames_count < free_frames ? frames_count : free_frames;
+
+	// copy in up to two parts around the end of the buffer
+	size_t offset = head & ring->mask;
+	size_t first = (size_t)ring->mask + 1 - offset;
+	if(first > pushed)
+		first = pushed;
+	memcpy(ring->buf + offset * ring->channels, pcm, first * ring->channels * sizeof(int16_t));
+	memcpy(ring->buf, pcm + first * ring->channels, (pushed - first) * ring->channels * sizeof(int16_t));
+	chiaki_atomic_store_32(&ring->head, head + (uint32_t)pushed);
+
+	ring->frames_pushed += pushed;
+	ring->frames_dropped += frames_count - pushed;
+	return pushed;
+}
+
+/**
+ * @return how much faster than nominal to read, given the fill before this read
+ */
+static double audio_ring_control(ChiakiAudioRing *ring, size_t fill, size_t target, size_t frames_count)
+{
+	ring->fill_avg += ((double)fill - ring->fill_avg) * FILL_AVG_WEIGHT;
+	chiaki_atomic_store_32(&ring->fill_avg_frames, (uint32_t)ring->fill_avg);
+
+	double err = (ring->fill_avg - (double)target) / (double)target;
+	ring->drift += err * GAIN_I * (double)frames_count;
+	if(ring->drift > RATIO_MAX)
+		ring->drift = RATIO_MAX;
+	else if(ring->drift < -RATIO_MAX)
+		ring->drift = -RATIO_MAX;
+
+	double ratio = ring->drift + err * GAIN_P;
+	if(ratio > RATIO_MAX)
+		ratio = RATIO_MAX;
+	else if(ratio < -RATIO_MAX)
+		ratio = -RATIO_MAX;
+	chiaki_atomic_store_32(&ring->ratio_ppm, (uint32_t)(int32_t)(ratio * 1000000.0));
+	return 1.0 + ratio;
+}
+
+CHIAKI_EXPORT void chiaki_audio_ring_pull(ChiakiAudioRing *ring, int16_t *pcm, size_t frames_count)
+{
+	size_t channels = ring->channels;
+	uint32_t tail = ring->tail;
+	size_t fill = (size_t)(chiaki_atomic_load_32(&ring->head) - tail);
+	size_t target = chiaki_atomic_load_32(&ring->target_frames);
+	size_t i = 0;
+
+	if(ring->priming)
+	{
+		if(fill < target || !fill)
+			goto silence;
+		ring->priming = false;
+		ring->fill_avg = (double)fill;
+	}
+
+	double ratio = audio_ring_control(ring, fill, target, frames_count);
+
+	if(ring->phase < 0.0)
+	{
+		// start interpolating from the first frame after priming
+		memcpy(ring->frame_prev, ring->buf + (tail & ring->mask) * channels, channels * sizeof(int16_t));
+		tail++;
+		fill--;
+		ring->phase = 0.0;
+	}
+
+	// linear interpolation between frame_prev and the frame at tail
+	for(; i<frames_count; i++)
+	{
+		if(!fill)
+		{
+			// nothing to interpolate towards anymore, play out the last frame as it is
+			memcpy(pcm + i * channels, ring->frame_prev, channels * sizeof(int16_t));
+			i++;
+			ring->underflows++;
+			ring->priming = true;
+			ring->phase = -1.0;
+			break;
+		}
+		const int16_t *frame_next = ring->buf + (tail & ring->mask) * channels;
+		for(size_t c=0; c<channels; c++)
+		{
+			int32_t prev = ring->frame_prev[c];
+			pcm[i * channels + c] = (int16_t)(prev + (int32_t)((double)(frame_next[c] - prev) * ring->phase));
+		}
+
+		ring->phase += ratio;
+		while(ring->phase >= 1.0 && fill)
+		{
+			memcpy(ring->frame_prev, ring->buf + (tail & ring->mask) * channels, channels * sizeof(int16_t));
+			tail++;
+			fill--;
+			ring->phase -= 1.0;
+		}
+	}
+	chiaki_atomic_store_32(&ring->tail, tail);
+
+silence:
+	memset(pcm + i * channels, 0, (frames_count - i) * channels * sizeof(int16_t));
+}
+
+CHIAKI_EXPORT void chiaki_audio_ring_set_target(ChiakiAudioRing *ring, size_t target_frames)
+{
+	if(target_frames < 1)
+		target_frames = 1;
+	if(target_frames > ring->mask)
+		target_frames = ring->mask;
+	chiaki_atomic_store_32(&ring->target_frames, (uint32_t)target_frames);
+}
+
+CHIAKI_EXPORT size_t chiaki_audio_ring_fill(ChiakiAudioRing *ring)
+{
+	uint32_t tail = chiaki_atomic_load_32(&ring->tail);
+	uint32_t head = chiaki_atomic_load_32(&ring->head);
+	return (size_t)(head - tail);
+}
+
+CHIAKI_EXPORT void chiaki_audio_ring_get_stats(ChiakiAudioRing *ring, ChiakiAudioRingStats *stats)
+{
+	stats->frames_pushed = ring->frames_pushed;
+	stats->frames_dropped = ring->frames_dropped;
+	stats->underflows = ring->underflows;
+	stats->fill_frames = chiaki_atomic_load_32(&ring->fill_avg_frames);
+	stats->target_frames = chiaki_atomic_load_32(&ring->target_frames);
+	stats->ratio_ppm = (int32_t)chiaki_atomic_load_32(&ring->ratio_ppm);
+}
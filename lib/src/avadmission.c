@@ -0,0 +1,121 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/avadmission.h>
+#include <chiaki/takion.h>
+#include <chiaki/audiojitterbuffer.h>
+
+#include <string.h>
+
+CHIAKI_EXPORT void chiaki_av_admission_init(ChiakiAVAdmission *admission)
+{
+	memset(admission, 0, sizeof(*admission));
+	for(size_t i=0; i<CHIAKI_AV_ADMISSION_VIDEO_FRAMES; i++)
+		admission->video_frames[i].frame_index = -1;
+	admission->audio_frame_index_last[0] = -1;
+	admission->audio_frame_index_last[1] = -1;
+}
+
+static ChiakiAVAdmissionVideoFrame *av_admission_video_frame(ChiakiAVAdmission *admission, ChiakiSeqNum16 frame_index)
+{
+	return &admission->video_frames[frame_index & (CHIAKI_AV_ADMISSION_VIDEO_FRAMES - 1)];
+}
+
+static bool av_admission_video_check(ChiakiAVAdmission *admission, ChiakiTakionAVPacket *packet)
+{
+	ChiakiAVAdmissionVideoFrame *frame = av_admission_video_frame(admission, packet->frame_index);
+	if(frame->frame_index < 0)
+		return true;
+
+	if(frame->frame_index != packet->frame_index)
+	{
+		// a newer frame took the slot, so the video receiver has moved past this one too
+		if(chiaki_seq_num_16_lt(packet->frame_index, (ChiakiSeqNum16)frame->frame_index))
+		{
+			admission->video_stale++;
+			return false;
+		}
+		return true;
+	}
+
+	if(packet->unit_index >= CHIAKI_FEC_UNITS_MAX)
+		return true; // invalid, but leave reporting it to the frame processor
+
+	if(frame->units_bitmap[packet->unit_index / 64] & (1ull << (packet->unit_index % 64)))
+	{
+		admission->video_duplicate++;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @return the newest frame index carried by an audio packet, i.e. the last of its source units
+ */
+static int32_t av_admission_audio_frame_index_last(ChiakiTakionAVPacket *packet)
+{
+	uint8_t source_units_count = chiaki_takion_av_packet_audio_source_units_count(packet);
+	if(!source_units_count)
+		return -1;
+	return (ChiakiSeqNum16)(packet->frame_index + source_units_count - 1);
+}
+
+static bool av_admission_audio_check(ChiakiAVAdmission *admission, ChiakiTakionAVPacket *packet)
+{
+	int32_t last = admission->audio_frame_index_last[packet->is_haptics ? 1 : 0];
+	int32_t frame_index_last = av_admission_audio_frame_index_last(packet);
+	if(last < 0 || frame_index_last < 0)
+		return true;
+
+	// haptics: all source and fec units refer to frames the audio receiver has already passed on.
+	// audio: late packets can still be reordered by the jitter buffer of the sink, unless they fell out of its window.
+	if(!packet->is_haptics)
+		last -= CHIAKI_AUDIO_JITTER_BUFFER_SLOTS;
+	if(!chiaki_seq_num_16_gt((ChiakiSeqNum16)frame_index_last, (ChiakiSeqNum16)last))
+	{
+		admission->audio_stale++;
+		return false;
+	}
+	return true;
+}
+
+CHIAKI_EXPORT bool chiaki_av_admission_check(ChiakiAVAdmission *admission, ChiakiTakionAVPacket *packet)
+{
+	bool admit = packet->is_video
+		? av_admission_video_check(admission, packet)
+		: av_admission_audio_check(admission, packet);
+	if(!admit)
+		admission->bytes_skipped += packet->data_size;
+	return admit;
+}
+
+CHIAKI_EXPORT void chiaki_av_admission_commit(ChiakiAVAdmission *admission, ChiakiTakionAVPacket *packet)
+{
+	if(!packet->is_video)
+	{
+		int32_t *last = &admission->audio_frame_index_last[packet->is_haptics ? 1 : 0];
+		int32_t frame_index_last = av_admission_audio_frame_index_last(packet);
+		if(frame_index_last >= 0 && (*last < 0 || chiaki_seq_num_16_gt((ChiakiSeqNum16)frame_index_last, (ChiakiSeqNum16)*last)))
+			*last = frame_index_last;
+		return;
+	}
+
+	ChiakiAVAdmissionVideoFrame *frame = av_admission_video_frame(admission, packet->frame_index);
+	if(frame->frame_index != packet->frame_index)
+	{
+		if(frame->frame_index >= 0 && chiaki_seq_num_16_lt(packet->frame_index, (ChiakiSeqNum16)frame->frame_index))
+			return;
+		frame->frame_index = packet->frame_index;
+		memset(frame->units_bitmap, 0, sizeof(frame->units_bitmap));
+	}
+	if(packet->unit_index < CHIAKI_FEC_UNITS_MAX)
+		frame->units_bitmap[packet->unit_index / 64] |= 1ull << (packet->unit_index % 64);
+}
+
+CHIAKI_EXPORT void chiaki_av_admission_log_stats(ChiakiAVAdmission *admission, ChiakiLog *log)
+{
+	CHIAKI_LOGI(log, "AV admission dropped %llu stale and %llu duplicate video packets, %llu stale audio packets, saving crypto on %llu bytes",
+			(unsigned long long)admission->video_stale,
+			(unsigned long long)admission->video_duplicate,
+			(unsigned long long)admission->audio_stale,
+			(unsigned long long)admission->bytes_skipped);
+}
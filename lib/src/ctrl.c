@@ -287,6 +287,10 @@ static void *ctrl_thread_func(void *user)
 
 	CHIAKI_LOGI(ctrl->session->log, "Ctrl connected");
 
+	err = chiaki_stop_pipe_register(&ctrl->notif_pipe, ctrl->sock, false);
+	if(err != CHIAKI_ERR_SUCCESS)
+		CHIAKI_LOGW(ctrl->session->log, "Ctrl failed to register socket in notif pipe");
+
 	while(true)
 	{
 		bool overflow = false;
@@ -381,6 +385,7 @@ static void *ctrl_thread_func(void *user)
 
 	chiaki_mutex_unlock(&ctrl->notif_mutex);
 
+	chiaki_stop_pipe_unregister(&ctrl->notif_pipe);
 	CHIAKI_SOCKET_CLOSE(ctrl->sock);
 
 	return NULL;
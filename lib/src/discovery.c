@@ -260,6 +260,10 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_thread_start(ChiakiDiscoveryThrea
 		return err;
 	}
 
+	err = chiaki_stop_pipe_register(&thread->stop_pipe, discovery->socket, false);
+	if(err != CHIAKI_ERR_SUCCESS)
+		CHIAKI_LOGW(discovery->log, "Discovery (thread) failed to register socket in stop pipe");
+
 	err = chiaki_thread_create(&thread->thread, discovery_thread_func, thread);
 	if(err != CHIAKI_ERR_SUCCESS)
 	{
@@ -1,6 +1,9 @@
 // SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
 
 #include <chiaki/fec.h>
+#include <chiaki/time.h>
+
+#include "gf256.h"
 
 #include <jerasure.h>
 #include <cauchy.h>
@@ -8,67 +11,446 @@
 #include <string.h>
 #include <stdlib.h>
 
-int *create_matrix(unsigned int k, unsigned int m)
+#define ERASURES_BITMAP_WORDS (CHIAKI_FEC_UNITS_MAX / 64)
+
+CHIAKI_EXPORT const char *chiaki_fec_backend_string(ChiakiFECBackend backend)
 {
-	return cauchy_original_coding_matrix(k, m, CHIAKI_FEC_WORDSIZE);
+	switch(backend)
+	{
+		case CHIAKI_FEC_BACKEND_JERASURE:
+			return "jerasure";
+		case CHIAKI_FEC_BACKEND_SCALAR:
+			return "scalar";
+		case CHIAKI_FEC_BACKEND_SSSE3:
+			return "SSSE3";
+		case CHIAKI_FEC_BACKEND_AVX2:
+			return "AVX2";
+		case CHIAKI_FEC_BACKEND_NEON:
+			return "NEON";
+		default:
+			return "unknown";
+	}
 }
 
-CHIAKI_EXPORT ChiakiErrorCode chiaki_fec_decode(uint8_t *frame_buf, size_t unit_size, size_t stride, unsigned int k, unsigned int m, const unsigned int *erasures, size_t erasures_count)
+CHIAKI_EXPORT bool chiaki_fec_backend_supported(ChiakiFECBackend backend)
 {
-	if(stride < unit_size)
-		return CHIAKI_ERR_INVALID_DATA;
-	int *matrix = create_matrix(k, m);
-	if(!matrix)
+	return chiaki_gf256_backend_supported(backend);
+}
+
+CHIAKI_EXPORT ChiakiFECBackend chiaki_fec_backend_best(void)
+{
+	return chiaki_gf256_backend_best();
+}
+
+CHIAKI_EXPORT void chiaki_fec_init(ChiakiFEC *fec)
+{
+	memset(fec, 0, sizeof(*fec));
+	fec->backend = chiaki_fec_backend_best();
+	fec->parallel_min_work = CHIAKI_FEC_PARALLEL_MIN_WORK_DEFAULT;
+}
+
+static void fec_stop_workers(ChiakiFEC *fec);
+
+CHIAKI_EXPORT void chiaki_fec_fini(ChiakiFEC *fec)
+{
+	fec_stop_workers(fec);
+	for(size_t i=0; i<CHIAKI_FEC_DECODE_CACHE_SIZE; i++)
+		free(fec->decode_cache[i].src_ids);
+	free(fec->inverse);
+	free(fec->coding_matrix);
+}
+
+static int *fec_coding_matrix(ChiakiFEC *fec, unsigned int k, unsigned int m)
+{
+	if(fec->coding_matrix && fec->coding_k == k && fec->coding_m == m)
+		return fec->coding_matrix;
+	free(fec->coding_matrix);
+	fec->coding_matrix = cauchy_original_coding_matrix(k, m, CHIAKI_FEC_WORDSIZE);
+	fec->coding_k = k;
+	fec->coding_m = m;
+	return fec->coding_matrix;
+}
+
+/**
+ * Invert the coding submatrix of the units that are left and keep only the rows needed for the erased source units.
+ */
+static ChiakiErrorCode fec_decode_matrix_build(ChiakiFEC *fec, ChiakiFECDecodeMatrix *dm, unsigned int k, unsigned int m, size_t erased_source_count)
+{
+	int *coding_matrix = fec_coding_matrix(fec, k, m);
+	if(!coding_matrix)
 		return CHIAKI_ERR_MEMORY;
 
-	ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
+	size_t inverse_size = (size_t)k * k;
+	if(fec->inverse_size < inverse_size)
+	{
+		free(fec->inverse);
+		fec->inverse = malloc(inverse_size * sizeof(int));
+		if(!fec->inverse)
+		{
+			fec->inverse_size = 0;
+			return CHIAKI_ERR_MEMORY;
+		}
+		fec->inverse_size = inverse_size;
+	}
 
-	int *jerasures = calloc(erasures_count + 1, sizeof(int));
-	if(!jerasures)
+	size_t alloc_size = (erased_source_count + 1) * k;
+	if(dm->alloc_size < alloc_size)
 	{
-		err = CHIAKI_ERR_MEMORY;
-		goto error_matrix;
+		free(dm->src_ids);
+		dm->src_ids = malloc(alloc_size * sizeof(int));
+		if(!dm->src_ids)
+		{
+			dm->alloc_size = 0;
+			return CHIAKI_ERR_MEMORY;
+		}
+		dm->alloc_size = alloc_size;
 	}
-	memcpy(jerasures, erasures, erasures_count * sizeof(int));
-	jerasures[erasures_count] = -1;
+	dm->rows = dm->src_ids + k;
 
-	uint8_t **data_ptrs = calloc(k, sizeof(uint8_t *));
-	if(!data_ptrs)
+	if(jerasure_make_decoding_matrix(k, m, CHIAKI_FEC_WORDSIZE, coding_matrix, fec->erased, fec->inverse, dm->src_ids) < 0)
+		return CHIAKI_ERR_FEC_FAILED;
+
+	size_t row = 0;
+	for(unsigned int i=0; i<k; i++)
 	{
-		err = CHIAKI_ERR_MEMORY;
-		goto error_jerasures;
+		if(!fec->erased[i])
+			continue;
+		memcpy(dm->rows + row * k, fec->inverse + (size_t)i * k, k * sizeof(int));
+		row++;
 	}
+	return CHIAKI_ERR_SUCCESS;
+}
 
-	uint8_t **coding_ptrs = calloc(m, sizeof(uint8_t *));
-	if(!coding_ptrs)
+static ChiakiErrorCode fec_decode_matrix_get(ChiakiFEC *fec, unsigned int k, unsigned int m, const uint64_t *erasures_bitmap, size_t erased_source_count, ChiakiFECDecodeMatrix **out)
+{
+	ChiakiFECDecodeMatrix *lru = NULL;
+	for(size_t i=0; i<CHIAKI_FEC_DECODE_CACHE_SIZE; i++)
 	{
-		err = CHIAKI_ERR_MEMORY;
-		goto error_data_ptrs;
+		ChiakiFECDecodeMatrix *dm = &fec->decode_cache[i];
+		if(dm->last_used && dm->k == k && dm->m == m
+			&& memcmp(dm->erasures, erasures_bitmap, sizeof(dm->erasures)) == 0)
+		{
+			dm->last_used = ++fec->decode_cache_clock;
+			fec->decode_cache_hits++;
+			*out = dm;
+			return CHIAKI_ERR_SUCCESS;
+		}
+		if(!lru || dm->last_used < lru->last_used)
+			lru = dm;
 	}
 
-	for(size_t i=0; i<k+m; i++)
+	fec->decode_cache_misses++;
+	lru->last_used = 0;
+	ChiakiErrorCode err = fec_decode_matrix_build(fec, lru, k, m, erased_source_count);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+	lru->k = k;
+	lru->m = m;
+	memcpy(lru->erasures, erasures_bitmap, sizeof(lru->erasures));
+	lru->last_used = ++fec->decode_cache_clock;
+	*out = lru;
+	return CHIAKI_ERR_SUCCESS;
+}
+
+/**
+ * Recover bytes [offset, offset + size) of all erased source units with a native backend
+ */
+static void fec_decode_stripe(ChiakiFEC *fec, ChiakiFECDecodeMatrix *dm, unsigned int k, size_t offset, size_t size)
+{
+	size_t row = 0;
+	for(unsigned int i=0; i<k; i++)
 	{
-		uint8_t *buf_ptr = frame_buf + stride * i;
-		if(i < k)
-			data_ptrs[i] = buf_ptr;
-		else
-			coding_ptrs[i - k] = buf_ptr;
+		if(!fec->erased[i])
+			continue;
+		const int *coefs = dm->rows + row * k;
+		row++;
+
+		// src_ids index directly into ptrs, because data and coding units are contiguous there
+		uint8_t *dst = fec->ptrs[i] + offset;
+		memset(dst, 0, size);
+		for(unsigned int j=0; j<k; j++)
+			chiaki_gf256_mul_add(fec->backend, dst, fec->ptrs[dm->src_ids[j]] + offset, (uint8_t)coefs[j], size);
 	}
+}
 
-	int res = jerasure_matrix_decode(k, m, CHIAKI_FEC_WORDSIZE, matrix, 0, jerasures,
-									 (char **)data_ptrs, (char **)coding_ptrs, unit_size);
+static void fec_job_stripe(ChiakiFEC *fec, unsigned int stripe)
+{
+	size_t offset = stripe * fec->job_stripe_size;
+	if(offset >= fec->job_unit_size)
+		return;
+	size_t size = fec->job_unit_size - offset;
+	if(size > fec->job_stripe_size)
+		size = fec->job_stripe_size;
+	fec_decode_stripe(fec, fec->job_dm, fec->job_k, offset, size);
+}
 
-	if(res < 0)
-		err = CHIAKI_ERR_FEC_FAILED;
-	else
-		err = CHIAKI_ERR_SUCCESS;
-
-	free(coding_ptrs);
-error_data_ptrs:
-	free(data_ptrs);
-error_jerasures:
-	free(jerasures);
-error_matrix:
-	free(matrix);
+static void *fec_worker_thread_func(void *user)
+{
+	ChiakiFECWorker *worker = user;
+	ChiakiFEC *fec = worker->fec;
+
+	// job_seq is 0 before any job, the thread may only start running after the first one has been posted
+	uint64_t seq = 0;
+	chiaki_mutex_lock(&fec->workers_mutex);
+	while(true)
+	{
+		while(!fec->workers_stop && fec->job_seq == seq)
+			chiaki_cond_wait(&fec->workers_cond, &fec->workers_mutex);
+		if(fec->workers_stop)
+			break;
+		seq = fec->job_seq;
+		chiaki_mutex_unlock(&fec->workers_mutex);
+
+		fec_job_stripe(fec, worker->stripe);
+
+		chiaki_mutex_lock(&fec->workers_mutex);
+		if(--fec->job_pending == 0)
+			chiaki_cond_signal(&fec->workers_done_cond);
+	}
+	chiaki_mutex_unlock(&fec->workers_mutex);
+	return NULL;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_fec_start_workers(ChiakiFEC *fec, unsigned int threads)
+{
+	if(fec->workers_count)
+		return CHIAKI_ERR_INVALID_DATA;
+	if(threads > CHIAKI_FEC_THREADS_MAX)
+		threads = CHIAKI_FEC_THREADS_MAX;
+	if(!threads)
+		return CHIAKI_ERR_SUCCESS;
+
+	ChiakiErrorCode err = chiaki_mutex_init(&fec->workers_mutex, false);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+	err = chiaki_cond_init(&fec->workers_cond);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_mutex;
+	err = chiaki_cond_init(&fec->workers_done_cond);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_cond;
+
+	fec->workers_stop = false;
+	fec->job_seq = 0;
+	fec->job_pending = 0;
+	for(; fec->workers_count<threads; fec->workers_count++)
+	{
+		ChiakiFECWorker *worker = &fec->workers[fec->workers_count];
+		worker->fec = fec;
+		worker->stripe = fec->workers_count + 1; // stripe 0 is for the calling thread
+		err = chiaki_thread_create(&worker->thread, fec_worker_thread_func, worker);
+		if(err != CHIAKI_ERR_SUCCESS)
+			break;
+		chiaki_thread_set_name(&worker->thread, "Chiaki FEC");
+	}
+	if(!fec->workers_count)
+		goto error_done_cond;
+	// with at least one worker we can still go on
+	return CHIAKI_ERR_SUCCESS;
+
+error_done_cond:
+	chiaki_cond_fini(&fec->workers_done_cond);
+error_cond:
+	chiaki_cond_fini(&fec->workers_cond);
+error_mutex:
+	chiaki_mutex_fini(&fec->workers_mutex);
 	return err;
 }
+
+static void fec_stop_workers(ChiakiFEC *fec)
+{
+	if(!fec->workers_count)
+		return;
+	chiaki_mutex_lock(&fec->workers_mutex);
+	fec->workers_stop = true;
+	chiaki_cond_broadcast(&fec->workers_cond);
+	chiaki_mutex_unlock(&fec->workers_mutex);
+	for(unsigned int i=0; i<fec->workers_count; i++)
+		chiaki_thread_join(&fec->workers[i].thread, NULL);
+	fec->workers_count = 0;
+	chiaki_cond_fini(&fec->workers_done_cond);
+	chiaki_cond_fini(&fec->workers_cond);
+	chiaki_mutex_fini(&fec->workers_mutex);
+}
+
+static void fec_decode_parallel(ChiakiFEC *fec, ChiakiFECDecodeMatrix *dm, unsigned int k, size_t unit_size)
+{
+	unsigned int stripes = fec->workers_count + 1;
+	size_t stripe_size = (unit_size + stripes - 1) / stripes;
+	stripe_size = ((stripe_size + CHIAKI_FEC_STRIPE_ALIGN - 1) / CHIAKI_FEC_STRIPE_ALIGN) * CHIAKI_FEC_STRIPE_ALIGN;
+
+	chiaki_mutex_lock(&fec->workers_mutex);
+	fec->job_dm = dm;
+	fec->job_k = k;
+	fec->job_unit_size = unit_size;
+	fec->job_stripe_size = stripe_size;
+	fec->job_pending = fec->workers_count;
+	fec->job_seq++;
+	chiaki_cond_broadcast(&fec->workers_cond);
+	chiaki_mutex_unlock(&fec->workers_mutex);
+
+	fec_job_stripe(fec, 0);
+
+	chiaki_mutex_lock(&fec->workers_mutex);
+	while(fec->job_pending)
+		chiaki_cond_wait(&fec->workers_done_cond, &fec->workers_mutex);
+	chiaki_mutex_unlock(&fec->workers_mutex);
+}
+
+CHIAKI_EXPORT double chiaki_fec_stats_parallel_speedup(const ChiakiFECStats *stats)
+{
+	if(!stats->decode_work || !stats->decode_us || !stats->parallel_decode_work || !stats->parallel_decode_us)
+		return 0.0;
+	double us_per_byte = (double)stats->decode_us / (double)stats->decode_work;
+	double parallel_us_per_byte = (double)stats->parallel_decode_us / (double)stats->parallel_decode_work;
+	return us_per_byte / parallel_us_per_byte;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_fec_decode(ChiakiFEC *fec, uint8_t *frame_buf, size_t unit_size, size_t stride, unsigned int k, unsigned int m, const unsigned int *erasures, size_t erasures_count)
+{
+	if(!fec)
+	{
+		ChiakiFEC tmp;
+		chiaki_fec_init(&tmp);
+		ChiakiErrorCode err = chiaki_fec_decode(&tmp, frame_buf, unit_size, stride, k, m, erasures, erasures_count);
+		chiaki_fec_fini(&tmp);
+		return err;
+	}
+
+	if(stride < unit_size)
+		return CHIAKI_ERR_INVALID_DATA;
+	if(!k || k + m > CHIAKI_FEC_UNITS_MAX)
+		return CHIAKI_ERR_INVALID_DATA;
+
+	memset(fec->erased, 0, (k + m) * sizeof(int));
+	uint64_t erasures_bitmap[ERASURES_BITMAP_WORDS] = { 0 };
+	size_t erased_count = 0;
+	size_t erased_source_count = 0;
+	for(size_t i=0; i<erasures_count; i++)
+	{
+		unsigned int e = erasures[i];
+		if(e >= k + m)
+			return CHIAKI_ERR_INVALID_DATA;
+		if(fec->erased[e])
+			continue;
+		fec->erased[e] = 1;
+		erasures_bitmap[e / 64] |= 1ull << (e % 64);
+		erased_count++;
+		if(e < k)
+			erased_source_count++;
+	}
+	if(erased_count > m)
+		return CHIAKI_ERR_FEC_FAILED;
+	if(!erased_source_count)
+		return CHIAKI_ERR_SUCCESS;
+
+	ChiakiFECDecodeMatrix *dm;
+	ChiakiErrorCode err = fec_decode_matrix_get(fec, k, m, erasures_bitmap, erased_source_count, &dm);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+
+	for(size_t i=0; i<k+m; i++)
+		fec->ptrs[i] = frame_buf + stride * i;
+
+	if(fec->backend == CHIAKI_FEC_BACKEND_JERASURE)
+	{
+		size_t row = 0;
+		for(unsigned int i=0; i<k; i++)
+		{
+			if(!fec->erased[i])
+				continue;
+			jerasure_matrix_dotprod(k, CHIAKI_FEC_WORDSIZE, dm->rows + row * k, dm->src_ids, i,
+					(char **)fec->ptrs, (char **)fec->ptrs + k, (int)unit_size);
+			row++;
+		}
+		return CHIAKI_ERR_SUCCESS;
+	}
+
+	size_t work = erased_source_count * k * unit_size;
+	uint64_t start_us = chiaki_time_now_monotonic_us();
+	if(fec->workers_count && work >= fec->parallel_min_work && unit_size >= 2 * CHIAKI_FEC_STRIPE_ALIGN)
+	{
+		fec_decode_parallel(fec, dm, k, unit_size);
+		fec->stats.parallel_decodes++;
+		fec->stats.parallel_decode_us += chiaki_time_now_monotonic_us() - start_us;
+		fec->stats.parallel_decode_work += work;
+	}
+	else
+	{
+		fec_decode_stripe(fec, dm, k, 0, unit_size);
+		fec->stats.decodes++;
+		fec->stats.decode_us += chiaki_time_now_monotonic_us() - start_us;
+		fec->stats.decode_work += work;
+	}
+
+	return CHIAKI_ERR_SUCCESS;
+}
+
+static ChiakiFECBackend fec_native_backend(ChiakiFEC *fec)
+{
+	return fec->backend == CHIAKI_FEC_BACKEND_JERASURE ? CHIAKI_FEC_BACKEND_SCALAR : fec->backend;
+}
+
+/**
+ * Coefficient of source unit src_unit in fec unit fec_unit, same as cauchy_original_coding_matrix()
+ */
+static uint8_t fec_coding_coef(unsigned int k, unsigned int m, unsigned int fec_unit, unsigned int src_unit)
+{
+	return chiaki_gf256_inv((uint8_t)((fec_unit - k) ^ (m + src_unit)));
+}
+
+CHIAKI_EXPORT void chiaki_fec_syndrome_add(ChiakiFEC *fec, uint8_t *syndrome, const uint8_t *src, size_t unit_size, unsigned int k, unsigned int m, unsigned int fec_unit, unsigned int src_unit)
+{
+	chiaki_gf256_mul_add(fec_native_backend(fec), syndrome, src, fec_coding_coef(k, m, fec_unit, src_unit), unit_size);
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_fec_recover_from_syndromes(ChiakiFEC *fec, uint8_t *frame_buf, size_t unit_size, size_t stride, unsigned int k, unsigned int m, const unsigned int *syndromes, const unsigned int *erasures, size_t count)
+{
+	if(stride < unit_size)
+		return CHIAKI_ERR_INVALID_DATA;
+	if(!k || k + m > CHIAKI_FEC_UNITS_MAX || count > m)
+		return CHIAKI_ERR_INVALID_DATA;
+	if(!count)
+		return CHIAKI_ERR_SUCCESS;
+
+	size_t inverse_size = 2 * count * count;
+	if(fec->inverse_size < inverse_size)
+	{
+		free(fec->inverse);
+		fec->inverse = malloc(inverse_size * sizeof(int));
+		if(!fec->inverse)
+		{
+			fec->inverse_size = 0;
+			return CHIAKI_ERR_MEMORY;
+		}
+		fec->inverse_size = inverse_size;
+	}
+	int *matrix = fec->inverse;
+	int *inverse = fec->inverse + count * count;
+
+	for(size_t a=0; a<count; a++)
+	{
+		if(syndromes[a] < k || syndromes[a] >= k + m)
+			return CHIAKI_ERR_INVALID_DATA;
+		for(size_t b=0; b<count; b++)
+		{
+			if(erasures[b] >= k)
+				return CHIAKI_ERR_INVALID_DATA;
+			matrix[a * count + b] = fec_coding_coef(k, m, syndromes[a], erasures[b]);
+		}
+	}
+
+	if(jerasure_invert_matrix(matrix, inverse, (int)count, CHIAKI_FEC_WORDSIZE) < 0)
+		return CHIAKI_ERR_FEC_FAILED;
+
+	ChiakiFECBackend backend = fec_native_backend(fec);
+	for(size_t b=0; b<count; b++)
+	{
+		uint8_t *dst = frame_buf + stride * erasures[b];
+		memset(dst, 0, unit_size);
+		for(size_t a=0; a<count; a++)
+			chiaki_gf256_mul_add(backend, dst, frame_buf + stride * syndromes[a], (uint8_t)inverse[b * count + a], unit_size);
+	}
+
+	return CHIAKI_ERR_SUCCESS;
+}
@@ -1,8 +1,14 @@
 
 #include <chiaki/ffmpegdecoder.h>
 
+#include <chiaki/time.h>
+
 #include <libavcodec/avcodec.h>
 
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
 static enum AVCodecID chiaki_codec_av_codec_id(ChiakiCodec codec)
 {
 	switch(codec)
@@ -15,8 +21,10 @@ static enum AVCodecID chiaki_codec_av_codec_id(ChiakiCodec codec)
 	}
 }
 
+static void *ffmpeg_decoder_thread_func(void *user);
+
 CHIAKI_EXPORT ChiakiErrorCode chiaki_ffmpeg_decoder_init(ChiakiFfmpegDecoder *decoder, ChiakiLog *log,
-		ChiakiCodec codec, const char *hw_decoder_name,
+		ChiakiCodec codec, const char *hw_decoder_name, bool slices,
 		ChiakiFfmpegFrameAvailable frame_available_cb, void *frame_available_cb_user)
 {
 	decoder->log = log;
@@ -27,8 +35,24 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_ffmpeg_decoder_init(ChiakiFfmpegDecoder *de
 	if(err != CHIAKI_ERR_SUCCESS)
 		return err;
 
+	err = chiaki_spsc_queue_init(&decoder->packet_queue, CHIAKI_FFMPEG_DECODER_QUEUE_SIZE_EXP, sizeof(AVPacket *));
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_mutex;
+
+	decoder->drop_policy = CHIAKI_FFMPEG_DECODER_DROP_UNTIL_KEYFRAME;
+	decoder->keyframe_wait = false;
+	decoder->keyframe_wait_start_ms = 0;
+	decoder->frame_latest = NULL;
+	memset(&decoder->stats, 0, sizeof(decoder->stats));
+
 	decoder->hw_device_ctx = NULL;
 	decoder->hw_pix_fmt = AV_PIX_FMT_NONE;
+	decoder->packet_pool = NULL;
+	decoder->packet_pool_buf_size = 0;
+	decoder->chunks = false;
+	decoder->slices_buf = NULL;
+	decoder->slices_buf_size = 0;
+	decoder->slices_buf_len = 0;
 
 #if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(58, 10, 100)
 	avcodec_register_all();
@@ -38,14 +62,14 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_ffmpeg_decoder_init(ChiakiFfmpegDecoder *de
 	if(!decoder->av_codec)
 	{
 		CHIAKI_LOGE(log, "%s Codec not available", chiaki_codec_name(codec));
-		goto error_mutex;
+		goto error_queue;
 	}
 
 	decoder->codec_context = avcodec_alloc_context3(decoder->av_codec);
 	if(!decoder->codec_context)
 	{
 		CHIAKI_LOGE(log, "Failed to alloc codec context");
-		goto error_mutex;
+		goto error_queue;
 	}
 
 	if(hw_decoder_name)
@@ -81,17 +105,39 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_ffmpeg_decoder_init(ChiakiFfmpegDecoder *de
 		decoder->codec_context->hw_device_ctx = av_buffer_ref(decoder->hw_device_ctx);
 	}
 
+	if(slices)
+	{
+		if(av_codec == AV_CODEC_ID_H264)
+		{
+			// h264 can decode each slice as it arrives and finish the picture with the last one
+			decoder->codec_context->flags2 |= AV_CODEC_FLAG2_CHUNKS;
+			decoder->chunks = true;
+		}
+		else
+			CHIAKI_LOGI(log, "%s decoder does not take slices separately, collecting them per frame", chiaki_codec_name(codec));
+	}
+
 	if(avcodec_open2(decoder->codec_context, decoder->av_codec, NULL) < 0)
 	{
 		CHIAKI_LOGE(log, "Failed to open codec context");
 		goto error_codec_context;
 	}
 
+	err = chiaki_thread_create(&decoder->thread, ffmpeg_decoder_thread_func, decoder);
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGE(log, "Failed to create decode thread");
+		goto error_codec_context;
+	}
+	chiaki_thread_set_name(&decoder->thread, "Chiaki Decode");
+
 	return CHIAKI_ERR_SUCCESS;
 error_codec_context:
 	if(decoder->hw_device_ctx)
 		av_buffer_unref(&decoder->hw_device_ctx);
 	avcodec_free_context(&decoder->codec_context);
+error_queue:
+	chiaki_spsc_queue_fini(&decoder->packet_queue);
 error_mutex:
 	chiaki_mutex_fini(&decoder->mutex);
 	return CHIAKI_ERR_UNKNOWN;
@@ -99,59 +145,305 @@ error_mutex:
 
 CHIAKI_EXPORT void chiaki_ffmpeg_decoder_fini(ChiakiFfmpegDecoder *decoder)
 {
+	chiaki_spsc_queue_close(&decoder->packet_queue);
+	chiaki_thread_join(&decoder->thread, NULL);
+	AVPacket *packet;
+	while(chiaki_spsc_queue_pop(&decoder->packet_queue, &packet))
+		av_packet_free(&packet);
+	chiaki_spsc_queue_fini(&decoder->packet_queue);
+
+	ChiakiFfmpegDecoderStats stats;
+	chiaki_ffmpeg_decoder_get_stats(decoder, &stats);
+	CHIAKI_LOGI(decoder->log, "FFMPEG Decoder decoded %llu packets into %llu frames (%llu replaced before being pulled), dropped %llu packets, max queue depth %llu, decode time avg %llu us max %llu us",
+			(unsigned long long)stats.packets_decoded,
+			(unsigned long long)stats.frames_decoded,
+			(unsigned long long)stats.frames_replaced,
+			(unsigned long long)stats.packets_dropped,
+			(unsigned long long)stats.queue_depth_max,
+			(unsigned long long)stats.decode_time_avg_us,
+			(unsigned long long)stats.decode_time_max_us);
+	av_frame_free(&decoder->frame_latest);
+	chiaki_mutex_fini(&decoder->mutex);
+
 	avcodec_close(decoder->codec_context);
 	avcodec_free_context(&decoder->codec_context);
 	if(decoder->hw_device_ctx)
 		av_buffer_unref(&decoder->hw_device_ctx);
+	av_buffer_pool_uninit(&decoder->packet_pool);
+	free(decoder->slices_buf);
 }
 
-CHIAKI_EXPORT bool chiaki_ffmpeg_decoder_video_sample_cb(uint8_t *buf, size_t buf_size, void *user)
+typedef enum
 {
-	ChiakiFfmpegDecoder *decoder = user;
+	FFMPEG_DECODER_NALU_OTHER,
+	FFMPEG_DECODER_NALU_PARAMS,
+	FFMPEG_DECODER_NALU_KEYFRAME
+} FfmpegDecoderNaluClass;
 
-	chiaki_mutex_lock(&decoder->mutex);
-	AVPacket packet;
-	av_init_packet(&packet);
-	packet.data = buf;
-	packet.size = buf_size;
-	int r;
-send_packet:
-	r = avcodec_send_packet(decoder->codec_context, &packet);
-	if(r != 0)
+/**
+ * Read an Exp-Golomb coded value, ignoring emulation prevention which does not matter for the first slice header fields.
+ * @return -1 if buf ends before the value
+ */
+static int64_t ffmpeg_decoder_read_ue(const uint8_t *buf, size_t buf_size, size_t *bit)
+{
+	size_t zeros = 0;
+	while(true)
+	{
+		if(*bit >= buf_size * 8 || zeros > 31)
+			return -1;
+		bool b = (buf[*bit / 8] >> (7 - *bit % 8)) & 1;
+		(*bit)++;
+		if(b)
+			break;
+		zeros++;
+	}
+	uint64_t v = 1;
+	for(size_t i=0; i<zeros; i++)
+	{
+		if(*bit >= buf_size * 8)
+			return -1;
+		v = (v << 1) | ((buf[*bit / 8] >> (7 - *bit % 8)) & 1);
+		(*bit)++;
+	}
+	return (int64_t)v - 1;
+}
+
+/**
+ * Classify an Annex-B sample by its first slice, or by its parameter sets if it has no slices.
+ */
+static FfmpegDecoderNaluClass ffmpeg_decoder_sample_class(ChiakiFfmpegDecoder *decoder, const uint8_t *buf, size_t buf_size)
+{
+	bool hevc = decoder->av_codec->id == AV_CODEC_ID_H265;
+	FfmpegDecoderNaluClass r = FFMPEG_DECODER_NALU_OTHER;
+	const uint8_t *end = buf + buf_size;
+	const uint8_t *cur = buf;
+	while(end - cur >= 4)
 	{
-		if(r == AVERROR(EAGAIN))
+		const uint8_t *one = memchr(cur + 2, 1, (size_t)(end - cur - 3));
+		if(!one)
+			break;
+		cur = one + 1;
+		if(one[-1] || one[-2])
+			continue;
+
+		if(hevc)
 		{
-			CHIAKI_LOGE(decoder->log, "AVCodec internal buffer is full removing frames before pushing");
-			AVFrame *frame = av_frame_alloc();
-			if(!frame)
-			{
-				CHIAKI_LOGE(decoder->log, "Failed to alloc AVFrame");
-				goto hell;
-			}
-			r = avcodec_receive_frame(decoder->codec_context, frame);
-			av_frame_free(&frame);
-			if(r != 0)
-			{
-				CHIAKI_LOGE(decoder->log, "Failed to pull frame");
-				goto hell;
-			}
-			goto send_packet;
+			uint8_t type = (cur[0] >> 1) & 0x3f;
+			if(type >= 32 && type <= 34)
+				r = FFMPEG_DECODER_NALU_PARAMS;
+			else if(type >= 16 && type <= 21)
+				return FFMPEG_DECODER_NALU_KEYFRAME;
+			else if(type < 32)
+				return FFMPEG_DECODER_NALU_OTHER;
 		}
 		else
 		{
-			char errbuf[128];
-			av_make_error_string(errbuf, sizeof(errbuf), r);
-			CHIAKI_LOGE(decoder->log, "Failed to push frame: %s", errbuf);
-			goto hell;
+			uint8_t type = cur[0] & 0x1f;
+			if(type == 7 || type == 8)
+				r = FFMPEG_DECODER_NALU_PARAMS;
+			else if(type == 5)
+				return FFMPEG_DECODER_NALU_KEYFRAME;
+			else if(type == 1)
+			{
+				// non-idr frames consisting only of I slices can be used to recover too
+				size_t bit = 8;
+				int64_t first_mb_in_slice = ffmpeg_decoder_read_ue(cur, (size_t)(end - cur), &bit);
+				int64_t slice_type = ffmpeg_decoder_read_ue(cur, (size_t)(end - cur), &bit);
+				if(first_mb_in_slice == 0 && (slice_type == 7 || slice_type == 9))
+					return FFMPEG_DECODER_NALU_KEYFRAME;
+				return FFMPEG_DECODER_NALU_OTHER;
+			}
 		}
 	}
+	return r;
+}
+
+static void ffmpeg_decoder_count_drop(ChiakiFfmpegDecoder *decoder)
+{
+	chiaki_mutex_lock(&decoder->mutex);
+	decoder->stats.packets_dropped++;
 	chiaki_mutex_unlock(&decoder->mutex);
+}
 
-	decoder->frame_available_cb(decoder, decoder->frame_available_cb_user);
-	return true;
-hell:
+/**
+ * Hand a packet over to the decode thread, applying the drop policy.
+ * @param packet taken over in any case
+ */
+static bool ffmpeg_decoder_queue_packet(ChiakiFfmpegDecoder *decoder, AVPacket *packet)
+{
+	if(decoder->keyframe_wait)
+	{
+		FfmpegDecoderNaluClass nalu_class = ffmpeg_decoder_sample_class(decoder, packet->data, packet->size);
+		uint64_t waited_ms = chiaki_time_now_monotonic_ms() - decoder->keyframe_wait_start_ms;
+		if(nalu_class == FFMPEG_DECODER_NALU_KEYFRAME || waited_ms >= CHIAKI_FFMPEG_DECODER_KEYFRAME_WAIT_MAX_MS)
+		{
+			CHIAKI_LOGI(decoder->log, "FFMPEG Decoder resuming after %llu ms %s",
+					(unsigned long long)waited_ms,
+					nalu_class == FFMPEG_DECODER_NALU_KEYFRAME ? "at a keyframe" : "without a keyframe");
+			decoder->keyframe_wait = false;
+		}
+		else if(nalu_class != FFMPEG_DECODER_NALU_PARAMS)
+		{
+			av_packet_free(&packet);
+			ffmpeg_decoder_count_drop(decoder);
+			return false;
+		}
+	}
+
+	if(!chiaki_spsc_queue_push(&decoder->packet_queue, &packet))
+	{
+		av_packet_free(&packet);
+		ffmpeg_decoder_count_drop(decoder);
+		if(decoder->drop_policy == CHIAKI_FFMPEG_DECODER_DROP_UNTIL_KEYFRAME && !decoder->keyframe_wait)
+		{
+			CHIAKI_LOGW(decoder->log, "FFMPEG Decoder queue is full, dropping until the next keyframe");
+			decoder->keyframe_wait = true;
+			decoder->keyframe_wait_start_ms = chiaki_time_now_monotonic_ms();
+		}
+		return false;
+	}
+
+	size_t depth = chiaki_spsc_queue_depth(&decoder->packet_queue);
+	chiaki_mutex_lock(&decoder->mutex);
+	if(depth > decoder->stats.queue_depth_max)
+		decoder->stats.queue_depth_max = depth;
 	chiaki_mutex_unlock(&decoder->mutex);
-	return false;
+	return true;
+}
+
+/**
+ * Make the decode thread drop whatever the codec holds of the current picture, in order with the packets.
+ */
+static void ffmpeg_decoder_queue_flush(ChiakiFfmpegDecoder *decoder)
+{
+	AVPacket *packet = NULL; // marker for the decode thread
+	if(!chiaki_spsc_queue_push(&decoder->packet_queue, &packet))
+		ffmpeg_decoder_count_drop(decoder);
+	// the flush takes the references with it, and the session reports the frame as corrupt anyway
+	if(decoder->drop_policy == CHIAKI_FFMPEG_DECODER_DROP_UNTIL_KEYFRAME && !decoder->keyframe_wait)
+	{
+		decoder->keyframe_wait = true;
+		decoder->keyframe_wait_start_ms = chiaki_time_now_monotonic_ms();
+	}
+}
+
+CHIAKI_EXPORT bool chiaki_ffmpeg_decoder_video_sample_cb(uint8_t *buf, size_t buf_size, void *user)
+{
+	// buf is only valid during the call, so it has to be copied for the decode thread anyway
+	ChiakiVideoSampleIOV iov = { buf, buf_size };
+	return chiaki_ffmpeg_decoder_video_sample_iov_cb(&iov, 1, user);
+}
+
+CHIAKI_EXPORT bool chiaki_ffmpeg_decoder_video_sample_iov_cb(ChiakiVideoSampleIOV *iov, size_t iov_count, void *user)
+{
+	ChiakiFfmpegDecoder *decoder = user;
+
+	size_t size = 0;
+	for(size_t i=0; i<iov_count; i++)
+		size += iov[i].size;
+	if(size > (size_t)(INT_MAX - AV_INPUT_BUFFER_PADDING_SIZE))
+	{
+		CHIAKI_LOGE(decoder->log, "Video sample too big");
+		return false;
+	}
+
+	if(!decoder->packet_pool || decoder->packet_pool_buf_size < size + AV_INPUT_BUFFER_PADDING_SIZE)
+	{
+		// buffers still referenced by the codec are freed when it releases them
+		av_buffer_pool_uninit(&decoder->packet_pool);
+		size_t buf_size = decoder->packet_pool_buf_size + decoder->packet_pool_buf_size / 2;
+		if(buf_size < size + AV_INPUT_BUFFER_PADDING_SIZE)
+			buf_size = size + AV_INPUT_BUFFER_PADDING_SIZE;
+		if(buf_size > (size_t)INT_MAX)
+			buf_size = INT_MAX;
+		decoder->packet_pool = av_buffer_pool_init((int)buf_size, NULL);
+		if(!decoder->packet_pool)
+		{
+			decoder->packet_pool_buf_size = 0;
+			CHIAKI_LOGE(decoder->log, "Failed to create AVPacket buffer pool");
+			return false;
+		}
+		decoder->packet_pool_buf_size = buf_size;
+	}
+
+	AVPacket *packet = av_packet_alloc();
+	if(!packet)
+	{
+		CHIAKI_LOGE(decoder->log, "Failed to alloc AVPacket");
+		return false;
+	}
+	// refcounted, so libavcodec takes the buffer over instead of copying the sample again
+	packet->buf = av_buffer_pool_get(decoder->packet_pool);
+	if(!packet->buf)
+	{
+		CHIAKI_LOGE(decoder->log, "Failed to get AVPacket buffer");
+		av_packet_free(&packet);
+		return false;
+	}
+	packet->data = packet->buf->data;
+	packet->size = (int)size;
+
+	uint8_t *cur = packet->data;
+	for(size_t i=0; i<iov_count; i++)
+	{
+		memcpy(cur, iov[i].buf, iov[i].size);
+		cur += iov[i].size;
+	}
+	memset(cur, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+
+	return ffmpeg_decoder_queue_packet(decoder, packet);
+}
+
+CHIAKI_EXPORT bool chiaki_ffmpeg_decoder_video_slice_cb(ChiakiVideoSampleIOV *iov, size_t iov_count, bool frame_end, void *user)
+{
+	ChiakiFfmpegDecoder *decoder = user;
+
+	if(decoder->chunks)
+	{
+		if(!iov_count)
+		{
+			// frame_end with nothing means the rest of the frame was lost. Chunked h264 only finishes a picture
+			// once all of its macroblocks arrived or the next one starts, so without a flush the partial picture
+			// would hold up the decoder for a whole frame.
+			if(frame_end)
+				ffmpeg_decoder_queue_flush(decoder);
+			return true;
+		}
+		return chiaki_ffmpeg_decoder_video_sample_iov_cb(iov, iov_count, decoder);
+	}
+
+	for(size_t i=0; i<iov_count; i++)
+	{
+		if(decoder->slices_buf_len + iov[i].size > decoder->slices_buf_size)
+		{
+			size_t buf_size = decoder->slices_buf_size + decoder->slices_buf_size / 2;
+			if(buf_size < decoder->slices_buf_len + iov[i].size)
+				buf_size = decoder->slices_buf_len + iov[i].size;
+			uint8_t *buf = realloc(decoder->slices_buf, buf_size);
+			if(!buf)
+			{
+				CHIAKI_LOGE(decoder->log, "Failed to grow slices buffer");
+				decoder->slices_buf_len = 0;
+				return false;
+			}
+			decoder->slices_buf = buf;
+			decoder->slices_buf_size = buf_size;
+		}
+		memcpy(decoder->slices_buf + decoder->slices_buf_len, iov[i].buf, iov[i].size);
+		decoder->slices_buf_len += iov[i].size;
+	}
+
+	if(!frame_end)
+		return true;
+
+	bool r = true;
+	if(iov_count || decoder->slices_buf_len)
+	{
+		ChiakiVideoSampleIOV frame = { decoder->slices_buf, decoder->slices_buf_len };
+		r = chiaki_ffmpeg_decoder_video_sample_iov_cb(&frame, 1, decoder);
+	}
+	decoder->slices_buf_len = 0;
+	return r;
 }
 
 static AVFrame *pull_from_hw(ChiakiFfmpegDecoder *decoder, AVFrame *hw_frame)
@@ -160,52 +452,130 @@ static AVFrame *pull_from_hw(ChiakiFfmpegDecoder *decoder, AVFrame *hw_frame)
 	if(av_hwframe_transfer_data(sw_frame, hw_frame, 0) < 0)
 	{
 		CHIAKI_LOGE(decoder->log, "Failed to transfer frame from hardware");
-		av_frame_unref(sw_frame);
-		sw_frame = NULL;
+		av_frame_free(&sw_frame);
 	}
 	av_frame_unref(hw_frame);
 	return sw_frame;
 }
 
-CHIAKI_EXPORT AVFrame *chiaki_ffmpeg_decoder_pull_frame(ChiakiFfmpegDecoder *decoder)
+/**
+ * Pass on everything the codec has finished, keeping only the newest frame for chiaki_ffmpeg_decoder_pull_frame().
+ * @return number of frames received
+ */
+static size_t ffmpeg_decoder_receive_frames(ChiakiFfmpegDecoder *decoder)
 {
-	chiaki_mutex_lock(&decoder->mutex);
-	// always try to pull as much as possible and return only the very last frame
-	AVFrame *frame_last = NULL;
-	AVFrame *frame = NULL;
+	size_t count = 0;
 	while(true)
 	{
-		AVFrame *next_frame;
-		if(frame_last)
-		{
-			av_frame_unref(frame_last);
-			next_frame = frame_last;
-		}
-		else
+		AVFrame *frame = av_frame_alloc();
+		if(!frame)
 		{
-			next_frame = av_frame_alloc();
-			if(!next_frame)
-				break;
+			CHIAKI_LOGE(decoder->log, "Failed to alloc AVFrame");
+			break;
 		}
-		frame_last = frame;
-		frame = next_frame;
 		int r = avcodec_receive_frame(decoder->codec_context, frame);
-		if(!r)
-			frame = decoder->hw_device_ctx ? pull_from_hw(decoder, frame) : frame;
-		else
+		if(r)
 		{
 			if(r != AVERROR(EAGAIN))
 				CHIAKI_LOGE(decoder->log, "Decoding with FFMPEG failed");
 			av_frame_free(&frame);
-			frame = frame_last;
 			break;
 		}
+		if(decoder->hw_device_ctx)
+		{
+			AVFrame *sw_frame = pull_from_hw(decoder, frame);
+			av_frame_free(&frame);
+			if(!sw_frame)
+				continue;
+			frame = sw_frame;
+		}
+		count++;
+
+		chiaki_mutex_lock(&decoder->mutex);
+		AVFrame *frame_prev = decoder->frame_latest;
+		decoder->frame_latest = frame;
+		decoder->stats.frames_decoded++;
+		if(frame_prev)
+			decoder->stats.frames_replaced++;
+		chiaki_mutex_unlock(&decoder->mutex);
+		av_frame_free(&frame_prev);
 	}
-	chiaki_mutex_unlock(&decoder->mutex);
+	return count;
+}
+
+static void ffmpeg_decoder_decode(ChiakiFfmpegDecoder *decoder, AVPacket *packet)
+{
+	size_t frames_count = 0;
+	int r;
+	while((r = avcodec_send_packet(decoder->codec_context, packet)) == AVERROR(EAGAIN))
+	{
+		// the codec wants its output to be taken first
+		size_t received = ffmpeg_decoder_receive_frames(decoder);
+		if(!received)
+		{
+			CHIAKI_LOGE(decoder->log, "AVCodec internal buffer is full, but no frame could be pulled");
+			break;
+		}
+		frames_count += received;
+	}
+	if(r && r != AVERROR(EAGAIN))
+	{
+		char errbuf[128];
+		av_make_error_string(errbuf, sizeof(errbuf), r);
+		CHIAKI_LOGE(decoder->log, "Failed to push frame: %s", errbuf);
+	}
+	frames_count += ffmpeg_decoder_receive_frames(decoder);
 
+	if(frames_count)
+		decoder->frame_available_cb(decoder, decoder->frame_available_cb_user);
+}
+
+static void *ffmpeg_decoder_thread_func(void *user)
+{
+	ChiakiFfmpegDecoder *decoder = user;
+	AVPacket *packet;
+	while(chiaki_spsc_queue_pop_wait(&decoder->packet_queue, &packet, UINT64_MAX) == CHIAKI_ERR_SUCCESS)
+	{
+		if(!packet)
+		{
+			avcodec_flush_buffers(decoder->codec_context);
+			continue;
+		}
+		uint64_t start_us = chiaki_time_now_monotonic_us();
+		ffmpeg_decoder_decode(decoder, packet);
+		av_packet_free(&packet);
+		uint64_t time_us = chiaki_time_now_monotonic_us() - start_us;
+
+		chiaki_mutex_lock(&decoder->mutex);
+		ChiakiFfmpegDecoderStats *stats = &decoder->stats;
+		stats->decode_time_avg_us = stats->packets_decoded
+			? (stats->decode_time_avg_us * 15 + time_us) / 16
+			: time_us;
+		if(time_us > stats->decode_time_max_us)
+			stats->decode_time_max_us = time_us;
+		stats->packets_decoded++;
+		chiaki_mutex_unlock(&decoder->mutex);
+	}
+	return NULL;
+}
+
+CHIAKI_EXPORT AVFrame *chiaki_ffmpeg_decoder_pull_frame(ChiakiFfmpegDecoder *decoder)
+{
+	chiaki_mutex_lock(&decoder->mutex);
+	AVFrame *frame = decoder->frame_latest;
+	decoder->frame_latest = NULL;
+	chiaki_mutex_unlock(&decoder->mutex);
 	return frame;
 }
 
+CHIAKI_EXPORT void chiaki_ffmpeg_decoder_get_stats(ChiakiFfmpegDecoder *decoder, ChiakiFfmpegDecoderStats *stats)
+{
+	chiaki_mutex_lock(&decoder->mutex);
+	*stats = decoder->stats;
+	chiaki_mutex_unlock(&decoder->mutex);
+	stats->queue_depth = chiaki_spsc_queue_depth(&decoder->packet_queue);
+}
+
 CHIAKI_EXPORT enum AVPixelFormat chiaki_ffmpeg_decoder_get_pixel_format(ChiakiFfmpegDecoder *decoder)
 {
 	// TODO: this is probably very wrong, especially for hdr
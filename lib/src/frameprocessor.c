@@ -32,14 +32,29 @@ CHIAKI_EXPORT uint64_t chiaki_stream_stats_bitrate(ChiakiStreamStats *stats, uin
 	return (stats->bytes * 8 * framerate) / stats->frames;
 }
 
-#define UNIT_SLOTS_MAX 256
+#define UNIT_SLOTS_MAX CHIAKI_FEC_UNITS_MAX
 
 struct chiaki_frame_unit_t
 {
 	size_t data_size;
 };
 
-CHIAKI_EXPORT void chiaki_frame_processor_init(ChiakiFrameProcessor *frame_processor, ChiakiLog *log)
+static inline bool unit_bit(const uint64_t *bitmap, size_t i)
+{
+	return (bitmap[i / 64] >> (i % 64)) & 1;
+}
+
+static inline void unit_bit_set(uint64_t *bitmap, size_t i)
+{
+	bitmap[i / 64] |= 1ull << (i % 64);
+}
+
+static inline void unit_bit_clear(uint64_t *bitmap, size_t i)
+{
+	bitmap[i / 64] &= ~(1ull << (i % 64));
+}
+
+CHIAKI_EXPORT void chiaki_frame_processor_init(ChiakiFrameProcessor *frame_processor, ChiakiLog *log, ChiakiFEC *fec)
 {
 	frame_processor->log = log;
 	frame_processor->frame_buf = NULL;
@@ -52,8 +67,15 @@ CHIAKI_EXPORT void chiaki_frame_processor_init(ChiakiFrameProcessor *frame_proce
 	frame_processor->units_fec_received = 0;
 	frame_processor->unit_slots = NULL;
 	frame_processor->unit_slots_size = 0;
+	memset(frame_processor->units_received_bitmap, 0, sizeof(frame_processor->units_received_bitmap));
+	memset(frame_processor->units_syndrome_bitmap, 0, sizeof(frame_processor->units_syndrome_bitmap));
+	memset(frame_processor->units_recovered_bitmap, 0, sizeof(frame_processor->units_recovered_bitmap));
 	frame_processor->flushed = true;
 	chiaki_stream_stats_reset(&frame_processor->stream_stats);
+	frame_processor->fec = fec;
+	frame_processor->fec_incremental = true;
+	frame_processor->fec_syndromes_count = 0;
+	frame_processor->fec_recovered = false;
 }
 
 CHIAKI_EXPORT void chiaki_frame_processor_fini(ChiakiFrameProcessor *frame_processor)
@@ -62,6 +84,24 @@ CHIAKI_EXPORT void chiaki_frame_processor_fini(ChiakiFrameProcessor *frame_proce
 	free(frame_processor->unit_slots);
 }
 
+CHIAKI_EXPORT ChiakiErrorCode chiaki_frame_processor_reserve(ChiakiFrameProcessor *frame_processor, size_t frame_buf_size)
+{
+	if(frame_processor->frame_buf && frame_processor->frame_buf_size >= frame_buf_size)
+		return CHIAKI_ERR_SUCCESS;
+	if(frame_buf_size > SIZE_MAX - CHIAKI_VIDEO_BUFFER_PADDING_SIZE)
+		return CHIAKI_ERR_OVERFLOW;
+	// contents don't have to be kept, so no realloc
+	free(frame_processor->frame_buf);
+	frame_processor->frame_buf = malloc(frame_buf_size + CHIAKI_VIDEO_BUFFER_PADDING_SIZE);
+	if(!frame_processor->frame_buf)
+	{
+		frame_processor->frame_buf_size = 0;
+		return CHIAKI_ERR_MEMORY;
+	}
+	frame_processor->frame_buf_size = frame_buf_size;
+	return CHIAKI_ERR_SUCCESS;
+}
+
 CHIAKI_EXPORT ChiakiErrorCode chiaki_frame_processor_alloc_frame(ChiakiFrameProcessor *frame_processor, ChiakiTakionAVPacket *packet)
 {
 	if(packet->units_in_frame_total < packet->units_in_frame_fec)
@@ -71,6 +111,10 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_frame_processor_alloc_frame(ChiakiFrameProc
 	}
 
 	frame_processor->flushed = false;
+	frame_processor->unit_slots_size = 0; // until the buffers are ready
+	memset(frame_processor->units_received_bitmap, 0, sizeof(frame_processor->units_received_bitmap));
+	memset(frame_processor->units_syndrome_bitmap, 0, sizeof(frame_processor->units_syndrome_bitmap));
+	memset(frame_processor->units_recovered_bitmap, 0, sizeof(frame_processor->units_recovered_bitmap));
 	frame_processor->units_source_expected = packet->units_in_frame_total - packet->units_in_frame_fec;
 	frame_processor->units_fec_expected = packet->units_in_frame_fec;
 	if(frame_processor->units_fec_expected < 1)
@@ -96,6 +140,8 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_frame_processor_alloc_frame(ChiakiFrameProc
 
 	frame_processor->units_source_received = 0;
 	frame_processor->units_fec_received = 0;
+	frame_processor->fec_syndromes_count = 0;
+	frame_processor->fec_recovered = false;
 
 	size_t unit_slots_size_required = frame_processor->units_source_expected + frame_processor->units_fec_expected;
 	if(unit_slots_size_required > UNIT_SLOTS_MAX)
@@ -103,51 +149,135 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_frame_processor_alloc_frame(ChiakiFrameProc
 		CHIAKI_LOGE(frame_processor->log, "Packet suggests more than %u unit slots", UNIT_SLOTS_MAX);
 		return CHIAKI_ERR_INVALID_DATA;
 	}
-	if(unit_slots_size_required != frame_processor->unit_slots_size)
+	if(!frame_processor->unit_slots)
 	{
-		void *new_ptr = NULL;
-		if(frame_processor->unit_slots)
+		frame_processor->unit_slots = malloc(UNIT_SLOTS_MAX * sizeof(ChiakiFrameUnit));
+		if(!frame_processor->unit_slots)
+			return CHIAKI_ERR_MEMORY;
+	}
+	frame_processor->unit_slots_size = 0;
+
+	if(unit_slots_size_required > SIZE_MAX / frame_processor->buf_stride_per_unit)
+		return CHIAKI_ERR_OVERFLOW;
+	size_t frame_buf_size_required = unit_slots_size_required * frame_processor->buf_stride_per_unit;
+	if(frame_processor->frame_buf_size < frame_buf_size_required)
+	{
+		// grow geometrically so a series of growing frames doesn't allocate every time
+		size_t frame_buf_size = frame_processor->frame_buf_size + frame_processor->frame_buf_size / 2;
+		if(frame_buf_size < frame_buf_size_required)
+			frame_buf_size = frame_buf_size_required;
+		ChiakiErrorCode err = chiaki_frame_processor_reserve(frame_processor, frame_buf_size);
+		if(err != CHIAKI_ERR_SUCCESS)
+			return err;
+	}
+	// units are zero-padded when they are put and erased units are fully written by FEC, so no need to clear anything here
+	frame_processor->unit_slots_size = unit_slots_size_required;
+
+	return CHIAKI_ERR_SUCCESS;
+}
+
+static void chiaki_frame_processor_restore_unit_sizes(ChiakiFrameProcessor *frame_processor)
+{
+	for(size_t i=0; i<frame_processor->units_source_expected; i++)
+	{
+		ChiakiFrameUnit *slot = frame_processor->unit_slots + i;
+		uint8_t *buf_ptr = frame_processor->frame_buf + frame_processor->buf_stride_per_unit * i;
+		uint16_t padding = ntohs(*((chiaki_unaligned_uint16_t *)buf_ptr));
+		if(padding >= frame_processor->buf_size_per_unit)
 		{
-			new_ptr = realloc(frame_processor->unit_slots, unit_slots_size_required * sizeof(ChiakiFrameUnit));
-			if(!new_ptr)
-				free(frame_processor->unit_slots);
+			CHIAKI_LOGE(frame_processor->log, "Padding in unit (%#x) is larger or equals to the whole unit size (%#llx)",
+						(unsigned int)padding, frame_processor->buf_size_per_unit);
+			chiaki_log_hexdump(frame_processor->log, CHIAKI_LOG_DEBUG, buf_ptr, 0x50);
+			continue;
 		}
-		else
-			new_ptr = malloc(unit_slots_size_required * sizeof(ChiakiFrameUnit));
+		slot->data_size = frame_processor->buf_size_per_unit - padding;
+		unit_bit_set(frame_processor->units_received_bitmap, i);
+	}
+}
 
-		frame_processor->unit_slots = new_ptr;
-		if(!new_ptr)
+static void chiaki_frame_processor_fec_solve(ChiakiFrameProcessor *frame_processor)
+{
+	unsigned int erasures[UNIT_SLOTS_MAX];
+	unsigned int syndromes[UNIT_SLOTS_MAX];
+	size_t erasures_count = 0;
+	size_t syndromes_count = 0;
+	size_t units_total = frame_processor->units_source_expected + frame_processor->units_fec_expected;
+	for(size_t i=0; i<units_total; i++)
+	{
+		if(i < frame_processor->units_source_expected)
 		{
-			frame_processor->unit_slots_size = 0;
-			return CHIAKI_ERR_MEMORY;
+			if(!unit_bit(frame_processor->units_received_bitmap, i))
+				erasures[erasures_count++] = (unsigned int)i;
 		}
-		else
-			frame_processor->unit_slots_size = unit_slots_size_required;
+		else if(unit_bit(frame_processor->units_syndrome_bitmap, i))
+			syndromes[syndromes_count++] = (unsigned int)i;
 	}
-	memset(frame_processor->unit_slots, 0, frame_processor->unit_slots_size * sizeof(ChiakiFrameUnit));
+	assert(syndromes_count >= erasures_count);
 
-	if(frame_processor->unit_slots_size > SIZE_MAX / frame_processor->buf_stride_per_unit)
-		return CHIAKI_ERR_OVERFLOW;
-	size_t frame_buf_size_required = frame_processor->unit_slots_size * frame_processor->buf_stride_per_unit;
-	if(frame_processor->frame_buf_size < frame_buf_size_required)
+	ChiakiErrorCode err = chiaki_fec_recover_from_syndromes(frame_processor->fec, frame_processor->frame_buf,
+			frame_processor->buf_size_per_unit, frame_processor->buf_stride_per_unit,
+			frame_processor->units_source_expected, frame_processor->units_fec_expected,
+			syndromes, erasures, erasures_count);
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGE(frame_processor->log, "Incremental FEC failed");
+		return;
+	}
+
+	CHIAKI_LOGI(frame_processor->log, "Frame Processor recovered %llu missing units incrementally",
+			(unsigned long long)erasures_count);
+	for(size_t i=0; i<erasures_count; i++)
+		unit_bit_set(frame_processor->units_recovered_bitmap, erasures[i]);
+	chiaki_frame_processor_restore_unit_sizes(frame_processor);
+	frame_processor->fec_recovered = true;
+}
+
+/**
+ * Update the syndromes with a unit that has just been put into its slot and recover once there are enough.
+ */
+static void chiaki_frame_processor_fec_unit(ChiakiFrameProcessor *frame_processor, unsigned int unit_index)
+{
+	unsigned int k = frame_processor->units_source_expected;
+	unsigned int m = frame_processor->units_fec_expected;
+	size_t unit_size = frame_processor->buf_size_per_unit;
+	size_t stride = frame_processor->buf_stride_per_unit;
+	uint8_t *unit_buf = frame_processor->frame_buf + stride * unit_index;
+	unsigned int missing = k - frame_processor->units_source_received;
+
+	if(unit_index < k)
 	{
-		free(frame_processor->frame_buf);
-		frame_processor->frame_buf = malloc(frame_buf_size_required + CHIAKI_VIDEO_BUFFER_PADDING_SIZE);
-		if(!frame_processor->frame_buf)
+		// late source unit, remove it from the syndromes we have so far
+		if(!frame_processor->fec_syndromes_count)
+			return;
+		for(unsigned int i=k; i<k+m; i++)
 		{
-			frame_processor->frame_buf_size = 0;
-			return CHIAKI_ERR_MEMORY;
+			if(unit_bit(frame_processor->units_syndrome_bitmap, i))
+				chiaki_fec_syndrome_add(frame_processor->fec, frame_processor->frame_buf + stride * i,
+						unit_buf, unit_size, k, m, i, unit_index);
 		}
-		frame_processor->frame_buf_size = frame_buf_size_required;
 	}
-	memset(frame_processor->frame_buf, 0, frame_buf_size_required + CHIAKI_VIDEO_BUFFER_PADDING_SIZE);
+	else
+	{
+		// no loss so far or enough syndromes already, keep the fec unit as it is
+		if(!missing || frame_processor->fec_syndromes_count >= missing)
+			return;
+		for(unsigned int i=0; i<k; i++)
+		{
+			if(unit_bit(frame_processor->units_received_bitmap, i))
+				chiaki_fec_syndrome_add(frame_processor->fec, unit_buf,
+						frame_processor->frame_buf + stride * i, unit_size, k, m, unit_index, i);
+		}
+		unit_bit_set(frame_processor->units_syndrome_bitmap, unit_index);
+		frame_processor->fec_syndromes_count++;
+	}
 
-	return CHIAKI_ERR_SUCCESS;
+	if(missing && frame_processor->fec_syndromes_count >= missing)
+		chiaki_frame_processor_fec_solve(frame_processor);
 }
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_frame_processor_put_unit(ChiakiFrameProcessor *frame_processor, ChiakiTakionAVPacket *packet)
 {
-	if(packet->unit_index > frame_processor->unit_slots_size)
+	if(packet->unit_index >= frame_processor->unit_slots_size)
 	{
 		CHIAKI_LOGE(frame_processor->log, "Packet's unit index is too high");
 		return CHIAKI_ERR_INVALID_DATA;
@@ -165,19 +295,34 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_frame_processor_put_unit(ChiakiFrameProcess
 		return CHIAKI_ERR_INVALID_DATA;
 	}
 
-	ChiakiFrameUnit *unit = frame_processor->unit_slots + packet->unit_index;
-	if(unit->data_size)
+	if(frame_processor->fec_recovered && packet->unit_index < frame_processor->units_source_expected)
+	{
+		// already recovered, only count its first arrival
+		if(!unit_bit(frame_processor->units_recovered_bitmap, packet->unit_index))
+		{
+			CHIAKI_LOGW(frame_processor->log, "Received duplicate unit");
+			return CHIAKI_ERR_INVALID_DATA;
+		}
+		unit_bit_clear(frame_processor->units_recovered_bitmap, packet->unit_index);
+		frame_processor->units_source_received++;
+		return CHIAKI_ERR_SUCCESS;
+	}
+
+	if(unit_bit(frame_processor->units_received_bitmap, packet->unit_index))
 	{
 		CHIAKI_LOGW(frame_processor->log, "Received duplicate unit");
 		return CHIAKI_ERR_INVALID_DATA;
 	}
 
+	ChiakiFrameUnit *unit = frame_processor->unit_slots + packet->unit_index;
 	unit->data_size = packet->data_size;
+	unit_bit_set(frame_processor->units_received_bitmap, packet->unit_index);
 	if(!frame_processor->flushed)
 	{
-		memcpy(frame_processor->frame_buf + packet->unit_index * frame_processor->buf_stride_per_unit,
-				packet->data,
-				packet->data_size);
+		uint8_t *buf_ptr = frame_processor->frame_buf + packet->unit_index * frame_processor->buf_stride_per_unit;
+		memcpy(buf_ptr, packet->data, packet->data_size);
+		// FEC works on units zero-padded to the full size, the buffer may still hold data of a previous frame
+		memset(buf_ptr + packet->data_size, 0, frame_processor->buf_size_per_unit - packet->data_size);
 	}
 
 	if(packet->unit_index < frame_processor->units_source_expected)
@@ -185,6 +330,9 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_frame_processor_put_unit(ChiakiFrameProcess
 	else
 		frame_processor->units_fec_received++;
 
+	if(frame_processor->fec_incremental && !frame_processor->flushed && !frame_processor->fec_recovered)
+		chiaki_frame_processor_fec_unit(frame_processor, packet->unit_index);
+
 	return CHIAKI_ERR_SUCCESS;
 }
 
@@ -192,7 +340,7 @@ CHIAKI_EXPORT void chiaki_frame_processor_report_packet_stats(ChiakiFrameProcess
 {
 	uint64_t received = frame_processor->units_source_received + frame_processor->units_fec_received;
 	uint64_t expected = frame_processor->units_source_expected + frame_processor->units_fec_expected;
-	chiaki_packet_stats_push_generation(packet_stats, received, expected - received);
+	chiaki_packet_stats_push_generation(packet_stats, received, expected > received ? expected - received : 0);
 }
 
 static ChiakiErrorCode chiaki_frame_processor_fec(ChiakiFrameProcessor *frame_processor)
@@ -204,21 +352,17 @@ static ChiakiErrorCode chiaki_frame_processor_fec(ChiakiFrameProcessor *frame_pr
 
 	size_t erasures_count = (frame_processor->units_source_expected + frame_processor->units_fec_expected)
 			- (frame_processor->units_source_received + frame_processor->units_fec_received);
-	unsigned int *erasures = calloc(erasures_count, sizeof(unsigned int));
-	if(!erasures)
-		return CHIAKI_ERR_MEMORY;
+	unsigned int erasures[UNIT_SLOTS_MAX];
 
 	size_t erasure_index = 0;
 	for(size_t i=0; i<frame_processor->units_source_expected + frame_processor->units_fec_expected; i++)
 	{
-		ChiakiFrameUnit *slot = frame_processor->unit_slots + i;
-		if(!slot->data_size)
+		if(!unit_bit(frame_processor->units_received_bitmap, i))
 		{
 			if(erasure_index >= erasures_count)
 			{
 				// should never happen by design, but too scary not to check
 				assert(false);
-				free(erasures);
 				return CHIAKI_ERR_UNKNOWN;
 			}
 			erasures[erasure_index++] = (unsigned int)i;
@@ -226,7 +370,7 @@ static ChiakiErrorCode chiaki_frame_processor_fec(ChiakiFrameProcessor *frame_pr
 	}
 	assert(erasure_index == erasures_count);
 
-	ChiakiErrorCode err = chiaki_fec_decode(frame_processor->frame_buf,
+	ChiakiErrorCode err = chiaki_fec_decode(frame_processor->fec, frame_processor->frame_buf,
 			frame_processor->buf_size_per_unit, frame_processor->buf_stride_per_unit,
 			frame_processor->units_source_expected, frame_processor->units_fec_expected,
 			erasures, erasures_count);
@@ -240,71 +384,127 @@ static ChiakiErrorCode chiaki_frame_processor_fec(ChiakiFrameProcessor *frame_pr
 	{
 		err = CHIAKI_ERR_SUCCESS;
 		CHIAKI_LOGI(frame_processor->log, "FEC successful");
-
-		// restore unit sizes
-		for(size_t i=0; i<frame_processor->units_source_expected; i++)
-		{
-			ChiakiFrameUnit *slot = frame_processor->unit_slots + i;
-			uint8_t *buf_ptr = frame_processor->frame_buf + frame_processor->buf_stride_per_unit * i;
-			uint16_t padding = ntohs(*((chiaki_unaligned_uint16_t *)buf_ptr));
-			if(padding >= frame_processor->buf_size_per_unit)
-			{
-				CHIAKI_LOGE(frame_processor->log, "Padding in unit (%#x) is larger or equals to the whole unit size (%#llx)",
-							(unsigned int)padding, frame_processor->buf_size_per_unit);
-				chiaki_log_hexdump(frame_processor->log, CHIAKI_LOG_DEBUG, buf_ptr, 0x50);
-				continue;
-			}
-			slot->data_size = frame_processor->buf_size_per_unit - padding;
-		}
+		chiaki_frame_processor_restore_unit_sizes(frame_processor);
 	}
 
-	free(erasures);
 	return err;
 }
 
-CHIAKI_EXPORT ChiakiFrameProcessorFlushResult chiaki_frame_processor_flush(ChiakiFrameProcessor *frame_processor, uint8_t **frame, size_t *frame_size)
+/**
+ * Complete the frame with FEC if necessary, before its units are handed out.
+ */
+static ChiakiFrameProcessorFlushResult chiaki_frame_processor_flush_fec(ChiakiFrameProcessor *frame_processor)
 {
-	if(frame_processor->units_source_expected == 0 || frame_processor->flushed)
-		return CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FAILED;
-
 	//CHIAKI_LOGD(NULL, "source: %u, fec: %u",
 	//		frame_processor->units_source_expected,
 	//		frame_processor->units_fec_expected);
 
-	ChiakiFrameProcessorFlushResult result = CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_SUCCESS;
-	if(frame_processor->units_source_received < frame_processor->units_source_expected)
+	if(frame_processor->fec_recovered)
+		return CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FEC_SUCCESS;
+	if(frame_processor->units_source_received >= frame_processor->units_source_expected)
+		return CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_SUCCESS;
+	if(frame_processor->fec_syndromes_count)
 	{
-		ChiakiErrorCode err = chiaki_frame_processor_fec(frame_processor);
-		if(err == CHIAKI_ERR_SUCCESS)
-			result = CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FEC_SUCCESS;
-		else
-			result = CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FEC_FAILED;
+		// fec units have already been consumed as syndromes and there were not enough of them
+		CHIAKI_LOGW(frame_processor->log, "Frame Processor received %u+%u / %u+%u units, not enough for FEC",
+				frame_processor->units_source_received, frame_processor->units_fec_received,
+				frame_processor->units_source_expected, frame_processor->units_fec_expected);
+		return CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FEC_FAILED;
 	}
+	ChiakiErrorCode err = chiaki_frame_processor_fec(frame_processor);
+	if(err == CHIAKI_ERR_SUCCESS)
+		return CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FEC_SUCCESS;
+	return CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FEC_FAILED;
+}
+
+CHIAKI_EXPORT uint8_t *chiaki_frame_processor_source_unit(ChiakiFrameProcessor *frame_processor, unsigned int i, size_t *size)
+{
+	if(frame_processor->flushed || i >= frame_processor->units_source_expected
+		|| !unit_bit(frame_processor->units_received_bitmap, i))
+		return NULL;
+	ChiakiFrameUnit *unit = frame_processor->unit_slots + i;
+	if(unit->data_size < 2)
+		return NULL;
+	*size = unit->data_size - 2;
+	return frame_processor->frame_buf + i*frame_processor->buf_stride_per_unit + 2;
+}
+
+/**
+ * Like chiaki_frame_processor_source_unit(), but logging why a unit can't be used
+ */
+static uint8_t *chiaki_frame_processor_unit_payload(ChiakiFrameProcessor *frame_processor, size_t i, size_t *size)
+{
+	uint8_t *payload = chiaki_frame_processor_source_unit(frame_processor, (unsigned int)i, size);
+	if(payload)
+		return payload;
+	if(!unit_bit(frame_processor->units_received_bitmap, i))
+		CHIAKI_LOGW(frame_processor->log, "Missing unit %#llx", (unsigned long long)i);
+	else
+	{
+		CHIAKI_LOGE(frame_processor->log, "Saved unit has size < 2");
+		chiaki_log_hexdump(frame_processor->log, CHIAKI_LOG_VERBOSE, frame_processor->frame_buf + i*frame_processor->buf_stride_per_unit, 0x50);
+	}
+	return NULL;
+}
+
+CHIAKI_EXPORT ChiakiFrameProcessorFlushResult chiaki_frame_processor_flush(ChiakiFrameProcessor *frame_processor, uint8_t **frame, size_t *frame_size)
+{
+	if(frame_processor->units_source_expected == 0 || frame_processor->unit_slots_size == 0 || frame_processor->flushed)
+		return CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FAILED;
+
+	ChiakiFrameProcessorFlushResult result = chiaki_frame_processor_flush_fec(frame_processor);
 
 	size_t cur = 0;
 	for(size_t i=0; i<frame_processor->units_source_expected; i++)
 	{
-		ChiakiFrameUnit *unit = frame_processor->unit_slots + i;
-		if(!unit->data_size)
-		{
-			CHIAKI_LOGW(frame_processor->log, "Missing unit %#llx", (unsigned long long)i);
+		size_t part_size;
+		uint8_t *part = chiaki_frame_processor_unit_payload(frame_processor, i, &part_size);
+		if(!part)
 			continue;
-		}
-		if(unit->data_size < 2)
-		{
-			CHIAKI_LOGE(frame_processor->log, "Saved unit has size < 2");
-			chiaki_log_hexdump(frame_processor->log, CHIAKI_LOG_VERBOSE, frame_processor->frame_buf + i*frame_processor->buf_size_per_unit, 0x50);
-			continue;
-		}
-		size_t part_size = unit->data_size - 2;
-		uint8_t *buf_ptr = frame_processor->frame_buf + i*frame_processor->buf_stride_per_unit;
-		memmove(frame_processor->frame_buf + cur, buf_ptr + 2, part_size);
+		memmove(frame_processor->frame_buf + cur, part, part_size);
 		cur += part_size;
 	}
 
+	// the decoder may read a bit beyond the end of the frame
+	memset(frame_processor->frame_buf + cur, 0, CHIAKI_VIDEO_BUFFER_PADDING_SIZE);
+
 	chiaki_stream_stats_frame(&frame_processor->stream_stats, (uint64_t)cur);
 
+	// units moved around above, so anything arriving late for this frame is only counted
+	frame_processor->flushed = true;
+
 	*frame = frame_processor->frame_buf;
 	*frame_size = cur;
 	return result;
 }
+
+CHIAKI_EXPORT ChiakiFrameProcessorFlushResult chiaki_frame_processor_flush_iov(ChiakiFrameProcessor *frame_processor, ChiakiVideoSampleIOV *iov, size_t *iov_count, size_t *frame_size)
+{
+	if(frame_processor->units_source_expected == 0 || frame_processor->unit_slots_size == 0 || frame_processor->flushed)
+		return CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FAILED;
+
+	ChiakiFrameProcessorFlushResult result = chiaki_frame_processor_flush_fec(frame_processor);
+
+	size_t count = 0;
+	size_t cur = 0;
+	for(size_t i=0; i<frame_processor->units_source_expected; i++)
+	{
+		size_t part_size;
+		uint8_t *part = chiaki_frame_processor_unit_payload(frame_processor, i, &part_size);
+		if(!part || !part_size)
+			continue;
+		iov[count].buf = part;
+		iov[count].size = part_size;
+		count++;
+		cur += part_size;
+	}
+
+	chiaki_stream_stats_frame(&frame_processor->stream_stats, (uint64_t)cur);
+
+	// the frame is out, anything arriving late for it is only counted
+	frame_processor->flushed = true;
+
+	*iov_count = count;
+	*frame_size = cur;
+	return result;
+}
@@ -0,0 +1,223 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include "gf256.h"
+#include "utils.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define GF256_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define GF256_TARGET(t)
+#else
+#define GF256_TARGET(t) __attribute__((target(t)))
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define GF256_NEON
+#include <arm_neon.h>
+#endif
+
+void chiaki_gf256_mul_tables(uint8_t c, uint8_t tables[0x20])
+{
+	// c * x^i for i < 8
+	uint8_t p[8];
+	p[0] = c;
+	for(size_t i=1; i<8; i++)
+		p[i] = chiaki_gf256_mul2(p[i-1]);
+
+	tables[0] = 0;
+	tables[0x10] = 0;
+	for(size_t x=1; x<0x10; x++)
+	{
+		// lowest set bit of x is added to the already known product of the remaining bits
+		size_t b = 0;
+		while(!(x & (1 << b)))
+			b++;
+		size_t rest = x & (x - 1);
+		tables[x] = tables[rest] ^ p[b];
+		tables[0x10 + x] = tables[0x10 + rest] ^ p[4 + b];
+	}
+}
+
+static void gf256_mul_add_scalar(uint8_t *dst, const uint8_t *src, const uint8_t *tables, size_t size)
+{
+	for(size_t i=0; i<size; i++)
+		dst[i] ^= tables[src[i] & 0xf] ^ tables[0x10 + (src[i] >> 4)];
+}
+
+#ifdef GF256_X86
+GF256_TARGET("ssse3")
+static void gf256_mul_add_ssse3(uint8_t *dst, const uint8_t *src, const uint8_t *tables, size_t size)
+{
+	__m128i lo = _mm_loadu_si128((const __m128i *)tables);
+	__m128i hi = _mm_loadu_si128((const __m128i *)(tables + 0x10));
+	__m128i mask = _mm_set1_epi8(0xf);
+	size_t i = 0;
+	for(; i + 0x10 <= size; i += 0x10)
+	{
+		__m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i p = _mm_xor_si128(
+				_mm_shuffle_epi8(lo, _mm_and_si128(s, mask)),
+				_mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi64(s, 4), mask)));
+		__m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(d, p));
+	}
+	gf256_mul_add_scalar(dst + i, src + i, tables, size - i);
+}
+
+GF256_TARGET("avx2")
+static void gf256_mul_add_avx2(uint8_t *dst, const uint8_t *src, const uint8_t *tables, size_t size)
+{
+	__m256i lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)tables));
+	__m256i hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(tables + 0x10)));
+	__m256i mask = _mm256_set1_epi8(0xf);
+	size_t i = 0;
+	for(; i + 0x20 <= size; i += 0x20)
+	{
+		__m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+		__m256i p = _mm256_xor_si256(
+				_mm256_shuffle_epi8(lo, _mm256_and_si256(s, mask)),
+				_mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi64(s, 4), mask)));
+		__m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+		_mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(d, p));
+	}
+	gf256_mul_add_scalar(dst + i, src + i, tables, size - i);
+}
+
+#ifdef _MSC_VER
+static bool gf256_cpu_has_ssse3(void)
+{
+	int info[4];
+	__cpuid(info, 1);
+	return (info[2] & (1 << 9)) != 0;
+}
+
+static bool gf256_cpu_has_avx2(void)
+{
+	int info[4];
+	__cpuid(info, 1);
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	if(!osxsave || !avx || (_xgetbv(0) & 6) != 6) // os must save xmm and ymm state
+		return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+}
+#else
+static bool gf256_cpu_has_ssse3(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("ssse3");
+}
+
+static bool gf256_cpu_has_avx2(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+#endif
+#endif
+
+#ifdef GF256_NEON
+static void gf256_mul_add_neon(uint8_t *dst, const uint8_t *src, const uint8_t *tables, size_t size)
+{
+	uint8x16_t mask = vdupq_n_u8(0xf);
+	size_t i = 0;
+#if defined(__aarch64__) || defined(_M_ARM64)
+	uint8x16_t lo = vld1q_u8(tables);
+	uint8x16_t hi = vld1q_u8(tables + 0x10);
+	for(; i + 0x10 <= size; i += 0x10)
+	{
+		uint8x16_t s = vld1q_u8(src + i);
+		uint8x16_t p = veorq_u8(
+				vqtbl1q_u8(lo, vandq_u8(s, mask)),
+				vqtbl1q_u8(hi, vshrq_n_u8(s, 4)));
+		vst1q_u8(dst + i, veorq_u8(vld1q_u8(dst + i), p));
+	}
+#else
+	uint8x8x2_t lo = { { vld1_u8(tables), vld1_u8(tables + 8) } };
+	uint8x8x2_t hi = { { vld1_u8(tables + 0x10), vld1_u8(tables + 0x18) } };
+	for(; i + 0x10 <= size; i += 0x10)
+	{
+		uint8x16_t s = vld1q_u8(src + i);
+		uint8x16_t sl = vandq_u8(s, mask);
+		uint8x16_t sh = vshrq_n_u8(s, 4);
+		uint8x16_t p = vcombine_u8(
+				veor_u8(vtbl2_u8(lo, vget_low_u8(sl)), vtbl2_u8(hi, vget_low_u8(sh))),
+				veor_u8(vtbl2_u8(lo, vget_high_u8(sl)), vtbl2_u8(hi, vget_high_u8(sh))));
+		vst1q_u8(dst + i, veorq_u8(vld1q_u8(dst + i), p));
+	}
+#endif
+	gf256_mul_add_scalar(dst + i, src + i, tables, size - i);
+}
+#endif
+
+bool chiaki_gf256_backend_supported(ChiakiFECBackend backend)
+{
+	switch(backend)
+	{
+		case CHIAKI_FEC_BACKEND_JERASURE:
+		case CHIAKI_FEC_BACKEND_SCALAR:
+			return true;
+#ifdef GF256_X86
+		case CHIAKI_FEC_BACKEND_SSSE3:
+			return gf256_cpu_has_ssse3();
+		case CHIAKI_FEC_BACKEND_AVX2:
+			return gf256_cpu_has_avx2();
+#endif
+#ifdef GF256_NEON
+		case CHIAKI_FEC_BACKEND_NEON:
+			return true;
+#endif
+		default:
+			return false;
+	}
+}
+
+ChiakiFECBackend chiaki_gf256_backend_best(void)
+{
+	static const ChiakiFECBackend preferred[] = {
+		CHIAKI_FEC_BACKEND_AVX2,
+		CHIAKI_FEC_BACKEND_SSSE3,
+		CHIAKI_FEC_BACKEND_NEON
+	};
+	for(size_t i=0; i<sizeof(preferred) / sizeof(preferred[0]); i++)
+	{
+		if(chiaki_gf256_backend_supported(preferred[i]))
+			return preferred[i];
+	}
+	return CHIAKI_FEC_BACKEND_SCALAR;
+}
+
+void chiaki_gf256_mul_add(ChiakiFECBackend backend, uint8_t *dst, const uint8_t *src, uint8_t c, size_t size)
+{
+	if(!c)
+		return;
+	if(c == 1)
+	{
+		xor_bytes(dst, src, size);
+		return;
+	}
+
+	uint8_t tables[0x20];
+	chiaki_gf256_mul_tables(c, tables);
+	switch(backend)
+	{
+#ifdef GF256_X86
+		case CHIAKI_FEC_BACKEND_SSSE3:
+			gf256_mul_add_ssse3(dst, src, tables, size);
+			break;
+		case CHIAKI_FEC_BACKEND_AVX2:
+			gf256_mul_add_avx2(dst, src, tables, size);
+			break;
+#endif
+#ifdef GF256_NEON
+		case CHIAKI_FEC_BACKEND_NEON:
+			gf256_mul_add_neon(dst, src, tables, size);
+			break;
+#endif
+		default:
+			gf256_mul_add_scalar(dst, src, tables, size);
+			break;
+	}
+}
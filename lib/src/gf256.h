@@ -0,0 +1,64 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_GF256_H
+#define CHIAKI_GF256_H
+
+#include <chiaki/fec.h>
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * Arithmetic in GF(2^8) with the polynomial x^8 + x^4 + x^3 + x^2 + 1 (0x11d),
+ * the same field jerasure uses for CHIAKI_FEC_WORDSIZE 8.
+ */
+
+static inline uint8_t chiaki_gf256_mul2(uint8_t a)
+{
+	return (uint8_t)((a << 1) ^ ((a & 0x80) ? 0x1d : 0));
+}
+
+static inline uint8_t chiaki_gf256_mul(uint8_t a, uint8_t b)
+{
+	uint8_t r = 0;
+	while(b)
+	{
+		if(b & 1)
+			r ^= a;
+		a = chiaki_gf256_mul2(a);
+		b >>= 1;
+	}
+	return r;
+}
+
+/**
+ * @return multiplicative inverse of a, which must not be 0
+ */
+static inline uint8_t chiaki_gf256_inv(uint8_t a)
+{
+	// a^254 = a^-1
+	uint8_t r = 1;
+	for(size_t i=0; i<7; i++)
+	{
+		a = chiaki_gf256_mul(a, a);
+		r = chiaki_gf256_mul(r, a);
+	}
+	return r;
+}
+
+/**
+ * Build the split tables for multiplying by c:
+ * tables[x] = c * x and tables[0x10 + x] = c * (x << 4) for x < 0x10
+ */
+void chiaki_gf256_mul_tables(uint8_t c, uint8_t tables[0x20]);
+
+/**
+ * dst ^= c * src, using the given native backend
+ */
+void chiaki_gf256_mul_add(ChiakiFECBackend backend, uint8_t *dst, const uint8_t *src, uint8_t c, size_t size);
+
+ChiakiFECBackend chiaki_gf256_backend_best(void);
+bool chiaki_gf256_backend_supported(ChiakiFECBackend backend);
+
+#endif // CHIAKI_GF256_H
@@ -2,6 +2,7 @@
 
 #include <chiaki/gkcrypt.h>
 #include <chiaki/session.h>
+#include <chiaki/time.h>
 
 #include <string.h>
 #include <assert.h>
@@ -18,10 +19,30 @@
 #endif
 
 #include "utils.h"
+#include "atomic_utils.h"
 
 #define KEY_BUF_CHUNK_SIZE 0x1000
+#define KEY_STREAM_STACK_SIZE 0x400
+
+// how long the key buf thread may take to wake up and refill before the consumer catches up
+#define KEY_BUF_REFILL_LATENCY_MS 8
+// timeout for the key buf thread, just in case
+#define KEY_BUF_THREAD_WAIT_MS 100
+
+#ifdef CHIAKI_LIB_ENABLE_MBEDTLS
+typedef mbedtls_aes_context GKCryptAESCtx;
+typedef mbedtls_gcm_context GKCryptGCMCtx;
+#define GKCRYPT_CTX(ctx) (&(ctx))
+#else
+typedef EVP_CIPHER_CTX GKCryptAESCtx;
+typedef EVP_CIPHER_CTX GKCryptGCMCtx;
+#define GKCRYPT_CTX(ctx) (ctx)
+#endif
 
 static ChiakiErrorCode gkcrypt_gen_key_iv(ChiakiGKCrypt *gkcrypt, uint8_t index, const uint8_t *handshake_key, const uint8_t *ecdh_secret);
+static ChiakiErrorCode gkcrypt_ctxs_init(ChiakiGKCrypt *gkcrypt);
+static void gkcrypt_ctxs_fini(ChiakiGKCrypt *gkcrypt);
+static ChiakiErrorCode gkcrypt_gen_key_stream_ctx(GKCryptAESCtx *ctx, const uint8_t *iv, uint64_t key_pos, uint8_t *buf, size_t buf_size);
 
 static void *gkcrypt_thread_func(void *user);
 
@@ -31,11 +52,16 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_init(ChiakiGKCrypt *gkcrypt, Chiaki
 	gkcrypt->index = index;
 
 	gkcrypt->key_buf_size = key_buf_chunks * KEY_BUF_CHUNK_SIZE;
-	gkcrypt->key_buf_populated = 0;
-	gkcrypt->key_buf_key_pos_min = 0;
-	gkcrypt->key_buf_start_offset = 0;
+	gkcrypt->key_buf_start = 0;
+	gkcrypt->key_buf_head = 0;
+	gkcrypt->key_buf_read_min = 0;
 	gkcrypt->last_key_pos = 0;
-	gkcrypt->key_buf_thread_stop = false;
+	gkcrypt->key_buf_refill_threshold = 2 * KEY_BUF_CHUNK_SIZE;
+	gkcrypt->key_buf_thread_waiting = 0;
+	gkcrypt->key_buf_thread_stop = 0;
+	gkcrypt->key_buf_misses = 0;
+	gkcrypt->key_buf_late = 0;
+	gkcrypt->ctxs_ready = false;
 
 	ChiakiErrorCode err;
 	if(gkcrypt->key_buf_size)
@@ -70,17 +96,32 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_init(ChiakiGKCrypt *gkcrypt, Chiaki
 	gkcrypt->key_gmac_index_current = 0;
 	memcpy(gkcrypt->key_gmac_current, gkcrypt->key_gmac_base, sizeof(gkcrypt->key_gmac_current));
 
+	err = chiaki_mutex_init(&gkcrypt->ctx_mutex, false);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_key_buf_cond;
+
+	err = gkcrypt_ctxs_init(gkcrypt);
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGE(gkcrypt->log, "GKCrypt failed to set up cipher contexts");
+		goto error_ctx_mutex;
+	}
+
 	if(gkcrypt->key_buf)
 	{
 		err = chiaki_thread_create(&gkcrypt->key_buf_thread, gkcrypt_thread_func, gkcrypt);
 		if(err != CHIAKI_ERR_SUCCESS)
-			goto error_key_buf_cond;
+			goto error_ctxs;
 
 		chiaki_thread_set_name(&gkcrypt->key_buf_thread, "Chiaki GKCrypt");
 	}
 
 	return CHIAKI_ERR_SUCCESS;
 
+error_ctxs:
+	gkcrypt_ctxs_fini(gkcrypt);
+error_ctx_mutex:
+	chiaki_mutex_fini(&gkcrypt->ctx_mutex);
 error_key_buf_cond:
 	if(gkcrypt->key_buf)
 		chiaki_cond_fini(&gkcrypt->key_buf_cond);
@@ -98,14 +139,198 @@ CHIAKI_EXPORT void chiaki_gkcrypt_fini(ChiakiGKCrypt *gkcrypt)
 	if(gkcrypt->key_buf)
 	{
 		chiaki_mutex_lock(&gkcrypt->key_buf_mutex);
-		gkcrypt->key_buf_thread_stop = true;
-		chiaki_mutex_unlock(&gkcrypt->key_buf_mutex);
+		chiaki_atomic_store_32(&gkcrypt->key_buf_thread_stop, 1);
 		chiaki_cond_signal(&gkcrypt->key_buf_cond);
+		chiaki_mutex_unlock(&gkcrypt->key_buf_mutex);
 		chiaki_thread_join(&gkcrypt->key_buf_thread, NULL);
+		if(gkcrypt->key_buf_misses || gkcrypt->key_buf_late)
+			CHIAKI_LOGI(gkcrypt->log, "GKCrypt %d key buf: %llu misses, %llu late requests",
+					(int)gkcrypt->index,
+					(unsigned long long)gkcrypt->key_buf_misses,
+					(unsigned long long)gkcrypt->key_buf_late);
 		chiaki_cond_fini(&gkcrypt->key_buf_cond);
 		chiaki_mutex_fini(&gkcrypt->key_buf_mutex);
 		chiaki_aligned_free(gkcrypt->key_buf);
 	}
+	gkcrypt_ctxs_fini(gkcrypt);
+	chiaki_mutex_fini(&gkcrypt->ctx_mutex);
+}
+
+#ifdef CHIAKI_LIB_ENABLE_MBEDTLS
+static ChiakiErrorCode gkcrypt_aes_ctx_init(GKCryptAESCtx *ctx, const uint8_t *key)
+{
+	mbedtls_aes_init(ctx);
+	if(mbedtls_aes_setkey_enc(ctx, key, 128) != 0)
+	{
+		mbedtls_aes_free(ctx);
+		return CHIAKI_ERR_UNKNOWN;
+	}
+	return CHIAKI_ERR_SUCCESS;
+}
+
+static void gkcrypt_aes_ctx_fini(GKCryptAESCtx *ctx)
+{
+	mbedtls_aes_free(ctx);
+}
+
+static ChiakiErrorCode gkcrypt_gcm_ctx_init(GKCryptGCMCtx *ctx)
+{
+	mbedtls_gcm_init(ctx);
+	return CHIAKI_ERR_SUCCESS;
+}
+
+static void gkcrypt_gcm_ctx_fini(GKCryptGCMCtx *ctx)
+{
+	mbedtls_gcm_free(ctx);
+}
+
+static ChiakiErrorCode gkcrypt_gcm_ctx_set_key(GKCryptGCMCtx *ctx, const uint8_t *key)
+{
+	if(mbedtls_gcm_setkey(ctx, MBEDTLS_CIPHER_ID_AES, key, CHIAKI_GKCRYPT_BLOCK_SIZE * 8) != 0)
+		return CHIAKI_ERR_UNKNOWN;
+	return CHIAKI_ERR_SUCCESS;
+}
+#else
+static ChiakiErrorCode gkcrypt_aes_ctx_init(GKCryptAESCtx **ctx, const uint8_t *key)
+{
+	*ctx = EVP_CIPHER_CTX_new();
+	if(!*ctx)
+		return CHIAKI_ERR_MEMORY;
+
+	if(!EVP_EncryptInit_ex(*ctx, EVP_aes_128_ecb(), NULL, key, NULL)
+		|| !EVP_CIPHER_CTX_set_padding(*ctx, 0))
+	{
+		EVP_CIPHER_CTX_free(*ctx);
+		*ctx = NULL;
+		return CHIAKI_ERR_UNKNOWN;
+	}
+	return CHIAKI_ERR_SUCCESS;
+}
+
+static void gkcrypt_aes_ctx_fini(GKCryptAESCtx **ctx)
+{
+	EVP_CIPHER_CTX_free(*ctx);
+	*ctx = NULL;
+}
+
+static ChiakiErrorCode gkcrypt_gcm_ctx_init(GKCryptGCMCtx **ctx)
+{
+	*ctx = EVP_CIPHER_CTX_new();
+	if(!*ctx)
+		return CHIAKI_ERR_MEMORY;
+
+	if(!EVP_CipherInit_ex(*ctx, EVP_aes_128_gcm(), NULL, NULL, NULL, 1)
+		|| !EVP_CIPHER_CTX_ctrl(*ctx, EVP_CTRL_GCM_SET_IVLEN, CHIAKI_GKCRYPT_BLOCK_SIZE, NULL))
+	{
+		EVP_CIPHER_CTX_free(*ctx);
+		*ctx = NULL;
+		return CHIAKI_ERR_UNKNOWN;
+	}
+	return CHIAKI_ERR_SUCCESS;
+}
+
+static void gkcrypt_gcm_ctx_fini(GKCryptGCMCtx **ctx)
+{
+	EVP_CIPHER_CTX_free(*ctx);
+	*ctx = NULL;
+}
+
+static ChiakiErrorCode gkcrypt_gcm_ctx_set_key(GKCryptGCMCtx *ctx, const uint8_t *key)
+{
+	// cipher and iv length are kept, only the key schedule is redone
+	if(!EVP_CipherInit_ex(ctx, NULL, NULL, key, NULL, 1))
+		return CHIAKI_ERR_UNKNOWN;
+	return CHIAKI_ERR_SUCCESS;
+}
+#endif
+
+/**
+ * Calculate the gmac of buf with a gcm context that has already been keyed.
+ */
+static ChiakiErrorCode gkcrypt_gcm_ctx_gmac(GKCryptGCMCtx *ctx, const uint8_t *iv, const uint8_t *buf, size_t buf_size, uint8_t *gmac_out)
+{
+#ifdef CHIAKI_LIB_ENABLE_MBEDTLS
+	// set "additional data" only whitout input nor output
+	// to get the same result as:
+	// EVP_EncryptUpdate(ctx, NULL, &len, buf, (int)buf_size)
+	if(mbedtls_gcm_crypt_and_tag(ctx, MBEDTLS_GCM_ENCRYPT,
+		   0, iv, CHIAKI_GKCRYPT_BLOCK_SIZE,
+		   buf, buf_size, NULL, NULL,
+		   CHIAKI_GKCRYPT_GMAC_SIZE, gmac_out) != 0)
+		return CHIAKI_ERR_UNKNOWN;
+#else
+	// only sets the iv and resets the gcm state, the key schedule is kept
+	if(!EVP_CipherInit_ex(ctx, NULL, NULL, NULL, iv, 1))
+		return CHIAKI_ERR_UNKNOWN;
+
+	int len;
+	if(!EVP_EncryptUpdate(ctx, NULL, &len, buf, (int)buf_size))
+		return CHIAKI_ERR_UNKNOWN;
+
+	if(!EVP_EncryptFinal_ex(ctx, NULL, &len))
+		return CHIAKI_ERR_UNKNOWN;
+
+	if(!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, CHIAKI_GKCRYPT_GMAC_SIZE, gmac_out))
+		return CHIAKI_ERR_UNKNOWN;
+#endif
+	return CHIAKI_ERR_SUCCESS;
+}
+
+static ChiakiErrorCode gkcrypt_ctxs_init(ChiakiGKCrypt *gkcrypt)
+{
+	ChiakiErrorCode err = gkcrypt_aes_ctx_init(&gkcrypt->key_stream_ctx, gkcrypt->key_base);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+
+	err = gkcrypt_aes_ctx_init(&gkcrypt->key_stream_thread_ctx, gkcrypt->key_base);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_key_stream_ctx;
+
+	err = gkcrypt_gcm_ctx_init(&gkcrypt->gmac_ctx);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_key_stream_thread_ctx;
+
+	size_t cache_entries = 0;
+	for(; cache_entries<CHIAKI_GKCRYPT_GMAC_KEY_CACHE_SIZE; cache_entries++)
+	{
+		ChiakiGKCryptGMACKeyCacheEntry *entry = &gkcrypt->gmac_key_cache[cache_entries];
+		entry->key_index = 0;
+		entry->last_used = 0;
+		err = gkcrypt_gcm_ctx_init(&entry->ctx);
+		if(err != CHIAKI_ERR_SUCCESS)
+			goto error_gmac_key_cache;
+	}
+	gkcrypt->gmac_key_cache_clock = 0;
+
+	err = gkcrypt_gcm_ctx_set_key(GKCRYPT_CTX(gkcrypt->gmac_ctx), gkcrypt->key_gmac_current);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_gmac_key_cache;
+	gkcrypt->gmac_ctx_key_index = gkcrypt->key_gmac_index_current;
+
+	gkcrypt->ctxs_ready = true;
+	return CHIAKI_ERR_SUCCESS;
+
+error_gmac_key_cache:
+	while(cache_entries > 0)
+		gkcrypt_gcm_ctx_fini(&gkcrypt->gmac_key_cache[--cache_entries].ctx);
+	gkcrypt_gcm_ctx_fini(&gkcrypt->gmac_ctx);
+error_key_stream_thread_ctx:
+	gkcrypt_aes_ctx_fini(&gkcrypt->key_stream_thread_ctx);
+error_key_stream_ctx:
+	gkcrypt_aes_ctx_fini(&gkcrypt->key_stream_ctx);
+	return err;
+}
+
+static void gkcrypt_ctxs_fini(ChiakiGKCrypt *gkcrypt)
+{
+	if(!gkcrypt->ctxs_ready)
+		return;
+	for(size_t i=0; i<CHIAKI_GKCRYPT_GMAC_KEY_CACHE_SIZE; i++)
+		gkcrypt_gcm_ctx_fini(&gkcrypt->gmac_key_cache[i].ctx);
+	gkcrypt_gcm_ctx_fini(&gkcrypt->gmac_ctx);
+	gkcrypt_aes_ctx_fini(&gkcrypt->key_stream_thread_ctx);
+	gkcrypt_aes_ctx_fini(&gkcrypt->key_stream_ctx);
+	gkcrypt->ctxs_ready = false;
 }
 
 static ChiakiErrorCode gkcrypt_gen_key_iv(ChiakiGKCrypt *gkcrypt, uint8_t index, const uint8_t *handshake_key, const uint8_t *ecdh_secret)
@@ -211,288 +436,311 @@ CHIAKI_EXPORT void chiaki_gkcrypt_gen_tmp_gmac_key(ChiakiGKCrypt *gkcrypt, uint6
 		memcpy(key_out, gkcrypt->key_gmac_base, sizeof(gkcrypt->key_gmac_base));
 }
 
-CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_gen_key_stream(ChiakiGKCrypt *gkcrypt, uint64_t key_pos, uint8_t *buf, size_t buf_size)
+static ChiakiErrorCode gkcrypt_gen_key_stream_ctx(GKCryptAESCtx *ctx, const uint8_t *iv, uint64_t key_pos, uint8_t *buf, size_t buf_size)
 {
 	assert(key_pos % CHIAKI_GKCRYPT_BLOCK_SIZE == 0);
 	assert(buf_size % CHIAKI_GKCRYPT_BLOCK_SIZE == 0);
 
-#ifdef CHIAKI_LIB_ENABLE_MBEDTLS
-	// build mbedtls aes context
-	mbedtls_aes_context ctx;
-	mbedtls_aes_init(&ctx);
-
-	if(mbedtls_aes_setkey_enc(&ctx, gkcrypt->key_base, 128) != 0)
-	{
-		mbedtls_aes_free(&ctx);
-		return CHIAKI_ERR_UNKNOWN;
-	}
-
-#else
-	EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
-	if(!ctx)
-		return CHIAKI_ERR_UNKNOWN;
-
-	if(!EVP_EncryptInit_ex(ctx, EVP_aes_128_ecb(), NULL, gkcrypt->key_base, NULL))
-	{
-		EVP_CIPHER_CTX_free(ctx);
-		return CHIAKI_ERR_UNKNOWN;
-	}
-
-	if(!EVP_CIPHER_CTX_set_padding(ctx, 0))
-	{
-		EVP_CIPHER_CTX_free(ctx);
-		return CHIAKI_ERR_UNKNOWN;
-	}
-#endif
 	int counter_offset = (int)(key_pos / CHIAKI_GKCRYPT_BLOCK_SIZE);
 
 	for(uint8_t *cur = buf, *end = buf + buf_size; cur < end; cur += CHIAKI_GKCRYPT_BLOCK_SIZE)
-		counter_add(cur, gkcrypt->iv, counter_offset++);
+		counter_add(cur, iv, counter_offset++);
 
 #ifdef CHIAKI_LIB_ENABLE_MBEDTLS
 	for(int i = 0; i < buf_size; i = i + 16)
 	{
 		// loop over all blocks of 16 bytes (128 bits)
-		if(mbedtls_aes_crypt_ecb(&ctx, MBEDTLS_AES_ENCRYPT, buf + i, buf + i) != 0)
-		{
-			mbedtls_aes_free(&ctx);
+		if(mbedtls_aes_crypt_ecb(ctx, MBEDTLS_AES_ENCRYPT, buf + i, buf + i) != 0)
 			return CHIAKI_ERR_UNKNOWN;
-		}
 	}
-
-	mbedtls_aes_free(&ctx);
 #else
 	int outl;
 	EVP_EncryptUpdate(ctx, buf, &outl, buf, (int)buf_size);
 	if(outl != buf_size)
-	{
-		EVP_CIPHER_CTX_free(ctx);
 		return CHIAKI_ERR_UNKNOWN;
-	}
-
-	EVP_CIPHER_CTX_free(ctx);
 #endif
 	return CHIAKI_ERR_SUCCESS;
 }
 
-static bool gkcrypt_key_buf_should_generate(ChiakiGKCrypt *gkcrypt)
+CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_gen_key_stream(ChiakiGKCrypt *gkcrypt, uint64_t key_pos, uint8_t *buf, size_t buf_size)
 {
-	return gkcrypt->last_key_pos > gkcrypt->key_buf_key_pos_min + gkcrypt->key_buf_populated / 2;
+	assert(gkcrypt->ctxs_ready);
+	chiaki_mutex_lock(&gkcrypt->ctx_mutex);
+	ChiakiErrorCode err = gkcrypt_gen_key_stream_ctx(GKCRYPT_CTX(gkcrypt->key_stream_ctx), gkcrypt->iv, key_pos, buf, buf_size);
+	chiaki_mutex_unlock(&gkcrypt->ctx_mutex);
+	return err;
 }
 
-CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_get_key_stream(ChiakiGKCrypt *gkcrypt, uint64_t key_pos, uint8_t *buf, size_t buf_size)
+/**
+ * Consumer side: publish the request and check whether [key_pos, key_pos + size) can be read from key_buf.
+ * If true, the range stays valid until the next request.
+ */
+static bool gkcrypt_key_buf_acquire(ChiakiGKCrypt *gkcrypt, uint64_t key_pos, size_t size)
 {
-	if(!gkcrypt->key_buf)
-		return chiaki_gkcrypt_gen_key_stream(gkcrypt, key_pos, buf, buf_size);
+	uint64_t end = key_pos + size;
+	if(end > gkcrypt->last_key_pos)
+	{
+		chiaki_atomic_store_64(&gkcrypt->last_key_pos, end);
+
+		// keep a quarter of the buffer behind for late packets, the rest may be refilled
+		uint64_t keep_behind = (gkcrypt->key_buf_size / 4 / KEY_BUF_CHUNK_SIZE) * KEY_BUF_CHUNK_SIZE;
+		if(end > keep_behind)
+		{
+			uint64_t read_min = ((end - keep_behind) / KEY_BUF_CHUNK_SIZE) * KEY_BUF_CHUNK_SIZE;
+			if(read_min > gkcrypt->key_buf_read_min)
+				chiaki_atomic_store_64(&gkcrypt->key_buf_read_min, read_min);
+		}
+	}
 
-	chiaki_mutex_lock(&gkcrypt->key_buf_mutex);
+	uint64_t head = chiaki_atomic_load_64(&gkcrypt->key_buf_head);
+	uint64_t start = chiaki_atomic_load_64(&gkcrypt->key_buf_start);
+	uint64_t read_min = gkcrypt->key_buf_read_min;
 
-	if(key_pos + buf_size > gkcrypt->last_key_pos)
-		gkcrypt->last_key_pos = key_pos + buf_size;
-	bool signal = gkcrypt_key_buf_should_generate(gkcrypt);
+	// wake up the producer early enough, depending on how fast we are consuming
+	if(head < gkcrypt->last_key_pos + chiaki_atomic_load_64(&gkcrypt->key_buf_refill_threshold))
+	{
+		chiaki_atomic_fence();
+		if(chiaki_atomic_load_32(&gkcrypt->key_buf_thread_waiting))
+		{
+			chiaki_mutex_lock(&gkcrypt->key_buf_mutex);
+			chiaki_cond_signal(&gkcrypt->key_buf_cond);
+			chiaki_mutex_unlock(&gkcrypt->key_buf_mutex);
+		}
+	}
 
-	ChiakiErrorCode err;
-	if(key_pos < gkcrypt->key_buf_key_pos_min
-		|| key_pos + buf_size >= gkcrypt->key_buf_key_pos_min + gkcrypt->key_buf_populated)
+	if(key_pos < start || key_pos < read_min)
+	{
+		gkcrypt->key_buf_late++;
+		CHIAKI_LOGV(gkcrypt->log, "Requested key stream for key pos %#llx on GKCrypt %d, which has already been dropped from the buffer",
+				(unsigned long long)key_pos, gkcrypt->index);
+		return false;
+	}
+
+	if(end > head)
 	{
+		gkcrypt->key_buf_misses++;
 		CHIAKI_LOGW(gkcrypt->log, "Requested key stream for key pos %#llx on GKCrypt %d, but it's not in the buffer:"
-				" key buf size %#llx, start offset: %#llx, populated: %#llx, min key pos: %#llx, last key pos: %#llx",
+				" key buf size %#llx, start: %#llx, head: %#llx, read min: %#llx, last key pos: %#llx",
 				(unsigned long long)key_pos,
 				gkcrypt->index,
 				(unsigned long long)gkcrypt->key_buf_size,
-				(unsigned long long)gkcrypt->key_buf_start_offset,
-				(unsigned long long)gkcrypt->key_buf_populated,
-				(unsigned long long)gkcrypt->key_buf_key_pos_min,
+				(unsigned long long)start,
+				(unsigned long long)head,
+				(unsigned long long)read_min,
 				(unsigned long long)gkcrypt->last_key_pos);
-		chiaki_mutex_unlock(&gkcrypt->key_buf_mutex);
-		err = chiaki_gkcrypt_gen_key_stream(gkcrypt, key_pos, buf, buf_size);
+		return false;
 	}
-	else
-	{
-		size_t offset_in_buf = key_pos - gkcrypt->key_buf_key_pos_min + gkcrypt->key_buf_start_offset;
-		offset_in_buf %= gkcrypt->key_buf_size;
-		size_t end = offset_in_buf + buf_size;
-		if(end > gkcrypt->key_buf_size)
-		{
-			size_t excess = end - gkcrypt->key_buf_size;
-			memcpy(buf, gkcrypt->key_buf + offset_in_buf, buf_size - excess);
-			memcpy(buf + (buf_size - excess), gkcrypt->key_buf, excess);
-		}
-		else
-			memcpy(buf, gkcrypt->key_buf + offset_in_buf, buf_size);
-		err = CHIAKI_ERR_SUCCESS;
-		chiaki_mutex_unlock(&gkcrypt->key_buf_mutex);
-	}
-
-	if(signal)
-		chiaki_cond_signal(&gkcrypt->key_buf_cond);
 
-	return err;
+	return true;
 }
 
-CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_decrypt(ChiakiGKCrypt *gkcrypt, uint64_t key_pos, uint8_t *buf, size_t buf_size)
+CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_get_key_stream(ChiakiGKCrypt *gkcrypt, uint64_t key_pos, uint8_t *buf, size_t buf_size)
 {
-	uint64_t padding_pre = key_pos % CHIAKI_GKCRYPT_BLOCK_SIZE;
-	size_t full_size = ((padding_pre + buf_size + CHIAKI_GKCRYPT_BLOCK_SIZE - 1) / CHIAKI_GKCRYPT_BLOCK_SIZE) * CHIAKI_GKCRYPT_BLOCK_SIZE;
-
-	uint8_t *key_stream = malloc(full_size);
-	if(!key_stream)
-		return CHIAKI_ERR_MEMORY;
+	if(!gkcrypt->key_buf || !gkcrypt_key_buf_acquire(gkcrypt, key_pos, buf_size))
+		return chiaki_gkcrypt_gen_key_stream(gkcrypt, key_pos, buf, buf_size);
 
-	ChiakiErrorCode err = chiaki_gkcrypt_get_key_stream(gkcrypt, key_pos - padding_pre, key_stream, full_size);
-	if(err != CHIAKI_ERR_SUCCESS)
+	size_t offset_in_buf = key_pos % gkcrypt->key_buf_size;
+	size_t first_size = gkcrypt->key_buf_size - offset_in_buf;
+	if(first_size >= buf_size)
+		memcpy(buf, gkcrypt->key_buf + offset_in_buf, buf_size);
+	else
 	{
-		free(key_stream);
-		return err;
+		memcpy(buf, gkcrypt->key_buf + offset_in_buf, first_size);
+		memcpy(buf + first_size, gkcrypt->key_buf, buf_size - first_size);
 	}
-
-	xor_bytes(buf, key_stream + padding_pre, buf_size);
-	free(key_stream);
-
 	return CHIAKI_ERR_SUCCESS;
 }
 
-CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_gmac(ChiakiGKCrypt *gkcrypt, uint64_t key_pos, const uint8_t *buf, size_t buf_size, uint8_t *gmac_out)
+/**
+ * XOR buf with freshly generated key stream, in pieces of a small stack buffer.
+ */
+static ChiakiErrorCode gkcrypt_xor_gen_key_stream(ChiakiGKCrypt *gkcrypt, uint64_t key_pos, uint8_t *buf, size_t buf_size)
 {
-	uint8_t iv[CHIAKI_GKCRYPT_BLOCK_SIZE];
-	counter_add(iv, gkcrypt->iv, key_pos / 0x10);
-
-	uint8_t *gmac_key = gkcrypt->key_gmac_current;
-	uint8_t gmac_key_tmp[CHIAKI_GKCRYPT_BLOCK_SIZE];
-	uint64_t key_index = (key_pos > 0 ? key_pos - 1 : 0) / CHIAKI_GKCRYPT_GMAC_KEY_REFRESH_KEY_POS;
-
-	if(key_index > gkcrypt->key_gmac_index_current)
+	uint8_t key_stream[KEY_STREAM_STACK_SIZE];
+	size_t padding_pre = (size_t)(key_pos % CHIAKI_GKCRYPT_BLOCK_SIZE);
+	key_pos -= padding_pre;
+	while(buf_size > 0)
 	{
-		chiaki_gkcrypt_gen_new_gmac_key(gkcrypt, key_index);
+		size_t full_size = ((padding_pre + buf_size + CHIAKI_GKCRYPT_BLOCK_SIZE - 1) / CHIAKI_GKCRYPT_BLOCK_SIZE) * CHIAKI_GKCRYPT_BLOCK_SIZE;
+		if(full_size > sizeof(key_stream))
+			full_size = sizeof(key_stream);
+		ChiakiErrorCode err = chiaki_gkcrypt_gen_key_stream(gkcrypt, key_pos, key_stream, full_size);
+		if(err != CHIAKI_ERR_SUCCESS)
+			return err;
+		size_t xor_size = full_size - padding_pre;
+		if(xor_size > buf_size)
+			xor_size = buf_size;
+		xor_bytes(buf, key_stream + padding_pre, xor_size);
+		buf += xor_size;
+		buf_size -= xor_size;
+		key_pos += full_size;
+		padding_pre = 0;
 	}
-	else if(key_index < gkcrypt->key_gmac_index_current)
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_decrypt(ChiakiGKCrypt *gkcrypt, uint64_t key_pos, uint8_t *buf, size_t buf_size)
+{
+	if(!gkcrypt->key_buf || !gkcrypt_key_buf_acquire(gkcrypt, key_pos, buf_size))
+		return gkcrypt_xor_gen_key_stream(gkcrypt, key_pos, buf, buf_size);
+
+	// xor straight from the ring
+	size_t offset_in_buf = key_pos % gkcrypt->key_buf_size;
+	size_t first_size = gkcrypt->key_buf_size - offset_in_buf;
+	if(first_size >= buf_size)
+		xor_bytes(buf, gkcrypt->key_buf + offset_in_buf, buf_size);
+	else
 	{
-		chiaki_gkcrypt_gen_tmp_gmac_key(gkcrypt, key_index, gmac_key_tmp);
-		gmac_key = gmac_key_tmp;
+		xor_bytes(buf, gkcrypt->key_buf + offset_in_buf, first_size);
+		xor_bytes(buf + first_size, gkcrypt->key_buf, buf_size - first_size);
 	}
+	return CHIAKI_ERR_SUCCESS;
+}
 
+/**
+ * Calculate a gmac with a temporary context, for a gkcrypt that has not been set up by chiaki_gkcrypt_init().
+ */
+static ChiakiErrorCode gkcrypt_gmac_oneshot(const uint8_t *gmac_key, const uint8_t *iv, const uint8_t *buf, size_t buf_size, uint8_t *gmac_out)
+{
 #ifdef CHIAKI_LIB_ENABLE_MBEDTLS
-	// build mbedtls gcm context AES_128_GCM
-	// Encryption
-	mbedtls_gcm_context actx;
-	mbedtls_gcm_init(&actx);
-	// set gmac_key 128 bits key
-	if(mbedtls_gcm_setkey(&actx, MBEDTLS_CIPHER_ID_AES, gmac_key, CHIAKI_GKCRYPT_BLOCK_SIZE * 8) != 0)
-	{
-		mbedtls_gcm_free(&actx);
-		return CHIAKI_ERR_UNKNOWN;
-	}
+	GKCryptGCMCtx ctx;
+	GKCryptGCMCtx *ctx_ptr = &ctx;
+#else
+	GKCryptGCMCtx *ctx;
+	GKCryptGCMCtx **ctx_ptr = &ctx;
+#endif
+	ChiakiErrorCode err = gkcrypt_gcm_ctx_init(ctx_ptr);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+	err = gkcrypt_gcm_ctx_set_key(GKCRYPT_CTX(ctx), gmac_key);
+	if(err == CHIAKI_ERR_SUCCESS)
+		err = gkcrypt_gcm_ctx_gmac(GKCRYPT_CTX(ctx), iv, buf, buf_size, gmac_out);
+	gkcrypt_gcm_ctx_fini(ctx_ptr);
+	return err;
+}
 
-	// encrypt without additional data
-	if(mbedtls_gcm_starts(&actx, MBEDTLS_GCM_ENCRYPT, iv, CHIAKI_GKCRYPT_BLOCK_SIZE, NULL, 0) != 0)
-	{
-		mbedtls_gcm_free(&actx);
-		return CHIAKI_ERR_UNKNOWN;
-	}
-	// set "additional data" only whitout input nor output
-	// to get the same result as:
-	// EVP_EncryptUpdate(ctx, NULL, &len, buf, (int)buf_size)
-	if(mbedtls_gcm_crypt_and_tag(&actx, MBEDTLS_GCM_ENCRYPT,
-		   0, iv, CHIAKI_GKCRYPT_BLOCK_SIZE,
-		   buf, buf_size, NULL, NULL,
-		   CHIAKI_GKCRYPT_GMAC_SIZE, gmac_out) != 0)
+/**
+ * Get a context keyed with the gmac key of an old key_index, deriving the key only if it is not cached yet.
+ * Must be called with ctx_mutex locked.
+ */
+static ChiakiErrorCode gkcrypt_gmac_key_cache_get(ChiakiGKCrypt *gkcrypt, uint64_t key_index, GKCryptGCMCtx **ctx_out)
+{
+	ChiakiGKCryptGMACKeyCacheEntry *lru = &gkcrypt->gmac_key_cache[0];
+	for(size_t i=0; i<CHIAKI_GKCRYPT_GMAC_KEY_CACHE_SIZE; i++)
 	{
-
-		mbedtls_gcm_free(&actx);
-		return CHIAKI_ERR_UNKNOWN;
+		ChiakiGKCryptGMACKeyCacheEntry *entry = &gkcrypt->gmac_key_cache[i];
+		if(entry->last_used && entry->key_index == key_index)
+		{
+			entry->last_used = ++gkcrypt->gmac_key_cache_clock;
+			*ctx_out = GKCRYPT_CTX(entry->ctx);
+			return CHIAKI_ERR_SUCCESS;
+		}
+		if(entry->last_used < lru->last_used)
+			lru = entry;
 	}
 
-	mbedtls_gcm_free(&actx);
-
+	uint8_t gmac_key[CHIAKI_GKCRYPT_BLOCK_SIZE];
+	chiaki_gkcrypt_gen_tmp_gmac_key(gkcrypt, key_index, gmac_key);
+	lru->last_used = 0;
+	ChiakiErrorCode err = gkcrypt_gcm_ctx_set_key(GKCRYPT_CTX(lru->ctx), gmac_key);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+	lru->key_index = key_index;
+	lru->last_used = ++gkcrypt->gmac_key_cache_clock;
+	*ctx_out = GKCRYPT_CTX(lru->ctx);
 	return CHIAKI_ERR_SUCCESS;
-#else
-	ChiakiErrorCode ret = CHIAKI_ERR_SUCCESS;
+}
 
-	EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
-	if(!ctx)
-	{
-		ret = CHIAKI_ERR_MEMORY;
-		goto fail;
-	}
+static inline uint64_t gkcrypt_gmac_key_index(uint64_t key_pos)
+{
+	return (key_pos > 0 ? key_pos - 1 : 0) / CHIAKI_GKCRYPT_GMAC_KEY_REFRESH_KEY_POS;
+}
 
-	if(!EVP_CipherInit_ex(ctx, EVP_aes_128_gcm(), NULL, NULL, NULL, 1))
-	{
-		ret = CHIAKI_ERR_UNKNOWN;
-		goto fail_cipher;
-	}
+/**
+ * Get the context keyed for key_index, advancing the current gmac key if necessary.
+ * Must be called with ctx_mutex locked.
+ */
+static ChiakiErrorCode gkcrypt_gmac_ctx_get(ChiakiGKCrypt *gkcrypt, uint64_t key_index, GKCryptGCMCtx **ctx_out)
+{
+	if(key_index > gkcrypt->key_gmac_index_current)
+		chiaki_gkcrypt_gen_new_gmac_key(gkcrypt, key_index);
 
-	if(!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, CHIAKI_GKCRYPT_BLOCK_SIZE, NULL))
-	{
-		ret = CHIAKI_ERR_UNKNOWN;
-		goto fail_cipher;
-	}
+	// old key, e.g. for a late packet
+	if(key_index < gkcrypt->key_gmac_index_current)
+		return gkcrypt_gmac_key_cache_get(gkcrypt, key_index, ctx_out);
 
-	if(!EVP_CipherInit_ex(ctx, NULL, NULL, gmac_key, iv, 1))
+	// only redo the key schedule when the current key has changed
+	if(gkcrypt->gmac_ctx_key_index != gkcrypt->key_gmac_index_current)
 	{
-		ret = CHIAKI_ERR_UNKNOWN;
-		goto fail_cipher;
+		ChiakiErrorCode err = gkcrypt_gcm_ctx_set_key(GKCRYPT_CTX(gkcrypt->gmac_ctx), gkcrypt->key_gmac_current);
+		if(err != CHIAKI_ERR_SUCCESS)
+			return err;
+		gkcrypt->gmac_ctx_key_index = gkcrypt->key_gmac_index_current;
 	}
+	*ctx_out = GKCRYPT_CTX(gkcrypt->gmac_ctx);
+	return CHIAKI_ERR_SUCCESS;
+}
 
-	int len;
-	if(!EVP_EncryptUpdate(ctx, NULL, &len, buf, (int)buf_size))
-	{
-		ret = CHIAKI_ERR_UNKNOWN;
-		goto fail_cipher;
-	}
+CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_gmac(ChiakiGKCrypt *gkcrypt, uint64_t key_pos, const uint8_t *buf, size_t buf_size, uint8_t *gmac_out)
+{
+	uint8_t iv[CHIAKI_GKCRYPT_BLOCK_SIZE];
+	counter_add(iv, gkcrypt->iv, key_pos / 0x10);
 
-	if(!EVP_EncryptFinal_ex(ctx, NULL, &len))
-	{
-		ret = CHIAKI_ERR_UNKNOWN;
-		goto fail_cipher;
-	}
+	uint64_t key_index = gkcrypt_gmac_key_index(key_pos);
 
-	if(!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, CHIAKI_GKCRYPT_GMAC_SIZE, gmac_out))
+	if(!gkcrypt->ctxs_ready)
 	{
-		ret = CHIAKI_ERR_UNKNOWN;
-		goto fail_cipher;
+		uint8_t *gmac_key = gkcrypt->key_gmac_current;
+		uint8_t gmac_key_tmp[CHIAKI_GKCRYPT_BLOCK_SIZE];
+		if(key_index > gkcrypt->key_gmac_index_current)
+			chiaki_gkcrypt_gen_new_gmac_key(gkcrypt, key_index);
+		else if(key_index < gkcrypt->key_gmac_index_current)
+		{
+			chiaki_gkcrypt_gen_tmp_gmac_key(gkcrypt, key_index, gmac_key_tmp);
+			gmac_key = gmac_key_tmp;
+		}
+		return gkcrypt_gmac_oneshot(gmac_key, iv, buf, buf_size, gmac_out);
 	}
 
-fail_cipher:
-	EVP_CIPHER_CTX_free(ctx);
-fail:
-	return ret;
-#endif
+	chiaki_mutex_lock(&gkcrypt->ctx_mutex);
+	GKCryptGCMCtx *ctx;
+	ChiakiErrorCode err = gkcrypt_gmac_ctx_get(gkcrypt, key_index, &ctx);
+	if(err == CHIAKI_ERR_SUCCESS)
+		err = gkcrypt_gcm_ctx_gmac(ctx, iv, buf, buf_size, gmac_out);
+	chiaki_mutex_unlock(&gkcrypt->ctx_mutex);
+	return err;
 }
 
-static bool key_buf_mutex_pred(void *user)
+/**
+ * Whether the producer can generate the chunk at head without overwriting anything the consumer may still read.
+ */
+static bool gkcrypt_key_buf_has_space(ChiakiGKCrypt *gkcrypt, uint64_t head, uint64_t read_min)
 {
-	ChiakiGKCrypt *gkcrypt = user;
-	if(gkcrypt->key_buf_thread_stop)
-		return true;
-
-	if(gkcrypt->key_buf_populated < gkcrypt->key_buf_size)
-		return true;
-
-	if(gkcrypt_key_buf_should_generate(gkcrypt))
-		return true;
-
-	return false;
+	return head < read_min || head + KEY_BUF_CHUNK_SIZE <= read_min + gkcrypt->key_buf_size;
 }
 
-static ChiakiErrorCode gkcrypt_generate_next_chunk(ChiakiGKCrypt *gkcrypt)
+/**
+ * Adapt the refill threshold to the consumption rate measured since the last call.
+ */
+static void gkcrypt_key_buf_update_threshold(ChiakiGKCrypt *gkcrypt, uint64_t *rate_time_ms, uint64_t *rate_key_pos, uint64_t *rate)
 {
-	assert(gkcrypt->key_buf_populated + KEY_BUF_CHUNK_SIZE <= gkcrypt->key_buf_size);
-	size_t buf_offset = (gkcrypt->key_buf_start_offset + gkcrypt->key_buf_populated) % gkcrypt->key_buf_size;
-	uint64_t key_pos = gkcrypt->key_buf_key_pos_min + gkcrypt->key_buf_populated;
-	uint8_t *buf_start = gkcrypt->key_buf + buf_offset;
-
-	chiaki_mutex_unlock(&gkcrypt->key_buf_mutex);
-
-	ChiakiErrorCode err = chiaki_gkcrypt_gen_key_stream(gkcrypt, key_pos, buf_start, KEY_BUF_CHUNK_SIZE);
-	if(err != CHIAKI_ERR_SUCCESS)
-		CHIAKI_LOGE(gkcrypt->log, "GKCrypt failed to generate key stream chunk");
-
-	chiaki_mutex_lock(&gkcrypt->key_buf_mutex);
-
-	if(err == CHIAKI_ERR_SUCCESS)
-		gkcrypt->key_buf_populated += KEY_BUF_CHUNK_SIZE;
-
-	return err;
+	uint64_t now = chiaki_time_now_monotonic_ms();
+	uint64_t dt = now - *rate_time_ms;
+	if(dt < KEY_BUF_REFILL_LATENCY_MS)
+		return;
+	uint64_t last_key_pos = chiaki_atomic_load_64(&gkcrypt->last_key_pos);
+	uint64_t sample = last_key_pos > *rate_key_pos ? (last_key_pos - *rate_key_pos) / dt : 0; // bytes per ms
+	*rate = sample > *rate ? sample : (*rate * 7 + sample) / 8; // follow increases immediately, decreases slowly
+	*rate_time_ms = now;
+	*rate_key_pos = last_key_pos;
+
+	uint64_t threshold = *rate * KEY_BUF_REFILL_LATENCY_MS;
+	uint64_t threshold_max = gkcrypt->key_buf_size / 2;
+	if(threshold < 2 * KEY_BUF_CHUNK_SIZE)
+		threshold = 2 * KEY_BUF_CHUNK_SIZE;
+	if(threshold > threshold_max)
+		threshold = threshold_max;
+	chiaki_atomic_store_64(&gkcrypt->key_buf_refill_threshold, threshold);
 }
 
 static void *gkcrypt_thread_func(void *user)
@@ -500,46 +748,54 @@ static void *gkcrypt_thread_func(void *user)
 	ChiakiGKCrypt *gkcrypt = user;
 	CHIAKI_LOGV(gkcrypt->log, "GKCrypt %d thread starting", (int)gkcrypt->index);
 
-	ChiakiErrorCode err = chiaki_mutex_lock(&gkcrypt->key_buf_mutex);
-	assert(err == CHIAKI_ERR_SUCCESS);
-	while(1)
-	{
-		err = chiaki_cond_wait_pred(&gkcrypt->key_buf_cond, &gkcrypt->key_buf_mutex, key_buf_mutex_pred, gkcrypt);
+	uint64_t rate_time_ms = chiaki_time_now_monotonic_ms();
+	uint64_t rate_key_pos = 0;
+	uint64_t rate = 0;
 
-		if(gkcrypt->key_buf_thread_stop || err != CHIAKI_ERR_SUCCESS)
-			break;
-
-		CHIAKI_LOGV(gkcrypt->log, "GKCrypt %d key buf size %#llx, start offset: %#llx, populated: %#llx, min key pos: %#llx, last key pos: %#llx, generating next chunk",
-					(int)gkcrypt->index,
-					(unsigned long long)gkcrypt->key_buf_size,
-					(unsigned long long)gkcrypt->key_buf_start_offset,
-					(unsigned long long)gkcrypt->key_buf_populated,
-					(unsigned long long)gkcrypt->key_buf_key_pos_min,
-					(unsigned long long)gkcrypt->last_key_pos);
-
-		if(gkcrypt->last_key_pos > gkcrypt->key_buf_key_pos_min + gkcrypt->key_buf_populated)
+	uint64_t head = gkcrypt->key_buf_head;
+	while(!chiaki_atomic_load_32(&gkcrypt->key_buf_thread_stop))
+	{
+		uint64_t read_min = chiaki_atomic_load_64(&gkcrypt->key_buf_read_min);
+		if(!gkcrypt_key_buf_has_space(gkcrypt, head, read_min))
 		{
-			// skip ahead if the last key pos is already beyond our buffer
-			uint64_t key_pos = (gkcrypt->last_key_pos / KEY_BUF_CHUNK_SIZE) * KEY_BUF_CHUNK_SIZE;
-			CHIAKI_LOGW(gkcrypt->log, "Already requested a higher key pos than in the buffer, skipping ahead from min %#llx to %#llx",
-						(unsigned long long)gkcrypt->key_buf_key_pos_min,
-						(unsigned long long)key_pos);
-			gkcrypt->key_buf_key_pos_min = key_pos;
-			gkcrypt->key_buf_start_offset = 0;
-			gkcrypt->key_buf_populated = 0;
+			gkcrypt_key_buf_update_threshold(gkcrypt, &rate_time_ms, &rate_key_pos, &rate);
+
+			chiaki_mutex_lock(&gkcrypt->key_buf_mutex);
+			chiaki_atomic_store_32(&gkcrypt->key_buf_thread_waiting, 1);
+			chiaki_atomic_fence();
+			// check again, the consumer only signals if it has seen key_buf_thread_waiting
+			if(!chiaki_atomic_load_32(&gkcrypt->key_buf_thread_stop)
+				&& !gkcrypt_key_buf_has_space(gkcrypt, head, chiaki_atomic_load_64(&gkcrypt->key_buf_read_min)))
+				chiaki_cond_timedwait(&gkcrypt->key_buf_cond, &gkcrypt->key_buf_mutex, KEY_BUF_THREAD_WAIT_MS);
+			chiaki_atomic_store_32(&gkcrypt->key_buf_thread_waiting, 0);
+			chiaki_mutex_unlock(&gkcrypt->key_buf_mutex);
+			continue;
 		}
-		else if(gkcrypt->key_buf_populated == gkcrypt->key_buf_size)
+
+		if(head < read_min)
 		{
-			gkcrypt->key_buf_start_offset = (gkcrypt->key_buf_start_offset + KEY_BUF_CHUNK_SIZE) % gkcrypt->key_buf_size;
-			gkcrypt->key_buf_key_pos_min += KEY_BUF_CHUNK_SIZE;
-			gkcrypt->key_buf_populated -= KEY_BUF_CHUNK_SIZE;
+			// the consumer is already beyond everything in the buffer, skip ahead
+			CHIAKI_LOGW(gkcrypt->log, "GKCrypt %d already requested a higher key pos than in the buffer, skipping ahead from %#llx to %#llx",
+						(int)gkcrypt->index,
+						(unsigned long long)head,
+						(unsigned long long)read_min);
+			head = read_min;
+			chiaki_atomic_store_64(&gkcrypt->key_buf_start, head);
+			chiaki_atomic_store_64(&gkcrypt->key_buf_head, head);
 		}
-		err = gkcrypt_generate_next_chunk(gkcrypt);
+
+		// key_stream_thread_ctx is exclusive to this thread, so no need to take ctx_mutex
+		uint8_t *chunk = gkcrypt->key_buf + (head % gkcrypt->key_buf_size);
+		ChiakiErrorCode err = gkcrypt_gen_key_stream_ctx(GKCRYPT_CTX(gkcrypt->key_stream_thread_ctx), gkcrypt->iv, head, chunk, KEY_BUF_CHUNK_SIZE);
 		if(err != CHIAKI_ERR_SUCCESS)
+		{
+			CHIAKI_LOGE(gkcrypt->log, "GKCrypt failed to generate key stream chunk");
 			break;
+		}
+		head += KEY_BUF_CHUNK_SIZE;
+		chiaki_atomic_store_64(&gkcrypt->key_buf_head, head);
 	}
 
-	chiaki_mutex_unlock(&gkcrypt->key_buf_mutex);
 	return NULL;
 }
 
@@ -0,0 +1,210 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/hapticsresampler.h>
+
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HAPTICS_RESAMPLER_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define HAPTICS_RESAMPLER_NEON
+#endif
+
+#define TAPS CHIAKI_HAPTICS_RESAMPLER_TAPS
+#define FACTOR CHIAKI_HAPTICS_RESAMPLER_FACTOR
+#define CHUNK CHIAKI_HAPTICS_RESAMPLER_CHUNK
+#define CHANNELS_OUT CHIAKI_HAPTICS_RESAMPLER_CHANNELS_OUT
+
+#if (defined(HAPTICS_RESAMPLER_SSE2) || defined(HAPTICS_RESAMPLER_NEON)) && (TAPS != 8 || FACTOR != 16 || CHANNELS_OUT != 4)
+#error "SIMD paths of the haptics resampler are written for 8 taps, 16 phases and 4 output channels"
+#endif
+
+/**
+ * Kaiser-windowed sinc (beta 6) with 128 taps and a cutoff at 1350 Hz, split into one filter per output phase.
+ * Every phase is scaled to a gain of exactly 1 in Q15, and its taps are reversed so it can be applied
+ * directly to the TAPS input samples ending at the newest one.
+ */
+static const int16_t coefs[FACTOR][TAPS] = {
+	{ 390, -1226, 1874, 29400, 3569, -1699, 498, -38 },
+	{ 288, -781, 378, 29065, 5446, -2183, 607, -52 },
+	{ 195, -375, -905, 28392, 7476, -2660, 711, -66 },
+	{ 114, -18, -1968, 27396, 9628, -3109, 804, -79 },
+	{ 46, 284, -2811, 26104, 11864, -3507, 878, -90 },
+	{ -8, 527, -3437, 24543, 14142, -3828, 926, -97 },
+	{ -49, 712, -3856, 22750, 16417, -4048, 941, -99 },
+	{ -76, 840, -4085, 20767, 18642, -4142, 914, -92 },
+	{ -92, 914, -4142, 18642, 20767, -4085, 840, -76 },
+	{ -99, 941, -4048, 16417, 22750, -3856, 712, -49 },
+	{ -97, 926, -3828, 14142, 24543, -3437, 527, -8 },
+	{ -90, 878, -3507, 11864, 26104, -2811, 284, 46 },
+	{ -79, 804, -3109, 9628, 27396, -1968, -18, 114 },
+	{ -66, 711, -2660, 7476, 28392, -905, -375, 195 },
+	{ -52, 607, -2183, 5446, 29065, 378, -781, 288 },
+	{ -38, 498, -1699, 3569, 29400, 1874, -1226, 390 }
+};
+
+CHIAKI_EXPORT void chiaki_haptics_resampler_init(ChiakiHapticsResampler *resampler)
+{
+	memset(resampler, 0, sizeof(*resampler));
+}
+
+#if defined(HAPTICS_RESAMPLER_SSE2)
+
+/**
+ * @return the sums of the 4 lanes of a, b, c and d
+ */
+static inline __m128i haptics_resampler_hsum4(__m128i a, __m128i b, __m128i c, __m128i d)
+{
+	__m128i ab = _mm_add_epi32(_mm_unpacklo_epi32(a, b), _mm_unpackhi_epi32(a, b));
+	__m128i cd = _mm_add_epi32(_mm_unpacklo_epi32(c, d), _mm_unpackhi_epi32(c, d));
+	return _mm_add_epi32(_mm_unpacklo_epi64(ab, cd), _mm_unpackhi_epi64(ab, cd));
+}
+
+/**
+ * All FACTOR phases for the window ending at x[TAPS - 1], as saturated int16
+ */
+static inline void haptics_resampler_phases(const int16_t *x, __m128i *lo, __m128i *hi)
+{
+	const __m128i round = _mm_set1_epi32(1 << 14);
+	__m128i window = _mm_loadu_si128((const __m128i *)x);
+	__m128i r[FACTOR / 4];
+	for(size_t p=0; p<FACTOR; p+=4)
+	{
+		__m128i s = haptics_resampler_hsum4(
+				_mm_madd_epi16(_mm_loadu_si128((const __m128i *)coefs[p]), window),
+				_mm_madd_epi16(_mm_loadu_si128((const __m128i *)coefs[p + 1]), window),
+				_mm_madd_epi16(_mm_loadu_si128((const __m128i *)coefs[p + 2]), window),
+				_mm_madd_epi16(_mm_loadu_si128((const __m128i *)coefs[p + 3]), window));
+		r[p / 4] = _mm_srai_epi32(_mm_add_epi32(s, round), 15);
+	}
+	*lo = _mm_packs_epi32(r[0], r[1]);
+	*hi = _mm_packs_epi32(r[2], r[3]);
+}
+
+static void haptics_resampler_run(ChiakiHapticsResampler *resampler, size_t frames_count, int16_t *out)
+{
+	const __m128i zero = _mm_setzero_si128();
+	for(size_t i=0; i<frames_count; i++)
+	{
+		__m128i l_lo, l_hi, r_lo, r_hi;
+		haptics_resampler_phases(resampler->hist[0] + i, &l_lo, &l_hi);
+		haptics_resampler_phases(resampler->hist[1] + i, &r_lo, &r_hi);
+
+		// interleave to frames of { 0, 0, l, r }
+		__m128i lr[4] = {
+			_mm_unpacklo_epi16(l_lo, r_lo),
+			_mm_unpackhi_epi16(l_lo, r_lo),
+			_mm_unpacklo_epi16(l_hi, r_hi),
+			_mm_unpackhi_epi16(l_hi, r_hi)
+		};
+		__m128i *dst = (__m128i *)(out + i * FACTOR * CHANNELS_OUT);
+		for(size_t j=0; j<4; j++)
+		{
+			_mm_storeu_si128(dst + j * 2, _mm_unpacklo_epi32(zero, lr[j]));
+			_mm_storeu_si128(dst + j * 2 + 1, _mm_unpackhi_epi32(zero, lr[j]));
+		}
+	}
+}
+
+#elif defined(HAPTICS_RESAMPLER_NEON)
+
+/**
+ * @return the sums of the 4 lanes of a, b, c and d
+ */
+static inline int32x4_t haptics_resampler_hsum4(int32x4_t a, int32x4_t b, int32x4_t c, int32x4_t d)
+{
+#if defined(__aarch64__) || defined(_M_ARM64)
+	return vpaddq_s32(vpaddq_s32(a, b), vpaddq_s32(c, d));
+#else
+	int32x2_t ab = vpadd_s32(vadd_s32(vget_low_s32(a), vget_high_s32(a)), vadd_s32(vget_low_s32(b), vget_high_s32(b)));
+	int32x2_t cd = vpadd_s32(vadd_s32(vget_low_s32(c), vget_high_s32(c)), vadd_s32(vget_low_s32(d), vget_high_s32(d)));
+	return vcombine_s32(ab, cd);
+#endif
+}
+
+static inline int32x4_t haptics_resampler_dot(const int16_t *coef, int16x8_t window)
+{
+	int16x8_t c = vld1q_s16(coef);
+	int32x4_t acc = vmull_s16(vget_low_s16(c), vget_low_s16(window));
+	return vmlal_s16(acc, vget_high_s16(c), vget_high_s16(window));
+}
+
+static void haptics_resampler_run(ChiakiHapticsResampler *resampler, size_t frames_count, int16_t *out)
+{
+	int16x4x4_t frames;
+	frames.val[0] = vdup_n_s16(0);
+	frames.val[1] = vdup_n_s16(0);
+	for(size_t i=0; i<frames_count; i++)
+	{
+		int16x8_t l = vld1q_s16(resampler->hist[0] + i);
+		int16x8_t r = vld1q_s16(resampler->hist[1] + i);
+		int16_t *dst = out + i * FACTOR * CHANNELS_OUT;
+		for(size_t p=0; p<FACTOR; p+=4)
+		{
+			frames.val[2] = vqrshrn_n_s32(haptics_resampler_hsum4(
+					haptics_resampler_dot(coefs[p], l), haptics_resampler_dot(coefs[p + 1], l),
+					haptics_resampler_dot(coefs[p + 2], l), haptics_resampler_dot(coefs[p + 3], l)), 15);
+			frames.val[3] = vqrshrn_n_s32(haptics_resampler_hsum4(
+					haptics_resampler_dot(coefs[p], r), haptics_resampler_dot(coefs[p + 1], r),
+					haptics_resampler_dot(coefs[p + 2], r), haptics_resampler_dot(coefs[p + 3], r)), 15);
+			// interleaves to frames of { 0, 0, l, r }
+			vst4_s16(dst + p * CHANNELS_OUT, frames);
+		}
+	}
+}
+
+#else
+
+static inline int16_t haptics_resampler_phase(const int16_t *coef, const int16_t *x)
+{
+	int32_t s = 1 << 14;
+	for(size_t k=0; k<TAPS; k++)
+		s += (int32_t)coef[k] * x[k];
+	s >>= 15;
+	return s > INT16_MAX ? INT16_MAX : (s < INT16_MIN ? INT16_MIN : (int16_t)s);
+}
+
+static void haptics_resampler_run(ChiakiHapticsResampler *resampler, size_t frames_count, int16_t *out)
+{
+	for(size_t i=0; i<frames_count; i++)
+	{
+		for(size_t p=0; p<FACTOR; p++)
+		{
+			int16_t *dst = out + (i * FACTOR + p) * CHANNELS_OUT;
+			dst[0] = 0;
+			dst[1] = 0;
+			dst[2] = haptics_resampler_phase(coefs[p], resampler->hist[0] + i);
+			dst[3] = haptics_resampler_phase(coefs[p], resampler->hist[1] + i);
+		}
+	}
+}
+
+#endif
+
+CHIAKI_EXPORT size_t chiaki_haptics_resampler_process(ChiakiHapticsResampler *resampler, const uint8_t *buf, size_t buf_size, int16_t *out)
+{
+	size_t frames_count = buf_size / 4;
+	for(size_t done=0; done<frames_count;)
+	{
+		size_t chunk = frames_count - done;
+		if(chunk > CHUNK)
+			chunk = CHUNK;
+
+		const uint8_t *in = buf + done * 4;
+		for(size_t i=0; i<chunk; i++)
+		{
+			resampler->hist[0][TAPS - 1 + i] = (int16_t)((uint16_t)in[i * 4] | ((uint16_t)in[i * 4 + 1] << 8));
+			resampler->hist[1][TAPS - 1 + i] = (int16_t)((uint16_t)in[i * 4 + 2] | ((uint16_t)in[i * 4 + 3] << 8));
+		}
+
+		haptics_resampler_run(resampler, chunk, out + done * FACTOR * CHANNELS_OUT);
+
+		// keep the end of this chunk as the start of the next one
+		for(size_t c=0; c<2; c++)
+			memmove(resampler->hist[c], resampler->hist[c] + chunk, (TAPS - 1) * sizeof(int16_t));
+		done += chunk;
+	}
+	return frames_count * FACTOR;
+}
@@ -4,6 +4,7 @@
 #if CHIAKI_LIB_ENABLE_OPUS
 
 #include <chiaki/opusdecoder.h>
+#include <chiaki/time.h>
 
 #include <opus/opus.h>
 
@@ -11,6 +12,7 @@
 
 static void chiaki_opus_decoder_header(ChiakiAudioHeader *header, void *user);
 static void chiaki_opus_decoder_frame(uint8_t *buf, size_t buf_size, void *user);
+static void chiaki_opus_decoder_frame_indexed(uint8_t *buf, size_t buf_size, ChiakiSeqNum16 frame_index, void *user);
 
 CHIAKI_EXPORT void chiaki_opus_decoder_init(ChiakiOpusDecoder *decoder, ChiakiLog *log)
 {
@@ -20,6 +22,7 @@ CHIAKI_EXPORT void chiaki_opus_decoder_init(ChiakiOpusDecoder *decoder, ChiakiLo
 
 	decoder->pcm_buf = NULL;
 	decoder->pcm_buf_size = 0;
+	chiaki_audio_jitter_buffer_init(&decoder->jitter_buffer, 0);
 
 	decoder->cb_user = NULL;
 	decoder->settings_cb = NULL;
@@ -28,6 +31,11 @@ CHIAKI_EXPORT void chiaki_opus_decoder_init(ChiakiOpusDecoder *decoder, ChiakiLo
 
 CHIAKI_EXPORT void chiaki_opus_decoder_fini(ChiakiOpusDecoder *decoder)
 {
+	ChiakiAudioJitterBufferStats *stats = &decoder->jitter_buffer.stats;
+	if(stats->frames_played)
+		CHIAKI_LOGI(decoder->log, "ChiakiOpusDecoder played %llu frames, recovered %llu with fec, concealed %llu, skipped %llu",
+				(unsigned long long)stats->frames_played, (unsigned long long)stats->frames_fec,
+				(unsigned long long)stats->frames_plc, (unsigned long long)stats->frames_skipped);
 	free(decoder->pcm_buf);
 }
 
@@ -36,6 +44,7 @@ CHIAKI_EXPORT void chiaki_opus_decoder_get_sink(ChiakiOpusDecoder *decoder, Chia
 	sink->user = decoder;
 	sink->header_cb = chiaki_opus_decoder_header;
 	sink->frame_cb = chiaki_opus_decoder_frame;
+	sink->frame_indexed_cb = chiaki_opus_decoder_frame_indexed;
 }
 
 static void chiaki_opus_decoder_header(ChiakiAudioHeader *header, void *user)
@@ -73,6 +82,8 @@ static void chiaki_opus_decoder_header(ChiakiAudioHeader *header, void *user)
 	}
 
 	decoder->pcm_buf_size = pcm_buf_size_required;
+	chiaki_audio_jitter_buffer_init(&decoder->jitter_buffer,
+			header->rate ? (uint64_t)header->frame_size * 1000000 / header->rate : 0);
 
 	if(decoder->settings_cb)
 		decoder->settings_cb(header->channels, header->rate, decoder->cb_user);
@@ -94,4 +105,46 @@ static void chiaki_opus_decoder_frame(uint8_t *buf, size_t buf_size, void *user)
 		decoder->frame_cb(decoder->pcm_buf, (size_t)r, decoder->cb_user);
 }
 
+
+static void chiaki_opus_decoder_frame_indexed(uint8_t *buf, size_t buf_size, ChiakiSeqNum16 frame_index, void *user)
+{
+	ChiakiOpusDecoder *decoder = user;
+	if(!decoder->opus_decoder)
+	{
+		CHIAKI_LOGE(decoder->log, "Received audio frame, but opus decoder is not initialized");
+		return;
+	}
+
+	uint64_t now_us = chiaki_time_now_monotonic_us();
+	chiaki_audio_jitter_buffer_put(&decoder->jitter_buffer, frame_index, buf, buf_size, now_us);
+
+	while(true)
+	{
+		const uint8_t *frame_buf = NULL;
+		size_t frame_buf_size = 0;
+		int decode_fec = 0;
+		switch(chiaki_audio_jitter_buffer_pop(&decoder->jitter_buffer, now_us, &frame_buf, &frame_buf_size))
+		{
+			case CHIAKI_AUDIO_JITTER_BUFFER_OUT_NONE:
+				return;
+			case CHIAKI_AUDIO_JITTER_BUFFER_OUT_FRAME:
+				break;
+			case CHIAKI_AUDIO_JITTER_BUFFER_OUT_FEC:
+				decode_fec = 1;
+				break;
+			case CHIAKI_AUDIO_JITTER_BUFFER_OUT_PLC:
+				// opus conceals the frame by itself with no data
+				frame_buf = NULL;
+				frame_buf_size = 0;
+				break;
+		}
+
+		int r = opus_decode(decoder->opus_decoder, frame_buf, (opus_int32)frame_buf_size, decoder->pcm_buf, decoder->audio_header.frame_size, decode_fec);
+		if(r < 1)
+			CHIAKI_LOGE(decoder->log, "Decoding audio frame with opus failed: %s", opus_strerror(r));
+		else if(decoder->frame_cb)
+			decoder->frame_cb(decoder->pcm_buf, (size_t)r, decoder->cb_user);
+	}
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,117 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/packetpool.h>
+
+#include "atomic_utils.h"
+
+#include <assert.h>
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_packet_pool_init(ChiakiPacketPool *pool, ChiakiLog *log, size_t bufs_count)
+{
+	pool->log = log;
+	pool->bufs_count = bufs_count;
+	pool->free_list = NULL;
+	pool->free_count = bufs_count;
+	pool->free_count_min = bufs_count;
+	pool->exhausted_count = 0;
+
+	ChiakiErrorCode err = chiaki_mutex_init(&pool->mutex, false);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+
+	pool->slab = malloc(bufs_count * CHIAKI_PACKET_BUF_SIZE);
+	if(!pool->slab)
+		goto error_mutex;
+
+	pool->bufs = calloc(bufs_count, sizeof(ChiakiPacketBuf));
+	if(!pool->bufs)
+		goto error_slab;
+
+	// build the free list back to front so buffers are handed out in slab order
+	for(size_t i=bufs_count; i>0; i--)
+	{
+		ChiakiPacketBuf *buf = &pool->bufs[i-1];
+		buf->pool = pool;
+		buf->refs = 0;
+		buf->size = 0;
+		buf->data = pool->slab + (i-1) * CHIAKI_PACKET_BUF_SIZE;
+		buf->next_free = pool->free_list;
+		pool->free_list = buf;
+	}
+
+	return CHIAKI_ERR_SUCCESS;
+error_slab:
+	free(pool->slab);
+error_mutex:
+	chiaki_mutex_fini(&pool->mutex);
+	return CHIAKI_ERR_MEMORY;
+}
+
+CHIAKI_EXPORT void chiaki_packet_pool_fini(ChiakiPacketPool *pool)
+{
+	if(pool->free_count != pool->bufs_count)
+		CHIAKI_LOGW(pool->log, "Packet pool finalized with %llu buffer(s) still in use",
+				(unsigned long long)(pool->bufs_count - pool->free_count));
+	free(pool->bufs);
+	free(pool->slab);
+	chiaki_mutex_fini(&pool->mutex);
+}
+
+CHIAKI_EXPORT ChiakiPacketBuf *chiaki_packet_pool_acquire(ChiakiPacketPool *pool)
+{
+	chiaki_mutex_lock(&pool->mutex);
+	ChiakiPacketBuf *buf = pool->free_list;
+	if(!buf)
+	{
+		pool->exhausted_count++;
+		chiaki_mutex_unlock(&pool->mutex);
+		return NULL;
+	}
+	pool->free_list = buf->next_free;
+	pool->free_count--;
+	if(pool->free_count < pool->free_count_min)
+		pool->free_count_min = pool->free_count;
+	chiaki_mutex_unlock(&pool->mutex);
+
+	buf->next_free = NULL;
+	buf->size = 0;
+	chiaki_atomic_store_32(&buf->refs, 1);
+	return buf;
+}
+
+CHIAKI_EXPORT void chiaki_packet_buf_ref(ChiakiPacketBuf *buf)
+{
+	chiaki_atomic_add_32(&buf->refs, 1);
+}
+
+CHIAKI_EXPORT void chiaki_packet_buf_unref(ChiakiPacketBuf *buf)
+{
+	uint32_t refs = chiaki_atomic_sub_32(&buf->refs, 1);
+	assert(refs != (uint32_t)-1);
+	if(refs != 0)
+		return;
+
+	ChiakiPacketPool *pool = buf->pool;
+	chiaki_mutex_lock(&pool->mutex);
+	buf->next_free = pool->free_list;
+	pool->free_list = buf;
+	pool->free_count++;
+	chiaki_mutex_unlock(&pool->mutex);
+}
+
+CHIAKI_EXPORT bool chiaki_packet_buf_is_unique(ChiakiPacketBuf *buf)
+{
+	return chiaki_atomic_load_32(&buf->refs) == 1;
+}
+
+CHIAKI_EXPORT void chiaki_packet_pool_log_stats(ChiakiPacketPool *pool)
+{
+	chiaki_mutex_lock(&pool->mutex);
+	size_t in_use_max = pool->bufs_count - pool->free_count_min;
+	uint64_t exhausted = pool->exhausted_count;
+	chiaki_mutex_unlock(&pool->mutex);
+	CHIAKI_LOGI(pool->log, "Packet pool: %llu buffer(s) of %u bytes (%llu KiB), at most %llu in use, exhausted %llu time(s)",
+			(unsigned long long)pool->bufs_count, (unsigned int)CHIAKI_PACKET_BUF_SIZE,
+			(unsigned long long)(pool->bufs_count * CHIAKI_PACKET_BUF_SIZE / 1024),
+			(unsigned long long)in_use_max, (unsigned long long)exhausted);
+}
@@ -144,6 +144,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_senkusha_run(ChiakiSenkusha *senkusha, uint
 
 	takion_info.enable_crypt = false;
 	takion_info.protocol_version = 7;
+	takion_info.packet_pool = NULL;
 
 	takion_info.cb = senkusha_takion_cb;
 	takion_info.cb_user = senkusha;
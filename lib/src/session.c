@@ -230,6 +230,8 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_session_init(ChiakiSession *session, Chiaki
 	session->connect_info.video_profile_auto_downgrade = connect_info->video_profile_auto_downgrade;
 	session->connect_info.enable_keyboard = connect_info->enable_keyboard;
 	session->connect_info.enable_dualsense = connect_info->enable_dualsense;
+	session->connect_info.fec_threads = connect_info->fec_threads;
+	session->connect_info.video_frame_deadline_ms = connect_info->video_frame_deadline_ms;
 
 	return CHIAKI_ERR_SUCCESS;
 error_stop_pipe:
@@ -0,0 +1,151 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/spscqueue.h>
+
+#include "atomic_utils.h"
+
+#include <string.h>
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_spsc_queue_init(ChiakiSPSCQueue *queue, size_t size_exp, size_t elem_size)
+{
+	if(size_exp > 30 || elem_size == 0)
+		return CHIAKI_ERR_INVALID_DATA;
+
+	queue->elem_size = elem_size;
+	queue->mask = (1u << size_exp) - 1;
+	queue->head = 0;
+	queue->tail = 0;
+	queue->consumer_waiting = 0;
+	queue->closed = 0;
+	queue->pushed = 0;
+	queue->dropped = 0;
+	queue->depth_max = 0;
+
+	queue->elems = malloc(((size_t)1 << size_exp) * elem_size);
+	if(!queue->elems)
+		return CHIAKI_ERR_MEMORY;
+
+	ChiakiErrorCode err = chiaki_mutex_init(&queue->mutex, false);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_elems;
+
+	err = chiaki_cond_init(&queue->cond);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_mutex;
+
+	return CHIAKI_ERR_SUCCESS;
+error_mutex:
+	chiaki_mutex_fini(&queue->mutex);
+error_elems:
+	free(queue->elems);
+	return err;
+}
+
+CHIAKI_EXPORT void chiaki_spsc_queue_fini(ChiakiSPSCQueue *queue)
+{
+	chiaki_cond_fini(&queue->cond);
+	chiaki_mutex_fini(&queue->mutex);
+	free(queue->elems);
+}
+
+static void spsc_queue_wake_consumer(ChiakiSPSCQueue *queue)
+{
+	// pairs with the fence in chiaki_spsc_queue_pop_wait()
+	chiaki_atomic_fence();
+	if(!chiaki_atomic_load_32(&queue->consumer_waiting))
+		return;
+	chiaki_mutex_lock(&queue->mutex);
+	chiaki_cond_signal(&queue->cond);
+	chiaki_mutex_unlock(&queue->mutex);
+}
+
+CHIAKI_EXPORT bool chiaki_spsc_queue_push(ChiakiSPSCQueue *queue, const void *elem)
+{
+	uint32_t head = queue->head;
+	uint32_t tail = chiaki_atomic_load_32(&queue->tail);
+	size_t depth = (size_t)(head - tail);
+	if(depth > queue->mask || chiaki_atomic_load_32(&queue->closed))
+	{
+		queue->dropped++;
+		return false;
+	}
+
+	memcpy(queue->elems + (size_t)(head & queue->mask) * queue->elem_size, elem, queue->elem_size);
+	chiaki_atomic_store_32(&queue->head, head + 1);
+
+	queue->pushed++;
+	if(depth + 1 > queue->depth_max)
+		queue->depth_max = depth + 1;
+
+	spsc_queue_wake_consumer(queue);
+	return true;
+}
+
+CHIAKI_EXPORT bool chiaki_spsc_queue_pop(ChiakiSPSCQueue *queue, void *elem)
+{
+	uint32_t tail = queue->tail;
+	uint32_t head = chiaki_atomic_load_32(&queue->head);
+	if(head == tail)
+		return false;
+
+	memcpy(elem, queue->elems + (size_t)(tail & queue->mask) * queue->elem_size, queue->elem_size);
+	chiaki_atomic_store_32(&queue->tail, tail + 1);
+	return true;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_spsc_queue_pop_wait(ChiakiSPSCQueue *queue, void *elem, uint64_t timeout_ms)
+{
+	if(chiaki_spsc_queue_pop(queue, elem))
+		return CHIAKI_ERR_SUCCESS;
+
+	ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
+	chiaki_mutex_lock(&queue->mutex);
+	while(true)
+	{
+		chiaki_atomic_store_32(&queue->consumer_waiting, 1);
+		// make the flag visible before checking again, so a concurrent push cannot be missed
+		chiaki_atomic_fence();
+		if(chiaki_spsc_queue_pop(queue, elem))
+		{
+			err = CHIAKI_ERR_SUCCESS;
+			break;
+		}
+		if(chiaki_atomic_load_32(&queue->closed))
+		{
+			err = CHIAKI_ERR_CANCELED;
+			break;
+		}
+		if(err == CHIAKI_ERR_TIMEOUT)
+			break;
+		if(timeout_ms == UINT64_MAX)
+			chiaki_cond_wait(&queue->cond, &queue->mutex);
+		else
+			err = chiaki_cond_timedwait(&queue->cond, &queue->mutex, timeout_ms);
+		// on timeout, check one last time before giving up
+	}
+	chiaki_atomic_store_32(&queue->consumer_waiting, 0);
+	chiaki_mutex_unlock(&queue->mutex);
+	return err;
+}
+
+CHIAKI_EXPORT void chiaki_spsc_queue_close(ChiakiSPSCQueue *queue)
+{
+	chiaki_mutex_lock(&queue->mutex);
+	chiaki_atomic_store_32(&queue->closed, 1);
+	chiaki_cond_signal(&queue->cond);
+	chiaki_mutex_unlock(&queue->mutex);
+}
+
+CHIAKI_EXPORT size_t chiaki_spsc_queue_depth(ChiakiSPSCQueue *queue)
+{
+	uint32_t tail = chiaki_atomic_load_32(&queue->tail);
+	uint32_t head = chiaki_atomic_load_32(&queue->head);
+	return (size_t)(head - tail);
+}
+
+CHIAKI_EXPORT void chiaki_spsc_queue_get_stats(ChiakiSPSCQueue *queue, ChiakiSPSCQueueStats *stats)
+{
+	stats->pushed = queue->pushed;
+	stats->dropped = queue->dropped;
+	stats->depth_max = queue->depth_max;
+}
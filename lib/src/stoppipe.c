@@ -13,6 +13,14 @@
 #include <sys/select.h>
 #endif
 
+#if defined(__linux__) && !defined(__SWITCH__)
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
 CHIAKI_EXPORT ChiakiErrorCode chiaki_stop_pipe_init(ChiakiStopPipe *stop_pipe)
 {
 #ifdef _WIN32
@@ -44,6 +52,27 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_stop_pipe_init(ChiakiStopPipe *stop_pipe)
 		close(stop_pipe->fd);
 		return CHIAKI_ERR_UNKNOWN;
 	}
+#elif defined(__linux__)
+	stop_pipe->registered_fd = CHIAKI_INVALID_SOCKET;
+	stop_pipe->registered_write = false;
+	stop_pipe->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(stop_pipe->event_fd < 0)
+		return CHIAKI_ERR_UNKNOWN;
+	stop_pipe->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if(stop_pipe->epoll_fd < 0)
+	{
+		close(stop_pipe->event_fd);
+		return CHIAKI_ERR_UNKNOWN;
+	}
+	struct epoll_event event = { 0 };
+	event.events = EPOLLIN;
+	event.data.fd = stop_pipe->event_fd;
+	if(epoll_ctl(stop_pipe->epoll_fd, EPOLL_CTL_ADD, stop_pipe->event_fd, &event) < 0)
+	{
+		close(stop_pipe->epoll_fd);
+		close(stop_pipe->event_fd);
+		return CHIAKI_ERR_UNKNOWN;
+	}
 #else
 	int r = pipe(stop_pipe->fds);
 	if(r < 0)
@@ -65,6 +94,9 @@ CHIAKI_EXPORT void chiaki_stop_pipe_fini(ChiakiStopPipe *stop_pipe)
 	WSACloseEvent(stop_pipe->event);
 #elif defined(__SWITCH__)
 	close(stop_pipe->fd);
+#elif defined(__linux__)
+	close(stop_pipe->epoll_fd);
+	close(stop_pipe->event_fd);
 #else
 	close(stop_pipe->fds[0]);
 	close(stop_pipe->fds[1]);
@@ -79,6 +111,9 @@ CHIAKI_EXPORT void chiaki_stop_pipe_stop(ChiakiStopPipe *stop_pipe)
 	// send to local socket (FIXME MSG_CONFIRM)
 	sendto(stop_pipe->fd, "\x00", 1, 0,
 		(struct sockaddr*)&stop_pipe->addr, sizeof(struct sockaddr_in));
+#elif defined(__linux__)
+	uint64_t v = 1;
+	write(stop_pipe->event_fd, &v, sizeof(v));
 #else
 	write(stop_pipe->fds[1], "\x00", 1);
 #endif
@@ -116,6 +151,61 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_stop_pipe_select_single(ChiakiStopPipe *sto
 		default:
 			return CHIAKI_ERR_UNKNOWN;
 	}
+#elif defined(__linux__)
+	int timeout = timeout_ms == UINT64_MAX ? -1 : (timeout_ms > INT_MAX ? INT_MAX : (int)timeout_ms);
+	int r;
+
+	if(!CHIAKI_SOCKET_IS_INVALID(fd) && fd == stop_pipe->registered_fd && write == stop_pipe->registered_write)
+	{
+		// fast path: everything is already registered, a single epoll_wait() is enough
+		struct epoll_event events[2];
+		do
+		{
+			r = epoll_wait(stop_pipe->epoll_fd, events, 2, timeout);
+		} while(r < 0 && errno == EINTR);
+
+		if(r < 0)
+			return CHIAKI_ERR_UNKNOWN;
+
+		bool fd_ready = false;
+		for(int i=0; i<r; i++)
+		{
+			if(events[i].data.fd == stop_pipe->event_fd)
+				return CHIAKI_ERR_CANCELED;
+			fd_ready = true;
+		}
+		return fd_ready ? CHIAKI_ERR_SUCCESS : CHIAKI_ERR_TIMEOUT;
+	}
+
+	// fd is not registered (e.g. short-lived sockets), watch it only for this call
+	struct pollfd pfds[2];
+	nfds_t nfds = 1;
+	pfds[0].fd = stop_pipe->event_fd;
+	pfds[0].events = POLLIN;
+	pfds[0].revents = 0;
+	if(!CHIAKI_SOCKET_IS_INVALID(fd))
+	{
+		pfds[1].fd = fd;
+		pfds[1].events = write ? POLLOUT : POLLIN;
+		pfds[1].revents = 0;
+		nfds = 2;
+	}
+
+	do
+	{
+		r = poll(pfds, nfds, timeout);
+	} while(r < 0 && errno == EINTR);
+
+	if(r < 0)
+		return CHIAKI_ERR_UNKNOWN;
+
+	if(pfds[0].revents & POLLIN)
+		return CHIAKI_ERR_CANCELED;
+
+	if(nfds == 2 && pfds[1].revents)
+		return CHIAKI_ERR_SUCCESS;
+
+	return CHIAKI_ERR_TIMEOUT;
 #else
 	fd_set rfds;
 	FD_ZERO(&rfds);
@@ -166,6 +256,44 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_stop_pipe_select_single(ChiakiStopPipe *sto
 #endif
 }
 
+CHIAKI_EXPORT ChiakiErrorCode chiaki_stop_pipe_register(ChiakiStopPipe *stop_pipe, chiaki_socket_t fd, bool write)
+{
+#if defined(__linux__) && !defined(__SWITCH__)
+	if(fd == stop_pipe->registered_fd && write == stop_pipe->registered_write)
+		return CHIAKI_ERR_SUCCESS;
+	chiaki_stop_pipe_unregister(stop_pipe);
+	if(CHIAKI_SOCKET_IS_INVALID(fd))
+		return CHIAKI_ERR_SUCCESS;
+
+	struct epoll_event event = { 0 };
+	event.events = write ? EPOLLOUT : EPOLLIN;
+	event.data.fd = fd;
+	if(epoll_ctl(stop_pipe->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+		return CHIAKI_ERR_UNKNOWN;
+	stop_pipe->registered_fd = fd;
+	stop_pipe->registered_write = write;
+#else
+	(void)stop_pipe;
+	(void)fd;
+	(void)write;
+#endif
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT void chiaki_stop_pipe_unregister(ChiakiStopPipe *stop_pipe)
+{
+#if defined(__linux__) && !defined(__SWITCH__)
+	if(CHIAKI_SOCKET_IS_INVALID(stop_pipe->registered_fd))
+		return;
+	// may fail if the fd has already been closed, which removes it from the epoll set anyway
+	epoll_ctl(stop_pipe->epoll_fd, EPOLL_CTL_DEL, stop_pipe->registered_fd, NULL);
+	stop_pipe->registered_fd = CHIAKI_INVALID_SOCKET;
+	stop_pipe->registered_write = false;
+#else
+	(void)stop_pipe;
+#endif
+}
+
 CHIAKI_EXPORT ChiakiErrorCode chiaki_stop_pipe_connect(ChiakiStopPipe *stop_pipe, chiaki_socket_t fd, struct sockaddr *addr, size_t addrlen)
 {
 	int r = connect(fd, addr, (socklen_t)addrlen);
@@ -253,6 +381,11 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_stop_pipe_reset(ChiakiStopPipe *stop_pipe)
 	int r;
 	while((r = read(stop_pipe->fd, &v, sizeof(v))) > 0);
 	return r < 0 ? CHIAKI_ERR_UNKNOWN : CHIAKI_ERR_SUCCESS;
+#elif defined(__linux__)
+	// reading an eventfd resets its counter at once
+	uint64_t v;
+	ssize_t r = read(stop_pipe->event_fd, &v, sizeof(v));
+	return r < 0 && errno != EAGAIN ? CHIAKI_ERR_UNKNOWN : CHIAKI_ERR_SUCCESS;
 #else
 	uint8_t v;
 	int r;
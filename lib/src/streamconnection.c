@@ -8,6 +8,7 @@
 #include <chiaki/base64.h>
 #include <chiaki/audio.h>
 #include <chiaki/video.h>
+#include <chiaki/time.h>
 
 #include <string.h>
 #include <assert.h>
@@ -33,6 +34,9 @@
 
 #define HEARTBEAT_INTERVAL_MS 1000
 
+#define STREAM_CONNECTION_PACKET_POOL_SIZE 1024
+#define STREAM_CONNECTION_AV_QUEUE_SIZE_EXP 8 // => 256 entries
+
 
 typedef enum {
 	STATE_IDLE,
@@ -41,6 +45,23 @@ typedef enum {
 	STATE_EXPECT_STREAMINFO
 } StreamConnectionState;
 
+typedef struct stream_connection_stream_info_t
+{
+	ChiakiAudioHeader audio_header;
+	ChiakiVideoProfile video_profiles[CHIAKI_VIDEO_PROFILES_MAX];
+	size_t video_profiles_count;
+} StreamConnectionStreamInfo;
+
+/**
+ * Element of av_queue.
+ * Stream info goes through the same queue as the packets so the receivers see both in order.
+ */
+typedef struct stream_connection_av_item_t
+{
+	ChiakiTakionAVPacket packet; // packet.buf holds a reference if stream_info is NULL
+	StreamConnectionStreamInfo *stream_info; // owned by the item if not NULL
+} StreamConnectionAVItem;
+
 void chiaki_session_send_event(ChiakiSession *session, ChiakiEvent *event);
 
 static void stream_connection_takion_cb(ChiakiTakionEvent *event, void *user);
@@ -56,6 +77,8 @@ static void stream_connection_takion_data_expect_bang(ChiakiStreamConnection *st
 static void stream_connection_takion_data_expect_streaminfo(ChiakiStreamConnection *stream_connection, uint8_t *buf, size_t buf_size);
 static ChiakiErrorCode stream_connection_send_streaminfo_ack(ChiakiStreamConnection *stream_connection);
 static void stream_connection_takion_av(ChiakiStreamConnection *stream_connection, ChiakiTakionAVPacket *packet);
+static void *stream_connection_av_thread_func(void *user);
+static void stream_connection_av_item_release(StreamConnectionAVItem *item);
 static ChiakiErrorCode stream_connection_send_heartbeat(ChiakiStreamConnection *stream_connection);
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_stream_connection_init(ChiakiStreamConnection *stream_connection, ChiakiSession *session)
@@ -151,6 +174,8 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_stream_connection_run(ChiakiStreamConnectio
 
 	takion_info.cb = stream_connection_takion_cb;
 	takion_info.cb_user = stream_connection;
+	// packets are still referenced from av_queue after Takion is closed
+	takion_info.packet_pool = &stream_connection->packet_pool;
 
 	err = chiaki_mutex_lock(&stream_connection->state_mutex);
 	assert(err == CHIAKI_ERR_SUCCESS);
@@ -184,6 +209,22 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_stream_connection_run(ChiakiStreamConnectio
 		goto err_haptics_receiver;
 	}
 
+	err = chiaki_packet_pool_init(&stream_connection->packet_pool, session->log, STREAM_CONNECTION_PACKET_POOL_SIZE);
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGE(session->log, "StreamConnection failed to initialize Packet Pool");
+		chiaki_mutex_unlock(&stream_connection->state_mutex);
+		goto err_video_receiver;
+	}
+
+	err = chiaki_spsc_queue_init(&stream_connection->av_queue, STREAM_CONNECTION_AV_QUEUE_SIZE_EXP, sizeof(StreamConnectionAVItem));
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGE(session->log, "StreamConnection failed to initialize AV Queue");
+		chiaki_mutex_unlock(&stream_connection->state_mutex);
+		goto err_packet_pool;
+	}
+
 	stream_connection->state = STATE_TAKION_CONNECT;
 	stream_connection->state_finished = false;
 	stream_connection->state_failed = false;
@@ -193,20 +234,31 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_stream_connection_run(ChiakiStreamConnectio
 	{
 		CHIAKI_LOGE(session->log, "StreamConnection connect failed");
 		chiaki_mutex_unlock(&stream_connection->state_mutex);
-		goto err_video_receiver;
+		goto err_av_queue;
 	}
 
+	// started after Takion, because it sends through it (corrupt frame reports) until it is joined.
+	// Anything Takion pushes before that just waits in av_queue.
+	err = chiaki_thread_create(&stream_connection->av_thread, stream_connection_av_thread_func, stream_connection);
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGE(session->log, "StreamConnection failed to start AV Thread");
+		chiaki_mutex_unlock(&stream_connection->state_mutex);
+		goto close_takion;
+	}
+	chiaki_thread_set_name(&stream_connection->av_thread, "Chiaki AV");
+
 	ChiakiCongestionControl congestion_control;
 	err = chiaki_congestion_control_start(&congestion_control, &stream_connection->takion, &stream_connection->packet_stats);
 	if(err != CHIAKI_ERR_SUCCESS)
 	{
 		CHIAKI_LOGE(session->log, "StreamConnection failed to start Congestion Control");
-		goto close_takion;
+		goto err_av_thread;
 	}
 
 	err = chiaki_cond_timedwait_pred(&stream_connection->state_cond, &stream_connection->state_mutex, EXPECT_TIMEOUT_MS, state_finished_cond_check, stream_connection);
 	assert(err == CHIAKI_ERR_SUCCESS || err == CHIAKI_ERR_TIMEOUT);
-	CHECK_STOP(close_takion);
+	CHECK_STOP(err_av_thread);
 	if(err != CHIAKI_ERR_SUCCESS)
 	{
 		CHIAKI_LOGE(session->log, "StreamConnection Takion connect failed");
@@ -323,12 +375,35 @@ disconnect:
 err_congestion_control:
 	chiaki_congestion_control_stop(&congestion_control);
 
-close_takion:
+err_av_thread:
 	chiaki_mutex_unlock(&stream_connection->state_mutex);
 
+	// reject further packets and let the av thread finish what is left, while Takion can still send
+	chiaki_spsc_queue_close(&stream_connection->av_queue);
+	chiaki_thread_join(&stream_connection->av_thread, NULL);
+
+close_takion:
 	chiaki_takion_close(&stream_connection->takion);
 	CHIAKI_LOGI(session->log, "StreamConnection closed takion");
 
+	// a push racing with the close may still have landed after the av thread was done
+	StreamConnectionAVItem av_item;
+	while(chiaki_spsc_queue_pop(&stream_connection->av_queue, &av_item))
+		stream_connection_av_item_release(&av_item);
+
+	ChiakiSPSCQueueStats av_queue_stats;
+	chiaki_spsc_queue_get_stats(&stream_connection->av_queue, &av_queue_stats);
+	CHIAKI_LOGI(session->log, "StreamConnection av queue: %llu packets queued, %llu dropped, max depth %llu",
+			(unsigned long long)av_queue_stats.pushed, (unsigned long long)av_queue_stats.dropped,
+			(unsigned long long)av_queue_stats.depth_max);
+
+err_av_queue:
+	chiaki_spsc_queue_fini(&stream_connection->av_queue);
+
+err_packet_pool:
+	chiaki_packet_pool_log_stats(&stream_connection->packet_pool);
+	chiaki_packet_pool_fini(&stream_connection->packet_pool);
+
 err_video_receiver:
 	chiaki_video_receiver_free(stream_connection->video_receiver);
 	stream_connection->video_receiver = NULL;
@@ -725,16 +800,24 @@ static void stream_connection_takion_data_expect_streaminfo(ChiakiStreamConnecti
 	if(audio_header_buf.size != CHIAKI_AUDIO_HEADER_SIZE)
 	{
 		CHIAKI_LOGE(stream_connection->log, "StreamConnection received invalid audio header in streaminfo");
-		goto error;
+		goto error_profiles;
 	}
 
-	ChiakiAudioHeader audio_header_s;
-	chiaki_audio_header_load(&audio_header_s, audio_header);
-	chiaki_audio_receiver_stream_info(stream_connection->audio_receiver, &audio_header_s);
+	StreamConnectionAVItem item = { 0 };
+	item.stream_info = malloc(sizeof(StreamConnectionStreamInfo));
+	if(!item.stream_info)
+		goto error_profiles;
+	chiaki_audio_header_load(&item.stream_info->audio_header, audio_header);
+	memcpy(item.stream_info->video_profiles, decode_resolutions_context.video_profiles, sizeof(item.stream_info->video_profiles));
+	item.stream_info->video_profiles_count = decode_resolutions_context.video_profiles_count;
 
-	chiaki_video_receiver_stream_info(stream_connection->video_receiver,
-			decode_resolutions_context.video_profiles,
-			decode_resolutions_context.video_profiles_count);
+	// applied on the av thread, in order with the packets
+	if(!chiaki_spsc_queue_push(&stream_connection->av_queue, &item))
+	{
+		CHIAKI_LOGE(stream_connection->log, "StreamConnection failed to queue streaminfo");
+		free(item.stream_info);
+		goto error_profiles;
+	}
 
 	// TODO: do some checks?
 
@@ -744,6 +827,9 @@ static void stream_connection_takion_data_expect_streaminfo(ChiakiStreamConnecti
 	stream_connection->state_finished = true;
 	chiaki_cond_signal(&stream_connection->state_cond);
 	return;
+error_profiles:
+	for(size_t i=0; i<decode_resolutions_context.video_profiles_count; i++)
+		free(decode_resolutions_context.video_profiles[i].header);
 error:
 	stream_connection->state_failed = true;
 	chiaki_cond_signal(&stream_connection->state_cond);
@@ -940,12 +1026,80 @@ static void stream_connection_takion_av(ChiakiStreamConnection *stream_connectio
 {
 	chiaki_gkcrypt_decrypt(stream_connection->gkcrypt_remote, packet->key_pos + CHIAKI_GKCRYPT_BLOCK_SIZE, packet->data, packet->data_size);
 
+	StreamConnectionAVItem item;
+	item.packet = *packet;
+	item.stream_info = NULL;
+	chiaki_packet_buf_ref(packet->buf);
+	if(!chiaki_spsc_queue_push(&stream_connection->av_queue, &item))
+		chiaki_packet_buf_unref(packet->buf); // counted in the queue stats
+}
+
+static void stream_connection_av_item_process(ChiakiStreamConnection *stream_connection, StreamConnectionAVItem *item)
+{
+	StreamConnectionStreamInfo *stream_info = item->stream_info;
+	if(stream_info)
+	{
+		chiaki_audio_receiver_stream_info(stream_connection->audio_receiver, &stream_info->audio_header);
+		chiaki_video_receiver_stream_info(stream_connection->video_receiver,
+				stream_info->video_profiles,
+				stream_info->video_profiles_count);
+		free(stream_info);
+		return;
+	}
+
+	ChiakiTakionAVPacket *packet = &item->packet;
 	if(packet->is_video)
 		chiaki_video_receiver_av_packet(stream_connection->video_receiver, packet);
 	else if(packet->is_haptics)
 	    chiaki_audio_receiver_av_packet(stream_connection->haptics_receiver, packet);
 	else
 		chiaki_audio_receiver_av_packet(stream_connection->audio_receiver, packet);
+	chiaki_packet_buf_unref(packet->buf);
+}
+
+/**
+ * Drop an item of av_queue without processing it.
+ */
+static void stream_connection_av_item_release(StreamConnectionAVItem *item)
+{
+	StreamConnectionStreamInfo *stream_info = item->stream_info;
+	if(stream_info)
+	{
+		for(size_t i=0; i<stream_info->video_profiles_count; i++)
+			free(stream_info->video_profiles[i].header);
+		free(stream_info);
+		return;
+	}
+	chiaki_packet_buf_unref(item->packet.buf);
+}
+
+/**
+ * Last stage of the receive pipeline, running the audio/video receivers including FEC and the sinks.
+ * Also flushes incomplete video frames when their deadline passes without further packets.
+ */
+static void *stream_connection_av_thread_func(void *user)
+{
+	ChiakiStreamConnection *stream_connection = user;
+	StreamConnectionAVItem item;
+	while(true)
+	{
+		uint64_t timeout_ms = UINT64_MAX;
+		uint64_t deadline_ms = chiaki_video_receiver_next_deadline_ms(stream_connection->video_receiver);
+		if(deadline_ms != UINT64_MAX)
+		{
+			uint64_t now_ms = chiaki_time_now_monotonic_ms();
+			timeout_ms = deadline_ms > now_ms ? deadline_ms - now_ms : 0;
+		}
+
+		ChiakiErrorCode err = chiaki_spsc_queue_pop_wait(&stream_connection->av_queue, &item, timeout_ms);
+		if(err == CHIAKI_ERR_SUCCESS)
+			stream_connection_av_item_process(stream_connection, &item);
+		else if(err == CHIAKI_ERR_TIMEOUT)
+			chiaki_video_receiver_flush_due(stream_connection->video_receiver, chiaki_time_now_monotonic_ms());
+		else // queue has been closed and drained
+			break;
+	}
+	return NULL;
 }
 
 static ChiakiErrorCode stream_connection_send_heartbeat(ChiakiStreamConnection *stream_connection)
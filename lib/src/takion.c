@@ -1,5 +1,7 @@
 // SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
 
+#define _GNU_SOURCE // recvmmsg
+
 #include "chiaki/feedback.h"
 #include <chiaki/takion.h>
 #include <chiaki/congestioncontrol.h>
@@ -27,6 +29,11 @@
 #include <sys/socket.h>
 #endif
 
+#if defined(__linux__) && !defined(__SWITCH__)
+#define TAKION_HAVE_RECVMMSG 1
+#include <sys/uio.h>
+#endif
+
 
 // VERY similar to SCTP, see RFC 4960
 
@@ -45,6 +52,16 @@
 
 #define TAKION_EXPECT_TIMEOUT_MS 5000
 
+#define TAKION_RECV_BATCH_SIZE 16
+
+/**
+ * Size of the pool created if none is given in ChiakiTakionConnectInfo.
+ * Must cover the receive batch, the rx queue, the reorder queue and postponed packets.
+ */
+#define TAKION_PACKET_POOL_SIZE 256
+
+#define TAKION_RX_QUEUE_SIZE_EXP 9 // => 512 entries
+
 /**
  * Base type of Takion packets. Lower nibble of the first byte in datagrams.
  */
@@ -108,6 +125,20 @@ typedef enum takion_chunk_type_t {
 	TAKION_CHUNK_TYPE_COOKIE_ACK = 0xb,
 } TakionChunkType;
 
+/**
+ * Pool buffers for draining multiple datagrams per wakeup of the Takion thread
+ */
+typedef struct takion_recv_batch_t
+{
+	ChiakiPacketBuf *bufs[TAKION_RECV_BATCH_SIZE];
+	size_t slots; // number of acquired buffers at the beginning of bufs
+	size_t count; // number of buffers that received a datagram
+#ifdef TAKION_HAVE_RECVMMSG
+	struct iovec iovs[TAKION_RECV_BATCH_SIZE];
+	struct mmsghdr msgs[TAKION_RECV_BATCH_SIZE];
+#endif
+} TakionRecvBatch;
+
 typedef struct takion_message_t
 {
 	uint32_t tag;
@@ -141,36 +172,27 @@ typedef struct takion_message_payload_init_ack_t
 	uint8_t cookie[TAKION_COOKIE_SIZE];
 } TakionMessagePayloadInitAck;
 
-typedef struct
-{
-	uint8_t *packet_buf;
-	size_t packet_size;
-	uint8_t type_b;
-	uint8_t *payload; // inside packet_buf
-	size_t payload_size;
-	uint16_t channel;
-} TakionDataPacketEntry;
-
 typedef struct chiaki_takion_postponed_packet_t
 {
-	uint8_t *buf;
-	size_t buf_size;
+	ChiakiPacketBuf *buf; // holds a reference
 } ChiakiTakionPostponedPacket;
 
 static void *takion_thread_func(void *user);
-static void takion_handle_packet(ChiakiTakion *takion, uint8_t *buf, size_t buf_size);
+static void *takion_proc_thread_func(void *user);
+static void takion_handle_packet(ChiakiTakion *takion, ChiakiPacketBuf *buf);
 static ChiakiErrorCode takion_handle_packet_mac(ChiakiTakion *takion, uint8_t base_type, uint8_t *buf, size_t buf_size);
-static void takion_handle_packet_message(ChiakiTakion *takion, uint8_t *buf, size_t buf_size);
-static void takion_handle_packet_message_data(ChiakiTakion *takion, uint8_t *packet_buf, size_t packet_buf_size, uint8_t type_b, uint8_t *payload, size_t payload_size);
+static void takion_handle_packet_message(ChiakiTakion *takion, ChiakiPacketBuf *buf);
+static void takion_handle_packet_message_data(ChiakiTakion *takion, ChiakiPacketBuf *packet_buf, uint8_t type_b, uint8_t *payload, size_t payload_size);
 static void takion_handle_packet_message_data_ack(ChiakiTakion *takion, uint8_t flags, uint8_t *buf, size_t buf_size);
 static ChiakiErrorCode takion_parse_message(ChiakiTakion *takion, uint8_t *buf, size_t buf_size, TakionMessage *msg);
 static void takion_write_message_header(uint8_t *buf, uint32_t tag, uint64_t key_pos, uint8_t chunk_type, uint8_t chunk_flags, size_t payload_data_size);
 static ChiakiErrorCode takion_send_message_init(ChiakiTakion *takion, TakionMessagePayloadInit *payload);
 static ChiakiErrorCode takion_send_message_cookie(ChiakiTakion *takion, uint8_t *cookie);
 static ChiakiErrorCode takion_recv(ChiakiTakion *takion, uint8_t *buf, size_t *buf_size, uint64_t timeout_ms);
+static ChiakiErrorCode takion_recv_batch(ChiakiTakion *takion, TakionRecvBatch *batch, uint64_t timeout_ms);
 static ChiakiErrorCode takion_recv_message_init_ack(ChiakiTakion *takion, TakionMessagePayloadInitAck *payload);
 static ChiakiErrorCode takion_recv_message_cookie_ack(ChiakiTakion *takion);
-static void takion_handle_packet_av(ChiakiTakion *takion, uint8_t base_type, uint8_t *buf, size_t buf_size);
+static void takion_handle_packet_av(ChiakiTakion *takion, uint8_t base_type, ChiakiPacketBuf *buf);
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_connect(ChiakiTakion *takion, ChiakiTakionConnectInfo *info)
 {
@@ -217,14 +239,29 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_connect(ChiakiTakion *takion, Chiaki
 	takion->postponed_packets_size = 0;
 	takion->postponed_packets_count = 0;
 	takion->enable_dualsense = info->enable_dualsense;
+	chiaki_av_admission_init(&takion->av_admission);
 
 	CHIAKI_LOGI(takion->log, "Takion connecting (version %u)", (unsigned int)info->protocol_version);
 
-	ChiakiErrorCode err = chiaki_stop_pipe_init(&takion->stop_pipe);
+	ChiakiErrorCode err;
+	takion->packet_pool = info->packet_pool;
+	if(!takion->packet_pool)
+	{
+		err = chiaki_packet_pool_init(&takion->packet_pool_own, takion->log, TAKION_PACKET_POOL_SIZE);
+		if(err != CHIAKI_ERR_SUCCESS)
+		{
+			CHIAKI_LOGE(takion->log, "Takion failed to create packet pool");
+			ret = err;
+			goto error_seq_num_local_mutex;
+		}
+		takion->packet_pool = &takion->packet_pool_own;
+	}
+
+	err = chiaki_stop_pipe_init(&takion->stop_pipe);
 	if(err != CHIAKI_ERR_SUCCESS)
 	{
 		CHIAKI_LOGE(takion->log, "Takion failed to create stop pipe");
-		goto error_seq_num_local_mutex;
+		goto error_packet_pool;
 	}
 
 	takion->sock = socket(info->sa->sa_family, SOCK_DGRAM, IPPROTO_UDP);
@@ -280,6 +317,11 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_connect(ChiakiTakion *takion, Chiaki
 		goto error_sock;
 	}
 
+	// the socket is watched on every receive, register it only once
+	err = chiaki_stop_pipe_register(&takion->stop_pipe, takion->sock, false);
+	if(err != CHIAKI_ERR_SUCCESS)
+		CHIAKI_LOGW(takion->log, "Takion failed to register socket in stop pipe");
+
 	err = chiaki_thread_create(&takion->thread, takion_thread_func, takion);
 	if(r != CHIAKI_ERR_SUCCESS)
 	{
@@ -295,6 +337,9 @@ error_sock:
 	CHIAKI_SOCKET_CLOSE(takion->sock);
 error_pipe:
 	chiaki_stop_pipe_fini(&takion->stop_pipe);
+error_packet_pool:
+	if(takion->packet_pool == &takion->packet_pool_own)
+		chiaki_packet_pool_fini(&takion->packet_pool_own);
 error_seq_num_local_mutex:
 	chiaki_mutex_fini(&takion->seq_num_local_mutex);
 error_gkcrypt_local_mutex:
@@ -307,6 +352,12 @@ CHIAKI_EXPORT void chiaki_takion_close(ChiakiTakion *takion)
 	chiaki_stop_pipe_stop(&takion->stop_pipe);
 	chiaki_thread_join(&takion->thread, NULL);
 	chiaki_stop_pipe_fini(&takion->stop_pipe);
+	chiaki_av_admission_log_stats(&takion->av_admission, takion->log);
+	if(takion->packet_pool == &takion->packet_pool_own)
+	{
+		chiaki_packet_pool_log_stats(&takion->packet_pool_own);
+		chiaki_packet_pool_fini(&takion->packet_pool_own);
+	}
 	chiaki_mutex_fini(&takion->seq_num_local_mutex);
 	chiaki_mutex_fini(&takion->gkcrypt_local_mutex);
 }
@@ -664,9 +715,131 @@ static void takion_data_drop(uint64_t seq_num, void *elem_user, void *cb_user)
 {
 	ChiakiTakion *takion = cb_user;
 	CHIAKI_LOGE(takion->log, "Takion dropping data with seq num %#llx", (unsigned long long)seq_num);
-	TakionDataPacketEntry *entry = elem_user;
-	free(entry->packet_buf);
-	free(entry);
+	chiaki_packet_buf_unref(elem_user);
+}
+
+static void takion_check_crypt_available(ChiakiTakion *takion, bool *crypt_available)
+{
+	if(takion->enable_crypt && !*crypt_available && takion->gkcrypt_remote)
+	{
+		*crypt_available = true;
+		CHIAKI_LOGI(takion->log, "Crypt has become available. Re-checking MACs of %llu packets", (unsigned long long)chiaki_reorder_queue_count(&takion->data_queue));
+		for(uint64_t i=0; i<chiaki_reorder_queue_count(&takion->data_queue); i++)
+		{
+			ChiakiPacketBuf *packet;
+			bool peeked = chiaki_reorder_queue_peek(&takion->data_queue, i, NULL, (void **)&packet);
+			if(!peeked)
+				continue;
+			if(packet->size == 0)
+				continue;
+			uint8_t base_type = (uint8_t)(packet->data[0] & TAKION_PACKET_BASE_TYPE_MASK);
+			if(takion_handle_packet_mac(takion, base_type, packet->data, packet->size) != CHIAKI_ERR_SUCCESS)
+			{
+				CHIAKI_LOGW(takion->log, "Found an invalid MAC");
+				chiaki_reorder_queue_drop(&takion->data_queue, i);
+			}
+		}
+
+	}
+
+	if(takion->postponed_packets && takion->gkcrypt_remote)
+	{
+		// there are some postponed packets that were waiting until crypt is initialized and it is now :-)
+
+		CHIAKI_LOGI(takion->log, "Takion flushing %llu postpone packet(s)", (unsigned long long)takion->postponed_packets_count);
+
+		ChiakiTakionPostponedPacket *packets = takion->postponed_packets;
+		size_t packets_count = takion->postponed_packets_count;
+		takion->postponed_packets = NULL;
+		takion->postponed_packets_size = 0;
+		takion->postponed_packets_count = 0;
+
+		for(size_t i=0; i<packets_count; i++)
+		{
+			ChiakiTakionPostponedPacket *packet = &packets[i];
+			takion_handle_packet(takion, packet->buf);
+			chiaki_packet_buf_unref(packet->buf);
+		}
+		free(packets);
+	}
+}
+
+static void takion_drop_postponed_packets(ChiakiTakion *takion)
+{
+	if(!takion->postponed_packets)
+		return;
+	for(size_t i=0; i<takion->postponed_packets_count; i++)
+		chiaki_packet_buf_unref(takion->postponed_packets[i].buf);
+	free(takion->postponed_packets);
+	takion->postponed_packets = NULL;
+	takion->postponed_packets_size = 0;
+	takion->postponed_packets_count = 0;
+}
+
+static void takion_recv_batch_init(TakionRecvBatch *batch)
+{
+	batch->slots = 0;
+	batch->count = 0;
+#ifdef TAKION_HAVE_RECVMMSG
+	memset(batch->msgs, 0, sizeof(batch->msgs));
+	for(size_t i=0; i<TAKION_RECV_BATCH_SIZE; i++)
+	{
+		batch->iovs[i].iov_base = NULL;
+		batch->iovs[i].iov_len = CHIAKI_PACKET_BUF_SIZE;
+		batch->msgs[i].msg_hdr.msg_iov = &batch->iovs[i];
+		batch->msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+#endif
+}
+
+static void takion_recv_batch_set_slot(TakionRecvBatch *batch, size_t i, ChiakiPacketBuf *buf)
+{
+	batch->bufs[i] = buf;
+#ifdef TAKION_HAVE_RECVMMSG
+	batch->iovs[i].iov_base = buf->data;
+#endif
+}
+
+/**
+ * Acquire buffers from the pool for all empty slots, as long as the pool has some left.
+ */
+static void takion_recv_batch_refill(TakionRecvBatch *batch, ChiakiPacketPool *pool)
+{
+	while(batch->slots < TAKION_RECV_BATCH_SIZE)
+	{
+		ChiakiPacketBuf *buf = chiaki_packet_pool_acquire(pool);
+		if(!buf)
+			break;
+		takion_recv_batch_set_slot(batch, batch->slots++, buf);
+	}
+}
+
+/**
+ * Give up all buffers of the last batch that are still referenced from elsewhere and keep the rest for the next receive.
+ */
+static void takion_recv_batch_release(TakionRecvBatch *batch)
+{
+	size_t kept = 0;
+	for(size_t i=0; i<batch->slots; i++)
+	{
+		ChiakiPacketBuf *buf = batch->bufs[i];
+		if(i < batch->count && !chiaki_packet_buf_is_unique(buf))
+		{
+			chiaki_packet_buf_unref(buf);
+			continue;
+		}
+		buf->size = 0;
+		takion_recv_batch_set_slot(batch, kept++, buf);
+	}
+	batch->slots = kept;
+	batch->count = 0;
+}
+
+static void takion_recv_batch_fini(TakionRecvBatch *batch)
+{
+	for(size_t i=0; i<batch->slots; i++)
+		chiaki_packet_buf_unref(batch->bufs[i]);
+	batch->slots = 0;
 }
 
 static void *takion_thread_func(void *user)
@@ -687,6 +860,13 @@ static void *takion_thread_func(void *user)
 		goto error_reoder_queue;
 
 
+	if(chiaki_spsc_queue_init(&takion->rx_queue, TAKION_RX_QUEUE_SIZE_EXP, sizeof(ChiakiPacketBuf *)) != CHIAKI_ERR_SUCCESS)
+		goto error_send_buffer;
+
+	if(chiaki_thread_create(&takion->proc_thread, takion_proc_thread_func, takion) != CHIAKI_ERR_SUCCESS)
+		goto error_rx_queue;
+	chiaki_thread_set_name(&takion->proc_thread, "Chiaki Takion Proc");
+
 	if(takion->cb)
 	{
 		ChiakiTakionEvent event = { 0 };
@@ -694,68 +874,49 @@ static void *takion_thread_func(void *user)
 		takion->cb(&event, takion->cb_user);
 	}
 
-	bool crypt_available = takion->gkcrypt_remote ? true : false;
+	TakionRecvBatch batch;
+	takion_recv_batch_init(&batch);
 
+	// this thread only receives, everything else happens in takion_proc_thread_func()
 	while(true)
 	{
-		if(takion->enable_crypt && !crypt_available && takion->gkcrypt_remote)
+		ChiakiErrorCode err = takion_recv_batch(takion, &batch, UINT64_MAX);
+		if(err != CHIAKI_ERR_SUCCESS)
+			break;
+		for(size_t i=0; i<batch.count; i++)
 		{
-			crypt_available = true;
-			CHIAKI_LOGI(takion->log, "Crypt has become available. Re-checking MACs of %llu packets", (unsigned long long)chiaki_reorder_queue_count(&takion->data_queue));
-			for(uint64_t i=0; i<chiaki_reorder_queue_count(&takion->data_queue); i++)
+			ChiakiPacketBuf *buf = batch.bufs[i];
+			if(!buf->size)
+				continue;
+			chiaki_packet_buf_ref(buf);
+			if(!chiaki_spsc_queue_push(&takion->rx_queue, &buf))
 			{
-				TakionDataPacketEntry *packet;
-				bool peeked = chiaki_reorder_queue_peek(&takion->data_queue, i, NULL, (void **)&packet);
-				if(!peeked)
-					continue;
-				if(packet->packet_size == 0)
-					continue;
-				uint8_t base_type = (uint8_t)(packet->packet_buf[0] & TAKION_PACKET_BASE_TYPE_MASK);
-				if(takion_handle_packet_mac(takion, base_type, packet->packet_buf, packet->packet_size) != CHIAKI_ERR_SUCCESS)
-				{
-					CHIAKI_LOGW(takion->log, "Found an invalid MAC");
-					chiaki_reorder_queue_drop(&takion->data_queue, i);
-				}
+				// counted in the queue stats, only worth a warning if it was not just AV
+				uint8_t base_type = (uint8_t)(buf->data[0] & TAKION_PACKET_BASE_TYPE_MASK);
+				if(base_type != TAKION_PACKET_TYPE_VIDEO && base_type != TAKION_PACKET_TYPE_AUDIO)
+					CHIAKI_LOGW(takion->log, "Takion rx queue full, dropping packet of type %#x", base_type);
+				chiaki_packet_buf_unref(buf);
 			}
-
 		}
+		takion_recv_batch_release(&batch);
+	}
 
-		if(takion->postponed_packets && takion->gkcrypt_remote)
-		{
-			// there are some postponed packets that were waiting until crypt is initialized and it is now :-)
+	takion_recv_batch_fini(&batch);
 
-			CHIAKI_LOGI(takion->log, "Takion flushing %llu postpone packet(s)", (unsigned long long)takion->postponed_packets_count);
+	chiaki_spsc_queue_close(&takion->rx_queue);
+	chiaki_thread_join(&takion->proc_thread, NULL);
+	takion_drop_postponed_packets(takion);
 
-			for(size_t i=0; i<takion->postponed_packets_count; i++)
-			{
-				ChiakiTakionPostponedPacket *packet = &takion->postponed_packets[i];
-				takion_handle_packet(takion, packet->buf, packet->buf_size);
-			}
-			free(takion->postponed_packets);
-			takion->postponed_packets = NULL;
-			takion->postponed_packets_size = 0;
-			takion->postponed_packets_count = 0;
-		}
+	ChiakiSPSCQueueStats rx_queue_stats;
+	chiaki_spsc_queue_get_stats(&takion->rx_queue, &rx_queue_stats);
+	CHIAKI_LOGI(takion->log, "Takion rx queue: %llu packets queued, %llu dropped, max depth %llu",
+			(unsigned long long)rx_queue_stats.pushed, (unsigned long long)rx_queue_stats.dropped,
+			(unsigned long long)rx_queue_stats.depth_max);
 
-		size_t received_size = 1500;
-		uint8_t *buf = malloc(received_size); // TODO: no malloc?
-		if(!buf)
-			break;
-		ChiakiErrorCode err = takion_recv(takion, buf, &received_size, UINT64_MAX);
-		if(err != CHIAKI_ERR_SUCCESS)
-		{
-			free(buf);
-			break;
-		}
-		uint8_t *resized_buf = realloc(buf, received_size);
-		if(!resized_buf)
-		{
-			free(buf);
-			continue;
-		}
-		takion_handle_packet(takion, resized_buf, received_size);
-	}
+error_rx_queue:
+	chiaki_spsc_queue_fini(&takion->rx_queue);
 
+error_send_buffer:
 	// chiaki_congestion_control_stop(&congestion_control);
 
 	chiaki_takion_send_buffer_fini(&takion->send_buffer);
@@ -770,10 +931,35 @@ beach:
 		event.type = CHIAKI_TAKION_EVENT_TYPE_DISCONNECT;
 		takion->cb(&event, takion->cb_user);
 	}
+	chiaki_stop_pipe_unregister(&takion->stop_pipe);
 	CHIAKI_SOCKET_CLOSE(takion->sock);
 	return NULL;
 }
 
+/**
+ * Processing stage, consuming the packets received by takion_thread_func().
+ * All packet handling and callbacks (except connect/disconnect) happen here.
+ */
+static void *takion_proc_thread_func(void *user)
+{
+	ChiakiTakion *takion = user;
+	bool crypt_available = takion->gkcrypt_remote ? true : false;
+
+	while(true)
+	{
+		ChiakiPacketBuf *buf;
+		// only fails after the queue has been closed and drained
+		if(chiaki_spsc_queue_pop_wait(&takion->rx_queue, &buf, UINT64_MAX) != CHIAKI_ERR_SUCCESS)
+			break;
+		// crypt may be set from within the callbacks of the previous packet
+		takion_check_crypt_available(takion, &crypt_available);
+		takion_handle_packet(takion, buf);
+		chiaki_packet_buf_unref(buf);
+	}
+
+	return NULL;
+}
+
 static ChiakiErrorCode takion_recv(ChiakiTakion *takion, uint8_t *buf, size_t *buf_size, uint64_t timeout_ms)
 {
 	ChiakiErrorCode err = chiaki_stop_pipe_select_single(&takion->stop_pipe, takion->sock, false, timeout_ms);
@@ -798,6 +984,78 @@ static ChiakiErrorCode takion_recv(ChiakiTakion *takion, uint8_t *buf, size_t *b
 	return CHIAKI_ERR_SUCCESS;
 }
 
+/**
+ * Wait for the socket to become readable and receive as many datagrams as are available, up to TAKION_RECV_BATCH_SIZE.
+ * batch->count may be 0 after a spurious wakeup.
+ */
+static ChiakiErrorCode takion_recv_batch(ChiakiTakion *takion, TakionRecvBatch *batch, uint64_t timeout_ms)
+{
+	batch->count = 0;
+	ChiakiErrorCode err = chiaki_stop_pipe_select_single(&takion->stop_pipe, takion->sock, false, timeout_ms);
+	if(err == CHIAKI_ERR_TIMEOUT || err == CHIAKI_ERR_CANCELED)
+		return err;
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGE(takion->log, "Takion select failed: %s", strerror(errno));
+		return err;
+	}
+
+	takion_recv_batch_refill(batch, takion->packet_pool);
+	if(!batch->slots)
+	{
+		// pool exhausted, drop the datagram instead of letting the socket back up
+		uint8_t drop_buf[CHIAKI_PACKET_BUF_SIZE];
+		int received_sz = recv(takion->sock, drop_buf, sizeof(drop_buf), 0);
+		if(received_sz < 0)
+		{
+			CHIAKI_LOGE(takion->log, "Takion recv failed: %s", strerror(errno));
+			return CHIAKI_ERR_NETWORK;
+		}
+		CHIAKI_LOGW(takion->log, "Takion packet pool exhausted, dropping packet");
+		return CHIAKI_ERR_SUCCESS;
+	}
+
+#ifdef TAKION_HAVE_RECVMMSG
+	int received = recvmmsg(takion->sock, batch->msgs, batch->slots, MSG_DONTWAIT, NULL);
+	if(received < 0)
+	{
+		if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+			return CHIAKI_ERR_SUCCESS;
+		CHIAKI_LOGE(takion->log, "Takion recvmmsg failed: %s", strerror(errno));
+		return CHIAKI_ERR_NETWORK;
+	}
+	for(int i=0; i<received; i++)
+		batch->bufs[i]->size = batch->msgs[i].msg_len; // empty datagrams are skipped by the caller
+	batch->count = (size_t)received;
+#else
+	// the socket is readable, so the first recv will not block
+	int received_sz = recv(takion->sock, batch->bufs[0]->data, CHIAKI_PACKET_BUF_SIZE, 0);
+	if(received_sz <= 0)
+	{
+		if(received_sz < 0)
+			CHIAKI_LOGE(takion->log, "Takion recv failed: %s", strerror(errno));
+		else
+			CHIAKI_LOGE(takion->log, "Takion recv returned 0");
+		return CHIAKI_ERR_NETWORK;
+	}
+	batch->bufs[0]->size = (size_t)received_sz;
+	batch->count = 1;
+#ifdef MSG_DONTWAIT
+	// drain whatever else is already queued without waiting again
+	while(batch->count < batch->slots)
+	{
+		ChiakiPacketBuf *buf = batch->bufs[batch->count];
+		received_sz = recv(takion->sock, buf->data, CHIAKI_PACKET_BUF_SIZE, MSG_DONTWAIT);
+		if(received_sz <= 0)
+			break; // EAGAIN or a real error, which the next blocking receive will report
+		buf->size = (size_t)received_sz;
+		batch->count++;
+	}
+#endif
+#endif
+	return CHIAKI_ERR_SUCCESS;
+}
+
 static ChiakiErrorCode takion_handle_packet_mac(ChiakiTakion *takion, uint8_t base_type, uint8_t *buf, size_t buf_size)
 {
 	if(!takion->gkcrypt_remote)
@@ -835,7 +1093,7 @@ static ChiakiErrorCode takion_handle_packet_mac(ChiakiTakion *takion, uint8_t ba
 	return CHIAKI_ERR_SUCCESS;
 }
 
-static void takion_postpone_packet(ChiakiTakion *takion, uint8_t *buf, size_t buf_size)
+static void takion_postpone_packet(ChiakiTakion *takion, ChiakiPacketBuf *buf)
 {
 	if(!takion->postponed_packets)
 	{
@@ -852,59 +1110,65 @@ static void takion_postpone_packet(ChiakiTakion *takion, uint8_t *buf, size_t bu
 		return;
 	}
 
-	CHIAKI_LOGI(takion->log, "Postpone packet of size %#llx", (unsigned long long)buf_size);
+	CHIAKI_LOGI(takion->log, "Postpone packet of size %#llx", (unsigned long long)buf->size);
 	ChiakiTakionPostponedPacket *packet = &takion->postponed_packets[takion->postponed_packets_count++];
+	chiaki_packet_buf_ref(buf);
 	packet->buf = buf;
-	packet->buf_size = buf_size;
 }
 
 /**
- * @param buf ownership of this buf is taken.
+ * Look at the cleartext header of an AV packet only, to skip the MAC check of packets that would be dropped anyway.
+ * Malformed packets are admitted so they are reported by the regular path.
  */
-static void takion_handle_packet(ChiakiTakion *takion, uint8_t *buf, size_t buf_size)
+static bool takion_av_admit(ChiakiTakion *takion, ChiakiPacketBuf *buf)
 {
-	assert(buf_size > 0);
-	uint8_t base_type = (uint8_t)(buf[0] & TAKION_PACKET_BASE_TYPE_MASK);
+	ChiakiKeyState key_state = takion->key_state;
+	ChiakiTakionAVPacket packet;
+	if(takion->av_packet_parse(&packet, &key_state, buf->data, buf->size) != CHIAKI_ERR_SUCCESS)
+		return true;
+	return chiaki_av_admission_check(&takion->av_admission, &packet);
+}
 
-	if(takion_handle_packet_mac(takion, base_type, buf, buf_size) != CHIAKI_ERR_SUCCESS)
-	{
-		free(buf);
+/**
+ * @param buf is only borrowed for the duration of the call, anything that keeps it takes its own reference.
+ */
+static void takion_handle_packet(ChiakiTakion *takion, ChiakiPacketBuf *buf)
+{
+	assert(buf->size > 0);
+	uint8_t base_type = (uint8_t)(buf->data[0] & TAKION_PACKET_BASE_TYPE_MASK);
+
+	if((base_type == TAKION_PACKET_TYPE_VIDEO || base_type == TAKION_PACKET_TYPE_AUDIO) && !takion_av_admit(takion, buf))
+		return;
+
+	if(takion_handle_packet_mac(takion, base_type, buf->data, buf->size) != CHIAKI_ERR_SUCCESS)
 		return;
-	}
 
 	switch(base_type)
 	{
 		case TAKION_PACKET_TYPE_CONTROL:
-			takion_handle_packet_message(takion, buf, buf_size);
+			takion_handle_packet_message(takion, buf);
 			break;
 		case TAKION_PACKET_TYPE_VIDEO:
 		case TAKION_PACKET_TYPE_AUDIO:
 			if(takion->enable_crypt && !takion->gkcrypt_remote)
-				takion_postpone_packet(takion, buf, buf_size);
+				takion_postpone_packet(takion, buf);
 			else
-			{
-				takion_handle_packet_av(takion, base_type, buf, buf_size);
-				free(buf);
-			}
+				takion_handle_packet_av(takion, base_type, buf);
 			break;
 		default:
 			CHIAKI_LOGW(takion->log, "Takion packet with unknown type %#x received", base_type);
-			chiaki_log_hexdump(takion->log, CHIAKI_LOG_WARNING, buf, buf_size);
-			free(buf);
+			chiaki_log_hexdump(takion->log, CHIAKI_LOG_WARNING, buf->data, buf->size);
 			break;
 	}
 }
 
 
-static void takion_handle_packet_message(ChiakiTakion *takion, uint8_t *buf, size_t buf_size)
+static void takion_handle_packet_message(ChiakiTakion *takion, ChiakiPacketBuf *buf)
 {
 	TakionMessage msg;
-	ChiakiErrorCode err = takion_parse_message(takion, buf+1, buf_size-1, &msg);
+	ChiakiErrorCode err = takion_parse_message(takion, buf->data+1, buf->size-1, &msg);
 	if(err != CHIAKI_ERR_SUCCESS)
-	{
-		free(buf);
 		return;
-	}
 
 	//CHIAKI_LOGD(takion->log, "Takion received message with tag %#x, key pos %#x, type (%#x, %#x), payload size %#x, payload:", msg.tag, msg.key_pos, msg.type_a, msg.type_b, msg.payload_size);
 	//chiaki_log_hexdump(takion->log, CHIAKI_LOG_DEBUG, buf, buf_size);
@@ -912,15 +1176,13 @@ static void takion_handle_packet_message(ChiakiTakion *takion, uint8_t *buf, siz
 	switch(msg.chunk_type)
 	{
 		case TAKION_CHUNK_TYPE_DATA:
-			takion_handle_packet_message_data(takion, buf, buf_size, msg.chunk_flags, msg.payload, msg.payload_size);
+			takion_handle_packet_message_data(takion, buf, msg.chunk_flags, msg.payload, msg.payload_size);
 			break;
 		case TAKION_CHUNK_TYPE_DATA_ACK:
 			takion_handle_packet_message_data_ack(takion, msg.chunk_flags, msg.payload, msg.payload_size);
-			free(buf);
 			break;
 		default:
 			CHIAKI_LOGW(takion->log, "Takion received message with unknown chunk type = %#x", msg.chunk_type);
-			free(buf);
 			break;
 	}
 }
@@ -931,21 +1193,18 @@ static void takion_flush_data_queue(ChiakiTakion *takion)
 	bool ack = false;
 	while(true)
 	{
-		TakionDataPacketEntry *entry;
-		bool pulled = chiaki_reorder_queue_pull(&takion->data_queue, &seq_num, (void **)&entry);
+		ChiakiPacketBuf *packet;
+		bool pulled = chiaki_reorder_queue_pull(&takion->data_queue, &seq_num, (void **)&packet);
 		if(!pulled)
 			break;
 		ack = true;
 
-		if(entry->payload_size < 9)
-		{
-			free(entry->packet_buf);
-			free(entry);
-			continue;
-		}
+		// size has been validated by takion_parse_message() and takion_handle_packet_message_data()
+		uint8_t *payload = packet->data + 1 + TAKION_MESSAGE_HEADER_SIZE;
+		size_t payload_size = packet->size - 1 - TAKION_MESSAGE_HEADER_SIZE;
 
-		uint16_t zero_a = *((chiaki_unaligned_uint16_t *)(entry->payload + 6));
-		uint8_t data_type = entry->payload[8]; // & 0xf
+		uint16_t zero_a = *((chiaki_unaligned_uint16_t *)(payload + 6));
+		uint8_t data_type = payload[8]; // & 0xf
 
 		if(zero_a != 0)
 			CHIAKI_LOGW(takion->log, "Takion received data with unexpected nonzero %#x at buf+6", zero_a);
@@ -956,27 +1215,26 @@ static void takion_flush_data_queue(ChiakiTakion *takion)
 				&& data_type != CHIAKI_TAKION_MESSAGE_DATA_TYPE_9)
 		{
 			CHIAKI_LOGW(takion->log, "Takion received data with unexpected data type %#x", data_type);
-			chiaki_log_hexdump(takion->log, CHIAKI_LOG_WARNING, entry->packet_buf, entry->packet_size);
+			chiaki_log_hexdump(takion->log, CHIAKI_LOG_WARNING, packet->data, packet->size);
 		}
 		else if(takion->cb)
 		{
 			ChiakiTakionEvent event = { 0 };
 			event.type = CHIAKI_TAKION_EVENT_TYPE_DATA;
 			event.data.data_type = (ChiakiTakionMessageDataType)data_type;
-			event.data.buf = entry->payload + 9;
-			event.data.buf_size = (size_t)(entry->payload_size - 9);
+			event.data.buf = payload + 9;
+			event.data.buf_size = (size_t)(payload_size - 9);
 			takion->cb(&event, takion->cb_user);
 		}
 
-		free(entry->packet_buf);
-		free(entry);
+		chiaki_packet_buf_unref(packet);
 	}
 
 	if(ack)
 		chiaki_takion_send_message_data_ack(takion, (uint32_t)seq_num);
 }
 
-static void takion_handle_packet_message_data(ChiakiTakion *takion, uint8_t *packet_buf, size_t packet_buf_size, uint8_t type_b, uint8_t *payload, size_t payload_size)
+static void takion_handle_packet_message_data(ChiakiTakion *takion, ChiakiPacketBuf *packet_buf, uint8_t type_b, uint8_t *payload, size_t payload_size)
 {
 	if(type_b != 1)
 		CHIAKI_LOGW(takion->log, "Takion received data with type_b = %#x (was expecting %#x)", type_b, 1);
@@ -987,19 +1245,10 @@ static void takion_handle_packet_message_data(ChiakiTakion *takion, uint8_t *pac
 		return;
 	}
 
-	TakionDataPacketEntry *entry = malloc(sizeof(TakionDataPacketEntry));
-	if(!entry)
-		return;
-
-	entry->type_b = type_b;
-	entry->packet_buf = packet_buf;
-	entry->packet_size = packet_buf_size;
-	entry->payload = payload;
-	entry->payload_size = payload_size;
-	entry->channel = ntohs(*((chiaki_unaligned_uint16_t *)(payload + 4)));
 	ChiakiSeqNum32 seq_num = ntohl(*((chiaki_unaligned_uint32_t *)(payload + 0)));
 
-	chiaki_reorder_queue_push(&takion->data_queue, seq_num, entry);
+	chiaki_packet_buf_ref(packet_buf); // released by takion_flush_data_queue() or takion_data_drop()
+	chiaki_reorder_queue_push(&takion->data_queue, seq_num, packet_buf);
 	takion_flush_data_queue(takion);
 }
 
@@ -1206,14 +1455,14 @@ static ChiakiErrorCode takion_recv_message_cookie_ack(ChiakiTakion *takion)
 	return CHIAKI_ERR_SUCCESS;
 }
 
-static void takion_handle_packet_av(ChiakiTakion *takion, uint8_t base_type, uint8_t *buf, size_t buf_size)
+static void takion_handle_packet_av(ChiakiTakion *takion, uint8_t base_type, ChiakiPacketBuf *buf)
 {
 	// HHIxIIx
 
 	assert(base_type == TAKION_PACKET_TYPE_VIDEO || base_type == TAKION_PACKET_TYPE_AUDIO);
 
 	ChiakiTakionAVPacket packet;
-	ChiakiErrorCode err = takion->av_packet_parse(&packet, &takion->key_state, buf, buf_size);
+	ChiakiErrorCode err = takion->av_packet_parse(&packet, &takion->key_state, buf->data, buf->size);
 	if(err != CHIAKI_ERR_SUCCESS)
 	{
 		if(err == CHIAKI_ERR_BUF_TOO_SMALL)
@@ -1221,6 +1470,9 @@ static void takion_handle_packet_av(ChiakiTakion *takion, uint8_t base_type, uin
 		return;
 	}
 
+	chiaki_av_admission_commit(&takion->av_admission, &packet);
+	packet.buf = buf;
+
 	if(takion->cb)
 	{
 		ChiakiTakionEvent event = { 0 };
@@ -22,6 +22,14 @@
 
 #include <stdint.h>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CHIAKI_XOR_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define CHIAKI_XOR_NEON
+#endif
+
 static inline ChiakiErrorCode set_port(struct sockaddr *sa, uint16_t port)
 {
 	if(sa->sa_family == AF_INET)
@@ -93,8 +101,22 @@ static inline int sendto_broadcast(ChiakiLog *log, chiaki_socket_t s, const void
 	return sendto(s, msg, len, flags, to, tolen);
 }
 
-static inline void xor_bytes(uint8_t *dst, uint8_t *src, size_t sz)
+/**
+ * dst ^= src, 16 bytes at a time where SIMD is available. The buffers may be unaligned.
+ */
+static inline void xor_bytes(uint8_t *dst, const uint8_t *src, size_t sz)
 {
+#if defined(CHIAKI_XOR_SSE2)
+	for(; sz >= 0x10; dst += 0x10, src += 0x10, sz -= 0x10)
+	{
+		__m128i d = _mm_loadu_si128((const __m128i *)dst);
+		__m128i s = _mm_loadu_si128((const __m128i *)src);
+		_mm_storeu_si128((__m128i *)dst, _mm_xor_si128(d, s));
+	}
+#elif defined(CHIAKI_XOR_NEON)
+	for(; sz >= 0x10; dst += 0x10, src += 0x10, sz -= 0x10)
+		vst1q_u8(dst, veorq_u8(vld1q_u8(dst), vld1q_u8(src)));
+#endif
 	while(sz > 0)
 	{
 		*dst ^= *src;
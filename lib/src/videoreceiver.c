@@ -2,10 +2,29 @@
 
 #include <chiaki/videoreceiver.h>
 #include <chiaki/session.h>
+#include <chiaki/time.h>
 
 #include <string.h>
 
-static ChiakiErrorCode chiaki_video_receiver_flush_frame(ChiakiVideoReceiver *video_receiver);
+// assumed if the fps are unknown
+#define FRAME_INTERVAL_DEFAULT_MS (1000.0 / 60.0)
+#define FRAME_DEADLINE_MIN_MS 2
+// weight of new samples in the assembly time and jitter averages
+#define FRAME_TIMING_GAIN (1.0 / 16.0)
+// how many mean deviations of jitter to tolerate on top of the assembly time
+#define FRAME_DEADLINE_JITTER_FACTOR 4.0
+// frame buffer reserved per pixel of the largest profile: half of an uncompressed 4:2:0 frame, enough for all but extreme I-frames
+#define FRAME_BUF_SIZE(width, height) (((size_t)(width) * (size_t)(height) * 3) / 4)
+
+static ChiakiVideoReceiverFrame *chiaki_video_receiver_frame(ChiakiVideoReceiver *video_receiver, ChiakiSeqNum16 frame_index);
+static void chiaki_video_receiver_deliver_next(ChiakiVideoReceiver *video_receiver);
+static uint64_t chiaki_video_receiver_head_deadline(ChiakiVideoReceiver *video_receiver);
+static void chiaki_video_receiver_update_deadline(ChiakiVideoReceiver *video_receiver);
+static void chiaki_video_receiver_frame_timing(ChiakiVideoReceiver *video_receiver, ChiakiVideoReceiverFrame *frame, uint64_t now_ms);
+static ChiakiErrorCode chiaki_video_receiver_flush_frame(ChiakiVideoReceiver *video_receiver, ChiakiVideoReceiverFrame *frame);
+static bool chiaki_video_receiver_sample(ChiakiVideoReceiver *video_receiver, uint8_t *buf, size_t buf_size);
+static void chiaki_video_receiver_slices(ChiakiVideoReceiver *video_receiver, ChiakiVideoReceiverFrame *frame);
+static bool chiaki_video_receiver_slices_end(ChiakiVideoReceiver *video_receiver, ChiakiVideoReceiverFrame *frame, ChiakiVideoSampleIOV *iov, size_t iov_count);
 
 CHIAKI_EXPORT void chiaki_video_receiver_init(ChiakiVideoReceiver *video_receiver, struct chiaki_session_t *session, ChiakiPacketStats *packet_stats)
 {
@@ -15,11 +34,38 @@ CHIAKI_EXPORT void chiaki_video_receiver_init(ChiakiVideoReceiver *video_receive
 	video_receiver->profiles_count = 0;
 	video_receiver->profile_cur = -1;
 
-	video_receiver->frame_index_cur = -1;
+	video_receiver->frame_index_next = -1;
 	video_receiver->frame_index_prev = -1;
 	video_receiver->frame_index_prev_complete = 0;
 
-	chiaki_frame_processor_init(&video_receiver->frame_processor, video_receiver->log);
+	unsigned int max_fps = session->connect_info.video_profile.max_fps;
+	video_receiver->frame_interval_ms = max_fps ? 1000.0 / max_fps : FRAME_INTERVAL_DEFAULT_MS;
+	video_receiver->frame_deadline_fixed_ms = session->connect_info.video_frame_deadline_ms;
+	// start out with 1.5 frame intervals until there are measurements
+	video_receiver->frame_assembly_avg_ms = video_receiver->frame_interval_ms / 2.0;
+	video_receiver->frame_jitter_ms = video_receiver->frame_interval_ms / (2.0 * FRAME_DEADLINE_JITTER_FACTOR);
+	video_receiver->frame_arrival_prev_index = -1;
+	video_receiver->frame_arrival_prev_ms = 0;
+	video_receiver->frames_deadline_flushed = 0;
+	chiaki_video_receiver_update_deadline(video_receiver);
+
+	chiaki_fec_init(&video_receiver->fec);
+	if(session->connect_info.fec_threads)
+	{
+		ChiakiErrorCode err = chiaki_fec_start_workers(&video_receiver->fec, session->connect_info.fec_threads);
+		if(err != CHIAKI_ERR_SUCCESS)
+			CHIAKI_LOGW(video_receiver->log, "Failed to start FEC worker threads, recovering on the receiving thread only");
+	}
+
+	for(size_t i=0; i<CHIAKI_VIDEO_RECEIVER_FRAMES_MAX; i++)
+	{
+		ChiakiVideoReceiverFrame *frame = &video_receiver->frames[i];
+		frame->frame_index = -1;
+		frame->flushed = true;
+		frame->assembled = false;
+		frame->first_packet_ms = 0;
+		chiaki_frame_processor_init(&frame->frame_processor, video_receiver->log, &video_receiver->fec);
+	}
 	video_receiver->packet_stats = packet_stats;
 }
 
@@ -27,7 +73,20 @@ CHIAKI_EXPORT void chiaki_video_receiver_fini(ChiakiVideoReceiver *video_receive
 {
 	for(size_t i=0; i<video_receiver->profiles_count; i++)
 		free(video_receiver->profiles[i].header);
-	chiaki_frame_processor_fini(&video_receiver->frame_processor);
+	for(size_t i=0; i<CHIAKI_VIDEO_RECEIVER_FRAMES_MAX; i++)
+		chiaki_frame_processor_fini(&video_receiver->frames[i].frame_processor);
+
+	CHIAKI_LOGI(video_receiver->log, "Video Receiver flushed %llu frames at their deadline, last deadline %llu ms",
+			(unsigned long long)video_receiver->frames_deadline_flushed,
+			(unsigned long long)video_receiver->frame_deadline_ms);
+
+	ChiakiFECStats *fec_stats = &video_receiver->fec.stats;
+	if(fec_stats->parallel_decodes)
+		CHIAKI_LOGI(video_receiver->log, "Video Receiver FEC: %llu single-threaded, %llu parallel recoveries, parallel speedup %.2fx",
+				(unsigned long long)fec_stats->decodes,
+				(unsigned long long)fec_stats->parallel_decodes,
+				chiaki_fec_stats_parallel_speedup(fec_stats));
+	chiaki_fec_fini(&video_receiver->fec);
 }
 
 CHIAKI_EXPORT void chiaki_video_receiver_stream_info(ChiakiVideoReceiver *video_receiver, ChiakiVideoProfile *profiles, size_t profiles_count)
@@ -42,11 +101,26 @@ CHIAKI_EXPORT void chiaki_video_receiver_stream_info(ChiakiVideoReceiver *video_
 	video_receiver->profiles_count = profiles_count;
 
 	CHIAKI_LOGI(video_receiver->log, "Video Profiles:");
+	size_t frame_buf_size = 0;
 	for(size_t i=0; i<video_receiver->profiles_count; i++)
 	{
 		ChiakiVideoProfile *profile = &video_receiver->profiles[i];
 		CHIAKI_LOGI(video_receiver->log, "  %zu: %ux%u", i, profile->width, profile->height);
 		//chiaki_log_hexdump(video_receiver->log, CHIAKI_LOG_DEBUG, profile->header, profile->header_sz);
+		size_t profile_frame_buf_size = FRAME_BUF_SIZE(profile->width, profile->height);
+		if(profile_frame_buf_size > frame_buf_size)
+			frame_buf_size = profile_frame_buf_size;
+	}
+
+	// allocate all frame buffers now instead of growing them on the first big frames
+	for(size_t i=0; i<CHIAKI_VIDEO_RECEIVER_FRAMES_MAX; i++)
+	{
+		ChiakiErrorCode err = chiaki_frame_processor_reserve(&video_receiver->frames[i].frame_processor, frame_buf_size);
+		if(err != CHIAKI_ERR_SUCCESS)
+		{
+			CHIAKI_LOGW(video_receiver->log, "Failed to reserve %llu bytes for video frames", (unsigned long long)frame_buf_size);
+			break;
+		}
 	}
 }
 
@@ -54,9 +128,16 @@ CHIAKI_EXPORT void chiaki_video_receiver_av_packet(ChiakiVideoReceiver *video_re
 {
 	// old frame?
 	ChiakiSeqNum16 frame_index = packet->frame_index;
-	if(video_receiver->frame_index_cur >= 0
-		&& chiaki_seq_num_16_lt(frame_index, (ChiakiSeqNum16)video_receiver->frame_index_cur))
+	if(video_receiver->frame_index_next >= 0
+		&& chiaki_seq_num_16_lt(frame_index, (ChiakiSeqNum16)video_receiver->frame_index_next))
 	{
+		ChiakiVideoReceiverFrame *frame = chiaki_video_receiver_frame(video_receiver, frame_index);
+		if(frame->frame_index == frame_index)
+		{
+			// frame has already been delivered, only count the unit
+			chiaki_frame_processor_put_unit(&frame->frame_processor, packet);
+			return;
+		}
 		CHIAKI_LOGW(video_receiver->log, "Video Receiver received old frame packet");
 		return;
 	}
@@ -75,80 +156,353 @@ CHIAKI_EXPORT void chiaki_video_receiver_av_packet(ChiakiVideoReceiver *video_re
 
 		ChiakiVideoProfile *profile = video_receiver->profiles + video_receiver->profile_cur;
 		CHIAKI_LOGI(video_receiver->log, "Switched to profile %d, resolution: %ux%u", video_receiver->profile_cur, profile->width, profile->height);
-		if(video_receiver->session->video_sample_cb)
-			video_receiver->session->video_sample_cb(profile->header, profile->header_sz, video_receiver->session->video_sample_cb_user);
+		chiaki_video_receiver_sample(video_receiver, profile->header, profile->header_sz);
 	}
 
-	// next frame?
-	if(video_receiver->frame_index_cur < 0 ||
-		chiaki_seq_num_16_gt(frame_index, (ChiakiSeqNum16)video_receiver->frame_index_cur))
+	if(video_receiver->frame_index_next < 0)
+		video_receiver->frame_index_next = frame_index;
+
+	// frame beyond the window? make room by delivering whatever we have of the oldest ones
+	while((ChiakiSeqNum16)(frame_index - (ChiakiSeqNum16)video_receiver->frame_index_next) >= CHIAKI_VIDEO_RECEIVER_FRAMES_MAX)
+		chiaki_video_receiver_deliver_next(video_receiver);
+
+	uint64_t now_ms = chiaki_time_now_monotonic_ms();
+	ChiakiVideoReceiverFrame *frame = chiaki_video_receiver_frame(video_receiver, frame_index);
+	if(frame->frame_index != frame_index)
 	{
-		if(video_receiver->packet_stats)
-			chiaki_frame_processor_report_packet_stats(&video_receiver->frame_processor, video_receiver->packet_stats);
+		// slot is reused, its previous frame will not receive anything anymore
+		if(frame->frame_index >= 0 && video_receiver->packet_stats)
+			chiaki_frame_processor_report_packet_stats(&frame->frame_processor, video_receiver->packet_stats);
+		frame->frame_index = frame_index;
+		frame->flushed = false;
+		frame->assembled = false;
+		frame->first_packet_ms = now_ms;
+		frame->slice_units = 0;
+		frame->slice_scanned = 0;
+		frame->slice_zeros = 0;
+		frame->slice_cut = 0;
+		frame->slice_delivered = 0;
+		frame->slice_failed = false;
+		chiaki_frame_processor_alloc_frame(&frame->frame_processor, packet);
+		chiaki_video_receiver_frame_timing(video_receiver, frame, now_ms);
+	}
 
-		// last frame not flushed yet?
-		if(video_receiver->frame_index_cur >= 0 && video_receiver->frame_index_prev != video_receiver->frame_index_cur)
-			chiaki_video_receiver_flush_frame(video_receiver);
+	chiaki_frame_processor_put_unit(&frame->frame_processor, packet);
+	if(!frame->assembled && chiaki_frame_processor_flush_possible(&frame->frame_processor))
+	{
+		frame->assembled = true;
+		chiaki_video_receiver_frame_timing(video_receiver, frame, now_ms);
+	}
 
-		ChiakiSeqNum16 next_frame_expected = (ChiakiSeqNum16)(video_receiver->frame_index_prev_complete + 1);
-		if(chiaki_seq_num_16_gt(frame_index, next_frame_expected)
-			&& !(frame_index == 1 && video_receiver->frame_index_cur < 0)) // ok for frame 1
-		{
-			CHIAKI_LOGW(video_receiver->log, "Detected missing or corrupt frame(s) from %d to %d", next_frame_expected, (int)frame_index);
-			stream_connection_send_corrupt_frame(&video_receiver->session->stream_connection, next_frame_expected, frame_index - 1);
-		}
+	chiaki_video_receiver_flush_due(video_receiver, now_ms);
+}
 
-		video_receiver->frame_index_cur = frame_index;
-		chiaki_frame_processor_alloc_frame(&video_receiver->frame_processor, packet);
+CHIAKI_EXPORT uint64_t chiaki_video_receiver_next_deadline_ms(ChiakiVideoReceiver *video_receiver)
+{
+	return chiaki_video_receiver_head_deadline(video_receiver);
+}
+
+CHIAKI_EXPORT void chiaki_video_receiver_flush_due(ChiakiVideoReceiver *video_receiver, uint64_t now_ms)
+{
+	while(true)
+	{
+		uint64_t deadline_ms = chiaki_video_receiver_head_deadline(video_receiver);
+		if(deadline_ms > now_ms)
+			break;
+		if(deadline_ms)
+			video_receiver->frames_deadline_flushed++;
+		chiaki_video_receiver_deliver_next(video_receiver);
 	}
 
-	chiaki_frame_processor_put_unit(&video_receiver->frame_processor, packet);
+	// the frame that is next in line may already pass on what it has
+	if(video_receiver->session->video_slice_cb && video_receiver->frame_index_next >= 0)
+	{
+		ChiakiSeqNum16 frame_index = (ChiakiSeqNum16)video_receiver->frame_index_next;
+		ChiakiVideoReceiverFrame *frame = chiaki_video_receiver_frame(video_receiver, frame_index);
+		if(frame->frame_index == frame_index && !frame->flushed)
+			chiaki_video_receiver_slices(video_receiver, frame);
+	}
+}
 
-	// if we are currently building up a frame
-	if(video_receiver->frame_index_cur != video_receiver->frame_index_prev)
+static ChiakiVideoReceiverFrame *chiaki_video_receiver_frame(ChiakiVideoReceiver *video_receiver, ChiakiSeqNum16 frame_index)
+{
+	return &video_receiver->frames[frame_index & (CHIAKI_VIDEO_RECEIVER_FRAMES_MAX - 1)];
+}
+
+/**
+ * Deliver the frame at frame_index_next, whatever state it is in, and advance to the following one.
+ */
+static void chiaki_video_receiver_deliver_next(ChiakiVideoReceiver *video_receiver)
+{
+	ChiakiSeqNum16 frame_index = (ChiakiSeqNum16)video_receiver->frame_index_next;
+	ChiakiVideoReceiverFrame *frame = chiaki_video_receiver_frame(video_receiver, frame_index);
+	if(frame->frame_index == frame_index && !frame->flushed)
 	{
-		// if we already have enough for the whole frame, flush it already
-		if(chiaki_frame_processor_flush_possible(&video_receiver->frame_processor))
-			chiaki_video_receiver_flush_frame(video_receiver);
+		chiaki_video_receiver_flush_frame(video_receiver, frame);
+		frame->flushed = true;
 	}
+	// else nothing of it has arrived, it is reported as corrupt once a later frame is delivered
+	video_receiver->frame_index_next = (ChiakiSeqNum16)(frame_index + 1);
+}
+
+/**
+ * @return time at which the frame at frame_index_next must be delivered, 0 if it is complete, UINT64_MAX if nothing is waiting
+ */
+static uint64_t chiaki_video_receiver_head_deadline(ChiakiVideoReceiver *video_receiver)
+{
+	if(video_receiver->frame_index_next < 0)
+		return UINT64_MAX;
+
+	ChiakiSeqNum16 frame_index = (ChiakiSeqNum16)video_receiver->frame_index_next;
+	ChiakiVideoReceiverFrame *frame = chiaki_video_receiver_frame(video_receiver, frame_index);
+	if(frame->frame_index == frame_index)
+		return frame->assembled ? 0 : frame->first_packet_ms + video_receiver->frame_deadline_ms;
+
+	// nothing received of the oldest frame, so its deadline starts with the first later frame that has arrived
+	for(ChiakiSeqNum16 i=1; i<CHIAKI_VIDEO_RECEIVER_FRAMES_MAX; i++)
+	{
+		ChiakiSeqNum16 later_index = (ChiakiSeqNum16)(frame_index + i);
+		ChiakiVideoReceiverFrame *later = chiaki_video_receiver_frame(video_receiver, later_index);
+		if(later->frame_index == later_index)
+			return later->first_packet_ms + video_receiver->frame_deadline_ms;
+	}
+	return UINT64_MAX;
+}
+
+static void chiaki_video_receiver_update_deadline(ChiakiVideoReceiver *video_receiver)
+{
+	if(video_receiver->frame_deadline_fixed_ms)
+	{
+		video_receiver->frame_deadline_ms = video_receiver->frame_deadline_fixed_ms;
+		return;
+	}
+	double deadline = video_receiver->frame_assembly_avg_ms + FRAME_DEADLINE_JITTER_FACTOR * video_receiver->frame_jitter_ms;
+	// never hold back more frames than the window can take
+	double deadline_max = video_receiver->frame_interval_ms * (CHIAKI_VIDEO_RECEIVER_FRAMES_MAX - 1);
+	if(deadline > deadline_max)
+		deadline = deadline_max;
+	if(deadline < FRAME_DEADLINE_MIN_MS)
+		deadline = FRAME_DEADLINE_MIN_MS;
+	video_receiver->frame_deadline_ms = (uint64_t)deadline;
+	if((double)video_receiver->frame_deadline_ms < deadline)
+		video_receiver->frame_deadline_ms++;
+}
+
+/**
+ * Update the timing estimates, called once when the first packet of a frame arrives and once when it is assembled.
+ */
+static void chiaki_video_receiver_frame_timing(ChiakiVideoReceiver *video_receiver, ChiakiVideoReceiverFrame *frame, uint64_t now_ms)
+{
+	if(frame->assembled)
+	{
+		double assembly_ms = (double)(now_ms - frame->first_packet_ms);
+		video_receiver->frame_assembly_avg_ms += FRAME_TIMING_GAIN * (assembly_ms - video_receiver->frame_assembly_avg_ms);
+	}
+	else
+	{
+		ChiakiSeqNum16 frame_index = (ChiakiSeqNum16)frame->frame_index;
+		if(video_receiver->frame_arrival_prev_index >= 0
+			&& chiaki_seq_num_16_gt(frame_index, (ChiakiSeqNum16)video_receiver->frame_arrival_prev_index))
+		{
+			ChiakiSeqNum16 frames = frame_index - (ChiakiSeqNum16)video_receiver->frame_arrival_prev_index;
+			double d = (double)(now_ms - video_receiver->frame_arrival_prev_ms) - frames * video_receiver->frame_interval_ms;
+			if(d < 0.0)
+				d = -d;
+			video_receiver->frame_jitter_ms += FRAME_TIMING_GAIN * (d - video_receiver->frame_jitter_ms);
+		}
+		video_receiver->frame_arrival_prev_index = frame_index;
+		video_receiver->frame_arrival_prev_ms = now_ms;
+	}
+	chiaki_video_receiver_update_deadline(video_receiver);
 }
 
 #define FLUSH_CORRUPT_FRAMES
 
-static ChiakiErrorCode chiaki_video_receiver_flush_frame(ChiakiVideoReceiver *video_receiver)
+static ChiakiErrorCode chiaki_video_receiver_flush_frame(ChiakiVideoReceiver *video_receiver, ChiakiVideoReceiverFrame *frame)
 {
-	uint8_t *frame;
-	size_t frame_size;
-	ChiakiFrameProcessorFlushResult flush_result = chiaki_frame_processor_flush(&video_receiver->frame_processor, &frame, &frame_size);
+	ChiakiSeqNum16 frame_index = (ChiakiSeqNum16)frame->frame_index;
+	ChiakiSession *session = video_receiver->session;
+	uint8_t *buf = NULL;
+	size_t buf_size;
+	ChiakiVideoSampleIOV iov[CHIAKI_FEC_UNITS_MAX];
+	size_t iov_count = 0;
+	ChiakiFrameProcessorFlushResult flush_result = session->video_slice_cb || session->video_sample_iov_cb
+		? chiaki_frame_processor_flush_iov(&frame->frame_processor, iov, &iov_count, &buf_size)
+		: chiaki_frame_processor_flush(&frame->frame_processor, &buf, &buf_size);
 
+	ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
+	bool succ = false;
 	if(flush_result == CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FAILED
 #ifndef FLUSH_CORRUPT_FRAMES
 		|| flush_result == CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FEC_FAILED
 #endif
 		)
 	{
-		CHIAKI_LOGW(video_receiver->log, "Failed to complete frame %d", (int)video_receiver->frame_index_cur);
-		return CHIAKI_ERR_UNKNOWN;
+		CHIAKI_LOGW(video_receiver->log, "Failed to complete frame %d", (int)frame_index);
+		err = CHIAKI_ERR_UNKNOWN;
+		// the decoder already got the beginning, so it still has to know the frame is over
+		if(session->video_slice_cb && frame->slice_delivered)
+			session->video_slice_cb(NULL, 0, true, session->video_slice_cb_user);
 	}
+	else
+	{
+		// TODO: Error Concealment on CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FEC_FAILED
 
-	// TODO: Error Concealment on CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FEC_FAILED
-
-	bool succ = flush_result != CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FEC_FAILED;
+		succ = flush_result != CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FEC_FAILED;
 
-	if(video_receiver->session->video_sample_cb)
-	{
-		bool cb_succ = video_receiver->session->video_sample_cb(frame, frame_size, video_receiver->session->video_sample_cb_user);
+		bool cb_succ;
+		if(session->video_slice_cb)
+			cb_succ = chiaki_video_receiver_slices_end(video_receiver, frame, iov, iov_count);
+		else if(session->video_sample_iov_cb)
+			cb_succ = session->video_sample_iov_cb(iov, iov_count, session->video_sample_iov_cb_user);
+		else
+			cb_succ = chiaki_video_receiver_sample(video_receiver, buf, buf_size);
 		if(!cb_succ)
 		{
 			succ = false;
 			CHIAKI_LOGW(video_receiver->log, "Video callback did not process frame successfully.");
 		}
+
+		video_receiver->frame_index_prev = frame_index;
+	}
+
+	// report skipped frames and this one if it is broken right away instead of waiting for the next complete frame
+	ChiakiSeqNum16 next_frame_expected = (ChiakiSeqNum16)(video_receiver->frame_index_prev_complete + 1);
+	ChiakiSeqNum16 corrupt_end = succ ? frame_index - 1 : frame_index;
+	if(!chiaki_seq_num_16_gt(next_frame_expected, corrupt_end))
+	{
+		CHIAKI_LOGW(video_receiver->log, "Detected missing or corrupt frame(s) from %d to %d", next_frame_expected, (int)corrupt_end);
+		stream_connection_send_corrupt_frame(&video_receiver->session->stream_connection, next_frame_expected, corrupt_end);
+	}
+	video_receiver->frame_index_prev_complete = frame_index;
+
+	return err;
+}
+
+/**
+ * Pass a contiguous sample to whichever video callback is set.
+ */
+static bool chiaki_video_receiver_sample(ChiakiVideoReceiver *video_receiver, uint8_t *buf, size_t buf_size)
+{
+	ChiakiSession *session = video_receiver->session;
+	if(session->video_slice_cb)
+	{
+		ChiakiVideoSampleIOV iov = { buf, buf_size };
+		return session->video_slice_cb(&iov, 1, true, session->video_slice_cb_user);
+	}
+	if(session->video_sample_iov_cb)
+	{
+		ChiakiVideoSampleIOV iov = { buf, buf_size };
+		return session->video_sample_iov_cb(&iov, 1, session->video_sample_iov_cb_user);
+	}
+	if(session->video_sample_cb)
+		return session->video_sample_cb(buf, buf_size, session->video_sample_cb_user);
+	return true;
+}
+
+/**
+ * Collect the payload bytes [start, end) of the first frame->slice_units source units.
+ *
+ * @param iov array of at least CHIAKI_FEC_UNITS_MAX elements
+ * @return number of elements written to iov
+ */
+static size_t chiaki_video_receiver_slice_iov(ChiakiVideoReceiverFrame *frame, size_t start, size_t end, ChiakiVideoSampleIOV *iov)
+{
+	size_t count = 0;
+	size_t offset = 0;
+	for(unsigned int i=0; i<frame->slice_units && offset < end; i++)
+	{
+		size_t size;
+		uint8_t *payload = chiaki_frame_processor_source_unit(&frame->frame_processor, i, &size);
+		if(!payload)
+			break;
+		if(offset + size > start)
+		{
+			size_t from = start > offset ? start - offset : 0;
+			size_t to = end < offset + size ? end - offset : size;
+			iov[count].buf = payload + from;
+			iov[count].size = to - from;
+			count++;
+		}
+		offset += size;
 	}
+	return count;
+}
 
-	video_receiver->frame_index_prev = video_receiver->frame_index_cur;
+/**
+ * Scan newly arrived units at the start of the frame for start codes and pass everything before the last one on.
+ */
+static void chiaki_video_receiver_slices(ChiakiVideoReceiver *video_receiver, ChiakiVideoReceiverFrame *frame)
+{
+	if(frame->slice_failed)
+		return;
+
+	size_t size;
+	uint8_t *payload;
+	while((payload = chiaki_frame_processor_source_unit(&frame->frame_processor, frame->slice_units, &size)))
+	{
+		const uint8_t *p = payload;
+		const uint8_t *end = payload + size;
+		while((p = memchr(p, 1, end - p)))
+		{
+			// 00 00 01 or 00 00 00 01, possibly with the zeros at the end of the previous unit
+			size_t j = p - payload;
+			unsigned int zeros = 0;
+			while(zeros < 3 && zeros < j && payload[j - 1 - zeros] == 0)
+				zeros++;
+			if(zeros == j)
+				zeros += frame->slice_zeros;
+			if(zeros > 3)
+				zeros = 3;
+			if(zeros >= 2)
+				frame->slice_cut = frame->slice_scanned + j - zeros;
+			p++;
+		}
 
-	if(succ)
-		video_receiver->frame_index_prev_complete = video_receiver->frame_index_cur;
+		unsigned int trailing_zeros = 0;
+		while(trailing_zeros < 3 && trailing_zeros < size && payload[size - 1 - trailing_zeros] == 0)
+			trailing_zeros++;
+		if(trailing_zeros == size)
+			trailing_zeros += frame->slice_zeros;
+		frame->slice_zeros = trailing_zeros > 3 ? 3 : trailing_zeros;
 
-	return CHIAKI_ERR_SUCCESS;
+		frame->slice_scanned += size;
+		frame->slice_units++;
+	}
+
+	if(frame->slice_cut <= frame->slice_delivered)
+		return;
+
+	ChiakiVideoSampleIOV iov[CHIAKI_FEC_UNITS_MAX];
+	size_t iov_count = chiaki_video_receiver_slice_iov(frame, frame->slice_delivered, frame->slice_cut, iov);
+	ChiakiSession *session = video_receiver->session;
+	if(!session->video_slice_cb(iov, iov_count, false, session->video_slice_cb_user))
+	{
+		CHIAKI_LOGW(video_receiver->log, "Video slice callback did not process slice of frame %d successfully.", (int)frame->frame_index);
+		frame->slice_failed = true;
+	}
+	frame->slice_delivered = frame->slice_cut;
+}
+
+/**
+ * Deliver the rest of the frame after the slices that already went out.
+ */
+static bool chiaki_video_receiver_slices_end(ChiakiVideoReceiver *video_receiver, ChiakiVideoReceiverFrame *frame, ChiakiVideoSampleIOV *iov, size_t iov_count)
+{
+	size_t skip = frame->slice_delivered;
+	while(iov_count && skip)
+	{
+		if(iov->size > skip)
+		{
+			iov->buf += skip;
+			iov->size -= skip;
+			break;
+		}
+		skip -= iov->size;
+		iov++;
+		iov_count--;
+	}
+	ChiakiSession *session = video_receiver->session;
+	bool succ = session->video_slice_cb(iov, iov_count, true, session->video_slice_cb_user);
+	return succ && !frame->slice_failed;
 }
@@ -46,6 +46,7 @@ extern "C"
 
 #include <chiaki/controller.h>
 #include <chiaki/log.h>
+#include <chiaki/audioring.h>
 
 #include "exception.h"
 
@@ -71,6 +72,10 @@ class IO
 		AVCodecContext *codec_context;
 		AVFrame *frame;
 		SDL_AudioDeviceID sdl_audio_device_id = 0;
+		// filled by the session thread, read by the sdl audio callback
+		ChiakiAudioRing audio_ring;
+		bool audio_ring_initialized = false;
+		static void AudioRingCB(void *user, Uint8 *stream, int len);
 		SDL_Event sdl_event;
 		SDL_Joystick *sdl_joystick_ptr[SDL_JOYSTICK_COUNT] = {0};
 #ifdef __SWITCH__
@@ -77,10 +77,14 @@ IO::IO()
 IO::~IO()
 {
 	//FreeJoystick();
-	if(this->sdl_audio_device_id <= 0)
+	if(this->sdl_audio_device_id > 0)
 	{
 		SDL_CloseAudioDevice(this->sdl_audio_device_id);
 	}
+	if(this->audio_ring_initialized)
+	{
+		chiaki_audio_ring_fini(&this->audio_ring);
+	}
 	FreeVideo();
 }
 
@@ -245,12 +249,24 @@ void IO::InitAudioCB(unsigned int channels, unsigned int rate)
 	// 2 == stereo
 	want.channels = channels;
 	want.samples = 1024;
-	want.callback = NULL;
+	want.callback = AudioRingCB;
+	want.userdata = this;
 
 	if(this->sdl_audio_device_id <= 0)
 	{
 		// the chiaki session might be called many times
 		// open the audio device only once
+		if(!this->audio_ring_initialized)
+		{
+			// keep about 20 ms on top of what the callback reads at once
+			ChiakiErrorCode err = chiaki_audio_ring_init(&this->audio_ring, channels, 14, want.samples + rate / 50);
+			if(err != CHIAKI_ERR_SUCCESS)
+			{
+				CHIAKI_LOGE(this->log, "Failed to init audio ring: %s", chiaki_error_string(err));
+				return;
+			}
+			this->audio_ring_initialized = true;
+		}
 		this->sdl_audio_device_id = SDL_OpenAudioDevice(NULL, 0, &want, NULL, 0);
 	}
 
@@ -286,18 +302,19 @@ void IO::AudioCB(int16_t *buf, size_t samples_count)
 			buf[x] = (int16_t)sample;
 	}
 
-	int audio_queued_size = SDL_GetQueuedAudioSize(this->sdl_audio_device_id);
-	if(audio_queued_size > 16000)
-	{
-		// clear audio queue to avoid big audio delay
-		// average values are close to 13000 bytes
-		CHIAKI_LOGW(this->log, "Triggering SDL_ClearQueuedAudio with queue size = %d", audio_queued_size);
-		SDL_ClearQueuedAudio(this->sdl_audio_device_id);
-	}
+	if(!this->audio_ring_initialized)
+		return;
 
-	int success = SDL_QueueAudio(this->sdl_audio_device_id, buf, sizeof(int16_t) * samples_count * 2);
-	if(success != 0)
-		CHIAKI_LOGE(this->log, "SDL_QueueAudio failed: %s\n", SDL_GetError());
+	// the ring compensates for clock drift, so latency neither grows nor has to be flushed
+	if(chiaki_audio_ring_push(&this->audio_ring, buf, samples_count) < samples_count)
+		CHIAKI_LOGW(this->log, "Audio ring overflow");
+}
+
+void IO::AudioRingCB(void *user, Uint8 *stream, int len)
+{
+	IO *io = (IO *)user;
+	size_t frames_count = (size_t)len / (io->audio_ring.channels * sizeof(int16_t));
+	chiaki_audio_ring_pull(&io->audio_ring, (int16_t *)stream, frames_count);
 }
 
 bool IO::InitVideo(int video_width, int video_height, int screen_width, int screen_height)
@@ -0,0 +1,175 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/audiojitterbuffer.h>
+
+#define FRAME_US 10000
+
+static void put(ChiakiAudioJitterBuffer *jitter_buffer, ChiakiSeqNum16 frame_index, uint64_t now_us)
+{
+	uint8_t buf[4] = { (uint8_t)(frame_index >> 8), (uint8_t)frame_index, 0x42, 0x42 };
+	munit_assert_true(chiaki_audio_jitter_buffer_put(jitter_buffer, frame_index, buf, sizeof(buf), now_us));
+}
+
+static ChiakiAudioJitterBufferOut pop(ChiakiAudioJitterBuffer *jitter_buffer, uint64_t now_us, int *frame_index)
+{
+	const uint8_t *buf = NULL;
+	size_t buf_size = 0;
+	ChiakiAudioJitterBufferOut out = chiaki_audio_jitter_buffer_pop(jitter_buffer, now_us, &buf, &buf_size);
+	*frame_index = -1;
+	if(out == CHIAKI_AUDIO_JITTER_BUFFER_OUT_FRAME || out == CHIAKI_AUDIO_JITTER_BUFFER_OUT_FEC)
+	{
+		munit_assert_size(buf_size, ==, 4);
+		*frame_index = (buf[0] << 8) | buf[1];
+	}
+	return out;
+}
+
+static void assert_pop(ChiakiAudioJitterBuffer *jitter_buffer, uint64_t now_us, ChiakiAudioJitterBufferOut out_expected, int frame_index_expected)
+{
+	int frame_index;
+	munit_assert_int(pop(jitter_buffer, now_us, &frame_index), ==, out_expected);
+	munit_assert_int(frame_index, ==, frame_index_expected);
+}
+
+static MunitResult test_in_order(const MunitParameter params[], void *user)
+{
+	ChiakiAudioJitterBuffer jitter_buffer;
+	chiaki_audio_jitter_buffer_init(&jitter_buffer, FRAME_US);
+	assert_pop(&jitter_buffer, 1, CHIAKI_AUDIO_JITTER_BUFFER_OUT_NONE, -1);
+
+	// two frames per packet every 20 ms, across the wrap-around, played right away
+	uint64_t t = 1000000;
+	for(ChiakiSeqNum16 i=0xfff0; i!=0x10; i+=2)
+	{
+		put(&jitter_buffer, i, t);
+		assert_pop(&jitter_buffer, t, CHIAKI_AUDIO_JITTER_BUFFER_OUT_FRAME, i);
+		assert_pop(&jitter_buffer, t, CHIAKI_AUDIO_JITTER_BUFFER_OUT_NONE, -1);
+		put(&jitter_buffer, (ChiakiSeqNum16)(i + 1), t + 5);
+		assert_pop(&jitter_buffer, t + 5, CHIAKI_AUDIO_JITTER_BUFFER_OUT_FRAME, (ChiakiSeqNum16)(i + 1));
+		t += 2 * FRAME_US;
+	}
+	munit_assert_uint64(jitter_buffer.stats.frames_played, ==, 0x20);
+	munit_assert_uint(jitter_buffer.target_frames, ==, 1);
+
+	// duplicates and played frames are rejected
+	uint8_t buf[4] = { 0 };
+	munit_assert_false(chiaki_audio_jitter_buffer_put(&jitter_buffer, 0xf, buf, sizeof(buf), t));
+	return MUNIT_OK;
+}
+
+static MunitResult test_conceal(const MunitParameter params[], void *user)
+{
+	ChiakiAudioJitterBuffer jitter_buffer;
+	chiaki_audio_jitter_buffer_init(&jitter_buffer, FRAME_US);
+	uint64_t t = 1000000;
+
+	put(&jitter_buffer, 10, t);
+	assert_pop(&jitter_buffer, t, CHIAKI_AUDIO_JITTER_BUFFER_OUT_FRAME, 10);
+
+	// 11 is late, 12 is not enough to give up on it yet
+	put(&jitter_buffer, 12, t + FRAME_US);
+	assert_pop(&jitter_buffer, t + FRAME_US, CHIAKI_AUDIO_JITTER_BUFFER_OUT_NONE, -1);
+	put(&jitter_buffer, 11, t + FRAME_US + 100);
+	assert_pop(&jitter_buffer, t + FRAME_US + 100, CHIAKI_AUDIO_JITTER_BUFFER_OUT_FRAME, 11);
+	assert_pop(&jitter_buffer, t + FRAME_US + 100, CHIAKI_AUDIO_JITTER_BUFFER_OUT_FRAME, 12);
+
+	// 13 lost, recovered from fec of 14 once 15 is there too
+	put(&jitter_buffer, 14, t + 3 * FRAME_US);
+	assert_pop(&jitter_buffer, t + 3 * FRAME_US, CHIAKI_AUDIO_JITTER_BUFFER_OUT_NONE, -1);
+	put(&jitter_buffer, 15, t + 3 * FRAME_US + 5);
+	assert_pop(&jitter_buffer, t + 3 * FRAME_US + 5, CHIAKI_AUDIO_JITTER_BUFFER_OUT_FEC, 14);
+	assert_pop(&jitter_buffer, t + 3 * FRAME_US + 5, CHIAKI_AUDIO_JITTER_BUFFER_OUT_FRAME, 14);
+	assert_pop(&jitter_buffer, t + 3 * FRAME_US + 5, CHIAKI_AUDIO_JITTER_BUFFER_OUT_FRAME, 15);
+
+	// 16 and 17 lost, which is more reordering than the target
+	put(&jitter_buffer, 18, t + 6 * FRAME_US);
+	uint64_t later = t + 6 * FRAME_US;
+	assert_pop(&jitter_buffer, later, CHIAKI_AUDIO_JITTER_BUFFER_OUT_PLC, -1);
+	assert_pop(&jitter_buffer, later, CHIAKI_AUDIO_JITTER_BUFFER_OUT_FEC, 18);
+	assert_pop(&jitter_buffer, later, CHIAKI_AUDIO_JITTER_BUFFER_OUT_FRAME, 18);
+
+	// a single gap is concealed once its time has passed
+	put(&jitter_buffer, 20, later + 2 * FRAME_US);
+	assert_pop(&jitter_buffer, later + 2 * FRAME_US, CHIAKI_AUDIO_JITTER_BUFFER_OUT_NONE, -1);
+	assert_pop(&jitter_buffer, later + 2 * FRAME_US + jitter_buffer.target_frames * FRAME_US - 1, CHIAKI_AUDIO_JITTER_BUFFER_OUT_NONE, -1);
+	later += 2 * FRAME_US + jitter_buffer.target_frames * FRAME_US;
+	assert_pop(&jitter_buffer, later, CHIAKI_AUDIO_JITTER_BUFFER_OUT_FEC, 20);
+	assert_pop(&jitter_buffer, later, CHIAKI_AUDIO_JITTER_BUFFER_OUT_FRAME, 20);
+
+	// a frame that has been concealed is not played anymore
+	uint8_t buf[4] = { 0 };
+	munit_assert_false(chiaki_audio_jitter_buffer_put(&jitter_buffer, 16, buf, sizeof(buf), later));
+
+	// long gaps are skipped
+	put(&jitter_buffer, 30, later + FRAME_US);
+	put(&jitter_buffer, 31, later + FRAME_US + 5);
+	put(&jitter_buffer, 32, later + FRAME_US + 10);
+	assert_pop(&jitter_buffer, later + FRAME_US + 10, CHIAKI_AUDIO_JITTER_BUFFER_OUT_FRAME, 30);
+
+	munit_assert_uint64(jitter_buffer.stats.frames_fec, ==, 3);
+	munit_assert_uint64(jitter_buffer.stats.frames_plc, ==, 1);
+	munit_assert_uint64(jitter_buffer.stats.frames_skipped, ==, 9);
+	return MUNIT_OK;
+}
+
+static MunitResult test_adapt(const MunitParameter params[], void *user)
+{
+	ChiakiAudioJitterBuffer jitter_buffer;
+	chiaki_audio_jitter_buffer_init(&jitter_buffer, FRAME_US);
+	uint64_t t = 1000000;
+	int frame_index;
+
+	// packets of two frames arriving up to 15 ms early or late
+	for(ChiakiSeqNum16 i=0; i<400; i+=2)
+	{
+		uint64_t arrival = t + (i % 4 ? 15000 : 0);
+		put(&jitter_buffer, i, arrival);
+		put(&jitter_buffer, (ChiakiSeqNum16)(i + 1), arrival + 5);
+		while(pop(&jitter_buffer, arrival + 5, &frame_index) != CHIAKI_AUDIO_JITTER_BUFFER_OUT_NONE);
+		t += 2 * FRAME_US;
+	}
+	munit_assert_uint(jitter_buffer.target_frames, >, 3);
+	munit_assert_uint(jitter_buffer.target_frames, <=, CHIAKI_AUDIO_JITTER_BUFFER_TARGET_MAX);
+
+	// calm again
+	for(ChiakiSeqNum16 i=400; i<1000; i+=2)
+	{
+		put(&jitter_buffer, i, t);
+		put(&jitter_buffer, (ChiakiSeqNum16)(i + 1), t + 5);
+		while(pop(&jitter_buffer, t + 5, &frame_index) != CHIAKI_AUDIO_JITTER_BUFFER_OUT_NONE);
+		t += 2 * FRAME_US;
+	}
+	munit_assert_uint(jitter_buffer.target_frames, ==, 1);
+	munit_assert_uint64(jitter_buffer.stats.frames_played, ==, 1000);
+	return MUNIT_OK;
+}
+
+MunitTest tests_audio_jitter_buffer[] = {
+	{
+		"/in_order",
+		test_in_order,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/conceal",
+		test_conceal,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/adapt",
+		test_adapt,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
@@ -0,0 +1,172 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/audioring.h>
+
+static MunitResult test_push_pull(const MunitParameter params[], void *user)
+{
+	ChiakiAudioRing ring;
+	ChiakiErrorCode err = chiaki_audio_ring_init(&ring, 2, 6, 32);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	int16_t pcm[2 * 64];
+	int16_t out[2 * 64];
+
+	// nothing is played until the target is reached
+	for(size_t i=0; i<2*20; i++)
+		pcm[i] = (int16_t)i;
+	munit_assert_size(chiaki_audio_ring_push(&ring, pcm, 20), ==, 20);
+	chiaki_audio_ring_pull(&ring, out, 10);
+	for(size_t i=0; i<2*10; i++)
+		munit_assert_int16(out[i], ==, 0);
+	munit_assert_size(chiaki_audio_ring_fill(&ring), ==, 20);
+
+	// exactly at the target, frames are passed through unchanged, across the end of the buffer
+	int16_t v = 2 * 20;
+	for(size_t round=0; round<8; round++)
+	{
+		size_t fill = chiaki_audio_ring_fill(&ring);
+		for(size_t i=0; i<2*(32-fill); i++)
+			pcm[i] = v++;
+		munit_assert_size(chiaki_audio_ring_push(&ring, pcm, 32 - fill), ==, 32 - fill);
+		chiaki_audio_ring_pull(&ring, out, 16);
+		for(size_t i=0; i<2*16; i++)
+			munit_assert_int16(out[i], ==, (int16_t)(round * 2 * 16 + i));
+	}
+
+	// too much is dropped
+	for(size_t i=0; i<2*64; i++)
+		pcm[i] = 0x42;
+	munit_assert_size(chiaki_audio_ring_push(&ring, pcm, 64), ==, 48);
+
+	ChiakiAudioRingStats stats;
+	chiaki_audio_ring_get_stats(&ring, &stats);
+	munit_assert_uint64(stats.frames_dropped, ==, 16);
+	munit_assert_uint64(stats.underflows, ==, 0);
+	munit_assert_int32(stats.ratio_ppm, ==, 0);
+
+	chiaki_audio_ring_fini(&ring);
+	return MUNIT_OK;
+}
+
+static MunitResult test_underflow(const MunitParameter params[], void *user)
+{
+	ChiakiAudioRing ring;
+	ChiakiErrorCode err = chiaki_audio_ring_init(&ring, 1, 8, 16);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	int16_t pcm[32];
+	int16_t out[32];
+	for(size_t i=0; i<32; i++)
+		pcm[i] = (int16_t)(i + 1);
+	chiaki_audio_ring_push(&ring, pcm, 16);
+	chiaki_audio_ring_pull(&ring, out, 32);
+	for(size_t i=0; i<32; i++)
+		munit_assert_int16(out[i], ==, i < 16 ? (int16_t)(i + 1) : 0);
+
+	ChiakiAudioRingStats stats;
+	chiaki_audio_ring_get_stats(&ring, &stats);
+	munit_assert_uint64(stats.underflows, ==, 1);
+
+	// waits for the target again
+	chiaki_audio_ring_push(&ring, pcm, 8);
+	chiaki_audio_ring_pull(&ring, out, 4);
+	for(size_t i=0; i<4; i++)
+		munit_assert_int16(out[i], ==, 0);
+	chiaki_audio_ring_push(&ring, pcm + 8, 8);
+	chiaki_audio_ring_pull(&ring, out, 4);
+	for(size_t i=0; i<4; i++)
+		munit_assert_int16(out[i], ==, (int16_t)(i + 1));
+
+	chiaki_audio_ring_fini(&ring);
+	return MUNIT_OK;
+}
+
+static void simulate_drift(int32_t drift_ppm)
+{
+	const size_t target = 960;
+	ChiakiAudioRing ring;
+	ChiakiErrorCode err = chiaki_audio_ring_init(&ring, 2, 12, target);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	// the console sends 480 frames every 10 ms of its own clock, the device reads 256 frames at a time
+	static int16_t pcm[2 * 480];
+	static int16_t out[2 * 256];
+	for(size_t i=0; i<2*480; i++)
+		pcm[i] = 1000;
+	double producer_period = 480.0 / (1.0 + drift_ppm / 1000000.0);
+	double producer_next = 0.0;
+	uint64_t t = 0;
+	size_t fill_min = SIZE_MAX, fill_max = 0;
+
+	// 20 minutes at 48 kHz
+	for(size_t pulls=0; pulls<20*60*48000/256; pulls++)
+	{
+		t += 256;
+		while(producer_next <= (double)t)
+		{
+			chiaki_audio_ring_push(&ring, pcm, 480);
+			producer_next += producer_period;
+		}
+		chiaki_audio_ring_pull(&ring, out, 256);
+
+		// once settled, the fill stays around the target
+		if(pulls > 5*60*48000/256)
+		{
+			ChiakiAudioRingStats stats;
+			chiaki_audio_ring_get_stats(&ring, &stats);
+			if(stats.fill_frames < fill_min)
+				fill_min = stats.fill_frames;
+			if(stats.fill_frames > fill_max)
+				fill_max = stats.fill_frames;
+		}
+	}
+
+	ChiakiAudioRingStats stats;
+	chiaki_audio_ring_get_stats(&ring, &stats);
+	munit_assert_uint64(stats.underflows, ==, 0);
+	munit_assert_uint64(stats.frames_dropped, ==, 0);
+	munit_assert_size(fill_min, >, target - target / 10);
+	munit_assert_size(fill_max, <, target + target / 10);
+	munit_assert_int32(stats.ratio_ppm, >, drift_ppm - 300);
+	munit_assert_int32(stats.ratio_ppm, <, drift_ppm + 300);
+
+	chiaki_audio_ring_fini(&ring);
+}
+
+static MunitResult test_drift(const MunitParameter params[], void *user)
+{
+	simulate_drift(0);
+	simulate_drift(3000);
+	simulate_drift(-3000);
+	return MUNIT_OK;
+}
+
+MunitTest tests_audio_ring[] = {
+	{
+		"/push_pull",
+		test_push_pull,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/underflow",
+		test_underflow,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/drift",
+		test_drift,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
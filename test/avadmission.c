@@ -0,0 +1,141 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/avadmission.h>
+#include <chiaki/takion.h>
+
+#include <string.h>
+
+static ChiakiTakionAVPacket video_packet(ChiakiSeqNum16 frame_index, ChiakiSeqNum16 unit_index)
+{
+	ChiakiTakionAVPacket packet;
+	memset(&packet, 0, sizeof(packet));
+	packet.is_video = true;
+	packet.frame_index = frame_index;
+	packet.unit_index = unit_index;
+	packet.data_size = 100;
+	return packet;
+}
+
+static ChiakiTakionAVPacket audio_packet(ChiakiSeqNum16 frame_index, bool is_haptics)
+{
+	ChiakiTakionAVPacket packet;
+	memset(&packet, 0, sizeof(packet));
+	packet.is_haptics = is_haptics;
+	packet.frame_index = frame_index;
+	packet.units_in_frame_fec = (4 << 8) | (1 << 4) | 2; // unit size 4, 1 fec, 2 source units
+	packet.units_in_frame_total = 3;
+	packet.data_size = 12;
+	return packet;
+}
+
+static bool admit(ChiakiAVAdmission *admission, ChiakiTakionAVPacket packet)
+{
+	if(!chiaki_av_admission_check(admission, &packet))
+		return false;
+	chiaki_av_admission_commit(admission, &packet);
+	return true;
+}
+
+static MunitResult test_video(const MunitParameter params[], void *user)
+{
+	ChiakiAVAdmission admission;
+	chiaki_av_admission_init(&admission);
+
+	munit_assert_true(admit(&admission, video_packet(0xfffe, 0)));
+	munit_assert_true(admit(&admission, video_packet(0xfffe, 1)));
+	munit_assert_false(admit(&admission, video_packet(0xfffe, 1)));
+	munit_assert_uint64(admission.video_duplicate, ==, 1);
+
+	// newer frames across the wrap-around
+	munit_assert_true(admit(&admission, video_packet(0xffff, 1)));
+	munit_assert_true(admit(&admission, video_packet(1, 0)));
+	munit_assert_true(admit(&admission, video_packet(1, 1)));
+
+	// still inside the window
+	munit_assert_true(admit(&admission, video_packet(0xfffe, 2)));
+
+	// its slot is taken by a newer frame now
+	munit_assert_true(admit(&admission, video_packet(2, 0)));
+	munit_assert_false(admit(&admission, video_packet(0xfffe, 3)));
+	munit_assert_uint64(admission.video_stale, ==, 1);
+
+	// unit indexes beyond the bitmap are left to the frame processor
+	munit_assert_true(admit(&admission, video_packet(2, CHIAKI_FEC_UNITS_MAX)));
+	munit_assert_true(admit(&admission, video_packet(2, CHIAKI_FEC_UNITS_MAX)));
+
+	munit_assert_uint64(admission.bytes_skipped, ==, 200);
+	return MUNIT_OK;
+}
+
+static MunitResult test_audio(const MunitParameter params[], void *user)
+{
+	ChiakiAVAdmission admission;
+	chiaki_av_admission_init(&admission);
+
+	munit_assert_true(admit(&admission, audio_packet(100, false)));
+	// late audio may still be reordered by the jitter buffer
+	munit_assert_true(admit(&admission, audio_packet(90, false)));
+	munit_assert_false(admit(&admission, audio_packet(60, false)));
+	munit_assert_true(admit(&admission, audio_packet(101, false)));
+	munit_assert_uint64(admission.audio_stale, ==, 1);
+
+	// haptics are a separate stream and are never reordered
+	munit_assert_true(admit(&admission, audio_packet(5, true)));
+	munit_assert_false(admit(&admission, audio_packet(5, true)));
+	munit_assert_false(admit(&admission, audio_packet(4, true)));
+	// the last source unit is new
+	munit_assert_true(admit(&admission, audio_packet(6, true)));
+	munit_assert_false(admit(&admission, audio_packet(0xffff, false)));
+	munit_assert_true(admit(&admission, audio_packet(103, false)));
+	munit_assert_uint64(admission.audio_stale, ==, 4);
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_unauthenticated(const MunitParameter params[], void *user)
+{
+	ChiakiAVAdmission admission;
+	chiaki_av_admission_init(&admission);
+
+	munit_assert_true(admit(&admission, video_packet(100, 0)));
+
+	// packets that are checked but never committed, e.g. because of a MAC mismatch, leave no trace
+	ChiakiTakionAVPacket forged = video_packet(104, 0);
+	munit_assert_true(chiaki_av_admission_check(&admission, &forged));
+	forged = audio_packet(1000, false);
+	munit_assert_true(chiaki_av_admission_check(&admission, &forged));
+
+	munit_assert_true(admit(&admission, video_packet(100, 1)));
+	munit_assert_true(admit(&admission, audio_packet(10, false)));
+	return MUNIT_OK;
+}
+
+MunitTest tests_av_admission[] = {
+	{
+		"/video",
+		test_video,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/audio",
+		test_audio,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/unauthenticated",
+		test_unauthenticated,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
@@ -16,7 +16,7 @@ typedef struct fec_test_case_t
 
 #include "fec_test_cases.inl"
 
-static MunitResult test_fec_case(FECTestCase *test_case)
+static MunitResult test_fec_case(ChiakiFEC *fec, FECTestCase *test_case)
 {
 	size_t b64len = strlen(test_case->frame_buffer_b64);
 	uint8_t *frame_buffer_ref = malloc(b64len);
@@ -45,7 +45,7 @@ static MunitResult test_fec_case(FECTestCase *test_case)
 		memset(frame_buffer + stride * e, 0x42, test_case->unit_size);
 	}
 
-	err = chiaki_fec_decode(frame_buffer, test_case->unit_size, stride, test_case->k, test_case->m, (const unsigned int *)test_case->erasures, erasures_count);
+	err = chiaki_fec_decode(fec, frame_buffer, test_case->unit_size, stride, test_case->k, test_case->m, (const unsigned int *)test_case->erasures, erasures_count);
 	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
 
 	for(size_t i=0; i<test_case->k; i++)
@@ -64,7 +64,237 @@ static MunitParameterEnum fec_params[] = {
 static MunitResult test_fec(const MunitParameter params[], void *test_user)
 {
 	unsigned long test_case_id = strtoul(params[0].value, NULL, 0);
-	return test_fec_case(&fec_test_cases[test_case_id]);
+	return test_fec_case(NULL, &fec_test_cases[test_case_id]);
+}
+
+static MunitResult test_fec_cached(const MunitParameter params[], void *test_user)
+{
+	ChiakiFEC fec;
+	chiaki_fec_init(&fec);
+	size_t cases_count = sizeof(fec_test_cases) / sizeof(fec_test_cases[0]);
+	for(size_t i=0; i<cases_count; i++)
+	{
+		// twice, so the second one hits the cache
+		for(size_t round=0; round<2; round++)
+		{
+			MunitResult r = test_fec_case(&fec, &fec_test_cases[i]);
+			if(r != MUNIT_OK)
+			{
+				chiaki_fec_fini(&fec);
+				return r;
+			}
+		}
+	}
+	// repeated patterns must have been decoded from the cache
+	munit_assert_uint64(fec.decode_cache_hits, >, 0);
+	chiaki_fec_fini(&fec);
+	return MUNIT_OK;
+}
+
+static MunitResult test_fec_syndromes(const MunitParameter params[], void *test_user)
+{
+	ChiakiFEC fec;
+	chiaki_fec_init(&fec);
+	size_t cases_count = sizeof(fec_test_cases) / sizeof(fec_test_cases[0]);
+	for(size_t c=0; c<cases_count; c++)
+	{
+		FECTestCase *test_case = &fec_test_cases[c];
+		unsigned int k = test_case->k;
+		unsigned int m = test_case->m;
+		size_t unit_size = test_case->unit_size;
+		size_t b64len = strlen(test_case->frame_buffer_b64);
+		uint8_t *frame_buffer = malloc(b64len);
+		munit_assert_not_null(frame_buffer);
+		ChiakiErrorCode err = chiaki_base64_decode(test_case->frame_buffer_b64, b64len, frame_buffer, &b64len);
+		munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+		uint8_t *frame_buffer_ref = malloc(b64len);
+		munit_assert_not_null(frame_buffer_ref);
+		memcpy(frame_buffer_ref, frame_buffer, b64len);
+
+		bool erased[0x100] = { 0 };
+		unsigned int erasures[0x10];
+		size_t erasures_count = 0;
+		for(const int *e = test_case->erasures; *e >= 0; e++)
+		{
+			erased[*e] = true;
+			if((unsigned int)*e < k)
+				erasures[erasures_count++] = (unsigned int)*e;
+		}
+		for(size_t i=0; i<erasures_count; i++)
+			memset(frame_buffer + erasures[i] * unit_size, 0, unit_size);
+
+		// turn the first received fec units into syndromes
+		unsigned int syndromes[0x10];
+		size_t syndromes_count = 0;
+		for(unsigned int i=k; i<k+m && syndromes_count<erasures_count; i++)
+		{
+			if(erased[i])
+				continue;
+			for(unsigned int j=0; j<k; j++)
+			{
+				if(!erased[j])
+					chiaki_fec_syndrome_add(&fec, frame_buffer + i * unit_size, frame_buffer + j * unit_size, unit_size, k, m, i, j);
+			}
+			syndromes[syndromes_count++] = i;
+		}
+		munit_assert_size(syndromes_count, ==, erasures_count);
+
+		err = chiaki_fec_recover_from_syndromes(&fec, frame_buffer, unit_size, unit_size, k, m, syndromes, erasures, erasures_count);
+		munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+		munit_assert_memory_equal(k * unit_size, frame_buffer, frame_buffer_ref);
+
+		free(frame_buffer_ref);
+		free(frame_buffer);
+	}
+	chiaki_fec_fini(&fec);
+	return MUNIT_OK;
+}
+
+static char *fec_backend_ids[] = { "0", "1", "2", "3", "4", NULL };
+
+static MunitParameterEnum fec_backend_params[] = {
+	{ "backend", fec_backend_ids },
+	{ NULL, NULL },
+};
+
+static ChiakiFECBackend fec_backend_param(const MunitParameter params[])
+{
+	return (ChiakiFECBackend)strtoul(params[0].value, NULL, 0);
+}
+
+static MunitResult test_fec_backend(const MunitParameter params[], void *test_user)
+{
+	ChiakiFECBackend backend = fec_backend_param(params);
+	if(!chiaki_fec_backend_supported(backend))
+		return MUNIT_SKIP;
+
+	ChiakiFEC fec;
+	chiaki_fec_init(&fec);
+	fec.backend = backend;
+	size_t cases_count = sizeof(fec_test_cases) / sizeof(fec_test_cases[0]);
+	for(size_t i=0; i<cases_count; i++)
+	{
+		MunitResult r = test_fec_case(&fec, &fec_test_cases[i]);
+		if(r != MUNIT_OK)
+		{
+			chiaki_fec_fini(&fec);
+			return r;
+		}
+	}
+	chiaki_fec_fini(&fec);
+	return MUNIT_OK;
+}
+
+static MunitResult test_fec_backend_random(const MunitParameter params[], void *test_user)
+{
+	ChiakiFECBackend backend = fec_backend_param(params);
+	if(!chiaki_fec_backend_supported(backend))
+		return MUNIT_SKIP;
+
+	ChiakiFEC fec_ref;
+	chiaki_fec_init(&fec_ref);
+	fec_ref.backend = CHIAKI_FEC_BACKEND_JERASURE;
+	ChiakiFEC fec;
+	chiaki_fec_init(&fec);
+	fec.backend = backend;
+
+	for(size_t iteration=0; iteration<0x20; iteration++)
+	{
+		unsigned int k = (unsigned int)munit_rand_int_range(1, 200);
+		unsigned int m = (unsigned int)munit_rand_int_range(1, 40);
+		// odd sizes to also cover the tails of the vector loops
+		size_t unit_size = (size_t)munit_rand_int_range(1, 1500);
+		size_t stride = ((unit_size + 0xf) / 0x10) * 0x10;
+		size_t frame_buffer_size = stride * (k + m);
+		uint8_t *frame_buffer = malloc(frame_buffer_size);
+		munit_assert_not_null(frame_buffer);
+		uint8_t *frame_buffer_ref = malloc(frame_buffer_size);
+		munit_assert_not_null(frame_buffer_ref);
+		munit_rand_memory(frame_buffer_size, frame_buffer);
+
+		// the units are random, so not a valid codeword, but decoding must still be bit-identical
+		unsigned int erasures[40];
+		size_t erasures_count = (size_t)munit_rand_int_range(1, (int)m);
+		for(size_t i=0; i<erasures_count; i++)
+		{
+			unsigned int e;
+			bool dup;
+			do
+			{
+				e = (unsigned int)munit_rand_int_range(0, (int)(k + m - 1));
+				dup = false;
+				for(size_t j=0; j<i; j++)
+					dup = dup || erasures[j] == e;
+			} while(dup);
+			erasures[i] = e;
+		}
+		memcpy(frame_buffer_ref, frame_buffer, frame_buffer_size);
+
+		ChiakiErrorCode err = chiaki_fec_decode(&fec_ref, frame_buffer_ref, unit_size, stride, k, m, erasures, erasures_count);
+		munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+		err = chiaki_fec_decode(&fec, frame_buffer, unit_size, stride, k, m, erasures, erasures_count);
+		munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+		for(size_t i=0; i<k; i++)
+			munit_assert_memory_equal(unit_size, frame_buffer + i * stride, frame_buffer_ref + i * stride);
+
+		free(frame_buffer_ref);
+		free(frame_buffer);
+	}
+
+	chiaki_fec_fini(&fec);
+	chiaki_fec_fini(&fec_ref);
+	return MUNIT_OK;
+}
+
+static MunitResult test_fec_parallel(const MunitParameter params[], void *test_user)
+{
+	ChiakiFEC fec_ref;
+	chiaki_fec_init(&fec_ref);
+	ChiakiFEC fec;
+	chiaki_fec_init(&fec);
+	ChiakiErrorCode err = chiaki_fec_start_workers(&fec, 3);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	fec.parallel_min_work = 0;
+
+	size_t cases_count = sizeof(fec_test_cases) / sizeof(fec_test_cases[0]);
+	for(size_t i=0; i<cases_count; i++)
+	{
+		MunitResult r = test_fec_case(&fec, &fec_test_cases[i]);
+		munit_assert_int(r, ==, MUNIT_OK);
+	}
+
+	for(size_t iteration=0; iteration<0x10; iteration++)
+	{
+		unsigned int k = (unsigned int)munit_rand_int_range(100, 200);
+		unsigned int m = 0x20;
+		size_t unit_size = (size_t)munit_rand_int_range(0x200, 1500);
+		size_t stride = ((unit_size + 0xf) / 0x10) * 0x10;
+		size_t frame_buffer_size = stride * (k + m);
+		uint8_t *frame_buffer = malloc(frame_buffer_size);
+		munit_assert_not_null(frame_buffer);
+		uint8_t *frame_buffer_ref = malloc(frame_buffer_size);
+		munit_assert_not_null(frame_buffer_ref);
+		munit_rand_memory(frame_buffer_size, frame_buffer);
+		memcpy(frame_buffer_ref, frame_buffer, frame_buffer_size);
+
+		unsigned int erasures[0x20];
+		for(size_t i=0; i<m; i++)
+			erasures[i] = (unsigned int)(i * 3);
+
+		err = chiaki_fec_decode(&fec_ref, frame_buffer_ref, unit_size, stride, k, m, erasures, m);
+		munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+		err = chiaki_fec_decode(&fec, frame_buffer, unit_size, stride, k, m, erasures, m);
+		munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+		munit_assert_memory_equal(frame_buffer_size, frame_buffer, frame_buffer_ref);
+
+		free(frame_buffer_ref);
+		free(frame_buffer);
+	}
+
+	munit_assert_uint64(fec.stats.parallel_decodes, >, 0);
+	chiaki_fec_fini(&fec);
+	chiaki_fec_fini(&fec_ref);
+	return MUNIT_OK;
 }
 
 MunitTest tests_fec[] = {
@@ -76,5 +306,45 @@ MunitTest tests_fec[] = {
 		MUNIT_TEST_OPTION_NONE,
 		fec_params
 	},
+	{
+		"/fec_cached",
+		test_fec_cached,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/fec_backend",
+		test_fec_backend,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		fec_backend_params
+	},
+	{
+		"/fec_backend_random",
+		test_fec_backend_random,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		fec_backend_params
+	},
+	{
+		"/fec_parallel",
+		test_fec_parallel,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/fec_syndromes",
+		test_fec_syndromes,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
 	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
 };
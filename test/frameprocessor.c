@@ -0,0 +1,316 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/frameprocessor.h>
+
+#include "test_log.h"
+
+#define TEST_K 20
+#define TEST_M 6
+#define TEST_UNIT_SIZE 500
+
+typedef struct frame_processor_test_frame_t
+{
+	uint8_t units[TEST_K + TEST_M][TEST_UNIT_SIZE];
+	size_t unit_sizes[TEST_K + TEST_M];
+} TestFrame;
+
+/**
+ * @param last_padding how much shorter than the others the last source unit is
+ */
+static void test_frame_gen_padded(TestFrame *frame, uint16_t last_padding)
+{
+	ChiakiFEC fec;
+	chiaki_fec_init(&fec);
+	memset(frame, 0, sizeof(*frame));
+	for(unsigned int i=0; i<TEST_K + TEST_M; i++)
+		frame->unit_sizes[i] = TEST_UNIT_SIZE;
+	frame->unit_sizes[TEST_K - 1] -= last_padding;
+	for(unsigned int i=0; i<TEST_K; i++)
+	{
+		// first 2 bytes are the padding, big endian
+		munit_rand_memory(frame->unit_sizes[i] - 2, frame->units[i] + 2);
+		uint16_t padding = (uint16_t)(TEST_UNIT_SIZE - frame->unit_sizes[i]);
+		frame->units[i][0] = (uint8_t)(padding >> 8);
+		frame->units[i][1] = (uint8_t)padding;
+		for(unsigned int j=TEST_K; j<TEST_K + TEST_M; j++)
+			chiaki_fec_syndrome_add(&fec, frame->units[j], frame->units[i], TEST_UNIT_SIZE, TEST_K, TEST_M, j, i);
+	}
+	chiaki_fec_fini(&fec);
+}
+
+static void test_frame_gen(TestFrame *frame)
+{
+	test_frame_gen_padded(frame, 0);
+}
+
+static void test_frame_packet(ChiakiTakionAVPacket *packet, TestFrame *frame, unsigned int unit_index)
+{
+	memset(packet, 0, sizeof(*packet));
+	packet->is_video = false;
+	packet->unit_index = unit_index;
+	packet->units_in_frame_total = TEST_K + TEST_M;
+	packet->units_in_frame_fec = TEST_M;
+	packet->data = frame->units[unit_index];
+	packet->data_size = frame->unit_sizes[unit_index];
+}
+
+static void test_frame_alloc(ChiakiFrameProcessor *frame_processor, TestFrame *frame)
+{
+	ChiakiTakionAVPacket packet;
+	test_frame_packet(&packet, frame, 0);
+	ChiakiErrorCode err = chiaki_frame_processor_alloc_frame(frame_processor, &packet);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+}
+
+static ChiakiErrorCode test_frame_put(ChiakiFrameProcessor *frame_processor, TestFrame *frame, unsigned int unit_index)
+{
+	ChiakiTakionAVPacket packet;
+	test_frame_packet(&packet, frame, unit_index);
+	return chiaki_frame_processor_put_unit(frame_processor, &packet);
+}
+
+static void test_frame_assert_flushed(ChiakiFrameProcessor *frame_processor, TestFrame *frame, ChiakiFrameProcessorFlushResult result_expected)
+{
+	uint8_t *buf;
+	size_t buf_size;
+	ChiakiFrameProcessorFlushResult result = chiaki_frame_processor_flush(frame_processor, &buf, &buf_size);
+	munit_assert_int(result, ==, result_expected);
+	size_t cur = 0;
+	for(unsigned int i=0; i<TEST_K; i++)
+	{
+		size_t part_size = frame->unit_sizes[i] - 2;
+		munit_assert_size(buf_size, >=, cur + part_size);
+		munit_assert_memory_equal(part_size, buf + cur, frame->units[i] + 2);
+		cur += part_size;
+	}
+	munit_assert_size(buf_size, ==, cur);
+}
+
+static MunitResult test_incremental_fec(const MunitParameter params[], void *user)
+{
+	TestFrame *frame = malloc(sizeof(TestFrame));
+	munit_assert_not_null(frame);
+	test_frame_gen(frame);
+
+	ChiakiFEC fec;
+	chiaki_fec_init(&fec);
+	ChiakiFrameProcessor frame_processor;
+	chiaki_frame_processor_init(&frame_processor, get_test_log(), &fec);
+	test_frame_alloc(&frame_processor, frame);
+
+	// 3 and 15 lost, 7 arrives late after the first fec unit
+	for(unsigned int i=0; i<TEST_K; i++)
+	{
+		if(i == 3 || i == 7 || i == 15)
+			continue;
+		munit_assert_int(test_frame_put(&frame_processor, frame, i), ==, CHIAKI_ERR_SUCCESS);
+	}
+	munit_assert_int(test_frame_put(&frame_processor, frame, TEST_K), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_uint(frame_processor.fec_syndromes_count, ==, 1);
+	munit_assert_int(test_frame_put(&frame_processor, frame, 7), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_false(frame_processor.fec_recovered);
+	munit_assert_false(chiaki_frame_processor_flush_possible(&frame_processor));
+
+	// the last needed unit completes the frame right away
+	munit_assert_int(test_frame_put(&frame_processor, frame, TEST_K + 1), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_true(frame_processor.fec_recovered);
+	munit_assert_true(chiaki_frame_processor_flush_possible(&frame_processor));
+
+	// units after recovery are only counted
+	munit_assert_int(test_frame_put(&frame_processor, frame, 3), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_int(test_frame_put(&frame_processor, frame, TEST_K + 2), ==, CHIAKI_ERR_SUCCESS);
+
+	test_frame_assert_flushed(&frame_processor, frame, CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FEC_SUCCESS);
+
+	// next frame without loss
+	test_frame_gen(frame);
+	test_frame_alloc(&frame_processor, frame);
+	for(unsigned int i=0; i<TEST_K + TEST_M; i++)
+		munit_assert_int(test_frame_put(&frame_processor, frame, i), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_uint(frame_processor.fec_syndromes_count, ==, 0);
+	test_frame_assert_flushed(&frame_processor, frame, CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_SUCCESS);
+
+	// and one with too much loss
+	test_frame_gen(frame);
+	test_frame_alloc(&frame_processor, frame);
+	for(unsigned int i=0; i<TEST_K + TEST_M; i++)
+	{
+		if(i % 3 == 0)
+			continue;
+		munit_assert_int(test_frame_put(&frame_processor, frame, i), ==, CHIAKI_ERR_SUCCESS);
+	}
+	munit_assert_false(frame_processor.fec_recovered);
+	uint8_t *buf;
+	size_t buf_size;
+	munit_assert_int(chiaki_frame_processor_flush(&frame_processor, &buf, &buf_size), ==, CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FEC_FAILED);
+
+	chiaki_frame_processor_fini(&frame_processor);
+	chiaki_fec_fini(&fec);
+	free(frame);
+	return MUNIT_OK;
+}
+
+static MunitResult test_duplicate_after_fec(const MunitParameter params[], void *user)
+{
+	TestFrame *frame = malloc(sizeof(TestFrame));
+	munit_assert_not_null(frame);
+	test_frame_gen(frame);
+
+	ChiakiFEC fec;
+	chiaki_fec_init(&fec);
+	ChiakiFrameProcessor frame_processor;
+	chiaki_frame_processor_init(&frame_processor, get_test_log(), &fec);
+	ChiakiPacketStats packet_stats;
+	munit_assert_int(chiaki_packet_stats_init(&packet_stats), ==, CHIAKI_ERR_SUCCESS);
+	test_frame_alloc(&frame_processor, frame);
+
+	// 3 lost and recovered from the first fec unit
+	for(unsigned int i=0; i<TEST_K; i++)
+	{
+		if(i == 3)
+			continue;
+		munit_assert_int(test_frame_put(&frame_processor, frame, i), ==, CHIAKI_ERR_SUCCESS);
+	}
+	munit_assert_int(test_frame_put(&frame_processor, frame, TEST_K), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_true(frame_processor.fec_recovered);
+
+	// 3 arrives late, then 3 and 5 again
+	munit_assert_int(test_frame_put(&frame_processor, frame, 3), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_int(test_frame_put(&frame_processor, frame, 3), ==, CHIAKI_ERR_INVALID_DATA);
+	munit_assert_int(test_frame_put(&frame_processor, frame, 5), ==, CHIAKI_ERR_INVALID_DATA);
+	munit_assert_uint(frame_processor.units_source_received, ==, TEST_K);
+
+	chiaki_frame_processor_report_packet_stats(&frame_processor, &packet_stats);
+	uint64_t received, lost;
+	chiaki_packet_stats_get(&packet_stats, false, &received, &lost);
+	munit_assert_uint64(received, ==, TEST_K + 1);
+	munit_assert_uint64(lost, ==, TEST_M - 1);
+
+	test_frame_assert_flushed(&frame_processor, frame, CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FEC_SUCCESS);
+
+	chiaki_packet_stats_fini(&packet_stats);
+	chiaki_frame_processor_fini(&frame_processor);
+	chiaki_fec_fini(&fec);
+	free(frame);
+	return MUNIT_OK;
+}
+
+static MunitResult test_reuse_buffer(const MunitParameter params[], void *user)
+{
+	TestFrame *frame = malloc(sizeof(TestFrame));
+	munit_assert_not_null(frame);
+
+	ChiakiFEC fec;
+	chiaki_fec_init(&fec);
+	ChiakiFrameProcessor frame_processor;
+	chiaki_frame_processor_init(&frame_processor, get_test_log(), &fec);
+	munit_assert_int(chiaki_frame_processor_reserve(&frame_processor, (TEST_K + TEST_M) * TEST_UNIT_SIZE * 2), ==, CHIAKI_ERR_SUCCESS);
+	uint8_t *frame_buf = frame_processor.frame_buf;
+
+	for(unsigned int round=0; round<3; round++)
+	{
+		// fill the buffer with garbage from a full frame first
+		test_frame_gen(frame);
+		test_frame_alloc(&frame_processor, frame);
+		for(unsigned int i=0; i<TEST_K + TEST_M; i++)
+			munit_assert_int(test_frame_put(&frame_processor, frame, i), ==, CHIAKI_ERR_SUCCESS);
+		test_frame_assert_flushed(&frame_processor, frame, CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_SUCCESS);
+
+		// a short unit must be zero-padded for FEC again
+		frame_processor.fec_incremental = round != 1;
+		test_frame_gen_padded(frame, 123);
+		test_frame_alloc(&frame_processor, frame);
+		for(unsigned int i=1; i<TEST_K + 1; i++)
+			munit_assert_int(test_frame_put(&frame_processor, frame, i), ==, CHIAKI_ERR_SUCCESS);
+		test_frame_assert_flushed(&frame_processor, frame, CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FEC_SUCCESS);
+	}
+
+	// reserved buffer was big enough for all frames
+	munit_assert_ptr_equal(frame_processor.frame_buf, frame_buf);
+
+	chiaki_frame_processor_fini(&frame_processor);
+	chiaki_fec_fini(&fec);
+	free(frame);
+	return MUNIT_OK;
+}
+
+static MunitResult test_flush_iov(const MunitParameter params[], void *user)
+{
+	TestFrame *frame = malloc(sizeof(TestFrame));
+	munit_assert_not_null(frame);
+	test_frame_gen_padded(frame, 42);
+
+	ChiakiFEC fec;
+	chiaki_fec_init(&fec);
+	ChiakiFrameProcessor frame_processor;
+	chiaki_frame_processor_init(&frame_processor, get_test_log(), &fec);
+	test_frame_alloc(&frame_processor, frame);
+	for(unsigned int i=0; i<TEST_K + TEST_M; i++)
+	{
+		if(i == 5 || i == TEST_K - 1)
+			continue;
+		munit_assert_int(test_frame_put(&frame_processor, frame, i), ==, CHIAKI_ERR_SUCCESS);
+	}
+
+	ChiakiVideoSampleIOV iov[CHIAKI_FEC_UNITS_MAX];
+	size_t iov_count;
+	size_t frame_size;
+	ChiakiFrameProcessorFlushResult result = chiaki_frame_processor_flush_iov(&frame_processor, iov, &iov_count, &frame_size);
+	munit_assert_int(result, ==, CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FEC_SUCCESS);
+	munit_assert_size(iov_count, ==, TEST_K);
+	size_t total = 0;
+	for(unsigned int i=0; i<TEST_K; i++)
+	{
+		munit_assert_size(iov[i].size, ==, frame->unit_sizes[i] - 2);
+		munit_assert_memory_equal(iov[i].size, iov[i].buf, frame->units[i] + 2);
+		total += iov[i].size;
+	}
+	munit_assert_size(frame_size, ==, total);
+
+	// only once per frame
+	result = chiaki_frame_processor_flush_iov(&frame_processor, iov, &iov_count, &frame_size);
+	munit_assert_int(result, ==, CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FAILED);
+
+	chiaki_frame_processor_fini(&frame_processor);
+	chiaki_fec_fini(&fec);
+	free(frame);
+	return MUNIT_OK;
+}
+
+MunitTest tests_frame_processor[] = {
+	{
+		"/incremental_fec",
+		test_incremental_fec,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/duplicate_after_fec",
+		test_duplicate_after_fec,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/reuse_buffer",
+		test_reuse_buffer,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/flush_iov",
+		test_flush_iov,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
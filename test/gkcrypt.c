@@ -5,6 +5,8 @@
 #include <chiaki/ecdh.h>
 #include <chiaki/gkcrypt.h>
 
+#include "test_log.h"
+
 static MunitResult test_ecdh(const MunitParameter params[], void *user)
 {
 	static const uint8_t handshake_key[] = { 0xfc, 0x5d, 0x4b, 0xa0, 0x3a, 0x35, 0x3a, 0xbb, 0x6a, 0x7f, 0xac, 0x79, 0x1b, 0x17, 0xbb, 0x34 };
@@ -169,6 +171,55 @@ static MunitResult test_endecrypt(const MunitParameter params[], void *user)
 	return MUNIT_OK;
 }
 
+static MunitResult test_decrypt_key_buf(const MunitParameter params[], void *user)
+{
+	static const uint8_t handshake_key[] = { 0x14, 0xf1, 0xe6, 0x94, 0x6c, 0x5d, 0xce, 0xa8, 0xb7, 0xaa, 0x48, 0x50, 0xf6, 0x4d, 0x21, 0xac };
+	static const uint8_t ecdh_secret[] = { 0xc, 0xeb, 0x77, 0x9, 0x83, 0x4d, 0x7a, 0xfc, 0x50, 0xb8, 0x46, 0x8c, 0xc6, 0x3c, 0x1e, 0x7c, 0x4e, 0x4a, 0x88, 0x93, 0x42, 0x80, 0xc1, 0x28, 0xe6, 0x1e, 0xe9, 0xd4, 0x1b, 0x8c, 0x69, 0x36 };
+
+	ChiakiLog *log = get_test_log();
+
+	// small key buf, so decrypting sequentially wraps around it many times
+	ChiakiGKCrypt gkcrypt_buf;
+	ChiakiErrorCode err = chiaki_gkcrypt_init(&gkcrypt_buf, log, 2, 42, handshake_key, ecdh_secret);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return MUNIT_ERROR;
+
+	ChiakiGKCrypt gkcrypt;
+	err = chiaki_gkcrypt_init(&gkcrypt, log, 0, 42, handshake_key, ecdh_secret);
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		chiaki_gkcrypt_fini(&gkcrypt_buf);
+		return MUNIT_ERROR;
+	}
+
+	uint8_t buf[1397];
+	uint8_t buf_expected[sizeof(buf)];
+	for(uint64_t key_pos = 0x11; key_pos < 0x20000; key_pos += sizeof(buf))
+	{
+		munit_rand_memory(sizeof(buf), buf);
+		memcpy(buf_expected, buf, sizeof(buf));
+		err = chiaki_gkcrypt_decrypt(&gkcrypt_buf, key_pos, buf, sizeof(buf));
+		munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+		err = chiaki_gkcrypt_decrypt(&gkcrypt, key_pos, buf_expected, sizeof(buf_expected));
+		munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+		munit_assert_memory_equal(sizeof(buf), buf, buf_expected);
+	}
+
+	// very late packet, long dropped from the ring
+	munit_rand_memory(sizeof(buf), buf);
+	memcpy(buf_expected, buf, sizeof(buf));
+	err = chiaki_gkcrypt_decrypt(&gkcrypt_buf, 0x11, buf, sizeof(buf));
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	err = chiaki_gkcrypt_decrypt(&gkcrypt, 0x11, buf_expected, sizeof(buf_expected));
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_memory_equal(sizeof(buf), buf, buf_expected);
+	munit_assert_uint64(gkcrypt_buf.key_buf_late, >, 0);
+
+	chiaki_gkcrypt_fini(&gkcrypt);
+	chiaki_gkcrypt_fini(&gkcrypt_buf);
+	return MUNIT_OK;
+}
+
 static MunitResult test_gmac(const MunitParameter params[], void *user)
 {
 	static const uint8_t gkcrypt_key[] = {	0xb6, 0x4b, 0x1e, 0x65, 0x3f, 0xbb, 0xa7, 0xab, 0x80, 0xb3, 0x1e, 0x5a, 0x32, 0x4d, 0xec, 0xc0 };
@@ -374,6 +425,22 @@ static MunitResult test_gmac_multiple_of_key_refresh(const MunitParameter params
 
 	munit_assert_memory_equal(sizeof(gmac), gmac, gmac_expected);
 
+	// switch the persistent contexts to other keys and back again
+	uint8_t gmac_other[CHIAKI_GKCRYPT_GMAC_SIZE];
+	err = chiaki_gkcrypt_gmac(&gkcrypt, key_pos + 2 * CHIAKI_GKCRYPT_GMAC_KEY_REFRESH_KEY_POS, data, sizeof(data), gmac_other);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	err = chiaki_gkcrypt_gmac(&gkcrypt, 0x10, data, sizeof(data), gmac_other);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	// old key index now, once derived and once from the cache
+	for(int i=0; i<2; i++)
+	{
+		memset(gmac, 0, sizeof(gmac));
+		err = chiaki_gkcrypt_gmac(&gkcrypt, key_pos, data, sizeof(data), gmac);
+		munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+		munit_assert_memory_equal(sizeof(gmac), gmac, gmac_expected);
+	}
+
 	chiaki_gkcrypt_fini(&gkcrypt);
 
 	return MUNIT_OK;
@@ -405,6 +472,14 @@ MunitTest tests_gkcrypt[] = {
 		MUNIT_TEST_OPTION_NONE,
 		NULL
 	},
+	{
+		"/decrypt_key_buf",
+		test_decrypt_key_buf,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
 	{
 		"/gmac",
 		test_gmac,
@@ -0,0 +1,162 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/hapticsresampler.h>
+
+#include <string.h>
+
+#define FRAMES 200
+#define OUT_FRAMES (FRAMES * CHIAKI_HAPTICS_RESAMPLER_FACTOR)
+
+static void make_input(uint8_t *buf, const int16_t *l, const int16_t *r, size_t frames_count)
+{
+	for(size_t i=0; i<frames_count; i++)
+	{
+		buf[i * 4] = (uint8_t)l[i];
+		buf[i * 4 + 1] = (uint8_t)((uint16_t)l[i] >> 8);
+		buf[i * 4 + 2] = (uint8_t)r[i];
+		buf[i * 4 + 3] = (uint8_t)((uint16_t)r[i] >> 8);
+	}
+}
+
+static MunitResult test_dc(const MunitParameter params[], void *user)
+{
+	int16_t l[FRAMES], r[FRAMES];
+	for(size_t i=0; i<FRAMES; i++)
+	{
+		l[i] = 1000;
+		r[i] = -2000;
+	}
+	uint8_t buf[FRAMES * 4];
+	make_input(buf, l, r, FRAMES);
+
+	static int16_t out[OUT_FRAMES * CHIAKI_HAPTICS_RESAMPLER_CHANNELS_OUT];
+	ChiakiHapticsResampler resampler;
+	chiaki_haptics_resampler_init(&resampler);
+	size_t out_frames = chiaki_haptics_resampler_process(&resampler, buf, sizeof(buf), out);
+	munit_assert_size(out_frames, ==, OUT_FRAMES);
+
+	for(size_t i=0; i<OUT_FRAMES; i++)
+	{
+		int16_t *frame = out + i * CHIAKI_HAPTICS_RESAMPLER_CHANNELS_OUT;
+		munit_assert_int16(frame[0], ==, 0);
+		munit_assert_int16(frame[1], ==, 0);
+		// every phase has a gain of exactly 1 once the filter is filled
+		if(i >= CHIAKI_HAPTICS_RESAMPLER_TAPS * CHIAKI_HAPTICS_RESAMPLER_FACTOR)
+		{
+			munit_assert_int16(frame[2], ==, 1000);
+			munit_assert_int16(frame[3], ==, -2000);
+		}
+	}
+	return MUNIT_OK;
+}
+
+static MunitResult test_split(const MunitParameter params[], void *user)
+{
+	int16_t l[FRAMES], r[FRAMES];
+	for(size_t i=0; i<FRAMES; i++)
+	{
+		l[i] = (int16_t)munit_rand_int_range(INT16_MIN, INT16_MAX);
+		r[i] = (int16_t)munit_rand_int_range(INT16_MIN, INT16_MAX);
+	}
+	uint8_t buf[FRAMES * 4];
+	make_input(buf, l, r, FRAMES);
+
+	static int16_t out_whole[OUT_FRAMES * CHIAKI_HAPTICS_RESAMPLER_CHANNELS_OUT];
+	ChiakiHapticsResampler resampler;
+	chiaki_haptics_resampler_init(&resampler);
+	chiaki_haptics_resampler_process(&resampler, buf, sizeof(buf), out_whole);
+
+	// the same stream split into frames of varying size must not have any seams
+	static int16_t out_split[OUT_FRAMES * CHIAKI_HAPTICS_RESAMPLER_CHANNELS_OUT];
+	chiaki_haptics_resampler_init(&resampler);
+	static const size_t frame_sizes[] = { 30, 1, 7, 30, 45, 2, 30, 55 };
+	size_t done = 0;
+	for(size_t i=0; done<FRAMES; i++)
+	{
+		size_t frames_count = frame_sizes[i % (sizeof(frame_sizes) / sizeof(frame_sizes[0]))];
+		if(frames_count > FRAMES - done)
+			frames_count = FRAMES - done;
+		size_t out_frames = chiaki_haptics_resampler_process(&resampler, buf + done * 4, frames_count * 4,
+				out_split + done * CHIAKI_HAPTICS_RESAMPLER_FACTOR * CHIAKI_HAPTICS_RESAMPLER_CHANNELS_OUT);
+		munit_assert_size(out_frames, ==, frames_count * CHIAKI_HAPTICS_RESAMPLER_FACTOR);
+		done += frames_count;
+	}
+	munit_assert_memory_equal(sizeof(out_whole), out_whole, out_split);
+	return MUNIT_OK;
+}
+
+static MunitResult test_saturate(const MunitParameter params[], void *user)
+{
+	// a full scale step overshoots, which has to clip instead of wrapping around
+	int16_t l[FRAMES], r[FRAMES];
+	for(size_t i=0; i<FRAMES; i++)
+	{
+		l[i] = i < FRAMES / 2 ? INT16_MIN : INT16_MAX;
+		r[i] = i < FRAMES / 2 ? INT16_MAX : INT16_MIN;
+	}
+	uint8_t buf[FRAMES * 4];
+	make_input(buf, l, r, FRAMES);
+
+	static int16_t out[OUT_FRAMES * CHIAKI_HAPTICS_RESAMPLER_CHANNELS_OUT];
+	ChiakiHapticsResampler resampler;
+	chiaki_haptics_resampler_init(&resampler);
+	chiaki_haptics_resampler_process(&resampler, buf, sizeof(buf), out);
+
+	size_t step_end = (FRAMES / 2 + CHIAKI_HAPTICS_RESAMPLER_TAPS) * CHIAKI_HAPTICS_RESAMPLER_FACTOR;
+	for(size_t i=step_end; i<OUT_FRAMES; i++)
+	{
+		munit_assert_int16(out[i * CHIAKI_HAPTICS_RESAMPLER_CHANNELS_OUT + 2], ==, INT16_MAX);
+		munit_assert_int16(out[i * CHIAKI_HAPTICS_RESAMPLER_CHANNELS_OUT + 3], ==, INT16_MIN);
+	}
+	// the filter is centered between its middle taps, so the step crosses zero halfway through that input frame
+	size_t step_mid = (FRAMES / 2 + CHIAKI_HAPTICS_RESAMPLER_TAPS / 2 - 1) * CHIAKI_HAPTICS_RESAMPLER_FACTOR
+			+ CHIAKI_HAPTICS_RESAMPLER_FACTOR / 2;
+	// before the window is filled with input, the ramp up from the initial silence rings on its own
+	for(size_t i=CHIAKI_HAPTICS_RESAMPLER_TAPS * CHIAKI_HAPTICS_RESAMPLER_FACTOR; i<step_end; i++)
+	{
+		// somewhere between, but never flipped
+		int16_t sample_l = out[i * CHIAKI_HAPTICS_RESAMPLER_CHANNELS_OUT + 2];
+		int16_t sample_r = out[i * CHIAKI_HAPTICS_RESAMPLER_CHANNELS_OUT + 3];
+		if(i < step_mid)
+		{
+			munit_assert_int16(sample_l, <=, 0);
+			munit_assert_int16(sample_r, >=, 0);
+		}
+		else
+		{
+			munit_assert_int16(sample_l, >=, 0);
+			munit_assert_int16(sample_r, <=, 0);
+		}
+	}
+	return MUNIT_OK;
+}
+
+MunitTest tests_haptics_resampler[] = {
+	{
+		"/dc",
+		test_dc,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/split",
+		test_split,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/saturate",
+		test_saturate,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
@@ -5,11 +5,19 @@
 extern MunitTest tests_seq_num[];
 extern MunitTest tests_key_state[];
 extern MunitTest tests_reorder_queue[];
+extern MunitTest tests_packet_pool[];
+extern MunitTest tests_spsc_queue[];
 extern MunitTest tests_http[];
 extern MunitTest tests_rpcrypt[];
 extern MunitTest tests_gkcrypt[];
 extern MunitTest tests_takion[];
 extern MunitTest tests_fec[];
+extern MunitTest tests_frame_processor[];
+extern MunitTest tests_video_receiver[];
+extern MunitTest tests_av_admission[];
+extern MunitTest tests_audio_jitter_buffer[];
+extern MunitTest tests_audio_ring[];
+extern MunitTest tests_haptics_resampler[];
 extern MunitTest tests_regist[];
 
 static MunitSuite suites[] = {
@@ -34,6 +42,20 @@ static MunitSuite suites[] = {
 		1,
 		MUNIT_SUITE_OPTION_NONE
 	},
+	{
+		"/packet_pool",
+		tests_packet_pool,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/spsc_queue",
+		tests_spsc_queue,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
 	{
 		"/http",
 		tests_http,
@@ -69,6 +91,48 @@ static MunitSuite suites[] = {
 		1,
 		MUNIT_SUITE_OPTION_NONE
 	},
+	{
+		"/frame_processor",
+		tests_frame_processor,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/video_receiver",
+		tests_video_receiver,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/av_admission",
+		tests_av_admission,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/audio_jitter_buffer",
+		tests_audio_jitter_buffer,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/audio_ring",
+		tests_audio_ring,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/haptics_resampler",
+		tests_haptics_resampler,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
 	{
 		"/regist",
 		tests_regist,
@@ -0,0 +1,65 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/packetpool.h>
+
+#include "test_log.h"
+
+#define POOL_SIZE 4
+
+static MunitResult test_packet_pool(const MunitParameter params[], void *test_user)
+{
+	ChiakiPacketPool pool;
+	ChiakiErrorCode err = chiaki_packet_pool_init(&pool, get_test_log(), POOL_SIZE);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	ChiakiPacketBuf *bufs[POOL_SIZE];
+	for(size_t i=0; i<POOL_SIZE; i++)
+	{
+		bufs[i] = chiaki_packet_pool_acquire(&pool);
+		munit_assert_not_null(bufs[i]);
+		munit_assert_size(bufs[i]->size, ==, 0);
+		munit_assert(chiaki_packet_buf_is_unique(bufs[i]));
+		for(size_t j=0; j<i; j++)
+			munit_assert_ptr_not_equal(bufs[i]->data, bufs[j]->data);
+	}
+
+	// exhausted
+	munit_assert_null(chiaki_packet_pool_acquire(&pool));
+	munit_assert_uint64(pool.exhausted_count, ==, 1);
+
+	// a buffer with more than one reference only comes back after the last unref
+	chiaki_packet_buf_ref(bufs[1]);
+	munit_assert(!chiaki_packet_buf_is_unique(bufs[1]));
+	chiaki_packet_buf_unref(bufs[1]);
+	munit_assert(chiaki_packet_buf_is_unique(bufs[1]));
+	munit_assert_null(chiaki_packet_pool_acquire(&pool));
+
+	chiaki_packet_buf_unref(bufs[1]);
+	ChiakiPacketBuf *buf = chiaki_packet_pool_acquire(&pool);
+	munit_assert_ptr_equal(buf, bufs[1]);
+	bufs[1] = buf;
+
+	for(size_t i=0; i<POOL_SIZE; i++)
+		chiaki_packet_buf_unref(bufs[i]);
+	munit_assert_size(pool.free_count, ==, POOL_SIZE);
+	munit_assert_size(pool.free_count_min, ==, 0);
+
+	chiaki_packet_pool_fini(&pool);
+
+	return MUNIT_OK;
+}
+
+
+MunitTest tests_packet_pool[] = {
+	{
+		"/packet_pool",
+		test_packet_pool,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
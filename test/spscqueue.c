@@ -0,0 +1,110 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/spscqueue.h>
+
+static MunitResult test_spsc_queue(const MunitParameter params[], void *test_user)
+{
+	ChiakiSPSCQueue queue;
+	ChiakiErrorCode err = chiaki_spsc_queue_init(&queue, 2, sizeof(uint32_t));
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	uint32_t v = 0;
+	munit_assert(!chiaki_spsc_queue_pop(&queue, &v));
+	err = chiaki_spsc_queue_pop_wait(&queue, &v, 1);
+	munit_assert_int(err, ==, CHIAKI_ERR_TIMEOUT);
+
+	for(uint32_t i=0; i<4; i++)
+		munit_assert(chiaki_spsc_queue_push(&queue, &i));
+	munit_assert_size(chiaki_spsc_queue_depth(&queue), ==, 4);
+
+	// full
+	v = 42;
+	munit_assert(!chiaki_spsc_queue_push(&queue, &v));
+
+	munit_assert(chiaki_spsc_queue_pop(&queue, &v));
+	munit_assert_uint32(v, ==, 0);
+	v = 4;
+	munit_assert(chiaki_spsc_queue_push(&queue, &v));
+
+	// closed, but remaining elements can still be popped in order
+	chiaki_spsc_queue_close(&queue);
+	v = 5;
+	munit_assert(!chiaki_spsc_queue_push(&queue, &v));
+	for(uint32_t i=1; i<5; i++)
+	{
+		err = chiaki_spsc_queue_pop_wait(&queue, &v, UINT64_MAX);
+		munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+		munit_assert_uint32(v, ==, i);
+	}
+	err = chiaki_spsc_queue_pop_wait(&queue, &v, UINT64_MAX);
+	munit_assert_int(err, ==, CHIAKI_ERR_CANCELED);
+
+	ChiakiSPSCQueueStats stats;
+	chiaki_spsc_queue_get_stats(&queue, &stats);
+	munit_assert_uint64(stats.pushed, ==, 5);
+	munit_assert_uint64(stats.dropped, ==, 2);
+	munit_assert_size(stats.depth_max, ==, 4);
+
+	chiaki_spsc_queue_fini(&queue);
+	return MUNIT_OK;
+}
+
+#define THREADED_COUNT 100000
+
+static void *producer_thread_func(void *user)
+{
+	ChiakiSPSCQueue *queue = user;
+	for(uint32_t i=0; i<THREADED_COUNT; i++)
+	{
+		while(!chiaki_spsc_queue_push(queue, &i));
+	}
+	chiaki_spsc_queue_close(queue);
+	return NULL;
+}
+
+static MunitResult test_spsc_queue_threaded(const MunitParameter params[], void *test_user)
+{
+	ChiakiSPSCQueue queue;
+	ChiakiErrorCode err = chiaki_spsc_queue_init(&queue, 4, sizeof(uint32_t));
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	ChiakiThread producer;
+	err = chiaki_thread_create(&producer, producer_thread_func, &queue);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	uint32_t expected = 0;
+	uint32_t v;
+	while(chiaki_spsc_queue_pop_wait(&queue, &v, UINT64_MAX) == CHIAKI_ERR_SUCCESS)
+	{
+		munit_assert_uint32(v, ==, expected);
+		expected++;
+	}
+	munit_assert_uint32(expected, ==, THREADED_COUNT);
+
+	chiaki_thread_join(&producer, NULL);
+	chiaki_spsc_queue_fini(&queue);
+	return MUNIT_OK;
+}
+
+
+MunitTest tests_spsc_queue[] = {
+	{
+		"/spsc_queue",
+		test_spsc_queue,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/spsc_queue_threaded",
+		test_spsc_queue_threaded,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
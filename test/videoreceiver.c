@@ -0,0 +1,227 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/videoreceiver.h>
+#include <chiaki/session.h>
+
+#include "test_log.h"
+
+#define TEST_K 4
+#define TEST_M 1
+#define TEST_UNIT_SIZE 100
+#define TEST_PAYLOAD_SIZE (TEST_UNIT_SIZE - 2)
+#define TEST_SLICES_MAX 16
+
+typedef struct video_receiver_test_t
+{
+	ChiakiSession *session;
+	ChiakiVideoReceiver video_receiver;
+	uint8_t units[TEST_K + TEST_M][TEST_UNIT_SIZE];
+	uint8_t frame[TEST_K * TEST_PAYLOAD_SIZE]; // payloads of all source units, as the decoder should get them
+	bool header_done;
+
+	// everything passed to the slice callback after the header
+	uint8_t out[TEST_K * TEST_PAYLOAD_SIZE];
+	size_t out_size;
+	size_t slice_ends[TEST_SLICES_MAX]; // offset in out after each call
+	bool slice_frame_end[TEST_SLICES_MAX];
+	size_t slices_count;
+} VideoReceiverTest;
+
+static bool test_slice_cb(ChiakiVideoSampleIOV *iov, size_t iov_count, bool frame_end, void *user)
+{
+	VideoReceiverTest *test = user;
+	if(!test->header_done)
+	{
+		// the first sample of the stream is the profile header
+		test->header_done = true;
+		return true;
+	}
+	for(size_t i=0; i<iov_count; i++)
+	{
+		munit_assert_size(test->out_size + iov[i].size, <=, sizeof(test->out));
+		memcpy(test->out + test->out_size, iov[i].buf, iov[i].size);
+		test->out_size += iov[i].size;
+	}
+	munit_assert_size(test->slices_count, <, TEST_SLICES_MAX);
+	test->slice_ends[test->slices_count] = test->out_size;
+	test->slice_frame_end[test->slices_count] = frame_end;
+	test->slices_count++;
+	return true;
+}
+
+/**
+ * Set up a receiver and fill the source units with payload that contains neither 0 nor 1,
+ * so the only start codes are the ones a test writes with test_write().
+ */
+static VideoReceiverTest *test_init(void)
+{
+	VideoReceiverTest *test = calloc(1, sizeof(VideoReceiverTest));
+	munit_assert_not_null(test);
+	test->session = calloc(1, sizeof(ChiakiSession));
+	munit_assert_not_null(test->session);
+	test->session->log = get_test_log();
+	test->session->connect_info.video_profile.max_fps = 60;
+	chiaki_session_set_video_slice_cb(test->session, test_slice_cb, test);
+
+	chiaki_video_receiver_init(&test->video_receiver, test->session, NULL);
+	ChiakiVideoProfile profile = { 0 };
+	profile.header_sz = 4;
+	profile.header = calloc(1, profile.header_sz);
+	munit_assert_not_null(profile.header);
+	chiaki_video_receiver_stream_info(&test->video_receiver, &profile, 1);
+
+	for(size_t i=0; i<sizeof(test->frame); i++)
+		test->frame[i] = 0x40 + (uint8_t)munit_rand_int_range(0, 0x3f);
+	return test;
+}
+
+static void test_fini(VideoReceiverTest *test)
+{
+	chiaki_video_receiver_fini(&test->video_receiver);
+	free(test->session);
+	free(test);
+}
+
+/**
+ * Write bytes into the frame payload at offset, which may span units.
+ */
+static void test_write(VideoReceiverTest *test, size_t offset, const void *buf, size_t size)
+{
+	munit_assert_size(offset + size, <=, sizeof(test->frame));
+	memcpy(test->frame + offset, buf, size);
+}
+
+static void test_put(VideoReceiverTest *test, unsigned int unit_index)
+{
+	// padding prefix is 0, fec units are never needed in these tests
+	if(unit_index < TEST_K)
+		memcpy(test->units[unit_index] + 2, test->frame + unit_index * TEST_PAYLOAD_SIZE, TEST_PAYLOAD_SIZE);
+	ChiakiTakionAVPacket packet = { 0 };
+	packet.is_video = true;
+	packet.frame_index = 1;
+	packet.unit_index = unit_index;
+	packet.units_in_frame_total = TEST_K + TEST_M;
+	packet.units_in_frame_fec = TEST_M;
+	packet.data = test->units[unit_index];
+	packet.data_size = TEST_UNIT_SIZE;
+	chiaki_video_receiver_av_packet(&test->video_receiver, &packet);
+}
+
+static void test_assert_frame(VideoReceiverTest *test)
+{
+	munit_assert_size(test->slices_count, >, 0);
+	munit_assert_true(test->slice_frame_end[test->slices_count - 1]);
+	for(size_t i=0; i+1<test->slices_count; i++)
+		munit_assert_false(test->slice_frame_end[i]);
+	munit_assert_size(test->out_size, ==, sizeof(test->frame));
+	munit_assert_memory_equal(sizeof(test->frame), test->out, test->frame);
+}
+
+static MunitResult test_split_start_code(const MunitParameter params[], void *user)
+{
+	VideoReceiverTest *test = test_init();
+	test_write(test, 0, "\x00\x00\x00\x01", 4);
+	// 00 00 at the end of unit 0, 01 at the start of unit 1
+	test_write(test, TEST_PAYLOAD_SIZE - 2, "\x00\x00\x01", 3);
+	// 00 at the end of unit 1, 00 01 at the start of unit 2
+	test_write(test, 2 * TEST_PAYLOAD_SIZE - 1, "\x00\x00\x01", 3);
+
+	test_put(test, 0);
+	// the zeros at the end of unit 0 might still become a start code
+	munit_assert_size(test->slices_count, ==, 0);
+
+	test_put(test, 1);
+	munit_assert_size(test->slices_count, ==, 1);
+	munit_assert_size(test->slice_ends[0], ==, TEST_PAYLOAD_SIZE - 2);
+
+	test_put(test, 2);
+	munit_assert_size(test->slices_count, ==, 2);
+	munit_assert_size(test->slice_ends[1], ==, 2 * TEST_PAYLOAD_SIZE - 1);
+
+	// the last unit completes the frame
+	test_put(test, 3);
+	munit_assert_size(test->slices_count, ==, 3);
+	test_assert_frame(test);
+
+	test_fini(test);
+	return MUNIT_OK;
+}
+
+static MunitResult test_start_code_length(const MunitParameter params[], void *user)
+{
+	VideoReceiverTest *test = test_init();
+	test_write(test, 0, "\x00\x00\x00\x01", 4);
+	// 4 byte code in unit 1 and 3 byte code in unit 2, each cut right before its first zero
+	test_write(test, TEST_PAYLOAD_SIZE + 10, "\x00\x00\x00\x01", 4);
+	test_write(test, 2 * TEST_PAYLOAD_SIZE + 20, "\x00\x00\x01", 3);
+
+	test_put(test, 0);
+	test_put(test, 1);
+	munit_assert_size(test->slices_count, ==, 1);
+	munit_assert_size(test->slice_ends[0], ==, TEST_PAYLOAD_SIZE + 10);
+
+	test_put(test, 2);
+	munit_assert_size(test->slices_count, ==, 2);
+	munit_assert_size(test->slice_ends[1], ==, 2 * TEST_PAYLOAD_SIZE + 20);
+
+	test_put(test, 3);
+	test_assert_frame(test);
+
+	test_fini(test);
+	return MUNIT_OK;
+}
+
+static MunitResult test_frame_end_after_slices(const MunitParameter params[], void *user)
+{
+	VideoReceiverTest *test = test_init();
+	test_write(test, 0, "\x00\x00\x00\x01", 4);
+	test_write(test, 30, "\x00\x00\x01", 3);
+	test_write(test, 3 * TEST_PAYLOAD_SIZE + 5, "\x00\x00\x01", 3);
+
+	// unit 2 arrives before unit 1, so only unit 0 can be scanned at first
+	test_put(test, 0);
+	munit_assert_size(test->slices_count, ==, 1);
+	munit_assert_size(test->slice_ends[0], ==, 30);
+	test_put(test, 2);
+	munit_assert_size(test->slices_count, ==, 1);
+
+	// the last unit completes the frame, everything not delivered yet goes out in one piece with frame_end
+	test_put(test, 3);
+	munit_assert_size(test->slices_count, ==, 1);
+	test_put(test, 1);
+	munit_assert_size(test->slices_count, ==, 2);
+	test_assert_frame(test);
+
+	test_fini(test);
+	return MUNIT_OK;
+}
+
+MunitTest tests_video_receiver[] = {
+	{
+		"/split_start_code",
+		test_split_start_code,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/start_code_length",
+		test_start_code_length,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/frame_end_after_slices",
+		test_frame_end_after_slices,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};